@@ -0,0 +1,339 @@
+#include "barnes_hut.h"
+
+#include "config.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr int kKeyBits   = 16;                    // per axis
+constexpr int kMaxDepth  = kKeyBits;
+constexpr int kBuckets   = 1 << (2 * BarnesHutTree::kTopLevels);
+constexpr int kBucketShift = 2 * (kKeyBits - BarnesHutTree::kTopLevels);
+
+// Spread the low 16 bits of v to the even bit positions.
+inline std::uint32_t spreadBits(std::uint32_t v) {
+  v &= 0xffffu;
+  v = (v | (v << 8)) & 0x00ff00ffu;
+  v = (v | (v << 4)) & 0x0f0f0f0fu;
+  v = (v | (v << 2)) & 0x33333333u;
+  v = (v | (v << 1)) & 0x55555555u;
+  return v;
+}
+
+// Inverse of spreadBits: gather the even bits of v into the low 16.
+inline std::uint32_t compactBits(std::uint32_t v) {
+  v &= 0x55555555u;
+  v = (v | (v >> 1)) & 0x33333333u;
+  v = (v | (v >> 2)) & 0x0f0f0f0fu;
+  v = (v | (v >> 4)) & 0x00ff00ffu;
+  v = (v | (v >> 8)) & 0x0000ffffu;
+  return v;
+}
+
+inline std::uint32_t mortonKey(float x, float y, float invCell) {
+  constexpr float kMaxCoord = static_cast<float>((1 << kKeyBits) - 1);
+  const float qx = std::clamp(x * invCell, 0.0f, kMaxCoord);
+  const float qy = std::clamp(y * invCell, 0.0f, kMaxCoord);
+  return spreadBits(static_cast<std::uint32_t>(qx)) |
+         (spreadBits(static_cast<std::uint32_t>(qy)) << 1);
+}
+
+// Quadrant digit of a key at the given depth (the node at `depth` splits
+// its range by this digit).
+inline std::uint32_t digitAt(std::uint64_t keyed, int depth) {
+  const std::uint32_t key = static_cast<std::uint32_t>(keyed >> 32);
+  return (key >> (2 * (kKeyBits - 1 - depth))) & 3u;
+}
+
+// Distance from the centre of mass to the centre of the node at `depth`
+// holding the given key.
+float comOffset(const BarnesHutTree::Node &n, std::uint64_t keyed, int depth,
+                float rootSize) {
+  const std::uint32_t key  = static_cast<std::uint32_t>(keyed >> 32);
+  const int shift = kKeyBits - depth;
+  const float cell = rootSize / static_cast<float>(1 << kKeyBits);
+  const auto corner = [shift, cell](std::uint32_t q) {
+    return static_cast<float>(shift >= kKeyBits ? 0u : (q >> shift) << shift) *
+           cell;
+  };
+  const float cx = corner(compactBits(key)) + 0.5f * n.size;
+  const float cy = corner(compactBits(key >> 1)) + 0.5f * n.size;
+  return std::sqrt((n.comX - cx) * (n.comX - cx) + (n.comY - cy) * (n.comY - cy));
+}
+
+constexpr int kGroup = 16;   // targets sharing one tree walk
+
+// Softened pull, per unit of G, of a point mass at (x, y) on a group of
+// kGroup targets. A target on the point itself gets nothing. The fixed
+// trip count lets the loop vectorise without a remainder.
+inline void pullGroup(float x, float y, float m, const float *__restrict tx,
+                      const float *__restrict ty, float *__restrict ax,
+                      float *__restrict ay) {
+  constexpr float eps2 = cfg::GRAVITY_SOFTENING * cfg::GRAVITY_SOFTENING;
+  for (int t = 0; t < kGroup; ++t) {
+    const float dx = x - tx[t];
+    const float dy = y - ty[t];
+    const float inv = 1.0f / std::sqrt(dx * dx + dy * dy + eps2);
+    const float s = m * inv * inv * inv;
+    ax[t] += s * dx;
+    ay[t] += s * dy;
+  }
+}
+
+// Mass and centre of mass of the bodies in [begin,end).
+void sumMass(const float *bx, const float *by, const float *bm,
+             std::uint32_t begin, std::uint32_t end,
+             BarnesHutTree::Node &n) {
+  float m = 0.0f, mx = 0.0f, my = 0.0f;
+  for (std::uint32_t k = begin; k < end; ++k) {
+    m  += bm[k];
+    mx += bm[k] * bx[k];
+    my += bm[k] * by[k];
+  }
+  n.mass = m;
+  n.comX = m > 0.0f ? mx / m : bx[begin];
+  n.comY = m > 0.0f ? my / m : by[begin];
+}
+
+} // namespace
+
+void BarnesHutTree::build(const ParticleSystem &p) {
+  buildImpl(p, nullptr, 0);
+}
+
+void BarnesHutTree::build(const ParticleSystem &p, ThreadPool &pool,
+                          std::size_t minChunk) {
+  buildImpl(p, &pool, minChunk);
+}
+
+void BarnesHutTree::buildImpl(const ParticleSystem &p, ThreadPool *pool,
+                              std::size_t minChunk) {
+  const std::size_t N = p.count;
+  nodes_.clear();
+  leaves_.clear();
+  keyed_.clear();
+  if (N == 0) return;
+
+  rootSize_ = std::max(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT);
+  const float invCell = static_cast<float>(1 << kKeyBits) / rootSize_;
+
+  keyed_.resize(N);
+  bodyX_.resize(N);
+  bodyY_.resize(N);
+  bodyMass_.resize(N);
+  bucketOf_.resize(N);
+  bucketStart_.assign(kBuckets + 1, 0u);
+  subtrees_.resize(kBuckets);
+
+  auto forRange = [pool, minChunk](std::size_t total, std::size_t chunk,
+                                   const ThreadPool::RangeFn &fn) {
+    if (pool) {
+      pool->parallelFor(total, chunk, fn);
+    } else {
+      fn(0, total);
+    }
+  };
+
+  // 1. Keys, in particle order.
+  const std::size_t chunk = std::max<std::size_t>(
+      minChunk, N / (4 * std::max(1u, pool ? pool->size() : 1u)) + 1);
+  forRange(N, chunk, [&](std::size_t b, std::size_t e) {
+    for (std::size_t i = b; i < e; ++i) {
+      const std::uint32_t key = mortonKey(p.posX[i], p.posY[i], invCell);
+      keyed_[i]    = (static_cast<std::uint64_t>(key) << 32) | i;
+      bucketOf_[i] = key >> kBucketShift;
+    }
+  });
+
+  // 2. Counting sort by bucket. The buckets are in key order, so after
+  // sorting each one by key the whole array is in key order.
+  for (std::size_t i = 0; i < N; ++i) ++bucketStart_[bucketOf_[i] + 1];
+  for (int b = 0; b < kBuckets; ++b) bucketStart_[b + 1] += bucketStart_[b];
+  scratch_.resize(N);
+  {
+    std::vector<std::uint32_t> cursor(bucketStart_.begin(),
+                                      bucketStart_.end() - 1);
+    for (std::size_t i = 0; i < N; ++i) {
+      scratch_[cursor[bucketOf_[i]]++] = keyed_[i];
+    }
+  }
+  keyed_.swap(scratch_);
+
+  // 3. Each bucket: sort by key, gather its bodies, build its subtree.
+  forRange(kBuckets, 1, [&](std::size_t b, std::size_t e) {
+    for (std::size_t bucket = b; bucket < e; ++bucket) {
+      const std::uint32_t begin = bucketStart_[bucket];
+      const std::uint32_t end   = bucketStart_[bucket + 1];
+      subtrees_[bucket].clear();
+      if (begin == end) continue;
+      std::sort(keyed_.begin() + begin, keyed_.begin() + end);
+      for (std::uint32_t s = begin; s < end; ++s) {
+        const std::uint32_t i = static_cast<std::uint32_t>(keyed_[s]);
+        bodyX_[s]    = p.posX[i];
+        bodyY_[s]    = p.posY[i];
+        bodyMass_[s] = p.type[i] == TYPE_STONE ? 0.0f : p.mass(i);
+      }
+      buildSubtree(subtrees_[bucket], begin, end, kTopLevels);
+    }
+  });
+
+  // 4. The levels above the buckets, with the subtrees copied in place.
+  emitTop(0, kBuckets, 0);
+
+  leaves_.clear();
+  for (std::uint32_t k = 0; k < nodes_.size(); ++k) {
+    if (nodes_[k].next == k + 1) leaves_.push_back(k);
+  }
+}
+
+std::uint32_t BarnesHutTree::buildSubtree(std::vector<Node> &out,
+                                          std::uint32_t begin,
+                                          std::uint32_t end, int depth) {
+  const std::uint32_t idx = static_cast<std::uint32_t>(out.size());
+  out.emplace_back();
+  Node n{};
+  n.begin = begin;
+  n.end   = end;
+  n.size  = rootSize_ / static_cast<float>(1u << depth);
+
+  if (end - begin <= static_cast<std::uint32_t>(cfg::BH_LEAF_SIZE) ||
+      depth == kMaxDepth) {
+    sumMass(bodyX_.data(), bodyY_.data(), bodyMass_.data(), begin, end, n);
+  } else {
+    float m = 0.0f, mx = 0.0f, my = 0.0f;
+    std::uint32_t lo = begin;
+    for (std::uint32_t q = 0; q < 4; ++q) {
+      const std::uint32_t hi = static_cast<std::uint32_t>(
+          std::partition_point(keyed_.begin() + lo, keyed_.begin() + end,
+                               [depth, q](std::uint64_t k) {
+                                 return digitAt(k, depth) <= q;
+                               }) - keyed_.begin());
+      if (hi > lo) {
+        const Node &c = out[buildSubtree(out, lo, hi, depth + 1)];
+        m  += c.mass;
+        mx += c.mass * c.comX;
+        my += c.mass * c.comY;
+      }
+      lo = hi;
+    }
+    n.mass = m;
+    n.comX = m > 0.0f ? mx / m : bodyX_[begin];
+    n.comY = m > 0.0f ? my / m : bodyY_[begin];
+  }
+  n.offset = comOffset(n, keyed_[begin], depth, rootSize_);
+  n.next = static_cast<std::uint32_t>(out.size());
+  out[idx] = n;
+  return idx;
+}
+
+void BarnesHutTree::emitTop(std::uint32_t bucketLo, std::uint32_t bucketHi,
+                            int depth) {
+  const std::uint32_t begin = bucketStart_[bucketLo];
+  const std::uint32_t end   = bucketStart_[bucketHi];
+
+  if (depth == kTopLevels) {
+    // A bucket: its subtree, with `next` moved to global indices.
+    const std::uint32_t offset = static_cast<std::uint32_t>(nodes_.size());
+    for (Node n : subtrees_[bucketLo]) {
+      n.next += offset;
+      nodes_.push_back(n);
+    }
+    return;
+  }
+
+  const std::uint32_t idx = static_cast<std::uint32_t>(nodes_.size());
+  nodes_.emplace_back();
+  Node n{};
+  n.begin = begin;
+  n.end   = end;
+  n.size  = rootSize_ / static_cast<float>(1u << depth);
+
+  if (end - begin <= static_cast<std::uint32_t>(cfg::BH_LEAF_SIZE)) {
+    sumMass(bodyX_.data(), bodyY_.data(), bodyMass_.data(), begin, end, n);
+  } else {
+    float m = 0.0f, mx = 0.0f, my = 0.0f;
+    const std::uint32_t quarter = (bucketHi - bucketLo) / 4;
+    for (std::uint32_t q = 0; q < 4; ++q) {
+      const std::uint32_t lo = bucketLo + q * quarter;
+      if (bucketStart_[lo] == bucketStart_[lo + quarter]) continue;
+      const std::uint32_t child = static_cast<std::uint32_t>(nodes_.size());
+      emitTop(lo, lo + quarter, depth + 1);
+      const Node &c = nodes_[child];
+      m  += c.mass;
+      mx += c.mass * c.comX;
+      my += c.mass * c.comY;
+    }
+    n.mass = m;
+    n.comX = m > 0.0f ? mx / m : bodyX_[begin];
+    n.comY = m > 0.0f ? my / m : bodyY_[begin];
+  }
+  n.offset = comOffset(n, keyed_[begin], depth, rootSize_);
+  n.next = static_cast<std::uint32_t>(nodes_.size());
+  nodes_[idx] = n;
+}
+
+void BarnesHutTree::accumulate(ParticleSystem &p, float theta, float scale,
+                               std::size_t begin, std::size_t end) const {
+  // theta = 0 opens everything; keep the reach finite so 0 * inf is not
+  // taken for a distance.
+  const float invTheta = 1.0f / std::max(theta, 1e-6f);
+  const Node *nodes = nodes_.data();
+  const std::uint32_t count = static_cast<std::uint32_t>(nodes_.size());
+
+  // Leaves starting in [begin,end), in slot order.
+  const auto first = std::lower_bound(
+      leaves_.begin(), leaves_.end(), begin,
+      [nodes](std::uint32_t leaf, std::size_t slot) {
+        return nodes[leaf].begin < slot;
+      });
+  for (auto it = first; it != leaves_.end() && nodes[*it].begin < end; ++it) {
+    const Node &leaf = nodes[*it];
+    for (std::uint32_t g = leaf.begin; g < leaf.end; g += kGroup) {
+      const std::uint32_t n = std::min<std::uint32_t>(kGroup, leaf.end - g);
+
+      // Targets, padded with copies of the last so every loop below runs
+      // the full group width; the padding's results are dropped.
+      float tx[kGroup], ty[kGroup], ax[kGroup] = {}, ay[kGroup] = {};
+      float minX = bodyX_[g], maxX = minX, minY = bodyY_[g], maxY = minY;
+      for (std::uint32_t t = 0; t < kGroup; ++t) {
+        const std::uint32_t slot = g + std::min(t, n - 1);
+        tx[t] = bodyX_[slot];
+        ty[t] = bodyY_[slot];
+        minX = std::min(minX, tx[t]);  maxX = std::max(maxX, tx[t]);
+        minY = std::min(minY, ty[t]);  maxY = std::max(maxY, ty[t]);
+      }
+
+      // One walk for the whole group: a node is accepted only if it is
+      // far enough from every point of the group's bounding box.
+      std::uint32_t k = 0;
+      while (k < count) {
+        const Node &nd = nodes[k];
+        const float ex = std::max({minX - nd.comX, nd.comX - maxX, 0.0f});
+        const float ey = std::max({minY - nd.comY, nd.comY - maxY, 0.0f});
+        const float reach = nd.size * invTheta + nd.offset;
+        if (reach * reach < ex * ex + ey * ey) {
+          pullGroup(nd.comX, nd.comY, nd.mass, tx, ty, ax, ay);
+          k = nd.next;
+        } else if (nd.next == k + 1) {
+          // A leaf: its subtree is just itself.
+          for (std::uint32_t s = nd.begin; s < nd.end; ++s) {
+            pullGroup(bodyX_[s], bodyY_[s], bodyMass_[s], tx, ty, ax, ay);
+          }
+          k = nd.next;
+        } else {
+          ++k;
+        }
+      }
+
+      for (std::uint32_t t = 0; t < n; ++t) {
+        const std::uint32_t i = static_cast<std::uint32_t>(keyed_[g + t]);
+        if (p.type[i] == TYPE_STONE) continue;
+        p.accX[i] += scale * ax[t];
+        p.accY[i] += scale * ay[t];
+      }
+    }
+  }
+}
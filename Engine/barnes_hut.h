@@ -0,0 +1,105 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include "particle.h"
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// ---------------------------------------------------------------------------
+// Quadtree over the particles' masses for long-range (self-)gravity.
+//
+// Every particle gets a 32-bit Morton key from its position in the square
+// that covers the world (16 bits per axis). Sorting by key puts each
+// quadtree node's particles in one contiguous range, so a node is just a
+// key prefix plus a slot range, and its children split that range where
+// the next two key bits change.
+//
+// The build is parallel in the way the grid builds are: keys are computed
+// per chunk, a counting sort bins the particles by their top
+// 2 * kTopLevels key bits (one bucket per node at that depth), and then
+// every bucket is sorted and turned into a subtree independently. The few
+// nodes above the buckets are built last, serially, and the subtrees are
+// copied behind them in depth-first order.
+//
+// Nodes are stored depth first, and each one records where its subtree
+// ends (`next`), so a traversal needs no stack: accept a node and jump to
+// `next`, or open it and step to the following node, its first child.
+// A node is accepted when the distance to its centre of mass exceeds
+// size / theta plus the centre of mass's offset from the middle of the
+// node (theta is the opening angle). The offset term keeps the error
+// bounded when the mass sits near one edge of the node, which the plain
+// size / distance < theta test does not. Leaves that are opened sum their
+// particles directly; with theta = 0 every leaf is opened and the result
+// is the direct O(N^2) sum.
+//
+// The walk is done once per group of up to 16 particles from one leaf
+// rather than once per particle: the test uses the distance from the
+// group's bounding box, and every accepted node or opened leaf is applied
+// to all 16 targets in a loop that vectorises. Neighbouring particles
+// accept almost the same nodes, so this costs a little extra opening for
+// a large cut in tree walks.
+//
+// Stone is kinematic and has no finite mass, so it takes no part as a
+// source. Forces are softened by cfg::GRAVITY_SOFTENING so close pairs,
+// which the collision pass keeps apart anyway, don't produce huge spikes.
+// ---------------------------------------------------------------------------
+
+class BarnesHutTree {
+public:
+  struct Node {
+    float comX, comY;          // centre of mass
+    float mass;
+    float size;                // side length of the node's square
+    std::uint32_t begin, end;  // particle slots covered
+    std::uint32_t next;        // first node after this subtree; a leaf
+                               // (summed directly when opened) is the
+                               // only node whose next is its own index + 1
+    float offset;              // centre of mass to the square's centre
+  };
+
+  // Top levels built serially; each node at this depth is a bucket whose
+  // subtree is built on its own.
+  static constexpr int kTopLevels = 4;
+
+  void build(const ParticleSystem &p);
+
+  // Same tree, with the key pass, the bucket sorts and the subtrees run on
+  // the pool.
+  void build(const ParticleSystem &p, ThreadPool &pool, std::size_t minChunk);
+
+  // Add `scale` times the softened pull of the whole tree (opening angle
+  // `theta`) to accX/accY of the particles in every leaf that starts in
+  // slots [begin,end). Each particle is in exactly one leaf, so calls on
+  // disjoint slot ranges can run in parallel. Stone is left alone.
+  void accumulate(ParticleSystem &p, float theta, float scale,
+                  std::size_t begin, std::size_t end) const;
+
+  std::size_t size() const { return keyed_.size(); }
+
+  const std::vector<Node> &nodes() const { return nodes_; }
+
+private:
+  float rootSize_ = 0.0f;
+
+  // Per-slot particle data in key order.
+  std::vector<std::uint64_t> keyed_;    // key << 32 | particle index
+  std::vector<std::uint64_t> scratch_;  // counting sort target
+  std::vector<float>         bodyX_, bodyY_, bodyMass_;
+
+  std::vector<std::uint32_t> bucketOf_;     // per particle
+  std::vector<std::uint32_t> bucketStart_;  // per bucket, plus the end
+  std::vector<std::vector<Node>> subtrees_; // per bucket, local `next`
+  std::vector<Node>          nodes_;
+  std::vector<std::uint32_t> leaves_;       // leaf node indices, slot order
+
+  void buildImpl(const ParticleSystem &p, ThreadPool *pool,
+                 std::size_t minChunk);
+  std::uint32_t buildSubtree(std::vector<Node> &out, std::uint32_t begin,
+                             std::uint32_t end, int depth);
+  void emitTop(std::uint32_t bucketLo, std::uint32_t bucketHi, int depth);
+};
+
+#endif
@@ -1,11 +1,38 @@
 #include "collisions.h"
 #include "config.h"
+#include "narrowphase.h"
 
 #include <algorithm>
 #include <cmath>
 
 namespace collisions {
 
+namespace {
+
+// Store particle i's kernel result: the position push goes into accX/accY,
+// which are reused as a position-correction scratch (forces have already
+// been converted into velocities for this substep, so the slots are free).
+// The velocity delta is accumulated directly — safe because we only touch
+// our own index i, and neighbours are read from `sorted`.
+inline void storeSums(ParticleSystem &p, std::size_t i,
+                      const narrowphase::PairSums &sums) {
+  p.accX[i] = sums.pushX;
+  p.accY[i] = sums.pushY;
+  p.velX[i] += sums.dvX;
+  p.velY[i] += sums.dvY;
+}
+
+inline void resolveOne(ParticleSystem &p,
+                       const narrowphase::SortedParticles &sorted,
+                       narrowphase::KernelFn kernel, std::size_t i,
+                       const narrowphase::Span *spans, int numSpans) {
+  narrowphase::PairSums sums;
+  kernel(sorted, p, static_cast<std::uint32_t>(i), spans, numSpans, sums);
+  storeSums(p, i, sums);
+}
+
+} // namespace
+
 // One-sided collision response: when looking at pair (i, j) we only
 // accumulate into i's scratch slot. j will reciprocate when it processes its
 // own neighbourhood. This makes the pass parallel-safe — every thread only
@@ -13,127 +40,410 @@ namespace collisions {
 //
 // We resolve overlap by moving i away from j by half the penetration depth
 // (other half handled by j's pass), then apply an impulse along the contact
-// normal with restitution + Coulomb-ish friction.
+// normal with restitution + Coulomb-ish friction. The pair maths lives in
+// the narrowphase kernels; this function only hands them slot spans.
 void resolveBand(ParticleSystem &p,
                  const SpatialHash &hash,
-                 const std::vector<std::uint32_t> &sortedIndices,
-                 std::size_t begin, std::size_t end) {
-  const float bias = cfg::POSITION_BIAS;
-  const float e    = cfg::COLLISION_RESTITUTION;
-  const float mu   = cfg::COLLISION_FRICTION;
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end, PeriodicAxes wrap,
+                 narrowphase::Kernel kind) {
+  const narrowphase::KernelFn kernel = narrowphase::kernelFn(kind);
+
+  for (std::size_t i = begin; i < end; ++i) {
+    if (p.asleep(i)) continue;
+    const int cx = hash.cellIndexX(p.posX[i]);
+    const int cy = hash.cellIndexY(p.posY[i]);
+
+    // Cells of one grid row are adjacent in cell order, so the three cells
+    // of each row form a single contiguous span of sorted slots; across a
+    // periodic seam the far side's cells add shifted ghost spans.
+    narrowphase::Span spans[6];
+    int numSpans = 0;
+    hash.forEachNeighbourSpan(cx, cy, wrap, [&](std::uint32_t b, std::uint32_t e,
+                                                float sx, float sy) {
+      spans[numSpans++] = { b, e, sx, sy };
+    });
+
+    resolveOne(p, sorted, kernel, i, spans, numSpans);
+  }
+}
+
+void resolveBand(ParticleSystem &p,
+                 const SparseSpatialHash &hash,
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end,
+                 narrowphase::Kernel kind) {
+  const narrowphase::KernelFn kernel = narrowphase::kernelFn(kind);
+
+  // Every neighbour cell costs a table probe, so the spans are kept while
+  // consecutive particles share a cell — the common case once particles
+  // have been reordered into cell order.
+  narrowphase::Span spans[9];
+  int numSpans = 0;
+  bool haveSpans = false;
+  int lastX = 0, lastY = 0;
 
   for (std::size_t i = begin; i < end; ++i) {
-    const float pxi = p.posX[i];
-    const float pyi = p.posY[i];
-    const float vxi = p.velX[i];
-    const float vyi = p.velY[i];
-    const float ri  = p.radius[i];
-    const float wi  = p.invMass[i];      // inverse mass
-    const auto  ti  = static_cast<ParticleType>(p.type[i]);
-
-    int cx = hash.cellIndexX(pxi);
-    int cy = hash.cellIndexY(pyi);
-
-    float pushX = 0.0f, pushY = 0.0f;
-    float dvX   = 0.0f, dvY   = 0.0f;
-
-    for (int dy = -1; dy <= 1; ++dy) {
-      for (int dx = -1; dx <= 1; ++dx) {
-        const auto &cell = hash.getCell(cx + dx, cy + dy);
-        for (std::uint32_t k = 0; k < cell.count; ++k) {
-          std::uint32_t j = sortedIndices[cell.start + k];
-          if (j == i) continue;
-
-          float rx = p.posX[j] - pxi;
-          float ry = p.posY[j] - pyi;
-          float dist2 = rx * rx + ry * ry;
-          float rSum  = ri + p.radius[j];
-          float rSum2 = rSum * rSum;
-          if (dist2 >= rSum2 || dist2 < 1e-6f) continue;
-
-          float dist = std::sqrt(dist2);
-          float invDist = 1.0f / dist;
-          float nx = rx * invDist;   // points i -> j
-          float ny = ry * invDist;
-          float overlap = rSum - dist;
-
-          // Mass-weighted partition: lighter particle (larger invMass)
-          // gets pushed more. If both are kinematic (stones), skip.
-          float wj = p.invMass[j];
-          float wSum = wi + wj;
-          if (wSum <= 0.0f) continue;
-
-          float share = bias * (wi / wSum);
-
-          // Liquid cohesion: don't push as hard, lets droplets coalesce.
-          float pushScale = 1.0f;
-          if (ti == TYPE_LIQUID && p.type[j] == TYPE_LIQUID) {
-            pushScale = cfg::LIQUID_COHESION;
-          }
-
-          pushX -= nx * overlap * share * pushScale;
-          pushY -= ny * overlap * share * pushScale;
-
-          // Velocity exchange along normal.
-          float vRelX = p.velX[j] - vxi;
-          float vRelY = p.velY[j] - vyi;
-          float vN    = vRelX * nx + vRelY * ny;
-          if (vN < 0.0f) {
-            // Particles separating — no impulse needed.
-            continue;
-          }
-          // Impulse magnitude such that the relative normal velocity flips
-          // sign and scales by restitution.
-          float jImp = (1.0f + e) * vN / wSum;
-          dvX += nx * jImp * wi;
-          dvY += ny * jImp * wi;
-
-          // Tangential friction (Coulomb cone).
-          float tx = -ny, ty = nx;
-          float vT = vRelX * tx + vRelY * ty;
-          float frictionScale = mu;
-          if (ti == TYPE_SAND || p.type[j] == TYPE_SAND) {
-            frictionScale = cfg::SAND_FRICTION_COEF;
-          }
-          float fImp = vT * frictionScale / wSum;
-          dvX += tx * fImp * wi;
-          dvY += ty * fImp * wi;
+    if (p.asleep(i)) continue;
+    const int cx = hash.cellIndexX(p.posX[i]);
+    const int cy = hash.cellIndexY(p.posY[i]);
+    if (haveSpans && cx == lastX && cy == lastY) {
+      resolveOne(p, sorted, kernel, i, spans, numSpans);
+      continue;
+    }
+    haveSpans = true;
+    lastX = cx;
+    lastY = cy;
+
+    // Occupied cells are stored column-major, so walking each column
+    // top to bottom lets back-to-back cells merge into one span. Gaps
+    // (unoccupied cells) split a column into separate spans.
+    numSpans = 0;
+    for (int x = cx - 1; x <= cx + 1; ++x) {
+      for (int y = cy - 1; y <= cy + 1; ++y) {
+        const auto &c = hash.getCell(x, y);
+        if (c.count == 0) continue;
+        if (numSpans > 0 && spans[numSpans - 1].end == c.start) {
+          spans[numSpans - 1].end = c.start + c.count;
+        } else {
+          spans[numSpans++] = { c.start, c.start + c.count };
         }
       }
     }
 
-    // Write to scratch slots in the SoA. accX/accY are reused as a
-    // position-correction scratch here (forces have already been
-    // converted into velocities for this substep, so the slots are free).
-    p.accX[i] = pushX;
-    p.accY[i] = pushY;
-    // We accumulate the velocity delta directly — safe because we only
-    // touch our own index i.
-    p.velX[i] += dvX;
-    p.velY[i] += dvY;
+    resolveOne(p, sorted, kernel, i, spans, numSpans);
   }
 }
 
-void applyWorldBounds(ParticleSystem &p, std::size_t begin, std::size_t end) {
-  const float w = cfg::WORLD_WIDTH;
-  const float h = cfg::WORLD_HEIGHT;
+void resolveBand(ParticleSystem &p,
+                 const MultiLevelGrid &grid,
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end,
+                 narrowphase::Kernel kind) {
+  const narrowphase::KernelFn kernel = narrowphase::kernelFn(kind);
+  const int levels = grid.levels();
+
+  // A large particle's window on a fine level spans many rows; spans are
+  // handed to the kernel in batches (the kernel accumulates into `sums`).
+  constexpr int kMaxSpans = 32;
+  narrowphase::Span spans[kMaxSpans];
+
+  for (std::size_t i = begin; i < end; ++i) {
+    if (p.asleep(i)) continue;
+    const float x = p.posX[i];
+    const float y = p.posY[i];
+    narrowphase::PairSums sums;
+    int numSpans = 0;
+
+    for (int l = 0; l < levels; ++l) {
+      if (grid.levelCount(l) == 0) continue;
+      const SpatialHash &g = grid.grid(l);
+      const std::uint32_t offset = grid.levelOffset(l);
+      // Any contact on this level is closer than `reach` on both axes. For
+      // same-size particles that is about one cell: the usual 3x3 window.
+      const float reach = p.radius(i) + grid.levelMaxRadius(l);
+      const int x0 = g.cellIndexX(x - reach), x1 = g.cellIndexX(x + reach);
+      const int y0 = g.cellIndexY(y - reach), y1 = g.cellIndexY(y + reach);
+
+      for (int row = y0; row <= y1; ++row) {
+        const auto &first = g.getCell(x0, row);
+        const auto &last  = g.getCell(x1, row);
+        if (first.start == last.start + last.count) continue;
+        if (numSpans == kMaxSpans) {
+          kernel(sorted, p, static_cast<std::uint32_t>(i), spans, numSpans, sums);
+          numSpans = 0;
+        }
+        spans[numSpans++] = { offset + first.start,
+                              offset + last.start + last.count };
+      }
+    }
+
+    kernel(sorted, p, static_cast<std::uint32_t>(i), spans, numSpans, sums);
+    storeSums(p, i, sums);
+  }
+}
+
+void resolveBand(ParticleSystem &p,
+                 const VerletList &lists,
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end,
+                 narrowphase::Kernel kind) {
+  const narrowphase::ListKernelFn kernel = narrowphase::listKernelFn(kind);
+  for (std::size_t i = begin; i < end; ++i) {
+    if (p.asleep(i)) continue;
+    narrowphase::PairSums sums;
+    kernel(sorted, p, static_cast<std::uint32_t>(i), lists.neighbours(i),
+           lists.neighbourCount(i), sums);
+    storeSums(p, i, sums);
+  }
+}
+
+namespace {
+
+struct TileGrid {
+  int tilesX, colX, colY, countX, countY;
+
+  TileGrid(const SpatialHash &hash, int colour)
+      : tilesX((hash.cols() + 1) / 2), colX(colour & 1), colY(colour >> 1),
+        countX((tilesX - colX + 1) / 2),
+        countY(((hash.rows() + 1) / 2 - colY + 1) / 2) {}
+};
+
+// Call fn(slot, spans, numSpans) for every slot in tiles [begin,end) of
+// one colour, with the slot's half-stencil as spans.
+template <class Fn>
+void forEachTileSlot(const SpatialHash &hash, int colour, std::size_t begin,
+                     std::size_t end, Fn &&fn) {
+  const int cols = hash.cols();
+  const int rows = hash.rows();
+  const TileGrid t(hash, colour);
+
+  for (std::size_t n = begin; n < end; ++n) {
+    const int tx = t.colX + 2 * static_cast<int>(n % t.countX);
+    const int ty = t.colY + 2 * static_cast<int>(n / t.countX);
+    const int x1 = std::min(2 * tx + 1, cols - 1);
+    const int y1 = std::min(2 * ty + 1, rows - 1);
+
+    for (int cy = 2 * ty; cy <= y1; ++cy) {
+      for (int cx = 2 * tx; cx <= x1; ++cx) {
+        const auto &cell = hash.getCell(cx, cy);
+        if (cell.count == 0) continue;
+
+        // Later slots of this cell plus the cell to the right form one
+        // span; the three cells below form another.
+        const auto &right = hash.getCell(std::min(cx + 1, cols - 1), cy);
+        const std::uint32_t rightEnd = right.start + right.count;
+        narrowphase::Span spans[2];
+        int numSpans = 1;
+        if (cy + 1 < rows) {
+          const auto &first = hash.getCell(std::max(cx - 1, 0), cy + 1);
+          const auto &last  = hash.getCell(std::min(cx + 1, cols - 1), cy + 1);
+          spans[1] = { first.start, last.start + last.count };
+          numSpans = 2;
+        }
+
+        for (std::uint32_t i = cell.start; i < cell.start + cell.count; ++i) {
+          spans[0] = { i + 1, rightEnd };
+          fn(i, spans, numSpans);
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+std::size_t colourTileCount(const SpatialHash &hash, int colour) {
+  const TileGrid t(hash, colour);
+  return static_cast<std::size_t>(std::max(0, t.countX)) *
+         static_cast<std::size_t>(std::max(0, t.countY));
+}
+
+void resolveColourTiles(const SpatialHash &hash,
+                        const narrowphase::SortedParticles &sorted,
+                        narrowphase::ContactAccum &acc,
+                        int colour, std::size_t begin, std::size_t end,
+                        narrowphase::Kernel kind) {
+  const narrowphase::PairKernelFn kernel = narrowphase::pairKernelFn(kind);
+  forEachTileSlot(hash, colour, begin, end,
+                  [&](std::uint32_t i, const narrowphase::Span *spans,
+                      int numSpans) { kernel(sorted, i, spans, numSpans, acc); });
+}
+
+void relaxColourTiles(const SpatialHash &hash,
+                      narrowphase::SortedParticles &sorted,
+                      int colour, std::size_t begin, std::size_t end,
+                      float bias) {
+  forEachTileSlot(hash, colour, begin, end,
+                  [&](std::uint32_t i, const narrowphase::Span *spans,
+                      int numSpans) {
+                    narrowphase::gaussSeidelKernel(sorted, i, spans, numSpans,
+                                                   bias);
+                  });
+}
+
+void applyContactAccum(ParticleSystem &p,
+                       const narrowphase::SortedParticles &sorted,
+                       const narrowphase::ContactAccum &acc,
+                       std::size_t begin, std::size_t end) {
+  for (std::size_t k = begin; k < end; ++k) {
+    if (sorted.asleep[k]) continue;
+    const std::uint32_t i = sorted.id[k];
+    p.accX[i] = acc.pushX[k];
+    p.accY[i] = acc.pushY[k];
+    p.velX[i] += acc.dvX[k];
+    p.velY[i] += acc.dvY[k];
+  }
+}
+
+void applyRelaxedSnapshot(ParticleSystem &p,
+                          const narrowphase::SortedParticles &sorted,
+                          std::size_t begin, std::size_t end) {
+  for (std::size_t k = begin; k < end; ++k) {
+    if (sorted.asleep[k]) continue;
+    const std::uint32_t i = sorted.id[k];
+    p.accX[i] = sorted.posX[k] - p.posX[i];
+    p.accY[i] = sorted.posY[k] - p.posY[i];
+    p.velX[i] = sorted.velX[k];
+    p.velY[i] = sorted.velY[k];
+  }
+}
+
+namespace {
+
+// Clamp one coordinate to [radius, extent - radius], reflecting the
+// velocity (scaled by restitution) if it points out of the world. Written
+// with selects rather than branches so the calling loops vectorise.
+inline void clampAxis(float &x, float &v, float radius, float extent) {
   const float r = cfg::BOUNDARY_RESTITUTION;
+  const bool lo = x < radius;
+  const bool hi = !lo & (x > extent - radius);
+  const bool reflect = (lo & (v < 0.0f)) | (hi & (v > 0.0f));
+  x = lo ? radius : (hi ? extent - radius : x);
+  v = reflect ? -v * r : v;
+}
+
+// Which particles of a range take their collision correction: any
+// non-stone awake particle (mixed storage), any awake one (a non-stone
+// type range) or none (a stone range, which is only clamped).
+enum class Movers { Mixed, Awake, None };
 
+// Body of applyCorrectionsAndBounds over raw arrays. Taking them as
+// restrict parameters (rather than locals pointing into p) is what lets
+// GCC vectorise the loop.
+template <Movers M>
+void correctAndClamp(float *__restrict px, float *__restrict py,
+                     float *__restrict vxs, float *__restrict vys,
+                     const float *__restrict ax, const float *__restrict ay,
+                     const std::uint16_t *__restrict mat,
+                     const Material *__restrict materials,
+                     const std::uint8_t *__restrict type,
+                     const std::uint16_t *__restrict rest,
+                     std::size_t begin, std::size_t end) {
   for (std::size_t i = begin; i < end; ++i) {
-    float radius = p.radius[i];
-    if (p.posX[i] < radius) {
-      p.posX[i] = radius;
-      if (p.velX[i] < 0.0f) p.velX[i] = -p.velX[i] * r;
-    } else if (p.posX[i] > w - radius) {
-      p.posX[i] = w - radius;
-      if (p.velX[i] > 0.0f) p.velX[i] = -p.velX[i] * r;
+    // 0 for stone and sleepers, whose correction is discarded; a multiply
+    // keeps the loop free of the per-particle branch the modular pass has.
+    float keep = 0.0f;
+    if constexpr (M == Movers::Mixed) {
+      keep = float((type[i] != TYPE_STONE) & (rest[i] < cfg::SLEEP_SUBSTEPS));
+    } else if constexpr (M == Movers::Awake) {
+      keep = float(rest[i] < cfg::SLEEP_SUBSTEPS);
     }
-    if (p.posY[i] < radius) {
-      p.posY[i] = radius;
-      if (p.velY[i] < 0.0f) p.velY[i] = -p.velY[i] * r;
-    } else if (p.posY[i] > h - radius) {
-      p.posY[i] = h - radius;
-      if (p.velY[i] > 0.0f) p.velY[i] = -p.velY[i] * r;
+    const float radius = materials[mat[i]].radius;
+    float x = px[i], y = py[i];
+    if constexpr (M != Movers::None) {
+      x += ax[i] * keep;
+      y += ay[i] * keep;
+    }
+    float vx = vxs[i], vy = vys[i];
+    clampAxis(x, vx, radius, cfg::WORLD_WIDTH);
+    clampAxis(y, vy, radius, cfg::WORLD_HEIGHT);
+    px[i] = x;   py[i] = y;
+    vxs[i] = vx; vys[i] = vy;
+  }
+}
+
+template <Movers M>
+void correctAndClamp(ParticleSystem &p, std::size_t begin, std::size_t end) {
+  correctAndClamp<M>(p.posX.data(), p.posY.data(), p.velX.data(),
+                     p.velY.data(), p.accX.data(), p.accY.data(),
+                     p.material.data(), p.materials.data(), p.type.data(),
+                     p.restSteps.data(),
+                     begin, end);
+}
+
+// Bring a coordinate that has left [0, extent) back in from the other
+// side, and move the previous position with it.
+inline void wrapAxis(float &x, float &prev, float extent) {
+  const float shift = x < 0.0f ? extent : (x >= extent ? -extent : 0.0f);
+  x    += shift;
+  prev += shift;
+}
+
+// Body of applyCorrectionsAndWrap (Correct) and applyWorldWrap. Periodic
+// runs are not the hot default, so one loop serves every storage order.
+template <bool Correct>
+void wrapOver(ParticleSystem &p, PeriodicAxes wrap, std::size_t begin,
+              std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    float x = p.posX[i], y = p.posY[i];
+    if (Correct && p.type[i] != TYPE_STONE && !p.asleep(i)) {
+      x += p.accX[i];
+      y += p.accY[i];
+    }
+    float vx = p.velX[i], vy = p.velY[i];
+    const float radius = p.radius(i);
+    if (wrap.x) wrapAxis(x, p.prevX[i], cfg::WORLD_WIDTH);
+    else        clampAxis(x, vx, radius, cfg::WORLD_WIDTH);
+    if (wrap.y) wrapAxis(y, p.prevY[i], cfg::WORLD_HEIGHT);
+    else        clampAxis(y, vy, radius, cfg::WORLD_HEIGHT);
+    p.posX[i] = x;  p.posY[i] = y;
+    p.velX[i] = vx; p.velY[i] = vy;
+  }
+}
+
+} // namespace
+
+void applyCorrectionsAndBounds(ParticleSystem &p, std::size_t begin,
+                               std::size_t end) {
+  if (p.partitioned) {
+    p.forEachTypeRange(begin, end, [&](auto type, std::size_t b, std::size_t e) {
+      if constexpr (decltype(type)::value == TYPE_STONE) {
+        correctAndClamp<Movers::None>(p, b, e);
+      } else {
+        correctAndClamp<Movers::Awake>(p, b, e);
+      }
+    });
+    return;
+  }
+  correctAndClamp<Movers::Mixed>(p, begin, end);
+}
+
+void applyWorldBounds(ParticleSystem &p, std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    float x = p.posX[i], y = p.posY[i];
+    float vx = p.velX[i], vy = p.velY[i];
+    const float radius = p.radius(i);
+    clampAxis(x, vx, radius, cfg::WORLD_WIDTH);
+    clampAxis(y, vy, radius, cfg::WORLD_HEIGHT);
+    p.posX[i] = x;  p.posY[i] = y;
+    p.velX[i] = vx; p.velY[i] = vy;
+  }
+}
+
+void applyCorrectionsAndWrap(ParticleSystem &p, PeriodicAxes wrap,
+                             std::size_t begin, std::size_t end) {
+  wrapOver<true>(p, wrap, begin, end);
+}
+
+void applyWorldWrap(ParticleSystem &p, PeriodicAxes wrap, std::size_t begin,
+                    std::size_t end) {
+  wrapOver<false>(p, wrap, begin, end);
+}
+
+void applyObstacles(ParticleSystem &p, const ObstacleField &field,
+                    std::size_t begin, std::size_t end) {
+  const float e  = cfg::BOUNDARY_RESTITUTION;
+  const float mu = cfg::OBSTACLE_FRICTION;
+  for (std::size_t i = begin; i < end; ++i) {
+    if (p.type[i] == TYPE_STONE || p.asleep(i)) continue;
+    float gx, gy;
+    const float depth = p.radius(i) - field.sample(p.posX[i], p.posY[i], gx, gy);
+    if (depth <= 0.0f) continue;
+    // On a ridge of the field (as deep in from two sides) there is no
+    // direction to push; the next substep will have moved it off.
+    const float len = std::sqrt(gx * gx + gy * gy);
+    if (len < 1e-6f) continue;
+    const float nx = gx / len, ny = gy / len;
+    p.posX[i] += nx * depth;
+    p.posY[i] += ny * depth;
+
+    const float vx = p.velX[i], vy = p.velY[i];
+    const float vn = vx * nx + vy * ny;
+    if (vn < 0.0f) {
+      const float tx = vx - vn * nx, ty = vy - vn * ny;
+      p.velX[i] = tx * (1.0f - mu) - vn * e * nx;
+      p.velY[i] = ty * (1.0f - mu) - vn * e * ny;
     }
   }
 }
@@ -1,8 +1,13 @@
 #ifndef COLLISIONS_H
 #define COLLISIONS_H
 
+#include "multi_level_grid.h"
+#include "narrowphase.h"
+#include "obstacle_field.h"
 #include "particle.h"
+#include "sparse_spatial_hash.h"
 #include "spatial_hash.h"
+#include "verlet_list.h"
 
 #include <cstdint>
 #include <vector>
@@ -12,35 +17,141 @@ class ThreadPool;
 // ---------------------------------------------------------------------------
 // Two-phase collision resolution.
 //
-// Phase 1 — position project: resolve overlap by moving each pair half the
-// penetration depth apart. Operates on positions only and is therefore
-// commutative-ish; we apply it in a deterministic neighbour-walk order so
-// the result is stable. To make it parallel-safe we operate on owner-only
-// half-pair writes guarded by the (i<j) ordering: each thread updates its
-// own index `i` but never writes to neighbours.
+// Each contact yields a position push (each particle moves its mass-weighted
+// share of the penetration depth) and a velocity impulse along the normal
+// with restitution and tangential friction. All neighbour reads come from
+// the cell-ordered snapshot, so results do not depend on visit order.
 //
-// Phase 2 — velocity impulse: at the end of all position corrections we
-// recompute normal-direction velocity exchange with a restitution coefficient
-// and apply tangential friction. Same single-writer rule.
+// One-sided pass (resolveBand): every particle walks its full 3x3
+// neighbourhood and writes only its own index. Race-free without any
+// scheduling, but every pair is evaluated twice, once from each side.
 //
-// Both phases are split into 4 colours of an interleaved cell pattern to
-// remove any read/write conflicts between threads while keeping work
-// balanced.
+// Coloured pass (uniform grid only): the grid is cut into 2x2-cell tiles
+// and each tile gets one of 4 colours by the parity of its tile
+// coordinates. A particle pairs only with later slots of its own cell, the
+// cell to its right and the three cells below (a half stencil), so each
+// pair is evaluated once and both shares are accumulated per slot. A
+// tile's writes stay within x-1..x+2, y..y+2 of its cells, which never
+// overlaps another tile of the same colour, so the tiles of one colour run
+// in parallel and the four colours run one after another. A final pass
+// copies the per-slot sums back to the particles.
+//
+// Gauss-Seidel pass (uniform grid only): the same tiles and colours, but
+// every pair is resolved in place in the snapshot, so later pairs, later
+// colours and later sweeps all see the corrected state. A tile also reads
+// only within its write region, so the colouring keeps that race-free.
+// The world bounds are enforced inside the sweep as well; otherwise the
+// bottom row is pushed into the floor, clamped back afterwards, and the
+// overlap above it is back for the next substep.
+// Gauss-Seidel removes overlap faster than the Jacobi passes, but it does
+// not make up for substeps: a deep pile still sinks further and takes
+// longer to settle than with Jacobi at 4 substeps, because the stack's
+// support only arrives as velocity impulses. The result is copied back to
+// the particles in the form the other passes leave it.
 // ---------------------------------------------------------------------------
 
 namespace collisions {
 
 // Resolve overlap by projecting each particle out by half the penetration
-// depth, and exchange momentum along the contact normal. Safe to call in
-// parallel within a single colour band.
+// depth, and exchange momentum along the contact normal. `sorted` must hold
+// the cell-ordered copy made right after `hash` was built. Sleeping
+// particles are skipped but still act as (motionless) neighbours. Safe to
+// call in parallel over disjoint index ranges. Along the `wrap` axes the
+// neighbourhood continues across the seam, with minimum-image distances.
+// Every pass here runs `kind`, the active kernel unless the caller passes
+// narrowphase::passKernel(deterministic).
 void resolveBand(ParticleSystem &p,
                  const SpatialHash &hash,
-                 const std::vector<std::uint32_t> &sortedIndices,
-                 std::size_t begin, std::size_t end);
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end, PeriodicAxes wrap = {},
+                 narrowphase::Kernel kind = narrowphase::activeKernel());
+
+// Same contact model over the sparse hash. Only occupied cells have slots
+// there, so the 3x3 neighbourhood can split into up to nine spans.
+void resolveBand(ParticleSystem &p,
+                 const SparseSpatialHash &hash,
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end,
+                 narrowphase::Kernel kind = narrowphase::activeKernel());
+
+// Same contact model over the multi-level grid: every non-empty level is
+// searched with a window sized for this particle's radius plus the largest
+// radius on that level, so contacts between very different sizes are found.
+void resolveBand(ParticleSystem &p,
+                 const MultiLevelGrid &grid,
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end,
+                 narrowphase::Kernel kind = narrowphase::activeKernel());
+
+// Same contact model over Verlet lists: each particle is tested only
+// against the slots listed for it.
+void resolveBand(ParticleSystem &p,
+                 const VerletList &lists,
+                 const narrowphase::SortedParticles &sorted,
+                 std::size_t begin, std::size_t end,
+                 narrowphase::Kernel kind = narrowphase::activeKernel());
+
+// Number of 2x2-cell tiles with the given colour (0..3).
+std::size_t colourTileCount(const SpatialHash &hash, int colour);
+
+// Coloured pass over tiles [begin,end) of one colour: evaluate every
+// half-stencil pair once and add both shares into `acc`, which must have
+// been zeroed for all slots. Safe to call in parallel within one colour.
+void resolveColourTiles(const SpatialHash &hash,
+                        const narrowphase::SortedParticles &sorted,
+                        narrowphase::ContactAccum &acc,
+                        int colour, std::size_t begin, std::size_t end,
+                        narrowphase::Kernel kind = narrowphase::activeKernel());
+
+// Gauss-Seidel sweep over tiles [begin,end) of one colour: resolve every
+// half-stencil pair in place in `sorted` (see gaussSeidelKernel). Safe to
+// call in parallel within one colour.
+void relaxColourTiles(const SpatialHash &hash,
+                      narrowphase::SortedParticles &sorted,
+                      int colour, std::size_t begin, std::size_t end,
+                      float bias);
+
+// Hand the Gauss-Seidel result for slots [begin,end) to the particles:
+// the position change goes into accX/accY for phase 6 and the velocity is
+// replaced. Sleepers are left as is.
+void applyRelaxedSnapshot(ParticleSystem &p,
+                          const narrowphase::SortedParticles &sorted,
+                          std::size_t begin, std::size_t end);
+
+// Hand the coloured pass's results for slots [begin,end) to the particles
+// they hold, in the same form resolveBand leaves them: the push in
+// accX/accY and the impulse added to the velocity. Sleepers are left as is.
+void applyContactAccum(ParticleSystem &p,
+                       const narrowphase::SortedParticles &sorted,
+                       const narrowphase::ContactAccum &acc,
+                       std::size_t begin, std::size_t end);
+
+// Phase 6 in one pass: add the position correction left in accX/accY to
+// every awake, non-stone particle, then clamp it to the world bounds.
+void applyCorrectionsAndBounds(ParticleSystem &p, std::size_t begin,
+                               std::size_t end);
 
 // Apply boundary collision (world walls) inline.
 void applyWorldBounds(ParticleSystem &p, std::size_t begin, std::size_t end);
 
+// The same two passes with periodic boundaries along the `wrap` axes: a
+// particle that has left the world there comes back in from the opposite
+// side instead of bouncing off a wall, and its prevX/prevY move with it so
+// the interpolated frame does not sweep it across the world. Axes not in
+// `wrap` keep their walls.
+void applyCorrectionsAndWrap(ParticleSystem &p, PeriodicAxes wrap,
+                             std::size_t begin, std::size_t end);
+void applyWorldWrap(ParticleSystem &p, PeriodicAxes wrap, std::size_t begin,
+                    std::size_t end);
+
+// Push every awake, non-stone particle of [begin,end) that is closer than
+// its radius to a baked obstacle back out along the field's gradient, then
+// reflect its velocity into the obstacle with cfg::BOUNDARY_RESTITUTION and
+// take cfg::OBSTACLE_FRICTION off its sliding speed. One field lookup per
+// particle, whatever the geometry. Runs after the world bounds.
+void applyObstacles(ParticleSystem &p, const ObstacleField &field,
+                    std::size_t begin, std::size_t end);
+
 } // namespace collisions
 
 #endif
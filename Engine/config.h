@@ -19,10 +19,63 @@ constexpr float WORLD_HEIGHT = 800.0f;
 constexpr float SPATIAL_CELL_SIZE = 8.0f;
 constexpr int   SPATIAL_CELL_SHIFT = 3; // log2(8)
 
+// Multi-level broadphase: level l uses cells of SPATIAL_CELL_SIZE * 2^l, so
+// four levels cover radii up to 8x the single-grid limit.
+constexpr int   GRID_LEVELS = 4;
+
+// Every this many substeps the particle arrays are physically permuted into
+// grid-cell order, so the gather into the cell-ordered snapshot and the
+// scatter back read nearby memory instead of chasing random indices. 0
+// disables the reorder. Each reorder copies every array once, so the
+// interval must be long enough for that copy to pay off.
+constexpr int   REORDER_INTERVAL = 16;
+
+// Verlet lists keep every neighbour within r_i + r_j + VERLET_SKIN and are
+// rebuilt once some particle has moved VERLET_SKIN / 2. A wider skin means
+// fewer rebuilds but longer lists, and the one-sided list pass walks every
+// entry on every substep, so the skin should stay around a particle radius.
+constexpr float VERLET_SKIN = 3.0f;
+
+// Sleeping: a particle slower than SLEEP_SPEED for SLEEP_SUBSTEPS substeps
+// in a row stops being integrated and collided until something faster than
+// WAKE_SPEED comes within contact range. The gap between the two speeds
+// keeps settling particles from waking each other back up. Contact range
+// is tracked on a coarse byte grid of SLEEP_CELL_SIZE cells.
+constexpr float SLEEP_SPEED     = 2.0f;
+constexpr float WAKE_SPEED      = 8.0f;
+constexpr int   SLEEP_SUBSTEPS  = 60;
+constexpr float SLEEP_CELL_SIZE = 16.0f;
+
+// Sleepers in cells nothing awake can reach this frame are moved to the end
+// of the arrays and left out of the substeps entirely. Moving them costs a
+// pass over every particle, so a frame only does it when at least
+// FREEZE_MIN_SHARE of the particles would be left out.
+constexpr float FREEZE_MIN_SHARE = 0.25f;
+
 // Integration
 constexpr int   PHYSICS_SUBSTEPS = 4;   // sub-steps per render frame
+
+// Adaptive substepping (off by default) is a safety mode: it only adds
+// substeps. Each frame the count is raised until the fastest particle moves
+// at most CFL_NUMBER times the smallest radius per substep, and with SPH
+// liquid until a pressure wave crosses at most SPH_CFL_NUMBER of the
+// smoothing length, clamped to [MIN_SUBSTEPS, MAX_SUBSTEPS] (InputState can
+// narrow both). The floor is the fixed count: contacts are separated by
+// position correction, which is only as stiff as the substep is short.
+constexpr float CFL_NUMBER     = 0.5f;
+constexpr int   MIN_SUBSTEPS   = PHYSICS_SUBSTEPS;
+constexpr int   MAX_SUBSTEPS   = 16;
+constexpr float SPH_CFL_NUMBER = 0.5f;
 constexpr float DT_DEFAULT       = 0.10f;
 
+// Fixed timestep: physics runs PHYSICS_RATE steps per second of wall time,
+// each advancing DT_DEFAULT of simulation time, however fast frames are
+// drawn. A slow frame runs at most MAX_STEPS_PER_FRAME catch-up steps and
+// drops the rest, so an overloaded machine slows the simulation down
+// instead of falling ever further behind.
+constexpr float PHYSICS_RATE        = 60.0f;
+constexpr int   MAX_STEPS_PER_FRAME = 4;
+
 // Boundaries
 constexpr float BOUNDARY_RESTITUTION = 0.85f;
 
@@ -31,12 +84,36 @@ constexpr float DEFAULT_RADIUS = 2.5f;
 constexpr float DEFAULT_MASS   = 1.0f;
 constexpr int   INITIAL_CAPACITY = 16384;
 
+// Particle storage (SoaArena): every per-particle array starts on a
+// SOA_ALIGNMENT boundary (a cache line, and the widest vector load), and
+// parallel chunks are whole multiples of it. SOA_HUGE_PAGES asks Linux to
+// back arenas of 2 MB and up with transparent huge pages.
+constexpr int  SOA_ALIGNMENT  = 64;
+constexpr bool SOA_HUGE_PAGES = true;
+
+// Static obstacles (ObstacleField): the signed distance to the geometry is
+// baked at the corners of OBSTACLE_CELL_SIZE cells and read back
+// bilinearly, so features should be at least a cell or two thick.
+// Particles touching an obstacle bounce off it with BOUNDARY_RESTITUTION
+// and lose OBSTACLE_FRICTION of their sliding speed.
+constexpr float OBSTACLE_CELL_SIZE = 4.0f;
+constexpr float OBSTACLE_FRICTION  = 0.10f;
+
 // Collision response (PBD-style: positions are projected out of overlap,
 // then an impulse exchange handles velocity).
 constexpr float COLLISION_RESTITUTION = 0.40f; // 0=perfectly inelastic, 1=elastic
 constexpr float COLLISION_FRICTION    = 0.10f;
 constexpr float POSITION_BIAS         = 0.50f; // share of overlap each particle takes
 
+// Gauss-Seidel solver: sweeps over the contacts per substep, and the share
+// of each overlap removed per contact. Corrections are seen by the next
+// contact right away, so it can remove the whole overlap, where the Jacobi
+// passes take POSITION_BIAS because corrections from different contacts
+// add up.
+constexpr int   SOLVER_ITERATIONS = 2;
+constexpr int   MAX_SOLVER_ITERATIONS = 8;
+constexpr float GS_POSITION_BIAS  = 1.00f;
+
 // Mouse interaction strengths
 constexpr float MOUSE_REPEL_STRENGTH  = 1800.0f;
 constexpr float MOUSE_ATTRACT_STRENGTH = 1200.0f;
@@ -57,12 +134,57 @@ constexpr float LIQUID_COHESION    = 0.45f; // multiplies overlap correction
 constexpr float SAND_FRICTION_COEF = 0.20f;
 constexpr float GAS_BUOYANCY_MULT  = -0.20f; // multiplier on gravity for gas
 
+// SPH liquid (InputState::sphLiquid). Neighbours are looked up in the 3x3
+// grid cells around a particle, so the smoothing length can't exceed
+// SPATIAL_CELL_SIZE. Rest density is that of a hex lattice with
+// SPH_REST_SPACING between particles, a little wider than the disc contact
+// distance so pressure holds particles apart before their discs touch; the
+// stiffness keeps a 100 px column within a few percent of it under default
+// gravity.
+constexpr float SPH_SMOOTHING    = SPATIAL_CELL_SIZE;
+constexpr float SPH_REST_SPACING = 2.2f * DEFAULT_RADIUS;
+constexpr float SPH_STIFFNESS    = 30000.0f; // pressure per unit density error
+constexpr float SPH_VISCOSITY    = 1.0f;
+constexpr float SPH_COHESION     = 150.0f;   // surface tension strength
+
+// Self-gravity (InputState::selfGravity): every particle attracts every
+// other with G * m / (r^2 + GRAVITY_SOFTENING^2).
+//
+// Barnes-Hut: a tree node is taken as a point mass when its side is below
+// the opening angle times its distance; smaller angles are more accurate
+// and slower. Leaves hold up to BH_LEAF_SIZE particles.
+//
+// Particle mesh: mass is spread over a PM_GRID_SIZE^2 grid covering the
+// world's bounding square and the field is solved by FFT, so the cost no
+// longer depends on how particles are spread. Forces are resolved only
+// down to a couple of cells, so close range is softer than the tree's.
+// The grid size must be a power of two between PM_MIN_GRID_SIZE and
+// PM_MAX_GRID_SIZE. Mass is deposited into up to PM_DEPOSIT_GRIDS private
+// grids, one per chunk of particles, which are then summed.
+constexpr float SELF_GRAVITY_G    = 1000.0f;
+constexpr float GRAVITY_SOFTENING = 2.0f * DEFAULT_RADIUS;
+constexpr float BH_THETA          = 0.5f;
+constexpr int   BH_LEAF_SIZE      = 16;
+constexpr int   PM_GRID_SIZE      = 256;
+constexpr int   PM_MIN_GRID_SIZE  = 64;
+constexpr int   PM_MAX_GRID_SIZE  = 1024;
+constexpr int   PM_DEPOSIT_GRIDS  = 8;
+
 // Rendering
 constexpr int RENDER_CIRCLE_VERTS = 12; // polygon edges per particle
 
 // Threading
 constexpr int  MIN_PARTICLES_PER_THREAD = 256;
 
+// Deterministic mode (InputState::deterministic): resets seed the RNG with
+// DETERMINISTIC_SEED, and every parallel pass is cut into chunks of
+// DETERMINISTIC_CHUNK items whatever the thread count, so each particle
+// takes the same code path (vector body or scalar tail) on 1 thread or 64.
+// The chunk is small because the collision passes split a single colour's
+// tiles, about a thousand of them, the same way.
+constexpr unsigned int DETERMINISTIC_SEED  = 1;
+constexpr int          DETERMINISTIC_CHUNK = 256;
+
 } // namespace cfg
 
 #endif
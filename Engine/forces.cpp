@@ -1,10 +1,102 @@
 #include "forces.h"
 #include "config.h"
 
+#include <algorithm>
 #include <cmath>
 
 namespace forces {
 
+namespace {
+
+// Per-type constants shared by the generic loops and the typed kernels.
+constexpr float gravityScale(ParticleType t) {
+  return t == TYPE_GAS ? cfg::GAS_BUOYANCY_MULT : 1.0f;
+}
+
+constexpr float dampingFor(ParticleType t) {
+  return t == TYPE_GAS    ? cfg::GAS_DAMPING
+       : t == TYPE_LIQUID ? cfg::LIQUID_DAMPING
+                          : cfg::DEFAULT_DAMPING;
+}
+
+// ----- Kernels for one type range of partitioned storage -----
+// The type is a template parameter, so every per-particle type test folds
+// away: stone ranges skip forces and integration outright, and the other
+// ranges only keep the (select-based) sleep test.
+
+void addAcceleration(float *__restrict ax, float *__restrict ay,
+                     float x, float y, std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    ax[i] += x;
+    ay[i] += y;
+  }
+}
+
+void scaleVelocity(float *__restrict vx, float *__restrict vy, float d,
+                   std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    vx[i] *= d;
+    vy[i] *= d;
+  }
+}
+
+void integrateVelocityAwake(float *__restrict vx, float *__restrict vy,
+                            const float *__restrict ax,
+                            const float *__restrict ay,
+                            const std::uint16_t *__restrict rest, float dt,
+                            std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; ++i) {
+    const bool active = rest[i] < cfg::SLEEP_SUBSTEPS;
+    vx[i] = active ? vx[i] + ax[i] * dt : vx[i];
+    vy[i] = active ? vy[i] + ay[i] * dt : vy[i];
+  }
+}
+
+float integratePositionAwake(float *__restrict px, float *__restrict py,
+                             const float *__restrict vx,
+                             const float *__restrict vy,
+                             const std::uint16_t *__restrict rest, float dt,
+                             std::size_t begin, std::size_t end) {
+  float maxV2 = 0.0f;
+  for (std::size_t i = begin; i < end; ++i) {
+    const bool active = rest[i] < cfg::SLEEP_SUBSTEPS;
+    px[i] = active ? px[i] + vx[i] * dt : px[i];
+    py[i] = active ? py[i] + vy[i] * dt : py[i];
+    maxV2 = std::max(maxV2, active ? vx[i] * vx[i] + vy[i] * vy[i] : 0.0f);
+  }
+  return maxV2;
+}
+
+template <ParticleType T>
+float integrateFusedAs(float *__restrict px, float *__restrict py,
+                       float *__restrict vxs, float *__restrict vys,
+                       const std::uint16_t *__restrict rest,
+                       float gx, float gy, float wx, float wy, float dt,
+                       std::size_t begin, std::size_t end) {
+  constexpr float d = dampingFor(T);
+  if constexpr (T == TYPE_STONE) {
+    scaleVelocity(vxs, vys, d, begin, end);
+    return 0.0f;
+  }
+  const float ax = gx * gravityScale(T) + wx;
+  const float ay = gy * gravityScale(T) + wy;
+  float maxV2 = 0.0f;
+  for (std::size_t i = begin; i < end; ++i) {
+    const bool active = rest[i] < cfg::SLEEP_SUBSTEPS;
+    float vx = vxs[i], vy = vys[i];
+    vx = (active ? vx + ax * dt : vx) * d;
+    vy = (active ? vy + ay * dt : vy) * d;
+    vxs[i] = vx;
+    vys[i] = vy;
+    px[i] = active ? px[i] + vx * dt : px[i];
+    py[i] = active ? py[i] + vy * dt : py[i];
+    maxV2 = std::max(maxV2, active ? vx * vx + vy * vy : 0.0f);
+  }
+  return maxV2;
+}
+
+} // namespace
+
 void zeroAccelerations(ParticleSystem &p, std::size_t begin, std::size_t end) {
   for (std::size_t i = begin; i < end; ++i) {
     p.accX[i] = 0.0f;
@@ -17,6 +109,16 @@ void applyGravity(ParticleSystem &p, const InputState &in,
   if (!in.gravityEnabled) return;
   const float gx = in.gravity.x;
   const float gy = in.gravity.y;
+  if (p.partitioned) {
+    p.forEachTypeRange(begin, end, [&](auto type, std::size_t b, std::size_t e) {
+      constexpr ParticleType T = decltype(type)::value;
+      if constexpr (T != TYPE_STONE) {
+        addAcceleration(p.accX.data(), p.accY.data(), gx * gravityScale(T),
+                        gy * gravityScale(T), b, e);
+      }
+    });
+    return;
+  }
   for (std::size_t i = begin; i < end; ++i) {
     const auto t = static_cast<ParticleType>(p.type[i]);
     if (t == TYPE_STONE) continue;
@@ -34,6 +136,14 @@ void applyWind(ParticleSystem &p, const InputState &in,
                std::size_t begin, std::size_t end) {
   if (in.wind.x == 0.0f && in.wind.y == 0.0f) return;
   const float wx = in.wind.x, wy = in.wind.y;
+  if (p.partitioned) {
+    p.forEachTypeRange(begin, end, [&](auto type, std::size_t b, std::size_t e) {
+      if constexpr (decltype(type)::value != TYPE_STONE) {
+        addAcceleration(p.accX.data(), p.accY.data(), wx, wy, b, e);
+      }
+    });
+    return;
+  }
   for (std::size_t i = begin; i < end; ++i) {
     if (p.type[i] == TYPE_STONE) continue;
     p.accX[i] += wx;
@@ -41,18 +151,47 @@ void applyWind(ParticleSystem &p, const InputState &in,
   }
 }
 
-void applyMouseField(ParticleSystem &p, const InputState &in,
-                     std::size_t begin, std::size_t end) {
-  if (!in.leftDown) return;
+void applySelfGravity(ParticleSystem &p, const InputState &in,
+                      const BarnesHutTree &tree,
+                      std::size_t begin, std::size_t end) {
+  if (!in.selfGravity) return;
+  tree.accumulate(p, in.openingAngle, cfg::SELF_GRAVITY_G, begin, end);
+}
+
+void applyMeshGravity(ParticleSystem &p, const InputState &in,
+                      const ParticleMesh &mesh,
+                      std::size_t begin, std::size_t end) {
+  if (!in.selfGravity) return;
+  mesh.accumulate(p, cfg::SELF_GRAVITY_G, begin, end);
+}
+
+bool mouseFieldActive(const InputState &in) {
+  if (!in.leftDown) return false;
+  const MouseMode m = in.mode;
+  return m == MouseMode::Attract || m == MouseMode::Repel ||
+         m == MouseMode::Vortex  || m == MouseMode::Drag;
+}
+
+float explosionRadius(const InputState &in) {
+  return std::max(60.0f, in.brushRadius * 2.0f);
+}
+
+namespace {
+
+// Bodies of the mouse field and the explosion for slots [begin,end) of an
+// index list: indexOf(j) is the particle in slot j. Plain ranges pass the
+// identity, region queries their candidates.
+template <class IndexOf>
+void mouseFieldOver(ParticleSystem &p, const InputState &in,
+                    std::size_t begin, std::size_t end, IndexOf indexOf) {
   const MouseMode m = in.mode;
-  if (m != MouseMode::Attract && m != MouseMode::Repel &&
-      m != MouseMode::Vortex  && m != MouseMode::Drag) return;
 
   const float radius = in.brushRadius;
   const float r2     = radius * radius;
   const float mx = in.mousePos.x, my = in.mousePos.y;
 
-  for (std::size_t i = begin; i < end; ++i) {
+  for (std::size_t j = begin; j < end; ++j) {
+    const std::size_t i = indexOf(j);
     if (p.type[i] == TYPE_STONE) continue;
     float dx = p.posX[i] - mx;
     float dy = p.posY[i] - my;
@@ -103,15 +242,16 @@ void applyMouseField(ParticleSystem &p, const InputState &in,
   }
 }
 
-void applyExplosionImpulse(ParticleSystem &p, const InputState &in,
-                           std::size_t begin, std::size_t end) {
-  if (!in.explodePending) return;
+template <class IndexOf>
+void explosionOver(ParticleSystem &p, const InputState &in,
+                   std::size_t begin, std::size_t end, IndexOf indexOf) {
   const float ex = in.explodePosition.x, ey = in.explodePosition.y;
-  const float radius = std::max(60.0f, in.brushRadius * 2.0f);
+  const float radius = explosionRadius(in);
   const float r2 = radius * radius;
   const float strength = cfg::MOUSE_EXPLODE_IMPULSE;
 
-  for (std::size_t i = begin; i < end; ++i) {
+  for (std::size_t j = begin; j < end; ++j) {
+    const std::size_t i = indexOf(j);
     if (p.type[i] == TYPE_STONE) continue;
     float dx = p.posX[i] - ex;
     float dy = p.posY[i] - ey;
@@ -121,22 +261,156 @@ void applyExplosionImpulse(ParticleSystem &p, const InputState &in,
     float falloff = 1.0f - d / radius;
     float invD = 1.0f / d;
     // Impulse: instantaneous velocity change (no dt scaling).
-    p.velX[i] += dx * invD * strength * falloff * p.invMass[i];
-    p.velY[i] += dy * invD * strength * falloff * p.invMass[i];
+    p.velX[i] += dx * invD * strength * falloff * p.invMass(i);
+    p.velY[i] += dy * invD * strength * falloff * p.invMass(i);
   }
 }
 
+inline std::size_t identity(std::size_t k) { return k; }
+
+} // namespace
+
+void applyMouseField(ParticleSystem &p, const InputState &in,
+                     std::size_t begin, std::size_t end) {
+  if (!mouseFieldActive(in)) return;
+  mouseFieldOver(p, in, begin, end, identity);
+}
+
+void applyMouseField(ParticleSystem &p, const InputState &in,
+                     const std::uint32_t *candidates,
+                     std::size_t begin, std::size_t end) {
+  if (!mouseFieldActive(in)) return;
+  mouseFieldOver(p, in, begin, end,
+                 [candidates](std::size_t k) { return candidates[k]; });
+}
+
+void applyExplosionImpulse(ParticleSystem &p, const InputState &in,
+                           std::size_t begin, std::size_t end) {
+  if (!in.explodePending) return;
+  explosionOver(p, in, begin, end, identity);
+}
+
+void applyExplosionImpulse(ParticleSystem &p, const InputState &in,
+                           const std::uint32_t *candidates,
+                           std::size_t begin, std::size_t end) {
+  if (!in.explodePending) return;
+  explosionOver(p, in, begin, end,
+                [candidates](std::size_t k) { return candidates[k]; });
+}
+
 void applyDamping(ParticleSystem &p, std::size_t begin, std::size_t end) {
+  if (p.partitioned) {
+    p.forEachTypeRange(begin, end, [&](auto type, std::size_t b, std::size_t e) {
+      scaleVelocity(p.velX.data(), p.velY.data(),
+                    dampingFor(decltype(type)::value), b, e);
+    });
+    return;
+  }
   for (std::size_t i = begin; i < end; ++i) {
-    float d;
-    switch (static_cast<ParticleType>(p.type[i])) {
-      case TYPE_GAS:    d = cfg::GAS_DAMPING; break;
-      case TYPE_LIQUID: d = cfg::LIQUID_DAMPING; break;
-      default:          d = cfg::DEFAULT_DAMPING; break;
-    }
+    const float d = dampingFor(static_cast<ParticleType>(p.type[i]));
     p.velX[i] *= d;
     p.velY[i] *= d;
   }
 }
 
+void integrateVelocity(ParticleSystem &p, float dt,
+                       std::size_t begin, std::size_t end) {
+  if (p.partitioned) {
+    p.forEachTypeRange(begin, end, [&](auto type, std::size_t b, std::size_t e) {
+      if constexpr (decltype(type)::value != TYPE_STONE) {
+        integrateVelocityAwake(p.velX.data(), p.velY.data(), p.accX.data(),
+                               p.accY.data(), p.restSteps.data(), dt, b, e);
+      }
+    });
+    return;
+  }
+  for (std::size_t i = begin; i < end; ++i) {
+    if (p.type[i] == TYPE_STONE || p.asleep(i)) continue;
+    p.velX[i] += p.accX[i] * dt;
+    p.velY[i] += p.accY[i] * dt;
+  }
+}
+
+float integratePosition(ParticleSystem &p, float dt,
+                        std::size_t begin, std::size_t end) {
+  float maxV2 = 0.0f;
+  if (p.partitioned) {
+    p.forEachTypeRange(begin, end, [&](auto type, std::size_t b, std::size_t e) {
+      if constexpr (decltype(type)::value != TYPE_STONE) {
+        maxV2 = std::max(maxV2, integratePositionAwake(
+                                    p.posX.data(), p.posY.data(), p.velX.data(),
+                                    p.velY.data(), p.restSteps.data(), dt, b, e));
+      }
+    });
+    return maxV2;
+  }
+  for (std::size_t i = begin; i < end; ++i) {
+    if (p.type[i] == TYPE_STONE || p.asleep(i)) continue;
+    p.posX[i] += p.velX[i] * dt;
+    p.posY[i] += p.velY[i] * dt;
+    maxV2 = std::max(maxV2, p.velX[i] * p.velX[i] + p.velY[i] * p.velY[i]);
+  }
+  return maxV2;
+}
+
+bool fusedIntegrationApplies(const InputState &in) {
+  return !mouseFieldActive(in) && !in.explodePending && !in.selfGravity;
+}
+
+namespace {
+
+// Body of integrateFused over raw arrays. As restrict parameters (rather
+// than loads through p's vectors) the loop vectorises under GCC.
+float integrateFusedArrays(float *__restrict px, float *__restrict py,
+                           float *__restrict vxs, float *__restrict vys,
+                           const std::uint8_t *__restrict type,
+                           const std::uint16_t *__restrict rest,
+                           float gx, float gy, float wx, float wy, float dt,
+                           std::size_t begin, std::size_t end) {
+  // Branch-free per particle (selects instead of skips) so the loop
+  // vectorises; the arithmetic order matches the modular path.
+  float maxV2 = 0.0f;
+  for (std::size_t i = begin; i < end; ++i) {
+    const std::uint8_t t = type[i];
+    const bool stone  = t == TYPE_STONE;
+    const bool active = !stone & (rest[i] < cfg::SLEEP_SUBSTEPS);
+    const float g = gravityScale(static_cast<ParticleType>(t));
+    const float d = dampingFor(static_cast<ParticleType>(t));
+    const float ax = stone ? 0.0f : gx * g + wx;
+    const float ay = stone ? 0.0f : gy * g + wy;
+
+    float vx = vxs[i], vy = vys[i];
+    vx = (active ? vx + ax * dt : vx) * d;
+    vy = (active ? vy + ay * dt : vy) * d;
+    vxs[i] = vx;
+    vys[i] = vy;
+    px[i] = active ? px[i] + vx * dt : px[i];
+    py[i] = active ? py[i] + vy * dt : py[i];
+    maxV2 = std::max(maxV2, active ? vx * vx + vy * vy : 0.0f);
+  }
+  return maxV2;
+}
+
+} // namespace
+
+float integrateFused(ParticleSystem &p, const InputState &in, float dt,
+                     std::size_t begin, std::size_t end) {
+  const float gx = in.gravityEnabled ? in.gravity.x : 0.0f;
+  const float gy = in.gravityEnabled ? in.gravity.y : 0.0f;
+  if (p.partitioned) {
+    float maxV2 = 0.0f;
+    p.forEachTypeRange(begin, end, [&](auto type, std::size_t b, std::size_t e) {
+      maxV2 = std::max(maxV2, integrateFusedAs<decltype(type)::value>(
+                                  p.posX.data(), p.posY.data(), p.velX.data(),
+                                  p.velY.data(), p.restSteps.data(), gx, gy,
+                                  in.wind.x, in.wind.y, dt, b, e));
+    });
+    return maxV2;
+  }
+  return integrateFusedArrays(p.posX.data(), p.posY.data(), p.velX.data(),
+                              p.velY.data(), p.type.data(),
+                              p.restSteps.data(), gx, gy, in.wind.x,
+                              in.wind.y, dt, begin, end);
+}
+
 } // namespace forces
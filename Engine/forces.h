@@ -1,10 +1,13 @@
 #ifndef FORCES_H
 #define FORCES_H
 
+#include "barnes_hut.h"
 #include "input_state.h"
 #include "particle.h"
+#include "particle_mesh.h"
 
 #include <cstddef>
+#include <cstdint>
 
 // ---------------------------------------------------------------------------
 // Field forces applied during the force-accumulation phase of the physics
@@ -27,20 +30,72 @@ void applyGravity(ParticleSystem &p, const InputState &in,
 void applyWind(ParticleSystem &p, const InputState &in,
                std::size_t begin, std::size_t end);
 
+// Mutual attraction of all particles (N-body gravity) from a tree built
+// over the current positions, with InputState::openingAngle. Unlike the
+// other forces, [begin,end) are the tree's slots (0..tree.size()), not
+// particle indices; each call still writes only particles no other range
+// touches. Stone neither pulls nor is pulled.
+void applySelfGravity(ParticleSystem &p, const InputState &in,
+                      const BarnesHutTree &tree,
+                      std::size_t begin, std::size_t end);
+
+// Same attraction interpolated from a particle-mesh solve over the current
+// positions, for particles [begin,end).
+void applyMeshGravity(ParticleSystem &p, const InputState &in,
+                      const ParticleMesh &mesh,
+                      std::size_t begin, std::size_t end);
+
+// True while the mouse field below is pushing particles around.
+bool mouseFieldActive(const InputState &in);
+
+// Radius of the pending explosion impulse.
+float explosionRadius(const InputState &in);
+
 // Mouse-driven field: attract / repel / vortex, depending on InputState.mode.
 // Only active while the left button is held (or always for vortex if you
 // want; here it's gated on leftDown).
 void applyMouseField(ParticleSystem &p, const InputState &in,
                      std::size_t begin, std::size_t end);
 
+// Same, for the particles candidates[begin..end) only, e.g. those a region
+// query found near the brush. Each particle may appear at most once.
+void applyMouseField(ParticleSystem &p, const InputState &in,
+                     const std::uint32_t *candidates,
+                     std::size_t begin, std::size_t end);
+
 // One-shot radial impulse, written directly to velocity, then the flag is
 // cleared by the caller. Safe to parallelise across the particle range.
 void applyExplosionImpulse(ParticleSystem &p, const InputState &in,
                            std::size_t begin, std::size_t end);
 
+void applyExplosionImpulse(ParticleSystem &p, const InputState &in,
+                           const std::uint32_t *candidates,
+                           std::size_t begin, std::size_t end);
+
 // Per-type velocity damping (air resistance / liquid viscosity).
 void applyDamping(ParticleSystem &p, std::size_t begin, std::size_t end);
 
+// Explicit Euler steps for awake, non-stone particles: v += a * dt and
+// x += v * dt respectively. integratePosition returns the largest squared
+// speed among the particles it moved (0 if none), for adaptive substeps.
+void integrateVelocity(ParticleSystem &p, float dt,
+                       std::size_t begin, std::size_t end);
+float integratePosition(ParticleSystem &p, float dt,
+                        std::size_t begin, std::size_t end);
+
+// True when the force phase is only gravity, wind and damping (no mouse
+// field, no pending explosion, no self-gravity), so integrateFused() gives the same result
+// as the modular functions above.
+bool fusedIntegrationApplies(const InputState &in);
+
+// Gravity + wind, velocity integration, damping and position integration
+// in a single pass over the range, streaming each particle's fields once.
+// The acceleration is kept in registers, so accX/accY are left untouched;
+// the collision phase only uses them as scratch. Returns the largest
+// squared speed among the particles moved, like integratePosition().
+float integrateFused(ParticleSystem &p, const InputState &in, float dt,
+                     std::size_t begin, std::size_t end);
+
 } // namespace forces
 
 #endif
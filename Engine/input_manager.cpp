@@ -3,6 +3,7 @@
 #include "simulation.h"
 
 #include <algorithm>
+#include <memory>
 
 namespace {
 constexpr float kGravityStep      = 1.5f;
@@ -11,6 +12,7 @@ constexpr float kBrushZoomFactor  = 1.15f;
 constexpr float kBrushMin         = 4.0f;
 constexpr float kBrushMax         = 400.0f;
 constexpr float kTimeScaleStep    = 0.10f;
+constexpr int   kMaxSubstepCeiling = 64;
 
 ParticleType keyToType(SDL_Keycode k) {
   switch (k) {
@@ -29,6 +31,35 @@ MouseMode cycleMode(MouseMode m, int dir) {
   v = ((v % n) + n) % n;
   return static_cast<MouseMode>(v);
 }
+
+Broadphase cycleBroadphase(Broadphase b) {
+  int v = (static_cast<int>(b) + 1) % static_cast<int>(Broadphase::Count);
+  return static_cast<Broadphase>(v);
+}
+
+CollisionSolver cycleSolver(CollisionSolver s) {
+  int v = (static_cast<int>(s) + 1) % static_cast<int>(CollisionSolver::Count);
+  return static_cast<CollisionSolver>(v);
+}
+
+GravitySolver cycleGravitySolver(GravitySolver s) {
+  int v = (static_cast<int>(s) + 1) % static_cast<int>(GravitySolver::Count);
+  return static_cast<GravitySolver>(v);
+}
+
+// Barnes-Hut opening angles offered by J, most accurate first.
+float nextOpeningAngle(float theta) {
+  constexpr float kAngles[] = {0.3f, 0.5f, 0.7f, 1.0f};
+  for (float a : kAngles) {
+    if (a > theta + 1e-3f) return a;
+  }
+  return kAngles[0];
+}
+
+// Particle-mesh grid sizes offered by Y: powers of two up to the maximum.
+int nextMeshSize(int n) {
+  return n >= cfg::PM_MAX_GRID_SIZE ? cfg::PM_MIN_GRID_SIZE : n * 2;
+}
 } // namespace
 
 const char *mouseModeName(MouseMode m) {
@@ -44,6 +75,33 @@ const char *mouseModeName(MouseMode m) {
   }
 }
 
+const char *broadphaseName(Broadphase b) {
+  switch (b) {
+    case Broadphase::UniformGrid: return "uniform grid";
+    case Broadphase::SparseGrid:  return "sparse grid";
+    case Broadphase::MultiLevel:  return "multi-level grid";
+    case Broadphase::VerletList:  return "verlet list";
+    default: return "?";
+  }
+}
+
+const char *collisionSolverName(CollisionSolver s) {
+  switch (s) {
+    case CollisionSolver::OneSided:      return "one-sided";
+    case CollisionSolver::ColouredPairs: return "coloured pairs";
+    case CollisionSolver::GaussSeidel:   return "gauss-seidel";
+    default: return "?";
+  }
+}
+
+const char *gravitySolverName(GravitySolver s) {
+  switch (s) {
+    case GravitySolver::BarnesHut:    return "barnes-hut";
+    case GravitySolver::ParticleMesh: return "particle mesh";
+    default: return "?";
+  }
+}
+
 bool InputManager::handleEvent(const SDL_Event &ev, Simulation &sim,
                                int simWindowId) {
   switch (ev.type) {
@@ -112,6 +170,46 @@ bool InputManager::handleEvent(const SDL_Event &ev, Simulation &sim,
                        state_.gridEnabled = sim.isGridEnabled();
                        return true;
       case SDLK_f:     sim.freezeAll(); return true;
+      case SDLK_n:     state_.broadphase = cycleBroadphase(state_.broadphase);
+                       return true;
+      case SDLK_z:     state_.sleepEnabled = !state_.sleepEnabled; return true;
+      case SDLK_v:     state_.solver = cycleSolver(state_.solver); return true;
+      case SDLK_l:     state_.sphLiquid = !state_.sphLiquid; return true;
+      case SDLK_x:     state_.deterministic = !state_.deterministic; return true;
+      case SDLK_TAB:   sim.togglePipelined();
+                       state_.pipelined = sim.isPipelined();
+                       return true;
+      case SDLK_6: {   // walls -> wrap x -> wrap y -> wrap both -> walls
+        const int next = ((state_.periodicX ? 1 : 0) |
+                          (state_.periodicY ? 2 : 0)) + 1;
+        state_.periodicX = (next & 1) != 0;
+        state_.periodicY = (next & 2) != 0;
+        return true;
+      }
+      case SDLK_7: {   // obstacles off, or the demo level on
+        std::shared_ptr<ObstacleField> field;
+        if (!sim.obstacles()) {
+          field = std::make_shared<ObstacleField>(ObstacleField::demoLevel());
+          field->bake();
+        }
+        sim.setObstacles(std::move(field));
+        return true;
+      }
+      case SDLK_k:     state_.selfGravity = !state_.selfGravity; return true;
+      case SDLK_j:     state_.openingAngle = nextOpeningAngle(state_.openingAngle);
+                       return true;
+      case SDLK_o:     state_.gravitySolver = cycleGravitySolver(state_.gravitySolver);
+                       return true;
+      case SDLK_y:     state_.meshSize = nextMeshSize(state_.meshSize); return true;
+      case SDLK_i:     state_.solverIterations =
+                           state_.solverIterations >= cfg::MAX_SOLVER_ITERATIONS
+                               ? 1 : state_.solverIterations * 2;
+                       return true;
+      case SDLK_t:     state_.fixedTimestep = !state_.fixedTimestep; return true;
+      case SDLK_u:     state_.adaptiveSubsteps = !state_.adaptiveSubsteps;
+                       return true;
+      case SDLK_p:     state_.partitionByType = !state_.partitionByType;
+                       return true;
 
       case SDLK_q: state_.mode = cycleMode(state_.mode, -1); return true;
       case SDLK_e: state_.mode = cycleMode(state_.mode, +1); return true;
@@ -138,6 +236,13 @@ bool InputManager::handleEvent(const SDL_Event &ev, Simulation &sim,
       case SDLK_PAGEDOWN:
         state_.spawnPerTick = std::max(1, state_.spawnPerTick - 1);
         return true;
+
+      case SDLK_COMMA:
+        state_.maxSubsteps = std::max(state_.minSubsteps, state_.maxSubsteps - 1);
+        return true;
+      case SDLK_PERIOD:
+        state_.maxSubsteps = std::min(kMaxSubstepCeiling, state_.maxSubsteps + 1);
+        return true;
       default: break;
     }
     return false;
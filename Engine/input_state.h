@@ -25,11 +25,45 @@ enum class MouseMode : int {
 
 const char *mouseModeName(MouseMode m);
 
+// Collision broadphase used while the grid is enabled.
+enum class Broadphase : int {
+  UniformGrid = 0,   // dense cols*rows grid over the world rect
+  SparseGrid,        // hashed grid storing only occupied cells
+  MultiLevel,        // one grid per power-of-two cell size, for mixed radii
+  VerletList,        // per-particle neighbour lists, rebuilt on the uniform grid
+  Count
+};
+
+const char *broadphaseName(Broadphase b);
+
+// How contacts are evaluated on the uniform grid (the other broadphases
+// always use the one-sided pass).
+enum class CollisionSolver : int {
+  OneSided = 0,    // every particle walks its full neighbourhood
+  ColouredPairs,   // each pair once, 4-colour tile scheduling
+  GaussSeidel,     // same tiles, pairs resolved in place, several sweeps
+  Count
+};
+
+const char *collisionSolverName(CollisionSolver s);
+
+// How self-gravity is computed when it is on.
+enum class GravitySolver : int {
+  BarnesHut = 0,   // quadtree walk, error set by the opening angle
+  ParticleMesh,    // CIC deposit + FFT Poisson solve on a grid
+  Count
+};
+
+const char *gravitySolverName(GravitySolver s);
+
 struct InputState {
   // Simulation control
   bool  paused    = false;
   float timeScale = 1.0f;
-  int   substeps  = cfg::PHYSICS_SUBSTEPS;
+  int   substeps  = cfg::PHYSICS_SUBSTEPS;     // when not adaptive
+  bool  adaptiveSubsteps = false;              // add substeps for fast motion
+  int   minSubsteps = cfg::MIN_SUBSTEPS;       // floor for adaptive mode
+  int   maxSubsteps = cfg::MAX_SUBSTEPS;       // ceiling for adaptive mode
 
   // Mouse
   Vec2      mousePos       {0.0f, 0.0f};
@@ -48,10 +82,26 @@ struct InputState {
   Vec2  gravity            {0.0f, 9.81f};
   bool  gravityEnabled     = true;
   Vec2  wind               {0.0f, 0.0f}; // refreshed each frame from WASD state
+  bool  selfGravity        = false;       // N-body attraction
+  GravitySolver gravitySolver = GravitySolver::BarnesHut;
+  float openingAngle       = cfg::BH_THETA;       // Barnes-Hut
+  int   meshSize           = cfg::PM_GRID_SIZE;   // particle-mesh cells per side
 
   // Engine flags
   bool gridEnabled         = true;
+  Broadphase broadphase    = Broadphase::UniformGrid;
+  CollisionSolver solver   = CollisionSolver::ColouredPairs;
+  int  solverIterations    = cfg::SOLVER_ITERATIONS; // Gauss-Seidel sweeps
   bool multithreadEnabled  = true;
+  int  reorderInterval     = cfg::REORDER_INTERVAL; // substeps; 0 = off
+  bool sleepEnabled        = true;
+  bool fixedTimestep       = true;  // cfg::PHYSICS_RATE steps/s, interpolated
+  bool partitionByType     = false; // contiguous per-type particle ranges
+  bool sphLiquid           = false; // liquid as SPH fluid (uniform grid only)
+  bool deterministic       = false; // seeded resets, thread-count-independent steps
+  bool pipelined           = false; // physics on its own thread (see simulation.h)
+  bool periodicX           = false; // left/right edges wrap around
+  bool periodicY           = false; // top/bottom edges wrap around
 
   // HUD
   bool showHelp            = true;
@@ -0,0 +1,83 @@
+#include "multi_level_grid.h"
+
+#include "particle.h"
+
+#include <algorithm>
+
+MultiLevelGrid::MultiLevelGrid(float width, float height, float baseCellSize,
+                               int levels) {
+  levels_.reserve(static_cast<std::size_t>(std::max(1, levels)));
+  float cell = baseCellSize;
+  for (int l = 0; l < std::max(1, levels); ++l) {
+    levels_.emplace_back(SpatialHash(width, height, cell));
+    cell *= 2.0f;
+  }
+}
+
+void MultiLevelGrid::build(std::vector<std::uint32_t> &indices,
+                           const float *posX,
+                           const float *posY,
+                           const std::uint16_t *material,
+                           const Material *materials,
+                           std::size_t count) {
+  buildImpl(indices, posX, posY, material, materials, count, nullptr, 0);
+}
+
+void MultiLevelGrid::build(std::vector<std::uint32_t> &indices,
+                           const float *posX,
+                           const float *posY,
+                           const std::uint16_t *material,
+                           const Material *materials,
+                           std::size_t count,
+                           ThreadPool &pool,
+                           std::size_t minChunk) {
+  buildImpl(indices, posX, posY, material, materials, count, &pool, minChunk);
+}
+
+void MultiLevelGrid::buildImpl(std::vector<std::uint32_t> &indices,
+                               const float *posX,
+                               const float *posY,
+                               const std::uint16_t *material,
+                               const Material *materials,
+                               std::size_t count,
+                               ThreadPool *pool,
+                               std::size_t minChunk) {
+  // 1. Bin particles into levels, keeping index order within each level.
+  for (Level &lv : levels_) {
+    lv.members.clear();
+    lv.maxRadius = 0.0f;
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    const float radius = materials[material[i]].radius;
+    Level &lv = levels_[levelOf(radius)];
+    lv.members.push_back(static_cast<std::uint32_t>(i));
+    lv.maxRadius = std::max(lv.maxRadius, radius);
+  }
+
+  if (indices.size() < count) indices.resize(count);
+
+  // 2. Counting-sort each level over its own members, then translate the
+  //    level-local order back to particle indices.
+  std::uint32_t offset = 0;
+  for (Level &lv : levels_) {
+    lv.offset = offset;
+    const std::size_t n = lv.members.size();
+    if (n == 0) continue;
+
+    lv.posX.resize(n);
+    lv.posY.resize(n);
+    for (std::size_t k = 0; k < n; ++k) {
+      lv.posX[k] = posX[lv.members[k]];
+      lv.posY[k] = posY[lv.members[k]];
+    }
+    if (pool) {
+      lv.grid.build(lv.local, lv.posX.data(), lv.posY.data(), n, *pool, minChunk);
+    } else {
+      lv.grid.build(lv.local, lv.posX.data(), lv.posY.data(), n);
+    }
+    for (std::size_t k = 0; k < n; ++k) {
+      indices[offset + k] = lv.members[lv.local[k]];
+    }
+    offset += static_cast<std::uint32_t>(n);
+  }
+}
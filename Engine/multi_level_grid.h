@@ -0,0 +1,94 @@
+#ifndef MULTI_LEVEL_GRID_H
+#define MULTI_LEVEL_GRID_H
+
+#include "spatial_hash.h"
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+struct Material;
+
+// ---------------------------------------------------------------------------
+// Hierarchical broadphase for mixed particle radii.
+//
+// Level l is a uniform grid with cell size baseCellSize * 2^l. Each particle
+// is binned into the finest level whose cells are at least its diameter, so
+// small particles keep small cells and one large particle no longer forces
+// a coarse cell size on everyone. The last level takes whatever is left.
+//
+// Each level is built as its own counting sort over its members, and the
+// per-level sorted index lists are concatenated (level 0 first) into one
+// sortedIndices buffer. A level's cell (start, count) is relative to that
+// level, so the global slot of a cell is levelOffset(l) + cell.start.
+//
+// A query for a particle of radius r walks every non-empty level with a
+// cell window wide enough for r plus that level's largest radius: a small
+// particle looks at about 3x3 cells on every level, a large one sweeps a
+// wider window on the finer levels. Both sides of a pair see each other, so
+// the one-sided collision rule still holds.
+// ---------------------------------------------------------------------------
+
+class MultiLevelGrid {
+public:
+  using Cell = SpatialHash::Cell;
+
+  MultiLevelGrid(float width, float height, float baseCellSize, int levels);
+
+  // Level a particle of the given radius is binned into.
+  int levelOf(float radius) const {
+    int l = 0;
+    while (l + 1 < levels() && 2.0f * radius > levels_[l].grid.cellSize()) ++l;
+    return l;
+  }
+
+  // Radii come from the particles' material table entries.
+  void build(std::vector<std::uint32_t> &indices,
+             const float *posX,
+             const float *posY,
+             const std::uint16_t *material,
+             const Material *materials,
+             std::size_t count);
+
+  // Same result, with each level's counting sort run on the pool.
+  void build(std::vector<std::uint32_t> &indices,
+             const float *posX,
+             const float *posY,
+             const std::uint16_t *material,
+             const Material *materials,
+             std::size_t count,
+             ThreadPool &pool,
+             std::size_t minChunk);
+
+  int levels() const { return static_cast<int>(levels_.size()); }
+
+  const SpatialHash &grid(int l)        const { return levels_[l].grid; }
+  std::uint32_t      levelOffset(int l) const { return levels_[l].offset; }
+  std::size_t        levelCount(int l)  const { return levels_[l].members.size(); }
+  float              levelMaxRadius(int l) const { return levels_[l].maxRadius; }
+
+private:
+  struct Level {
+    SpatialHash grid;
+    std::vector<std::uint32_t> members;   // particle indices on this level
+    std::vector<float>         posX, posY; // members' positions, packed
+    std::vector<std::uint32_t> local;     // level-local sorted order
+    std::uint32_t offset    = 0;
+    float         maxRadius = 0.0f;
+
+    explicit Level(const SpatialHash &g) : grid(g) {}
+  };
+
+  std::vector<Level> levels_;
+
+  void buildImpl(std::vector<std::uint32_t> &indices,
+                 const float *posX,
+                 const float *posY,
+                 const std::uint16_t *material,
+                 const Material *materials,
+                 std::size_t count,
+                 ThreadPool *pool,
+                 std::size_t minChunk);
+};
+
+#endif
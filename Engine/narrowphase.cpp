@@ -0,0 +1,1231 @@
+#include "narrowphase.h"
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NARROWPHASE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define NARROWPHASE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace narrowphase {
+
+void SortedParticles::resize(std::size_t n) {
+  // Padding slots stay zeroed; kernels mask lanes past a span's end, so
+  // their contents never reach a result.
+  const std::size_t padded = n + kMaxLanes;
+  if (posX.size() < padded) {
+    posX.resize(padded);    posY.resize(padded);
+    velX.resize(padded);    velY.resize(padded);
+    radius.resize(padded);  invMass.resize(padded);
+    type.resize(padded);    id.resize(padded);
+    asleep.resize(padded);
+  }
+  count = n;
+}
+
+void SortedParticles::gather(const ParticleSystem &p,
+                             const std::uint32_t *order,
+                             std::size_t begin, std::size_t end) {
+  for (std::size_t k = begin; k < end; ++k) {
+    const std::uint32_t j = order[k];
+    posX[k] = p.posX[j];  posY[k] = p.posY[j];
+    velX[k] = p.velX[j];  velY[k] = p.velY[j];
+    radius[k]  = p.radius(j);
+    invMass[k] = p.invMass(j);
+    type[k]    = p.type[j];
+    id[k]      = j;
+    asleep[k]  = p.asleep(j) ? 1 : 0;
+  }
+}
+
+void SortedParticles::refresh(const ParticleSystem &p,
+                              const std::uint32_t *order,
+                              std::size_t begin, std::size_t end) {
+  for (std::size_t k = begin; k < end; ++k) {
+    const std::uint32_t j = order[k];
+    posX[k] = p.posX[j];  posY[k] = p.posY[j];
+    velX[k] = p.velX[j];  velY[k] = p.velY[j];
+    asleep[k] = p.asleep(j) ? 1 : 0;
+  }
+}
+
+void ContactAccum::resize(std::size_t n) {
+  if (pushX.size() < n) {
+    pushX.resize(n); pushY.resize(n);
+    dvX.resize(n);   dvY.resize(n);
+  }
+}
+
+void ContactAccum::zero(std::size_t begin, std::size_t end) {
+  std::fill(pushX.begin() + begin, pushX.begin() + end, 0.0f);
+  std::fill(pushY.begin() + begin, pushY.begin() + end, 0.0f);
+  std::fill(dvX.begin() + begin, dvX.begin() + end, 0.0f);
+  std::fill(dvY.begin() + begin, dvY.begin() + end, 0.0f);
+}
+
+namespace {
+
+// Shared per-particle constants for one kernel call.
+struct SelfState {
+  float px, py, vx, vy, r, w;
+  bool  liquid, sand;
+
+  SelfState(const ParticleSystem &p, std::uint32_t i)
+      : px(p.posX[i]), py(p.posY[i]), vx(p.velX[i]), vy(p.velY[i]),
+        r(p.radius(i)), w(p.invMass(i)),
+        liquid(p.type[i] == TYPE_LIQUID), sand(p.type[i] == TYPE_SAND) {}
+
+  // Same, read from slot i of the snapshot (pair kernels).
+  SelfState(const SortedParticles &c, std::uint32_t i)
+      : px(c.posX[i]), py(c.posY[i]), vx(c.velX[i]), vy(c.velY[i]),
+        r(c.radius[i]), w(c.invMass[i]),
+        liquid(c.type[i] == TYPE_LIQUID), sand(c.type[i] == TYPE_SAND) {}
+};
+
+// Reference kernel. Every SIMD kernel below mirrors this arithmetic lane
+// by lane; keep them in sync when the contact model changes.
+void scalarKernel(const SortedParticles &c, const ParticleSystem &p,
+                  std::uint32_t i, const Span *spans, int numSpans,
+                  PairSums &out) {
+  const float bias = cfg::POSITION_BIAS;
+  const float e    = cfg::COLLISION_RESTITUTION;
+  const float mu   = cfg::COLLISION_FRICTION;
+  const SelfState s(p, i);
+
+  float pushX = 0.0f, pushY = 0.0f;
+  float dvX   = 0.0f, dvY   = 0.0f;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    // Measuring from i moved back by the span's shift is measuring to the
+    // shifted (ghost) images of its slots.
+    const float px = s.px - spans[sp].shiftX;
+    const float py = s.py - spans[sp].shiftY;
+    for (std::uint32_t k = spans[sp].begin; k < spans[sp].end; ++k) {
+      if (c.id[k] == i) continue;
+
+      float rx = c.posX[k] - px;
+      float ry = c.posY[k] - py;
+      float dist2 = rx * rx + ry * ry;
+      float rSum  = s.r + c.radius[k];
+      float rSum2 = rSum * rSum;
+      if (dist2 >= rSum2 || dist2 < 1e-6f) continue;
+
+      float dist = std::sqrt(dist2);
+      float invDist = 1.0f / dist;
+      float nx = rx * invDist;   // points i -> j
+      float ny = ry * invDist;
+      float overlap = rSum - dist;
+
+      // Mass-weighted partition: lighter particle (larger invMass)
+      // gets pushed more. If both are kinematic (stones), skip.
+      float wj = c.invMass[k];
+      float wSum = s.w + wj;
+      if (wSum <= 0.0f) continue;
+
+      float share = bias * (s.w / wSum);
+
+      // Liquid cohesion: don't push as hard, lets droplets coalesce.
+      float pushScale = 1.0f;
+      if (s.liquid && c.type[k] == TYPE_LIQUID) {
+        pushScale = cfg::LIQUID_COHESION;
+      }
+
+      pushX -= nx * overlap * share * pushScale;
+      pushY -= ny * overlap * share * pushScale;
+
+      // Velocity exchange along normal.
+      float vRelX = c.velX[k] - s.vx;
+      float vRelY = c.velY[k] - s.vy;
+      float vN    = vRelX * nx + vRelY * ny;
+      if (vN > 0.0f) {
+        // j moving away from i along the normal: particles separating —
+        // no impulse needed.
+        continue;
+      }
+      // Impulse magnitude such that the relative normal velocity flips
+      // sign and scales by restitution.
+      float jImp = (1.0f + e) * vN / wSum;
+      dvX += nx * jImp * s.w;
+      dvY += ny * jImp * s.w;
+
+      // Tangential friction (Coulomb cone).
+      float tx = -ny, ty = nx;
+      float vT = vRelX * tx + vRelY * ty;
+      float frictionScale = mu;
+      if (s.sand || c.type[k] == TYPE_SAND) {
+        frictionScale = cfg::SAND_FRICTION_COEF;
+      }
+      float fImp = vT * frictionScale / wSum;
+      dvX += tx * fImp * s.w;
+      dvY += ty * fImp * s.w;
+    }
+  }
+
+  out.pushX += pushX; out.pushY += pushY;
+  out.dvX   += dvX;   out.dvY   += dvY;
+}
+
+// Symmetric reference kernel. For a pair with normal n (i -> j) the
+// one-sided kernel gives i a push of -n * P * w_i and j a push of
+// +n * P * w_j, with P = overlap * bias * cohesion / wSum; the velocity
+// impulse J is likewise shared as +J * w_i and -J * w_j. Both shares are
+// computed here from one evaluation.
+void scalarPairKernel(const SortedParticles &c, std::uint32_t i,
+                      const Span *spans, int numSpans, ContactAccum &acc) {
+  const float bias = cfg::POSITION_BIAS;
+  const float e    = cfg::COLLISION_RESTITUTION;
+  const float mu   = cfg::COLLISION_FRICTION;
+  const SelfState s(c, i);
+  const bool asleep = c.asleep[i] != 0;
+
+  float pushX = 0.0f, pushY = 0.0f;
+  float dvX   = 0.0f, dvY   = 0.0f;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    for (std::uint32_t k = spans[sp].begin; k < spans[sp].end; ++k) {
+      if (asleep && c.asleep[k]) continue;
+
+      float rx = c.posX[k] - s.px;
+      float ry = c.posY[k] - s.py;
+      float dist2 = rx * rx + ry * ry;
+      float rSum  = s.r + c.radius[k];
+      if (dist2 >= rSum * rSum || dist2 < 1e-6f) continue;
+
+      float wj = c.invMass[k];
+      float wSum = s.w + wj;
+      if (wSum <= 0.0f) continue;
+      float invW = 1.0f / wSum;
+
+      float dist = std::sqrt(dist2);
+      float invDist = 1.0f / dist;
+      float nx = rx * invDist;   // points i -> j
+      float ny = ry * invDist;
+      float overlap = rSum - dist;
+
+      float pushScale = 1.0f;
+      if (s.liquid && c.type[k] == TYPE_LIQUID) {
+        pushScale = cfg::LIQUID_COHESION;
+      }
+      float push = overlap * bias * pushScale * invW;
+      pushX -= nx * push * s.w;
+      pushY -= ny * push * s.w;
+      acc.pushX[k] += nx * push * wj;
+      acc.pushY[k] += ny * push * wj;
+
+      float vRelX = c.velX[k] - s.vx;
+      float vRelY = c.velY[k] - s.vy;
+      float vN    = vRelX * nx + vRelY * ny;
+      if (vN > 0.0f) continue;   // separating
+
+      float tx = -ny, ty = nx;
+      float vT = vRelX * tx + vRelY * ty;
+      float frictionScale = mu;
+      if (s.sand || c.type[k] == TYPE_SAND) {
+        frictionScale = cfg::SAND_FRICTION_COEF;
+      }
+      float jImp = (1.0f + e) * vN * invW;
+      float fImp = vT * frictionScale * invW;
+      float jx = nx * jImp + tx * fImp;
+      float jy = ny * jImp + ty * fImp;
+      dvX += jx * s.w;
+      dvY += jy * s.w;
+      acc.dvX[k] -= jx * wj;
+      acc.dvY[k] -= jy * wj;
+    }
+  }
+
+  acc.pushX[i] += pushX; acc.pushY[i] += pushY;
+  acc.dvX[i]   += dvX;   acc.dvY[i]   += dvY;
+}
+
+// One-sided reference kernel over an explicit slot list; same arithmetic
+// as scalarKernel.
+void scalarListKernel(const SortedParticles &c, const ParticleSystem &p,
+                      std::uint32_t i, const std::uint32_t *slots,
+                      std::uint32_t n, PairSums &out) {
+  const float bias = cfg::POSITION_BIAS;
+  const float e    = cfg::COLLISION_RESTITUTION;
+  const float mu   = cfg::COLLISION_FRICTION;
+  const SelfState s(p, i);
+
+  float pushX = 0.0f, pushY = 0.0f;
+  float dvX   = 0.0f, dvY   = 0.0f;
+
+  for (std::uint32_t m = 0; m < n; ++m) {
+    const std::uint32_t k = slots[m];
+    float rx = c.posX[k] - s.px;
+    float ry = c.posY[k] - s.py;
+    float dist2 = rx * rx + ry * ry;
+    float rSum  = s.r + c.radius[k];
+    if (dist2 >= rSum * rSum || dist2 < 1e-6f) continue;
+
+    float wSum = s.w + c.invMass[k];
+    if (wSum <= 0.0f) continue;
+
+    float dist = std::sqrt(dist2);
+    float invDist = 1.0f / dist;
+    float nx = rx * invDist;
+    float ny = ry * invDist;
+    float overlap = rSum - dist;
+
+    float share = bias * (s.w / wSum);
+    float pushScale = 1.0f;
+    if (s.liquid && c.type[k] == TYPE_LIQUID) {
+      pushScale = cfg::LIQUID_COHESION;
+    }
+    pushX -= nx * overlap * share * pushScale;
+    pushY -= ny * overlap * share * pushScale;
+
+    float vRelX = c.velX[k] - s.vx;
+    float vRelY = c.velY[k] - s.vy;
+    float vN    = vRelX * nx + vRelY * ny;
+    if (vN > 0.0f) continue;   // separating
+
+    float jImp = (1.0f + e) * vN / wSum;
+    dvX += nx * jImp * s.w;
+    dvY += ny * jImp * s.w;
+
+    float tx = -ny, ty = nx;
+    float vT = vRelX * tx + vRelY * ty;
+    float frictionScale = mu;
+    if (s.sand || c.type[k] == TYPE_SAND) {
+      frictionScale = cfg::SAND_FRICTION_COEF;
+    }
+    float fImp = vT * frictionScale / wSum;
+    dvX += tx * fImp * s.w;
+    dvY += ty * fImp * s.w;
+  }
+
+  out.pushX += pushX; out.pushY += pushY;
+  out.dvX   += dvX;   out.dvY   += dvY;
+}
+
+// Add the first n (< lane count) values of a spilled vector to dst[k..]
+// (SSE2 and NEON have no masked store).
+// Lanes past a span's end belong to cells another thread may own, so a
+// partial batch is never written back as a whole vector.
+inline void addTail(float *dst, std::uint32_t k, std::uint32_t n,
+                    const float *lanes) {
+  for (std::uint32_t l = 0; l < n; ++l) dst[k + l] += lanes[l];
+}
+
+#if defined(__SSE2__)
+
+inline __m128 sseSelect(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline float sseSum(__m128 v) {
+  __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+  __m128 sums = _mm_add_ps(v, shuf);
+  shuf = _mm_movehl_ps(shuf, sums);
+  sums = _mm_add_ss(sums, shuf);
+  return _mm_cvtss_f32(sums);
+}
+
+// Four type bytes widened to 32-bit lanes.
+inline __m128i sseLoadTypes(const std::uint8_t *t) {
+  std::int32_t packed;
+  std::memcpy(&packed, t, sizeof(packed));
+  const __m128i z = _mm_setzero_si128();
+  return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), z), z);
+}
+
+void sse2Kernel(const SortedParticles &c, const ParticleSystem &p,
+                std::uint32_t i, const Span *spans, int numSpans,
+                PairSums &out) {
+  const SelfState s(p, i);
+  const __m128 one   = _mm_set1_ps(1.0f);
+  const __m128 zero  = _mm_setzero_ps();
+  const __m128 eps   = _mm_set1_ps(1e-6f);
+  const __m128 bias  = _mm_set1_ps(cfg::POSITION_BIAS);
+  const __m128 rest  = _mm_set1_ps(1.0f + cfg::COLLISION_RESTITUTION);
+  const __m128 mu    = _mm_set1_ps(cfg::COLLISION_FRICTION);
+  const __m128 muS   = _mm_set1_ps(cfg::SAND_FRICTION_COEF);
+  const __m128 coh   = _mm_set1_ps(cfg::LIQUID_COHESION);
+  const __m128 vxi = _mm_set1_ps(s.vx), vyi = _mm_set1_ps(s.vy);
+  const __m128 ri  = _mm_set1_ps(s.r),  wi  = _mm_set1_ps(s.w);
+  const __m128i self   = _mm_set1_epi32(static_cast<int>(i));
+  const __m128i lane   = _mm_set_epi32(3, 2, 1, 0);
+  const __m128i liquid = _mm_set1_epi32(TYPE_LIQUID);
+  const __m128i sand   = _mm_set1_epi32(TYPE_SAND);
+
+  __m128 pushX = zero, pushY = zero, dvX = zero, dvY = zero;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    const std::uint32_t end = spans[sp].end;
+    const __m128 pxi = _mm_set1_ps(s.px - spans[sp].shiftX);
+    const __m128 pyi = _mm_set1_ps(s.py - spans[sp].shiftY);
+    for (std::uint32_t k = spans[sp].begin; k < end; k += 4) {
+      const __m128i live = _mm_cmplt_epi32(lane, _mm_set1_epi32(static_cast<int>(end - k)));
+      const __m128i ids  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&c.id[k]));
+
+      const __m128 rx = _mm_sub_ps(_mm_loadu_ps(&c.posX[k]), pxi);
+      const __m128 ry = _mm_sub_ps(_mm_loadu_ps(&c.posY[k]), pyi);
+      const __m128 dist2 = _mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry));
+      const __m128 rSum  = _mm_add_ps(ri, _mm_loadu_ps(&c.radius[k]));
+      const __m128 wSum  = _mm_add_ps(wi, _mm_loadu_ps(&c.invMass[k]));
+
+      __m128 contact = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ids, self)),
+                                     _mm_castsi128_ps(live));
+      contact = _mm_and_ps(contact, _mm_cmplt_ps(dist2, _mm_mul_ps(rSum, rSum)));
+      contact = _mm_and_ps(contact, _mm_cmpge_ps(dist2, eps));
+      contact = _mm_and_ps(contact, _mm_cmpgt_ps(wSum, zero));
+      if (_mm_movemask_ps(contact) == 0) continue;
+
+      // Masked-off lanes get harmless denominators so nothing turns into NaN.
+      const __m128 dist    = _mm_sqrt_ps(sseSelect(contact, dist2, one));
+      const __m128 invDist = _mm_div_ps(one, dist);
+      const __m128 invW    = _mm_div_ps(one, sseSelect(contact, wSum, one));
+      const __m128 nx = _mm_mul_ps(rx, invDist);
+      const __m128 ny = _mm_mul_ps(ry, invDist);
+      const __m128 overlap = _mm_sub_ps(rSum, dist);
+      const __m128i types = sseLoadTypes(&c.type[k]);
+
+      __m128 push = _mm_mul_ps(_mm_mul_ps(overlap, bias), _mm_mul_ps(wi, invW));
+      if (s.liquid) {
+        const __m128 liq = _mm_castsi128_ps(_mm_cmpeq_epi32(types, liquid));
+        push = _mm_mul_ps(push, sseSelect(liq, coh, one));
+      }
+      push  = _mm_and_ps(push, contact);
+      pushX = _mm_sub_ps(pushX, _mm_mul_ps(nx, push));
+      pushY = _mm_sub_ps(pushY, _mm_mul_ps(ny, push));
+
+      const __m128 vRelX = _mm_sub_ps(_mm_loadu_ps(&c.velX[k]), vxi);
+      const __m128 vRelY = _mm_sub_ps(_mm_loadu_ps(&c.velY[k]), vyi);
+      const __m128 vN = _mm_add_ps(_mm_mul_ps(vRelX, nx), _mm_mul_ps(vRelY, ny));
+      const __m128 approaching = _mm_and_ps(contact, _mm_cmple_ps(vN, zero));
+
+      __m128 fric = muS;
+      if (!s.sand) {
+        const __m128 sd = _mm_castsi128_ps(_mm_cmpeq_epi32(types, sand));
+        fric = sseSelect(sd, muS, mu);
+      }
+      // Tangent is (-ny, nx).
+      const __m128 vT   = _mm_sub_ps(_mm_mul_ps(vRelY, nx), _mm_mul_ps(vRelX, ny));
+      const __m128 jImp = _mm_mul_ps(_mm_mul_ps(rest, vN), invW);
+      const __m128 fImp = _mm_mul_ps(_mm_mul_ps(vT, fric), invW);
+      const __m128 dx = _mm_sub_ps(_mm_mul_ps(nx, jImp), _mm_mul_ps(ny, fImp));
+      const __m128 dy = _mm_add_ps(_mm_mul_ps(ny, jImp), _mm_mul_ps(nx, fImp));
+      dvX = _mm_add_ps(dvX, _mm_and_ps(_mm_mul_ps(dx, wi), approaching));
+      dvY = _mm_add_ps(dvY, _mm_and_ps(_mm_mul_ps(dy, wi), approaching));
+    }
+  }
+
+  out.pushX += sseSum(pushX); out.pushY += sseSum(pushY);
+  out.dvX   += sseSum(dvX);   out.dvY   += sseSum(dvY);
+}
+
+inline void sseAddTo(float *dst, std::uint32_t k, std::uint32_t n, __m128 v) {
+  if (n >= 4) {
+    _mm_storeu_ps(dst + k, _mm_add_ps(_mm_loadu_ps(dst + k), v));
+  } else {
+    alignas(16) float t[4];
+    _mm_storeu_ps(t, v);
+    addTail(dst, k, n, t);
+  }
+}
+
+void sse2PairKernel(const SortedParticles &c, std::uint32_t i,
+                    const Span *spans, int numSpans, ContactAccum &acc) {
+  const SelfState s(c, i);
+  const bool asleep = c.asleep[i] != 0;
+  const __m128 one   = _mm_set1_ps(1.0f);
+  const __m128 zero  = _mm_setzero_ps();
+  const __m128 eps   = _mm_set1_ps(1e-6f);
+  const __m128 bias  = _mm_set1_ps(cfg::POSITION_BIAS);
+  const __m128 rest  = _mm_set1_ps(1.0f + cfg::COLLISION_RESTITUTION);
+  const __m128 mu    = _mm_set1_ps(cfg::COLLISION_FRICTION);
+  const __m128 muS   = _mm_set1_ps(cfg::SAND_FRICTION_COEF);
+  const __m128 coh   = _mm_set1_ps(cfg::LIQUID_COHESION);
+  const __m128 pxi = _mm_set1_ps(s.px), pyi = _mm_set1_ps(s.py);
+  const __m128 vxi = _mm_set1_ps(s.vx), vyi = _mm_set1_ps(s.vy);
+  const __m128 ri  = _mm_set1_ps(s.r),  wi  = _mm_set1_ps(s.w);
+  const __m128i lane   = _mm_set_epi32(3, 2, 1, 0);
+  const __m128i liquid = _mm_set1_epi32(TYPE_LIQUID);
+  const __m128i sand   = _mm_set1_epi32(TYPE_SAND);
+  const __m128i zeroI  = _mm_setzero_si128();
+
+  __m128 pushX = zero, pushY = zero, dvX = zero, dvY = zero;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    const std::uint32_t end = spans[sp].end;
+    for (std::uint32_t k = spans[sp].begin; k < end; k += 4) {
+      const __m128i live = _mm_cmplt_epi32(lane, _mm_set1_epi32(static_cast<int>(end - k)));
+
+      const __m128 rx = _mm_sub_ps(_mm_loadu_ps(&c.posX[k]), pxi);
+      const __m128 ry = _mm_sub_ps(_mm_loadu_ps(&c.posY[k]), pyi);
+      const __m128 dist2 = _mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry));
+      const __m128 rSum  = _mm_add_ps(ri, _mm_loadu_ps(&c.radius[k]));
+      const __m128 wj    = _mm_loadu_ps(&c.invMass[k]);
+      const __m128 wSum  = _mm_add_ps(wi, wj);
+
+      __m128 contact = _mm_castsi128_ps(live);
+      if (asleep) {
+        const __m128i slept = sseLoadTypes(&c.asleep[k]);
+        contact = _mm_and_ps(contact, _mm_castsi128_ps(_mm_cmpeq_epi32(slept, zeroI)));
+      }
+      contact = _mm_and_ps(contact, _mm_cmplt_ps(dist2, _mm_mul_ps(rSum, rSum)));
+      contact = _mm_and_ps(contact, _mm_cmpge_ps(dist2, eps));
+      contact = _mm_and_ps(contact, _mm_cmpgt_ps(wSum, zero));
+      if (_mm_movemask_ps(contact) == 0) continue;
+
+      const __m128 dist    = _mm_sqrt_ps(sseSelect(contact, dist2, one));
+      const __m128 invDist = _mm_div_ps(one, dist);
+      const __m128 invW    = _mm_div_ps(one, sseSelect(contact, wSum, one));
+      const __m128 nx = _mm_mul_ps(rx, invDist);
+      const __m128 ny = _mm_mul_ps(ry, invDist);
+      const __m128 overlap = _mm_sub_ps(rSum, dist);
+      const __m128i types = sseLoadTypes(&c.type[k]);
+
+      __m128 push = _mm_mul_ps(_mm_mul_ps(overlap, bias), invW);
+      if (s.liquid) {
+        const __m128 liq = _mm_castsi128_ps(_mm_cmpeq_epi32(types, liquid));
+        push = _mm_mul_ps(push, sseSelect(liq, coh, one));
+      }
+      push = _mm_and_ps(push, contact);
+      const __m128 pnx = _mm_mul_ps(nx, push), pny = _mm_mul_ps(ny, push);
+      pushX = _mm_sub_ps(pushX, _mm_mul_ps(pnx, wi));
+      pushY = _mm_sub_ps(pushY, _mm_mul_ps(pny, wi));
+
+      const __m128 vRelX = _mm_sub_ps(_mm_loadu_ps(&c.velX[k]), vxi);
+      const __m128 vRelY = _mm_sub_ps(_mm_loadu_ps(&c.velY[k]), vyi);
+      const __m128 vN = _mm_add_ps(_mm_mul_ps(vRelX, nx), _mm_mul_ps(vRelY, ny));
+      const __m128 approaching = _mm_and_ps(contact, _mm_cmple_ps(vN, zero));
+
+      __m128 fric = muS;
+      if (!s.sand) {
+        const __m128 sd = _mm_castsi128_ps(_mm_cmpeq_epi32(types, sand));
+        fric = sseSelect(sd, muS, mu);
+      }
+      const __m128 vT   = _mm_sub_ps(_mm_mul_ps(vRelY, nx), _mm_mul_ps(vRelX, ny));
+      const __m128 jImp = _mm_mul_ps(_mm_mul_ps(rest, vN), invW);
+      const __m128 fImp = _mm_mul_ps(_mm_mul_ps(vT, fric), invW);
+      const __m128 jx = _mm_and_ps(_mm_sub_ps(_mm_mul_ps(nx, jImp), _mm_mul_ps(ny, fImp)), approaching);
+      const __m128 jy = _mm_and_ps(_mm_add_ps(_mm_mul_ps(ny, jImp), _mm_mul_ps(nx, fImp)), approaching);
+      dvX = _mm_add_ps(dvX, _mm_mul_ps(jx, wi));
+      dvY = _mm_add_ps(dvY, _mm_mul_ps(jy, wi));
+
+      const std::uint32_t n = end - k;
+      sseAddTo(acc.pushX.data(), k, n, _mm_mul_ps(pnx, wj));
+      sseAddTo(acc.pushY.data(), k, n, _mm_mul_ps(pny, wj));
+      sseAddTo(acc.dvX.data(), k, n, _mm_sub_ps(zero, _mm_mul_ps(jx, wj)));
+      sseAddTo(acc.dvY.data(), k, n, _mm_sub_ps(zero, _mm_mul_ps(jy, wj)));
+    }
+  }
+
+  acc.pushX[i] += sseSum(pushX); acc.pushY[i] += sseSum(pushY);
+  acc.dvX[i]   += sseSum(dvX);   acc.dvY[i]   += sseSum(dvY);
+}
+
+#endif // __SSE2__
+
+#if defined(NARROWPHASE_X86)
+
+__attribute__((target("avx2")))
+inline float avxSum(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_add_ps(lo, hi);
+  __m128 shuf = _mm_movehdup_ps(lo);
+  __m128 sums = _mm_add_ps(lo, shuf);
+  shuf = _mm_movehl_ps(shuf, sums);
+  sums = _mm_add_ss(sums, shuf);
+  return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2")))
+void avx2Kernel(const SortedParticles &c, const ParticleSystem &p,
+                std::uint32_t i, const Span *spans, int numSpans,
+                PairSums &out) {
+  const SelfState s(p, i);
+  const __m256 one   = _mm256_set1_ps(1.0f);
+  const __m256 zero  = _mm256_setzero_ps();
+  const __m256 eps   = _mm256_set1_ps(1e-6f);
+  const __m256 bias  = _mm256_set1_ps(cfg::POSITION_BIAS);
+  const __m256 rest  = _mm256_set1_ps(1.0f + cfg::COLLISION_RESTITUTION);
+  const __m256 mu    = _mm256_set1_ps(cfg::COLLISION_FRICTION);
+  const __m256 muS   = _mm256_set1_ps(cfg::SAND_FRICTION_COEF);
+  const __m256 coh   = _mm256_set1_ps(cfg::LIQUID_COHESION);
+  const __m256 vxi = _mm256_set1_ps(s.vx), vyi = _mm256_set1_ps(s.vy);
+  const __m256 ri  = _mm256_set1_ps(s.r),  wi  = _mm256_set1_ps(s.w);
+  const __m256i self   = _mm256_set1_epi32(static_cast<int>(i));
+  const __m256i lane   = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i liquid = _mm256_set1_epi32(TYPE_LIQUID);
+  const __m256i sand   = _mm256_set1_epi32(TYPE_SAND);
+
+  __m256 pushX = zero, pushY = zero, dvX = zero, dvY = zero;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    const std::uint32_t end = spans[sp].end;
+    const __m256 pxi = _mm256_set1_ps(s.px - spans[sp].shiftX);
+    const __m256 pyi = _mm256_set1_ps(s.py - spans[sp].shiftY);
+    for (std::uint32_t k = spans[sp].begin; k < end; k += 8) {
+      const __m256i live = _mm256_cmpgt_epi32(
+          _mm256_set1_epi32(static_cast<int>(end - k)), lane);
+      const __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&c.id[k]));
+
+      const __m256 rx = _mm256_sub_ps(_mm256_loadu_ps(&c.posX[k]), pxi);
+      const __m256 ry = _mm256_sub_ps(_mm256_loadu_ps(&c.posY[k]), pyi);
+      const __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry));
+      const __m256 rSum  = _mm256_add_ps(ri, _mm256_loadu_ps(&c.radius[k]));
+      const __m256 wSum  = _mm256_add_ps(wi, _mm256_loadu_ps(&c.invMass[k]));
+
+      __m256 contact = _mm256_andnot_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(ids, self)),
+          _mm256_castsi256_ps(live));
+      contact = _mm256_and_ps(contact,
+                              _mm256_cmp_ps(dist2, _mm256_mul_ps(rSum, rSum), _CMP_LT_OQ));
+      contact = _mm256_and_ps(contact, _mm256_cmp_ps(dist2, eps, _CMP_GE_OQ));
+      contact = _mm256_and_ps(contact, _mm256_cmp_ps(wSum, zero, _CMP_GT_OQ));
+      if (_mm256_movemask_ps(contact) == 0) continue;
+
+      // Masked-off lanes get harmless denominators so nothing turns into NaN.
+      const __m256 dist    = _mm256_sqrt_ps(_mm256_blendv_ps(one, dist2, contact));
+      const __m256 invDist = _mm256_div_ps(one, dist);
+      const __m256 invW    = _mm256_div_ps(one, _mm256_blendv_ps(one, wSum, contact));
+      const __m256 nx = _mm256_mul_ps(rx, invDist);
+      const __m256 ny = _mm256_mul_ps(ry, invDist);
+      const __m256 overlap = _mm256_sub_ps(rSum, dist);
+      const __m256i types = _mm256_cvtepu8_epi32(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&c.type[k])));
+
+      __m256 push = _mm256_mul_ps(_mm256_mul_ps(overlap, bias), _mm256_mul_ps(wi, invW));
+      if (s.liquid) {
+        const __m256 liq = _mm256_castsi256_ps(_mm256_cmpeq_epi32(types, liquid));
+        push = _mm256_mul_ps(push, _mm256_blendv_ps(one, coh, liq));
+      }
+      push  = _mm256_and_ps(push, contact);
+      pushX = _mm256_sub_ps(pushX, _mm256_mul_ps(nx, push));
+      pushY = _mm256_sub_ps(pushY, _mm256_mul_ps(ny, push));
+
+      const __m256 vRelX = _mm256_sub_ps(_mm256_loadu_ps(&c.velX[k]), vxi);
+      const __m256 vRelY = _mm256_sub_ps(_mm256_loadu_ps(&c.velY[k]), vyi);
+      const __m256 vN = _mm256_add_ps(_mm256_mul_ps(vRelX, nx), _mm256_mul_ps(vRelY, ny));
+      const __m256 approaching =
+          _mm256_and_ps(contact, _mm256_cmp_ps(vN, zero, _CMP_LE_OQ));
+
+      __m256 fric = muS;
+      if (!s.sand) {
+        const __m256 sd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(types, sand));
+        fric = _mm256_blendv_ps(mu, muS, sd);
+      }
+      // Tangent is (-ny, nx).
+      const __m256 vT   = _mm256_sub_ps(_mm256_mul_ps(vRelY, nx), _mm256_mul_ps(vRelX, ny));
+      const __m256 jImp = _mm256_mul_ps(_mm256_mul_ps(rest, vN), invW);
+      const __m256 fImp = _mm256_mul_ps(_mm256_mul_ps(vT, fric), invW);
+      const __m256 dx = _mm256_sub_ps(_mm256_mul_ps(nx, jImp), _mm256_mul_ps(ny, fImp));
+      const __m256 dy = _mm256_add_ps(_mm256_mul_ps(ny, jImp), _mm256_mul_ps(nx, fImp));
+      dvX = _mm256_add_ps(dvX, _mm256_and_ps(_mm256_mul_ps(dx, wi), approaching));
+      dvY = _mm256_add_ps(dvY, _mm256_and_ps(_mm256_mul_ps(dy, wi), approaching));
+    }
+  }
+
+  out.pushX += avxSum(pushX); out.pushY += avxSum(pushY);
+  out.dvX   += avxSum(dvX);   out.dvY   += avxSum(dvY);
+}
+
+// One-sided kernel over a slot list: the same lanes as avx2Kernel, with
+// the candidate fields fetched by gather instead of a contiguous load.
+__attribute__((target("avx2")))
+void avx2ListKernel(const SortedParticles &c, const ParticleSystem &p,
+                    std::uint32_t i, const std::uint32_t *slots,
+                    std::uint32_t n, PairSums &out) {
+  const SelfState s(p, i);
+  const __m256 one   = _mm256_set1_ps(1.0f);
+  const __m256 zero  = _mm256_setzero_ps();
+  const __m256 eps   = _mm256_set1_ps(1e-6f);
+  const __m256 bias  = _mm256_set1_ps(cfg::POSITION_BIAS);
+  const __m256 rest  = _mm256_set1_ps(1.0f + cfg::COLLISION_RESTITUTION);
+  const __m256 mu    = _mm256_set1_ps(cfg::COLLISION_FRICTION);
+  const __m256 muS   = _mm256_set1_ps(cfg::SAND_FRICTION_COEF);
+  const __m256 coh   = _mm256_set1_ps(cfg::LIQUID_COHESION);
+  const __m256 pxi = _mm256_set1_ps(s.px), pyi = _mm256_set1_ps(s.py);
+  const __m256 vxi = _mm256_set1_ps(s.vx), vyi = _mm256_set1_ps(s.vy);
+  const __m256 ri  = _mm256_set1_ps(s.r),  wi  = _mm256_set1_ps(s.w);
+  const __m256i lane   = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i liquid = _mm256_set1_epi32(TYPE_LIQUID);
+  const __m256i sand   = _mm256_set1_epi32(TYPE_SAND);
+  const __m256i byte   = _mm256_set1_epi32(0xff);
+
+  __m256 pushX = zero, pushY = zero, dvX = zero, dvY = zero;
+
+  for (std::uint32_t m = 0; m < n; m += 8) {
+    const __m256i live = _mm256_cmpgt_epi32(
+        _mm256_set1_epi32(static_cast<int>(n - m)), lane);
+    // Dead lanes gather slot 0, which always exists.
+    const __m256i idx = _mm256_and_si256(
+        _mm256_maskload_epi32(reinterpret_cast<const int *>(slots + m), live), live);
+
+    const __m256 rx = _mm256_sub_ps(_mm256_i32gather_ps(c.posX.data(), idx, 4), pxi);
+    const __m256 ry = _mm256_sub_ps(_mm256_i32gather_ps(c.posY.data(), idx, 4), pyi);
+    const __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry));
+    const __m256 rSum  = _mm256_add_ps(ri, _mm256_i32gather_ps(c.radius.data(), idx, 4));
+    const __m256 wSum  = _mm256_add_ps(wi, _mm256_i32gather_ps(c.invMass.data(), idx, 4));
+
+    __m256 contact = _mm256_castsi256_ps(live);
+    contact = _mm256_and_ps(contact,
+                            _mm256_cmp_ps(dist2, _mm256_mul_ps(rSum, rSum), _CMP_LT_OQ));
+    contact = _mm256_and_ps(contact, _mm256_cmp_ps(dist2, eps, _CMP_GE_OQ));
+    contact = _mm256_and_ps(contact, _mm256_cmp_ps(wSum, zero, _CMP_GT_OQ));
+    if (_mm256_movemask_ps(contact) == 0) continue;
+
+    const __m256 dist    = _mm256_sqrt_ps(_mm256_blendv_ps(one, dist2, contact));
+    const __m256 invDist = _mm256_div_ps(one, dist);
+    const __m256 invW    = _mm256_div_ps(one, _mm256_blendv_ps(one, wSum, contact));
+    const __m256 nx = _mm256_mul_ps(rx, invDist);
+    const __m256 ny = _mm256_mul_ps(ry, invDist);
+    const __m256 overlap = _mm256_sub_ps(rSum, dist);
+    // Type bytes: gather the 32-bit word at each slot and keep its low byte
+    // (the arrays are padded, so reading 3 bytes past a slot is safe).
+    const __m256i types = _mm256_and_si256(
+        _mm256_i32gather_epi32(reinterpret_cast<const int *>(c.type.data()), idx, 1),
+        byte);
+
+    __m256 push = _mm256_mul_ps(_mm256_mul_ps(overlap, bias), _mm256_mul_ps(wi, invW));
+    if (s.liquid) {
+      const __m256 liq = _mm256_castsi256_ps(_mm256_cmpeq_epi32(types, liquid));
+      push = _mm256_mul_ps(push, _mm256_blendv_ps(one, coh, liq));
+    }
+    push  = _mm256_and_ps(push, contact);
+    pushX = _mm256_sub_ps(pushX, _mm256_mul_ps(nx, push));
+    pushY = _mm256_sub_ps(pushY, _mm256_mul_ps(ny, push));
+
+    const __m256 vRelX = _mm256_sub_ps(_mm256_i32gather_ps(c.velX.data(), idx, 4), vxi);
+    const __m256 vRelY = _mm256_sub_ps(_mm256_i32gather_ps(c.velY.data(), idx, 4), vyi);
+    const __m256 vN = _mm256_add_ps(_mm256_mul_ps(vRelX, nx), _mm256_mul_ps(vRelY, ny));
+    const __m256 approaching =
+        _mm256_and_ps(contact, _mm256_cmp_ps(vN, zero, _CMP_LE_OQ));
+
+    __m256 fric = muS;
+    if (!s.sand) {
+      const __m256 sd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(types, sand));
+      fric = _mm256_blendv_ps(mu, muS, sd);
+    }
+    const __m256 vT   = _mm256_sub_ps(_mm256_mul_ps(vRelY, nx), _mm256_mul_ps(vRelX, ny));
+    const __m256 jImp = _mm256_mul_ps(_mm256_mul_ps(rest, vN), invW);
+    const __m256 fImp = _mm256_mul_ps(_mm256_mul_ps(vT, fric), invW);
+    const __m256 dx = _mm256_sub_ps(_mm256_mul_ps(nx, jImp), _mm256_mul_ps(ny, fImp));
+    const __m256 dy = _mm256_add_ps(_mm256_mul_ps(ny, jImp), _mm256_mul_ps(nx, fImp));
+    dvX = _mm256_add_ps(dvX, _mm256_and_ps(_mm256_mul_ps(dx, wi), approaching));
+    dvY = _mm256_add_ps(dvY, _mm256_and_ps(_mm256_mul_ps(dy, wi), approaching));
+  }
+
+  out.pushX += avxSum(pushX); out.pushY += avxSum(pushY);
+  out.dvX   += avxSum(dvX);   out.dvY   += avxSum(dvY);
+}
+
+__attribute__((target("avx2")))
+inline void avxAddTo(float *dst, std::uint32_t k, __m256i live, __m256 v) {
+  // Masked load/store: lanes past the span's end are neither read nor
+  // written, so cells owned by other threads are left alone.
+  const __m256 cur = _mm256_maskload_ps(dst + k, live);
+  _mm256_maskstore_ps(dst + k, live, _mm256_add_ps(cur, v));
+}
+
+__attribute__((target("avx2")))
+void avx2PairKernel(const SortedParticles &c, std::uint32_t i,
+                    const Span *spans, int numSpans, ContactAccum &acc) {
+  const SelfState s(c, i);
+  const bool asleep = c.asleep[i] != 0;
+  const __m256 one   = _mm256_set1_ps(1.0f);
+  const __m256 zero  = _mm256_setzero_ps();
+  const __m256 eps   = _mm256_set1_ps(1e-6f);
+  const __m256 bias  = _mm256_set1_ps(cfg::POSITION_BIAS);
+  const __m256 rest  = _mm256_set1_ps(1.0f + cfg::COLLISION_RESTITUTION);
+  const __m256 mu    = _mm256_set1_ps(cfg::COLLISION_FRICTION);
+  const __m256 muS   = _mm256_set1_ps(cfg::SAND_FRICTION_COEF);
+  const __m256 coh   = _mm256_set1_ps(cfg::LIQUID_COHESION);
+  const __m256 pxi = _mm256_set1_ps(s.px), pyi = _mm256_set1_ps(s.py);
+  const __m256 vxi = _mm256_set1_ps(s.vx), vyi = _mm256_set1_ps(s.vy);
+  const __m256 ri  = _mm256_set1_ps(s.r),  wi  = _mm256_set1_ps(s.w);
+  const __m256i lane   = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i liquid = _mm256_set1_epi32(TYPE_LIQUID);
+  const __m256i sand   = _mm256_set1_epi32(TYPE_SAND);
+  const __m256i zeroI  = _mm256_setzero_si256();
+
+  __m256 pushX = zero, pushY = zero, dvX = zero, dvY = zero;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    const std::uint32_t end = spans[sp].end;
+    for (std::uint32_t k = spans[sp].begin; k < end; k += 8) {
+      const __m256i live = _mm256_cmpgt_epi32(
+          _mm256_set1_epi32(static_cast<int>(end - k)), lane);
+
+      const __m256 rx = _mm256_sub_ps(_mm256_loadu_ps(&c.posX[k]), pxi);
+      const __m256 ry = _mm256_sub_ps(_mm256_loadu_ps(&c.posY[k]), pyi);
+      const __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry));
+      const __m256 rSum  = _mm256_add_ps(ri, _mm256_loadu_ps(&c.radius[k]));
+      const __m256 wj    = _mm256_loadu_ps(&c.invMass[k]);
+      const __m256 wSum  = _mm256_add_ps(wi, wj);
+
+      __m256 contact = _mm256_castsi256_ps(live);
+      if (asleep) {
+        const __m256i slept = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&c.asleep[k])));
+        contact = _mm256_and_ps(contact,
+                                _mm256_castsi256_ps(_mm256_cmpeq_epi32(slept, zeroI)));
+      }
+      contact = _mm256_and_ps(contact,
+                              _mm256_cmp_ps(dist2, _mm256_mul_ps(rSum, rSum), _CMP_LT_OQ));
+      contact = _mm256_and_ps(contact, _mm256_cmp_ps(dist2, eps, _CMP_GE_OQ));
+      contact = _mm256_and_ps(contact, _mm256_cmp_ps(wSum, zero, _CMP_GT_OQ));
+      if (_mm256_movemask_ps(contact) == 0) continue;
+
+      const __m256 dist    = _mm256_sqrt_ps(_mm256_blendv_ps(one, dist2, contact));
+      const __m256 invDist = _mm256_div_ps(one, dist);
+      const __m256 invW    = _mm256_div_ps(one, _mm256_blendv_ps(one, wSum, contact));
+      const __m256 nx = _mm256_mul_ps(rx, invDist);
+      const __m256 ny = _mm256_mul_ps(ry, invDist);
+      const __m256 overlap = _mm256_sub_ps(rSum, dist);
+      const __m256i types = _mm256_cvtepu8_epi32(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&c.type[k])));
+
+      __m256 push = _mm256_mul_ps(_mm256_mul_ps(overlap, bias), invW);
+      if (s.liquid) {
+        const __m256 liq = _mm256_castsi256_ps(_mm256_cmpeq_epi32(types, liquid));
+        push = _mm256_mul_ps(push, _mm256_blendv_ps(one, coh, liq));
+      }
+      push = _mm256_and_ps(push, contact);
+      const __m256 pnx = _mm256_mul_ps(nx, push), pny = _mm256_mul_ps(ny, push);
+      pushX = _mm256_sub_ps(pushX, _mm256_mul_ps(pnx, wi));
+      pushY = _mm256_sub_ps(pushY, _mm256_mul_ps(pny, wi));
+
+      const __m256 vRelX = _mm256_sub_ps(_mm256_loadu_ps(&c.velX[k]), vxi);
+      const __m256 vRelY = _mm256_sub_ps(_mm256_loadu_ps(&c.velY[k]), vyi);
+      const __m256 vN = _mm256_add_ps(_mm256_mul_ps(vRelX, nx), _mm256_mul_ps(vRelY, ny));
+      const __m256 approaching =
+          _mm256_and_ps(contact, _mm256_cmp_ps(vN, zero, _CMP_LE_OQ));
+
+      __m256 fric = muS;
+      if (!s.sand) {
+        const __m256 sd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(types, sand));
+        fric = _mm256_blendv_ps(mu, muS, sd);
+      }
+      const __m256 vT   = _mm256_sub_ps(_mm256_mul_ps(vRelY, nx), _mm256_mul_ps(vRelX, ny));
+      const __m256 jImp = _mm256_mul_ps(_mm256_mul_ps(rest, vN), invW);
+      const __m256 fImp = _mm256_mul_ps(_mm256_mul_ps(vT, fric), invW);
+      const __m256 jx = _mm256_and_ps(
+          _mm256_sub_ps(_mm256_mul_ps(nx, jImp), _mm256_mul_ps(ny, fImp)), approaching);
+      const __m256 jy = _mm256_and_ps(
+          _mm256_add_ps(_mm256_mul_ps(ny, jImp), _mm256_mul_ps(nx, fImp)), approaching);
+      dvX = _mm256_add_ps(dvX, _mm256_mul_ps(jx, wi));
+      dvY = _mm256_add_ps(dvY, _mm256_mul_ps(jy, wi));
+
+      avxAddTo(acc.pushX.data(), k, live, _mm256_mul_ps(pnx, wj));
+      avxAddTo(acc.pushY.data(), k, live, _mm256_mul_ps(pny, wj));
+      avxAddTo(acc.dvX.data(), k, live, _mm256_sub_ps(zero, _mm256_mul_ps(jx, wj)));
+      avxAddTo(acc.dvY.data(), k, live, _mm256_sub_ps(zero, _mm256_mul_ps(jy, wj)));
+    }
+  }
+
+  acc.pushX[i] += avxSum(pushX); acc.pushY[i] += avxSum(pushY);
+  acc.dvX[i]   += avxSum(dvX);   acc.dvY[i]   += avxSum(dvY);
+}
+
+#endif // NARROWPHASE_X86
+
+#if defined(NARROWPHASE_NEON)
+
+inline float32x4_t neonMask(float32x4_t v, uint32x4_t m) {
+  return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), m));
+}
+
+void neonKernel(const SortedParticles &c, const ParticleSystem &p,
+                std::uint32_t i, const Span *spans, int numSpans,
+                PairSums &out) {
+  const SelfState s(p, i);
+  const float32x4_t one  = vdupq_n_f32(1.0f);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t eps  = vdupq_n_f32(1e-6f);
+  const float32x4_t bias = vdupq_n_f32(cfg::POSITION_BIAS);
+  const float32x4_t rest = vdupq_n_f32(1.0f + cfg::COLLISION_RESTITUTION);
+  const float32x4_t mu   = vdupq_n_f32(cfg::COLLISION_FRICTION);
+  const float32x4_t muS  = vdupq_n_f32(cfg::SAND_FRICTION_COEF);
+  const float32x4_t coh  = vdupq_n_f32(cfg::LIQUID_COHESION);
+  const float32x4_t vxi = vdupq_n_f32(s.vx), vyi = vdupq_n_f32(s.vy);
+  const float32x4_t ri  = vdupq_n_f32(s.r),  wi  = vdupq_n_f32(s.w);
+  const uint32x4_t self   = vdupq_n_u32(i);
+  const uint32_t   laneInit[4] = { 0, 1, 2, 3 };
+  const uint32x4_t lane   = vld1q_u32(laneInit);
+  const uint32x4_t liquid = vdupq_n_u32(TYPE_LIQUID);
+  const uint32x4_t sand   = vdupq_n_u32(TYPE_SAND);
+
+  float32x4_t pushX = zero, pushY = zero, dvX = zero, dvY = zero;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    const std::uint32_t end = spans[sp].end;
+    const float32x4_t pxi = vdupq_n_f32(s.px - spans[sp].shiftX);
+    const float32x4_t pyi = vdupq_n_f32(s.py - spans[sp].shiftY);
+    for (std::uint32_t k = spans[sp].begin; k < end; k += 4) {
+      const uint32x4_t live = vcltq_u32(lane, vdupq_n_u32(end - k));
+      const uint32x4_t ids  = vld1q_u32(&c.id[k]);
+
+      const float32x4_t rx = vsubq_f32(vld1q_f32(&c.posX[k]), pxi);
+      const float32x4_t ry = vsubq_f32(vld1q_f32(&c.posY[k]), pyi);
+      const float32x4_t dist2 = vaddq_f32(vmulq_f32(rx, rx), vmulq_f32(ry, ry));
+      const float32x4_t rSum  = vaddq_f32(ri, vld1q_f32(&c.radius[k]));
+      const float32x4_t wSum  = vaddq_f32(wi, vld1q_f32(&c.invMass[k]));
+
+      uint32x4_t contact = vbicq_u32(live, vceqq_u32(ids, self));
+      contact = vandq_u32(contact, vcltq_f32(dist2, vmulq_f32(rSum, rSum)));
+      contact = vandq_u32(contact, vcgeq_f32(dist2, eps));
+      contact = vandq_u32(contact, vcgtq_f32(wSum, zero));
+      if (vmaxvq_u32(contact) == 0) continue;
+
+      // Masked-off lanes get harmless denominators so nothing turns into NaN.
+      const float32x4_t dist    = vsqrtq_f32(vbslq_f32(contact, dist2, one));
+      const float32x4_t invDist = vdivq_f32(one, dist);
+      const float32x4_t invW    = vdivq_f32(one, vbslq_f32(contact, wSum, one));
+      const float32x4_t nx = vmulq_f32(rx, invDist);
+      const float32x4_t ny = vmulq_f32(ry, invDist);
+      const float32x4_t overlap = vsubq_f32(rSum, dist);
+      const uint32x4_t types =
+          vmovl_u16(vget_low_u16(vmovl_u8(vld1_u8(&c.type[k]))));
+
+      float32x4_t push = vmulq_f32(vmulq_f32(overlap, bias), vmulq_f32(wi, invW));
+      if (s.liquid) {
+        push = vmulq_f32(push, vbslq_f32(vceqq_u32(types, liquid), coh, one));
+      }
+      push  = neonMask(push, contact);
+      pushX = vsubq_f32(pushX, vmulq_f32(nx, push));
+      pushY = vsubq_f32(pushY, vmulq_f32(ny, push));
+
+      const float32x4_t vRelX = vsubq_f32(vld1q_f32(&c.velX[k]), vxi);
+      const float32x4_t vRelY = vsubq_f32(vld1q_f32(&c.velY[k]), vyi);
+      const float32x4_t vN = vaddq_f32(vmulq_f32(vRelX, nx), vmulq_f32(vRelY, ny));
+      const uint32x4_t approaching = vandq_u32(contact, vcleq_f32(vN, zero));
+
+      float32x4_t fric = muS;
+      if (!s.sand) {
+        fric = vbslq_f32(vceqq_u32(types, sand), muS, mu);
+      }
+      // Tangent is (-ny, nx).
+      const float32x4_t vT   = vsubq_f32(vmulq_f32(vRelY, nx), vmulq_f32(vRelX, ny));
+      const float32x4_t jImp = vmulq_f32(vmulq_f32(rest, vN), invW);
+      const float32x4_t fImp = vmulq_f32(vmulq_f32(vT, fric), invW);
+      const float32x4_t dx = vsubq_f32(vmulq_f32(nx, jImp), vmulq_f32(ny, fImp));
+      const float32x4_t dy = vaddq_f32(vmulq_f32(ny, jImp), vmulq_f32(nx, fImp));
+      dvX = vaddq_f32(dvX, neonMask(vmulq_f32(dx, wi), approaching));
+      dvY = vaddq_f32(dvY, neonMask(vmulq_f32(dy, wi), approaching));
+    }
+  }
+
+  out.pushX += vaddvq_f32(pushX); out.pushY += vaddvq_f32(pushY);
+  out.dvX   += vaddvq_f32(dvX);   out.dvY   += vaddvq_f32(dvY);
+}
+
+inline void neonAddTo(float *dst, std::uint32_t k, std::uint32_t n, float32x4_t v) {
+  if (n >= 4) {
+    vst1q_f32(dst + k, vaddq_f32(vld1q_f32(dst + k), v));
+  } else {
+    alignas(16) float t[4];
+    vst1q_f32(t, v);
+    addTail(dst, k, n, t);
+  }
+}
+
+void neonPairKernel(const SortedParticles &c, std::uint32_t i,
+                    const Span *spans, int numSpans, ContactAccum &acc) {
+  const SelfState s(c, i);
+  const bool asleep = c.asleep[i] != 0;
+  const float32x4_t one  = vdupq_n_f32(1.0f);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t eps  = vdupq_n_f32(1e-6f);
+  const float32x4_t bias = vdupq_n_f32(cfg::POSITION_BIAS);
+  const float32x4_t rest = vdupq_n_f32(1.0f + cfg::COLLISION_RESTITUTION);
+  const float32x4_t mu   = vdupq_n_f32(cfg::COLLISION_FRICTION);
+  const float32x4_t muS  = vdupq_n_f32(cfg::SAND_FRICTION_COEF);
+  const float32x4_t coh  = vdupq_n_f32(cfg::LIQUID_COHESION);
+  const float32x4_t pxi = vdupq_n_f32(s.px), pyi = vdupq_n_f32(s.py);
+  const float32x4_t vxi = vdupq_n_f32(s.vx), vyi = vdupq_n_f32(s.vy);
+  const float32x4_t ri  = vdupq_n_f32(s.r),  wi  = vdupq_n_f32(s.w);
+  const uint32_t   laneInit[4] = { 0, 1, 2, 3 };
+  const uint32x4_t lane   = vld1q_u32(laneInit);
+  const uint32x4_t liquid = vdupq_n_u32(TYPE_LIQUID);
+  const uint32x4_t sand   = vdupq_n_u32(TYPE_SAND);
+
+  float32x4_t pushX = zero, pushY = zero, dvX = zero, dvY = zero;
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    const std::uint32_t end = spans[sp].end;
+    for (std::uint32_t k = spans[sp].begin; k < end; k += 4) {
+      const float32x4_t rx = vsubq_f32(vld1q_f32(&c.posX[k]), pxi);
+      const float32x4_t ry = vsubq_f32(vld1q_f32(&c.posY[k]), pyi);
+      const float32x4_t dist2 = vaddq_f32(vmulq_f32(rx, rx), vmulq_f32(ry, ry));
+      const float32x4_t rSum  = vaddq_f32(ri, vld1q_f32(&c.radius[k]));
+      const float32x4_t wj    = vld1q_f32(&c.invMass[k]);
+      const float32x4_t wSum  = vaddq_f32(wi, wj);
+
+      uint32x4_t contact = vcltq_u32(lane, vdupq_n_u32(end - k));
+      if (asleep) {
+        const uint32x4_t slept =
+            vmovl_u16(vget_low_u16(vmovl_u8(vld1_u8(&c.asleep[k]))));
+        contact = vbicq_u32(contact, vtstq_u32(slept, slept));
+      }
+      contact = vandq_u32(contact, vcltq_f32(dist2, vmulq_f32(rSum, rSum)));
+      contact = vandq_u32(contact, vcgeq_f32(dist2, eps));
+      contact = vandq_u32(contact, vcgtq_f32(wSum, zero));
+      if (vmaxvq_u32(contact) == 0) continue;
+
+      const float32x4_t dist    = vsqrtq_f32(vbslq_f32(contact, dist2, one));
+      const float32x4_t invDist = vdivq_f32(one, dist);
+      const float32x4_t invW    = vdivq_f32(one, vbslq_f32(contact, wSum, one));
+      const float32x4_t nx = vmulq_f32(rx, invDist);
+      const float32x4_t ny = vmulq_f32(ry, invDist);
+      const float32x4_t overlap = vsubq_f32(rSum, dist);
+      const uint32x4_t types =
+          vmovl_u16(vget_low_u16(vmovl_u8(vld1_u8(&c.type[k]))));
+
+      float32x4_t push = vmulq_f32(vmulq_f32(overlap, bias), invW);
+      if (s.liquid) {
+        push = vmulq_f32(push, vbslq_f32(vceqq_u32(types, liquid), coh, one));
+      }
+      push = neonMask(push, contact);
+      const float32x4_t pnx = vmulq_f32(nx, push), pny = vmulq_f32(ny, push);
+      pushX = vsubq_f32(pushX, vmulq_f32(pnx, wi));
+      pushY = vsubq_f32(pushY, vmulq_f32(pny, wi));
+
+      const float32x4_t vRelX = vsubq_f32(vld1q_f32(&c.velX[k]), vxi);
+      const float32x4_t vRelY = vsubq_f32(vld1q_f32(&c.velY[k]), vyi);
+      const float32x4_t vN = vaddq_f32(vmulq_f32(vRelX, nx), vmulq_f32(vRelY, ny));
+      const uint32x4_t approaching = vandq_u32(contact, vcleq_f32(vN, zero));
+
+      float32x4_t fric = muS;
+      if (!s.sand) {
+        fric = vbslq_f32(vceqq_u32(types, sand), muS, mu);
+      }
+      const float32x4_t vT   = vsubq_f32(vmulq_f32(vRelY, nx), vmulq_f32(vRelX, ny));
+      const float32x4_t jImp = vmulq_f32(vmulq_f32(rest, vN), invW);
+      const float32x4_t fImp = vmulq_f32(vmulq_f32(vT, fric), invW);
+      const float32x4_t jx = neonMask(
+          vsubq_f32(vmulq_f32(nx, jImp), vmulq_f32(ny, fImp)), approaching);
+      const float32x4_t jy = neonMask(
+          vaddq_f32(vmulq_f32(ny, jImp), vmulq_f32(nx, fImp)), approaching);
+      dvX = vaddq_f32(dvX, vmulq_f32(jx, wi));
+      dvY = vaddq_f32(dvY, vmulq_f32(jy, wi));
+
+      const std::uint32_t n = end - k;
+      neonAddTo(acc.pushX.data(), k, n, vmulq_f32(pnx, wj));
+      neonAddTo(acc.pushY.data(), k, n, vmulq_f32(pny, wj));
+      neonAddTo(acc.dvX.data(), k, n, vnegq_f32(vmulq_f32(jx, wj)));
+      neonAddTo(acc.dvY.data(), k, n, vnegq_f32(vmulq_f32(jy, wj)));
+    }
+  }
+
+  acc.pushX[i] += vaddvq_f32(pushX); acc.pushY[i] += vaddvq_f32(pushY);
+  acc.dvX[i]   += vaddvq_f32(dvX);   acc.dvY[i]   += vaddvq_f32(dvY);
+}
+
+#endif // NARROWPHASE_NEON
+
+} // namespace
+
+KernelFn kernelFn(Kernel k) {
+  switch (k) {
+#if defined(__SSE2__)
+    case Kernel::SSE2: return sse2Kernel;
+#endif
+#if defined(NARROWPHASE_X86)
+    case Kernel::AVX2: return avx2Kernel;
+#endif
+#if defined(NARROWPHASE_NEON)
+    case Kernel::NEON: return neonKernel;
+#endif
+    default: return scalarKernel;
+  }
+}
+
+PairKernelFn pairKernelFn(Kernel k) {
+  switch (k) {
+#if defined(__SSE2__)
+    case Kernel::SSE2: return sse2PairKernel;
+#endif
+#if defined(NARROWPHASE_X86)
+    case Kernel::AVX2: return avx2PairKernel;
+#endif
+#if defined(NARROWPHASE_NEON)
+    case Kernel::NEON: return neonPairKernel;
+#endif
+    default: return scalarPairKernel;
+  }
+}
+
+ListKernelFn listKernelFn(Kernel k) {
+  switch (k) {
+#if defined(NARROWPHASE_X86)
+    case Kernel::AVX2: return avx2ListKernel;
+#endif
+    default: return scalarListKernel;
+  }
+}
+
+namespace {
+
+struct Selection {
+  Kernel       kind;
+  KernelFn     fn;
+  PairKernelFn pairFn;
+  ListKernelFn listFn;
+};
+
+Selection &selection() {
+  static Selection s{ bestKernel(), kernelFn(bestKernel()),
+                      pairKernelFn(bestKernel()), listKernelFn(bestKernel()) };
+  return s;
+}
+
+} // namespace
+
+const char *kernelName(Kernel k) {
+  switch (k) {
+    case Kernel::Scalar: return "scalar";
+    case Kernel::SSE2:   return "SSE2";
+    case Kernel::AVX2:   return "AVX2";
+    case Kernel::NEON:   return "NEON";
+    default:             return "?";
+  }
+}
+
+bool kernelSupported(Kernel k) {
+  switch (k) {
+    case Kernel::Scalar: return true;
+#if defined(__SSE2__)
+    case Kernel::SSE2:   return true;
+#endif
+#if defined(NARROWPHASE_X86)
+    case Kernel::AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+#if defined(NARROWPHASE_NEON)
+    case Kernel::NEON:   return true;
+#endif
+    default:             return false;
+  }
+}
+
+Kernel bestKernel() {
+  const Kernel order[] = { Kernel::AVX2, Kernel::NEON, Kernel::SSE2 };
+  for (Kernel k : order) {
+    if (kernelSupported(k)) return k;
+  }
+  return Kernel::Scalar;
+}
+
+Kernel   activeKernel()   { return selection().kind; }
+
+Kernel passKernel(bool deterministic) {
+  return deterministic ? kDeterministicKernel : selection().kind;
+}
+KernelFn activeKernelFn() { return selection().fn; }
+PairKernelFn activePairKernelFn() { return selection().pairFn; }
+ListKernelFn activeListKernelFn() { return selection().listFn; }
+
+bool setKernel(Kernel k) {
+  if (!kernelSupported(k)) return false;
+  selection() = { k, kernelFn(k), pairKernelFn(k), listKernelFn(k) };
+  return true;
+}
+
+namespace {
+
+// The world-bounds rule from phase 6 (clamp, reflect an outward velocity
+// with BOUNDARY_RESTITUTION), applied as the Gauss-Seidel pass moves things.
+inline void keepInWorld(float &x, float &v, float radius, float extent) {
+  if (x < radius) {
+    x = radius;
+    if (v < 0.0f) v = -v * cfg::BOUNDARY_RESTITUTION;
+  } else if (x > extent - radius) {
+    x = extent - radius;
+    if (v > 0.0f) v = -v * cfg::BOUNDARY_RESTITUTION;
+  }
+}
+
+} // namespace
+
+// Same contact model as scalarPairKernel, but each pair's push and impulse
+// are written back before the next pair is read. A sleeper gets weight 0,
+// so its awake partner takes the whole correction. Everything this moves
+// is kept inside the world right away, so a push into the floor turns
+// into a push on the other particle on the next sweep.
+void gaussSeidelKernel(SortedParticles &c, std::uint32_t i, const Span *spans,
+                       int numSpans, float bias) {
+  const float e  = cfg::COLLISION_RESTITUTION;
+  const float mu = cfg::COLLISION_FRICTION;
+  const bool liquid = c.type[i] == TYPE_LIQUID;
+  const bool sand   = c.type[i] == TYPE_SAND;
+  const float r  = c.radius[i];
+  const float wi = c.asleep[i] ? 0.0f : c.invMass[i];
+  float px = c.posX[i], py = c.posY[i];
+  float vx = c.velX[i], vy = c.velY[i];
+
+  for (int sp = 0; sp < numSpans; ++sp) {
+    for (std::uint32_t k = spans[sp].begin; k < spans[sp].end; ++k) {
+      float rx = c.posX[k] - px;
+      float ry = c.posY[k] - py;
+      float dist2 = rx * rx + ry * ry;
+      float rSum  = r + c.radius[k];
+      if (dist2 >= rSum * rSum || dist2 < 1e-6f) continue;
+
+      float wj = c.asleep[k] ? 0.0f : c.invMass[k];
+      float wSum = wi + wj;
+      if (wSum <= 0.0f) continue;
+      float invW = 1.0f / wSum;
+
+      float dist = std::sqrt(dist2);
+      float invDist = 1.0f / dist;
+      float nx = rx * invDist;   // points i -> j
+      float ny = ry * invDist;
+      float overlap = rSum - dist;
+
+      float pushScale = 1.0f;
+      if (liquid && c.type[k] == TYPE_LIQUID) {
+        pushScale = cfg::LIQUID_COHESION;
+      }
+      float push = overlap * bias * pushScale * invW;
+      px -= nx * push * wi;
+      py -= ny * push * wi;
+      c.posX[k] += nx * push * wj;
+      c.posY[k] += ny * push * wj;
+      keepInWorld(c.posX[k], c.velX[k], c.radius[k], cfg::WORLD_WIDTH);
+      keepInWorld(c.posY[k], c.velY[k], c.radius[k], cfg::WORLD_HEIGHT);
+
+      float vRelX = c.velX[k] - vx;
+      float vRelY = c.velY[k] - vy;
+      float vN    = vRelX * nx + vRelY * ny;
+      if (vN > 0.0f) continue;   // separating
+
+      float tx = -ny, ty = nx;
+      float vT = vRelX * tx + vRelY * ty;
+      float frictionScale = mu;
+      if (sand || c.type[k] == TYPE_SAND) {
+        frictionScale = cfg::SAND_FRICTION_COEF;
+      }
+      float jImp = (1.0f + e) * vN * invW;
+      float fImp = vT * frictionScale * invW;
+      float jx = nx * jImp + tx * fImp;
+      float jy = ny * jImp + ty * fImp;
+      vx += jx * wi;
+      vy += jy * wi;
+      c.velX[k] -= jx * wj;
+      c.velY[k] -= jy * wj;
+    }
+  }
+
+  keepInWorld(px, vx, r, cfg::WORLD_WIDTH);
+  keepInWorld(py, vy, r, cfg::WORLD_HEIGHT);
+  c.posX[i] = px; c.posY[i] = py;
+  c.velX[i] = vx; c.velY[i] = vy;
+}
+
+} // namespace narrowphase
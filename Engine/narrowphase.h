@@ -0,0 +1,170 @@
+#ifndef NARROWPHASE_H
+#define NARROWPHASE_H
+
+#include "particle.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Pair kernels for the collision pass.
+//
+// After the spatial hash is built, the fields the kernels read are copied
+// into SortedParticles in cell order. A particle's neighbours in one grid
+// row (three adjacent cells) are then a contiguous slot range, so the
+// kernels stream them with plain vector loads instead of gathering through
+// random indices. The copy is also a stable snapshot: the one-sided pass
+// writes velocities in place, and reading neighbours from the copy keeps
+// every particle's result independent of thread scheduling.
+//
+// A kernel tests one particle `i` against a few slot spans and returns the
+// summed position push and velocity delta for `i` only (the one-sided rule
+// from collisions.h). The scalar kernel is the reference; the SIMD kernels
+// evaluate 4 (SSE2 / NEON) or 8 (AVX2) candidates per iteration with masked
+// accumulation and must agree with it up to float rounding.
+//
+// Pair kernels are the symmetric variant used by the coloured solver: each
+// pair is evaluated once, from the particle with the lower slot in the
+// half-stencil, and both particles' shares are accumulated into per-slot
+// ContactAccum arrays. Neighbour reads still come from the snapshot, so
+// the result matches the one-sided kernels up to summation order.
+//
+// The Gauss-Seidel kernel is a scalar-only sibling of the pair kernel that
+// applies each contact to the snapshot as soon as it is evaluated, so the
+// next pair sees the corrected positions and velocities. Each pair depends
+// on the previous one, which leaves nothing for SIMD lanes to share.
+//
+// List kernels are the one-sided kernel over an explicit slot list (Verlet
+// lists). Only AVX2 has a hardware gather; the other targets use the
+// scalar list kernel.
+//
+// The kernel is chosen once at startup from the CPU's reported features
+// rather than from compile flags, so one binary built without -march=native
+// still uses AVX2 where it exists; the widest supported ISA wins. The
+// kernels differ in float rounding, so deterministic mode ignores that
+// choice and always runs kDeterministicKernel: a seeded scene then hashes
+// the same on every CPU, whichever kernel is active.
+// ---------------------------------------------------------------------------
+
+namespace narrowphase {
+
+enum class Kernel : int {
+  Scalar = 0,
+  SSE2,
+  AVX2,
+  NEON,
+  Count
+};
+
+// Widest kernel batch; SortedParticles keeps this many padding slots past
+// `count` so a batch starting at any valid slot can load unconditionally.
+constexpr std::size_t kMaxLanes = 8;
+
+struct SortedParticles {
+  std::vector<float>         posX, posY, velX, velY, radius, invMass;
+  std::vector<std::uint8_t>  type;
+  std::vector<std::uint32_t> id;   // particle index held in each slot
+  std::vector<std::uint8_t>  asleep;
+  std::size_t count = 0;
+
+  void resize(std::size_t n);
+
+  // Fill slots [begin,end) from p in the given order. Safe to call in
+  // parallel on disjoint ranges after resize().
+  void gather(const ParticleSystem &p, const std::uint32_t *order,
+              std::size_t begin, std::size_t end);
+
+  // Refill only what a substep changes (positions, velocities, sleep) in
+  // slots [begin,end), for a snapshot gathered in the same order over the
+  // same layout. Same parallel rules as gather().
+  void refresh(const ParticleSystem &p, const std::uint32_t *order,
+               std::size_t begin, std::size_t end);
+};
+
+// Half-open slot range inside SortedParticles. Across a periodic seam a
+// span holds ghost cells, the far side's cells seen from this one: every
+// slot in it is taken as lying at its position plus (shiftX, shiftY), which
+// makes the kernels measure minimum-image distances. Only the one-sided
+// kernels (KernelFn) honour the shift; the pair, Gauss-Seidel and list
+// kernels expect spans without one.
+struct Span {
+  std::uint32_t begin, end;
+  float shiftX = 0.0f, shiftY = 0.0f;
+};
+
+struct PairSums {
+  float pushX = 0.0f, pushY = 0.0f;
+  float dvX   = 0.0f, dvY   = 0.0f;
+};
+
+using KernelFn = void (*)(const SortedParticles &s, const ParticleSystem &p,
+                          std::uint32_t i, const Span *spans, int numSpans,
+                          PairSums &out);
+
+// Same contact model for an explicit list of `n` neighbour slots (Verlet
+// lists) instead of contiguous spans. The slots must not include i.
+using ListKernelFn = void (*)(const SortedParticles &s, const ParticleSystem &p,
+                              std::uint32_t i, const std::uint32_t *slots,
+                              std::uint32_t n, PairSums &out);
+
+// Per-slot results of the symmetric pass, indexed like SortedParticles.
+struct ContactAccum {
+  std::vector<float> pushX, pushY, dvX, dvY;
+
+  // Size for n slots and zero [begin,end). Call resize() once, then zero
+  // disjoint ranges in parallel.
+  void resize(std::size_t n);
+  void zero(std::size_t begin, std::size_t end);
+};
+
+// Evaluate every pair between slot `i` and the slots in `spans` once, and
+// add i's share at acc[i] and the partner's at acc[partner]. Spans must
+// not contain i. Pairs where both particles are asleep are skipped. The
+// caller guarantees no other thread touches any of those slots meanwhile.
+using PairKernelFn = void (*)(const SortedParticles &s, std::uint32_t i,
+                              const Span *spans, int numSpans,
+                              ContactAccum &acc);
+
+// Resolve every pair between slot `i` and the slots in `spans` in place:
+// positions and velocities in `s` are corrected pair by pair, each
+// particle taking its mass-weighted share of `bias` times the overlap, and
+// kept inside the world bounds. Sleeping particles count as immovable.
+// Same exclusivity rule as PairKernelFn.
+void gaussSeidelKernel(SortedParticles &s, std::uint32_t i, const Span *spans,
+                       int numSpans, float bias);
+
+const char *kernelName(Kernel k);
+
+// True if the kernel was compiled in and the running CPU supports it.
+bool kernelSupported(Kernel k);
+
+// Kernel picked by runtime detection (the widest supported one).
+Kernel bestKernel();
+
+// Kernel run in deterministic mode. The scalar kernel is the reference and
+// exists on every target.
+constexpr Kernel kDeterministicKernel = Kernel::Scalar;
+
+// Kernel currently used by collisions::resolveBand.
+Kernel activeKernel();
+
+// Kernel a collision pass should run: kDeterministicKernel when
+// `deterministic` is set, otherwise activeKernel().
+Kernel passKernel(bool deterministic);
+
+// Entry points of kernel k, which must be supported.
+KernelFn kernelFn(Kernel k);
+PairKernelFn pairKernelFn(Kernel k);
+ListKernelFn listKernelFn(Kernel k);
+KernelFn activeKernelFn();
+PairKernelFn activePairKernelFn();
+ListKernelFn activeListKernelFn();
+
+// Override the active kernel (benchmarking / debugging). Returns false and
+// leaves the selection untouched if the kernel isn't supported here.
+bool setKernel(Kernel k);
+
+} // namespace narrowphase
+
+#endif
@@ -0,0 +1,133 @@
+#include "obstacle_field.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+// Distance from p to the segment ab.
+float segmentDistance(Vec2 p, Vec2 a, Vec2 b) {
+  const Vec2 ab = b - a, ap = p - a;
+  const float len2 = ab.magnitudeSq();
+  const float t = len2 > 0.0f
+                      ? std::clamp(Vec2::dot(ap, ab) / len2, 0.0f, 1.0f)
+                      : 0.0f;
+  return (ap - ab * t).magnitude();
+}
+
+} // namespace
+
+void ObstacleField::addSegment(Vec2 a, Vec2 b, float thickness) {
+  segments_.push_back({ a, b, thickness * 0.5f });
+}
+
+void ObstacleField::addPolygon(std::vector<Vec2> points) {
+  if (points.size() >= 3) polygons_.push_back({ std::move(points) });
+}
+
+void ObstacleField::clear() {
+  segments_.clear();
+  polygons_.clear();
+  nodes_.clear();
+}
+
+bool ObstacleField::load(const std::string &path, std::string &error) {
+  std::ifstream in(path);
+  if (!in) {
+    error = "cannot open " + path;
+    return false;
+  }
+  std::string line;
+  for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+    std::istringstream words(line);
+    std::string kind;
+    if (!(words >> kind) || kind[0] == '#') continue;
+
+    std::vector<float> v;
+    for (float f; words >> f;) v.push_back(f);
+    const bool parsed = words.eof();
+    if (parsed && kind == "segment" && v.size() == 5) {
+      addSegment({ v[0], v[1] }, { v[2], v[3] }, v[4]);
+    } else if (parsed && kind == "polygon" && v.size() >= 6 && v.size() % 2 == 0) {
+      std::vector<Vec2> points;
+      for (std::size_t k = 0; k < v.size(); k += 2) points.push_back({ v[k], v[k + 1] });
+      addPolygon(std::move(points));
+    } else {
+      error = path + ":" + std::to_string(lineNo) + ": expected 'segment x0 y0 "
+              "x1 y1 thickness' or 'polygon x0 y0 x1 y1 x2 y2 ...'";
+      return false;
+    }
+  }
+  return true;
+}
+
+ObstacleField ObstacleField::demoLevel() {
+  const float w = cfg::WORLD_WIDTH, h = cfg::WORLD_HEIGHT;
+  ObstacleField field;
+
+  // Funnel, with an 80 px neck.
+  field.addSegment({ w * 0.30f, h * 0.20f }, { w * 0.5f - 40.0f, h * 0.42f }, 12.0f);
+  field.addSegment({ w * 0.70f, h * 0.20f }, { w * 0.5f + 40.0f, h * 0.42f }, 12.0f);
+
+  // Open box under it.
+  const float left = w * 0.5f - 130.0f, right = w * 0.5f + 130.0f;
+  const float top = h * 0.62f, floor = h * 0.78f;
+  field.addSegment({ left, top },   { left, floor },  10.0f);
+  field.addSegment({ left, floor }, { right, floor }, 10.0f);
+  field.addSegment({ right, floor }, { right, top },  10.0f);
+
+  // Rolling hills along the bottom.
+  std::vector<Vec2> hills;
+  for (float x = 0.0f; x <= w; x += 40.0f) {
+    hills.push_back({ x, h - 50.0f - 30.0f * std::sin(x / 130.0f) });
+  }
+  hills.push_back({ w, h });
+  hills.push_back({ 0.0f, h });
+  field.addPolygon(std::move(hills));
+  return field;
+}
+
+float ObstacleField::distance(Vec2 p) const {
+  // Farther than anything in the world: the value far from every shape.
+  float best = cfg::WORLD_WIDTH + cfg::WORLD_HEIGHT;
+  for (const Segment &s : segments_) {
+    best = std::min(best, segmentDistance(p, s.a, s.b) - s.radius);
+  }
+  for (const Polygon &poly : polygons_) {
+    float edge = best;
+    bool inside = false;
+    const std::size_t n = poly.points.size();
+    for (std::size_t k = 0, j = n - 1; k < n; j = k++) {
+      const Vec2 a = poly.points[j], b = poly.points[k];
+      edge = std::min(edge, segmentDistance(p, a, b));
+      // Even-odd rule: count the edges a ray to +x crosses.
+      if ((a.y > p.y) != (b.y > p.y) &&
+          p.x < a.x + (p.y - a.y) * (b.x - a.x) / (b.y - a.y)) {
+        inside = !inside;
+      }
+    }
+    best = std::min(best, inside ? -edge : edge);
+  }
+  return best;
+}
+
+void ObstacleField::bake() {
+  const float cell = cfg::OBSTACLE_CELL_SIZE;
+  const int cols = static_cast<int>(std::ceil(cfg::WORLD_WIDTH / cell));
+  const int rows = static_cast<int>(std::ceil(cfg::WORLD_HEIGHT / cell));
+  stride_  = static_cast<std::size_t>(cols) + 1;
+  invCell_ = 1.0f / cell;
+  maxCell_ = std::nextafter(static_cast<float>(cols), 0.0f);
+  maxRow_  = std::nextafter(static_cast<float>(rows), 0.0f);
+  nodes_.resize(stride_ * (static_cast<std::size_t>(rows) + 1));
+  for (int y = 0; y <= rows; ++y) {
+    for (int x = 0; x <= cols; ++x) {
+      nodes_[static_cast<std::size_t>(y) * stride_ + x] =
+          distance({ x * cell, y * cell });
+    }
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef OBSTACLE_FIELD_H
+#define OBSTACLE_FIELD_H
+
+#include "vec2.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Static obstacle geometry, baked into a signed distance field.
+//
+// Obstacles are thick line segments (capsules, for walls, ramps and
+// funnels) and solid polygons (containers, terrain). They never move and
+// have no particles of their own, so they cost nothing in the hash, the
+// gather or the pair kernels.
+//
+// bake() evaluates the signed distance to the union of all shapes at the
+// corners of a grid of cfg::OBSTACLE_CELL_SIZE cells over the world:
+// negative inside an obstacle, positive outside. That is done once, by
+// brute force over every node and edge. Afterwards sample() returns the
+// bilinearly interpolated distance and its gradient, which points away
+// from the nearest surface, from the four corners of one cell, so testing
+// a particle costs the same however much geometry there is. Phase 6 pushes
+// any particle closer than its radius back out along that gradient
+// (collisions::applyObstacles).
+//
+// A text file lists one shape per line, in world coordinates:
+//   segment x0 y0 x1 y1 thickness
+//   polygon x0 y0 x1 y1 x2 y2 ...     (at least three points)
+// Blank lines and lines starting with '#' are skipped.
+// ---------------------------------------------------------------------------
+
+class ObstacleField {
+public:
+  struct Segment {
+    Vec2  a, b;
+    float radius;   // half the thickness
+  };
+
+  // Closed outline; the inside (by the even-odd rule) is solid.
+  struct Polygon {
+    std::vector<Vec2> points;
+  };
+
+  void addSegment(Vec2 a, Vec2 b, float thickness);
+  void addPolygon(std::vector<Vec2> points);
+  void clear();
+
+  // Add the shapes listed in the file at `path`. Returns false, with a
+  // message in `error`, if it can't be read or a line doesn't parse;
+  // shapes before the bad line are kept.
+  bool load(const std::string &path, std::string &error);
+
+  // A funnel over an open box on hilly terrain, for the demo toggle and
+  // the benchmark.
+  static ObstacleField demoLevel();
+
+  // Evaluate the distance field for the current shapes. Must be called
+  // after adding shapes and before sample().
+  void bake();
+
+  bool empty() const { return segments_.empty() && polygons_.empty(); }
+  bool baked() const { return !nodes_.empty(); }
+
+  // Signed distance at (x, y), clamped into the world, and its gradient
+  // (not normalised) in gx/gy.
+  float sample(float x, float y, float &gx, float &gy) const {
+    float fx = x * invCell_, fy = y * invCell_;
+    fx = fx < 0.0f ? 0.0f : (fx > maxCell_ ? maxCell_ : fx);
+    fy = fy < 0.0f ? 0.0f : (fy > maxRow_ ? maxRow_ : fy);
+    const int cx = static_cast<int>(fx), cy = static_cast<int>(fy);
+    const float tx = fx - cx, ty = fy - cy;
+    const float *n0 = &nodes_[static_cast<std::size_t>(cy) * stride_ + cx];
+    const float *n1 = n0 + stride_;
+    const float top = n0[0] + (n0[1] - n0[0]) * tx;
+    const float bot = n1[0] + (n1[1] - n1[0]) * tx;
+    gx = ((n0[1] - n0[0]) * (1.0f - ty) + (n1[1] - n1[0]) * ty) * invCell_;
+    gy = (bot - top) * invCell_;
+    return top + (bot - top) * ty;
+  }
+
+  // Exact signed distance to the shapes (what bake() stores per node).
+  float distance(Vec2 p) const;
+
+  const std::vector<Segment> &segments() const { return segments_; }
+  const std::vector<Polygon> &polygons() const { return polygons_; }
+
+  // Bytes held by the baked grid.
+  std::size_t bytes() const { return nodes_.size() * sizeof(float); }
+
+private:
+  std::vector<Segment> segments_;
+  std::vector<Polygon> polygons_;
+
+  // (cols + 1) x (rows + 1) node distances, row-major.
+  std::vector<float> nodes_;
+  std::size_t stride_ = 0;
+  float invCell_ = 0.0f;
+  float maxCell_ = 0.0f, maxRow_ = 0.0f;  // largest valid fx / fy, < cols / rows
+};
+
+#endif
@@ -1,70 +1,472 @@
 #include "particle.h"
 
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
+template <class Self, class Fn>
+void ParticleSystem::forEachField(Self &self, Fn &&fn) {
+  fn(self.posX);  fn(self.posY);
+  fn(self.velX);  fn(self.velY);
+  fn(self.accX);  fn(self.accY);
+  fn(self.prevX); fn(self.prevY);
+  fn(self.type);
+  fn(self.material);
+  fn(self.restSteps);
+}
+
+namespace {
+
+// Non-zero entries of mask in [begin,end), none if end <= begin. Free of
+// branches and of stores, so it vectorises.
+std::size_t countMarked(const std::vector<std::uint8_t> &mask,
+                        std::size_t begin, std::size_t end) {
+  std::size_t n = 0;
+  for (std::size_t i = begin; i < end; ++i) n += mask[i] != 0;
+  return n;
+}
+
+} // namespace
+
 ParticleSystem::ParticleSystem(std::size_t initialCapacity) {
+  for (int t = 0; t < TYPE_COUNT; ++t) {
+    materials.push_back(materialFor(static_cast<ParticleType>(t)));
+  }
   reserve(initialCapacity);
 }
 
+ParticleSystem::ParticleSystem(const ParticleSystem &other)
+    : ParticleSystem(other.capacity) {
+  std::vector<const void *> from;
+  forEachField(other, [&](const auto &field) { from.push_back(field.data()); });
+  std::size_t k = 0;
+  forEachField(*this, [&](auto &field) {
+    std::memcpy(field.data(), from[k++], other.count * sizeof(field[0]));
+  });
+  count         = other.count;
+  layoutVersion = other.layoutVersion;
+  partitioned   = other.partitioned;
+  typeStart     = other.typeStart;
+  materials     = other.materials;
+  overrideIds_  = other.overrideIds_;
+}
+
+ParticleSystem::ParticleSystem(ParticleSystem &&other) noexcept
+    : ParticleSystem(0) {
+  swap(other);
+}
+
+ParticleSystem &ParticleSystem::operator=(const ParticleSystem &other) {
+  if (this != &other) {
+    ParticleSystem copy(other);
+    swap(copy);
+  }
+  return *this;
+}
+
+ParticleSystem &ParticleSystem::operator=(ParticleSystem &&other) noexcept {
+  swap(other);
+  return *this;
+}
+
+void ParticleSystem::swap(ParticleSystem &other) noexcept {
+  // The views point into the blocks, which don't move, so they swap along.
+  std::swap(posX, other.posX);   std::swap(posY, other.posY);
+  std::swap(velX, other.velX);   std::swap(velY, other.velY);
+  std::swap(accX, other.accX);   std::swap(accY, other.accY);
+  std::swap(prevX, other.prevX); std::swap(prevY, other.prevY);
+  std::swap(type, other.type);
+  std::swap(material, other.material);
+  std::swap(restSteps, other.restSteps);
+  std::swap(materials, other.materials);
+  std::swap(overrideIds_, other.overrideIds_);
+  std::swap(count, other.count);
+  std::swap(capacity, other.capacity);
+  std::swap(layoutVersion, other.layoutVersion);
+  std::swap(partitioned, other.partitioned);
+  std::swap(typeStart, other.typeStart);
+  std::swap(arena_, other.arena_);
+}
+
 void ParticleSystem::reserve(std::size_t newCapacity) {
   if (newCapacity <= capacity) return;
 
-  posX.resize(newCapacity);
-  posY.resize(newCapacity);
-  velX.resize(newCapacity);
-  velY.resize(newCapacity);
-  accX.resize(newCapacity);
-  accY.resize(newCapacity);
+  std::vector<std::size_t> elemSizes;
+  forEachField(*this, [&](const auto &field) {
+    elemSizes.push_back(sizeof(field[0]));
+  });
+  arena_.grow(elemSizes, newCapacity, count);
+  std::size_t k = 0;
+  forEachField(*this, [&](auto &field) {
+    field.attach(arena_.field(k++), newCapacity);
+  });
 
-  radius.resize(newCapacity);
-  mass.resize(newCapacity);
-  invMass.resize(newCapacity);
-  type.resize(newCapacity);
+  capacity = newCapacity;
+}
 
-  colorR.resize(newCapacity);
-  colorG.resize(newCapacity);
-  colorB.resize(newCapacity);
-  colorA.resize(newCapacity);
+std::size_t ParticleSystem::bytesPerParticle() const {
+  std::size_t bytes = 0;
+  forEachField(*this, [&](const auto &field) { bytes += sizeof(field[0]); });
+  return bytes;
+}
 
-  capacity = newCapacity;
+void ParticleSystem::clear() {
+  count = 0;
+  typeStart.fill(0);
+  ++layoutVersion;
+  // No particle refers to an override any more.
+  materials.resize(TYPE_COUNT);
+  overrideIds_.clear();
 }
 
-void ParticleSystem::clear() { count = 0; }
+void ParticleSystem::moveParticle(std::size_t from, std::size_t to) {
+  posX[to] = posX[from]; posY[to] = posY[from];
+  velX[to] = velX[from]; velY[to] = velY[from];
+  accX[to] = accX[from]; accY[to] = accY[from];
+  prevX[to] = prevX[from]; prevY[to] = prevY[from];
+  type[to]     = type[from];
+  material[to] = material[from];
+  restSteps[to] = restSteps[from];
+}
+
+std::uint16_t ParticleSystem::materialId(float r, float m, ParticleType t,
+                                         SDL_Color c) {
+  const float w = (m > 0.0f && t != TYPE_STONE) ? 1.0f / m : 0.0f;
+  const Material &base = materials[t];
+  if (r == base.radius && m == base.mass && w == base.invMass &&
+      c.r == base.color.r && c.g == base.color.g && c.b == base.color.b &&
+      c.a == base.color.a) {
+    return static_cast<std::uint16_t>(t);
+  }
+  const std::uint32_t rgba = std::uint32_t{c.r} << 24 | std::uint32_t{c.g} << 16 |
+                             std::uint32_t{c.b} << 8 | c.a;
+  const auto key = std::make_tuple(r, m, w, rgba);
+  auto it = overrideIds_.find(key);
+  if (it != overrideIds_.end()) return it->second;
+  if (materials.size() >= kNoMaterial) return kNoMaterial;
+  const auto id = static_cast<std::uint16_t>(materials.size());
+  materials.push_back({r, m, w, c});
+  overrideIds_.emplace(key, id);
+  return id;
+}
 
 std::size_t ParticleSystem::add(float x, float y, float vx, float vy,
                                 float r, float m, ParticleType t,
                                 SDL_Color c) {
+  const std::uint16_t id = materialId(r, m, t, c);
+  if (id == kNoMaterial) return count;
+  return addWithMaterial(x, y, vx, vy, t, id);
+}
+
+std::size_t ParticleSystem::add(float x, float y, float vx, float vy,
+                                ParticleType t) {
+  return addWithMaterial(x, y, vx, vy, t, static_cast<std::uint16_t>(t));
+}
+
+std::size_t ParticleSystem::addWithMaterial(float x, float y, float vx,
+                                            float vy, ParticleType t,
+                                            std::uint16_t id) {
   if (count >= capacity) {
     reserve(capacity * 2 + 1024);
   }
   std::size_t i = count;
+  if (partitioned) {
+    // Open a hole at the end of t's range: every later range hands its
+    // first particle to its end, from the last range down.
+    for (int u = TYPE_COUNT - 1; u > t; --u) {
+      if (typeStart[u] != i) moveParticle(typeStart[u], i);
+      i = typeStart[u]++;
+    }
+    ++typeStart[TYPE_COUNT];
+  }
   posX[i] = x; posY[i] = y;
   velX[i] = vx; velY[i] = vy;
   accX[i] = 0.0f; accY[i] = 0.0f;
+  prevX[i] = x; prevY[i] = y;
 
-  radius[i] = r;
-  mass[i]   = m;
-  invMass[i] = (m > 0.0f && t != TYPE_STONE) ? 1.0f / m : 0.0f;
-  type[i]   = static_cast<std::uint8_t>(t);
-
-  colorR[i] = c.r; colorG[i] = c.g; colorB[i] = c.b; colorA[i] = c.a;
+  type[i]      = static_cast<std::uint8_t>(t);
+  material[i]  = id;
+  restSteps[i] = 0;
   ++count;
+  ++layoutVersion;
   return i;
 }
 
 void ParticleSystem::removeSwap(std::size_t i) {
   if (i >= count) return;
-  std::size_t last = count - 1;
-  if (i != last) {
-    posX[i] = posX[last]; posY[i] = posY[last];
-    velX[i] = velX[last]; velY[i] = velY[last];
-    accX[i] = accX[last]; accY[i] = accY[last];
-    radius[i] = radius[last];
-    mass[i]   = mass[last];
-    invMass[i] = invMass[last];
-    type[i]   = type[last];
-    colorR[i] = colorR[last]; colorG[i] = colorG[last];
-    colorB[i] = colorB[last]; colorA[i] = colorA[last];
+  if (partitioned) {
+    // Fill i from the end of its own range, then close the hole that
+    // leaves by moving each later range's last particle to its front.
+    const int t = type[i];
+    std::size_t hole = typeStart[t + 1] - 1;
+    if (hole != i) moveParticle(hole, i);
+    for (int u = t + 1; u < TYPE_COUNT; ++u) {
+      const std::size_t last = typeStart[u + 1] - 1;
+      if (last != hole) moveParticle(last, hole);
+      typeStart[u] = hole;
+      hole = last;
+    }
+    --typeStart[TYPE_COUNT];
+  } else if (i != count - 1) {
+    moveParticle(count - 1, i);
   }
   --count;
+  ++layoutVersion;
+}
+
+bool ParticleSystem::preferSwapRemoval(std::size_t victims, std::size_t tail,
+                                       std::size_t moved) const {
+  // Costs measured with the erase benchmark on 1M particles, in units of
+  // one particle gathered by the compaction (about 5 ns). Both paths scan
+  // the tail's mask, the compaction twice. A removeSwap costs about 3,
+  // since its moves land in random places, and about 6 with partitioning,
+  // where it also moves a particle per later type range. Swapping wins
+  // below roughly a quarter of the tail removed, a tenth by type.
+  const float perVictim   = partitioned ? 6.0f : 3.0f;
+  const float swapCost    = 0.25f * tail + perVictim * victims;
+  const float compactCost = 0.4f * tail + moved;
+  return swapCost < compactCost;
+}
+
+std::size_t ParticleSystem::removeSwapped(const std::vector<std::uint8_t> &mask,
+                                          std::size_t first) {
+  // Highest index first: everything above i is a survivor by then, so
+  // removeSwap fills i from there and leaves the lower victims in place.
+  const std::size_t before = count;
+  for (std::size_t i = count; i-- > first;) {
+    if (mask[i]) removeSwap(i);
+  }
+  return before - count;
+}
+
+std::size_t ParticleSystem::removeMask(const std::vector<std::uint8_t> &mask) {
+  return removeMaskImpl(mask, nullptr, 0, nullptr);
+}
+
+std::size_t ParticleSystem::removeMask(const std::vector<std::uint8_t> &mask,
+                                       ThreadPool &pool, std::size_t minChunk,
+                                       ParticleSystem &scratch) {
+  return removeMaskImpl(mask, &pool, minChunk, &scratch);
+}
+
+std::size_t ParticleSystem::removeMaskImpl(const std::vector<std::uint8_t> &mask,
+                                           ThreadPool *pool,
+                                           std::size_t minChunk,
+                                           ParticleSystem *scratch) {
+  // Nothing before the first victim moves.
+  std::size_t first = 0;
+  while (first < count && !mask[first]) ++first;
+  if (first == count) return 0;
+  const std::size_t tail = count - first;
+
+  auto forRange = [pool](std::size_t total, std::size_t chunk,
+                         const ThreadPool::RangeFn &fn) {
+    if (pool) {
+      pool->parallelFor(total, chunk, fn);
+    } else {
+      fn(0, total);
+    }
+  };
+  const std::size_t maxChunks =
+      std::max<std::size_t>(1, tail / std::max<std::size_t>(1, minChunk));
+  const std::size_t wanted =
+      pool ? std::min<std::size_t>(std::max(1u, pool->size()), maxChunks) : 1;
+  const std::size_t chunk = (tail + wanted - 1) / wanted;
+  // Rounding the chunk up can cover the tail in fewer chunks than wanted
+  // (5 particles in 4 chunks of 2); a chunk starting past the end would
+  // count negative survivors.
+  const std::size_t numChunks = (tail + chunk - 1) / chunk;
+
+  // 1. Survivors per chunk of the tail, and the victims per type that
+  // finishRemoval needs with partitioning. Type ranges are contiguous
+  // then, so each is counted over its piece of the chunk; without them
+  // only the total matters and it goes in removed[0].
+  std::vector<std::size_t> offset(numChunks + 1, 0);
+  std::vector<std::array<std::size_t, TYPE_COUNT>> removedIn(numChunks);
+  forRange(numChunks, 1, [&](std::size_t cb, std::size_t ce) {
+    for (std::size_t c = cb; c < ce; ++c) {
+      const std::size_t b = first + c * chunk;
+      const std::size_t e = std::min(b + chunk, count);
+      std::array<std::size_t, TYPE_COUNT> removed{};
+      if (partitioned) {
+        for (int t = 0; t < TYPE_COUNT; ++t) {
+          removed[t] = countMarked(mask, std::max(b, typeStart[t]),
+                                   std::min(e, typeStart[t + 1]));
+        }
+      } else {
+        removed[0] = countMarked(mask, b, e);
+      }
+      std::size_t victims = 0;
+      for (std::size_t n : removed) victims += n;
+      offset[c + 1] = (e - b) - victims;
+      removedIn[c]  = removed;
+    }
+  });
+
+  // 2. Prefix sum: chunk c's survivors go to first + offset[c] onwards.
+  std::array<std::size_t, TYPE_COUNT> removed{};
+  for (std::size_t c = 0; c < numChunks; ++c) {
+    offset[c + 1] += offset[c];
+    for (int t = 0; t < TYPE_COUNT; ++t) removed[t] += removedIn[c][t];
+  }
+  const std::size_t kept = offset[numChunks];
+  // Gathering into the scratch store copies the untouched prefix as well,
+  // but splits the copying over the workers; sliding the survivors down
+  // in place moves only the tail, on one thread. Take the cheaper one,
+  // counting only the workers the machine can run at once.
+  const std::size_t workers =
+      pool ? std::max(1u, std::min(pool->size(),
+                                   std::thread::hardware_concurrency()))
+           : 1;
+  if (scratch && first + kept >= kept * workers) scratch = nullptr;
+  const std::size_t moved = scratch ? (first + kept) / workers : kept;
+  if (preferSwapRemoval(tail - kept, tail, moved)) {
+    return removeSwapped(mask, first);
+  }
+
+  // 3. Source index of every survivor, the untouched prefix included when
+  // gathering into the scratch store. Each index is written and then kept
+  // or overwritten depending on the mask, since a branch on a random mask
+  // mispredicts about every other particle. Stopping after the chunk's
+  // last survivor keeps those writes inside the chunk's own output.
+  const std::size_t base = scratch ? first : 0;
+  std::vector<std::uint32_t> keep(base + kept);
+  if (scratch) std::iota(keep.begin(), keep.begin() + first, 0u);
+  forRange(numChunks, 1, [&](std::size_t cb, std::size_t ce) {
+    for (std::size_t c = cb; c < ce; ++c) {
+      const std::size_t b = first + c * chunk;
+      std::size_t e = std::min(b + chunk, count);
+      while (e > b && mask[e - 1]) --e;
+      std::uint32_t *out = keep.data() + base + offset[c];
+      std::size_t n = 0;
+      for (std::size_t i = b; i < e; ++i) {
+        out[n] = static_cast<std::uint32_t>(i);
+        n += !mask[i];
+      }
+    }
+  });
+
+  if (!scratch) {
+    // 4. Slide each field's survivors down over the gaps. keep[k] >= first
+    // + k, so every slot is read before it is overwritten.
+    const std::uint32_t *src = keep.data();
+    forEachField(*this, [&](auto &field) {
+      auto *f = field.data();
+      for (std::size_t k = 0; k < kept; ++k) f[first + k] = f[src[k]];
+    });
+    return finishRemoval(first + kept, removed);
+  }
+
+  // 4. Gather the survivors into the scratch store by particle range, then
+  // hand its arrays over and keep ours for the next removal.
+  scratch->reserve(capacity);
+  scratch->count         = count;
+  scratch->layoutVersion = layoutVersion;
+  scratch->partitioned   = partitioned;
+  scratch->typeStart     = typeStart;
+  scratch->copyMaterialsFrom(*this);
+  const std::size_t total = first + kept;
+  const std::size_t gatherChunks =
+      std::min(numChunks, std::max<std::size_t>(
+                              1, total / std::max<std::size_t>(1, minChunk)));
+  const std::uint32_t *order = keep.data();
+  forRange(total, (total + gatherChunks - 1) / gatherChunks,
+           [&](std::size_t b, std::size_t e) {
+             scratch->gatherFrom(*this, order, b, e);
+           });
+  swap(*scratch);
+  return finishRemoval(total, removed);
+}
+
+std::size_t ParticleSystem::finishRemoval(
+    std::size_t kept, const std::array<std::size_t, TYPE_COUNT> &removed) {
+  if (partitioned) {
+    // Each range start moves down by the victims of every earlier type.
+    std::size_t below = 0;
+    for (int t = 0; t < TYPE_COUNT; ++t) {
+      typeStart[t] -= below;
+      below += removed[t];
+    }
+    typeStart[TYPE_COUNT] = kept;
+  }
+  const std::size_t n = count - kept;
+  count = kept;
+  ++layoutVersion;
+  return n;
+}
+
+void ParticleSystem::setPartitioned(bool on) {
+  if (on == partitioned) return;
+  partitioned = on;
+  if (!on) return;
+
+  // Stable counting sort by type.
+  std::array<std::size_t, TYPE_COUNT + 1> start{};
+  for (std::size_t i = 0; i < count; ++i) ++start[type[i] + 1];
+  for (int t = 0; t < TYPE_COUNT; ++t) start[t + 1] += start[t];
+  typeStart = start;
+  std::vector<std::uint32_t> order(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    order[start[type[i]]++] = static_cast<std::uint32_t>(i);
+  }
+
+  ParticleSystem sorted(capacity);
+  sorted.copyMaterialsFrom(*this);
+  sorted.gatherFrom(*this, order.data(), 0, count);
+  sorted.count         = count;
+  sorted.partitioned   = true;
+  sorted.typeStart     = typeStart;
+  sorted.layoutVersion = layoutVersion + 1;
+  *this = std::move(sorted);
+}
+
+void ParticleSystem::gatherFrom(const ParticleSystem &src,
+                                const std::uint32_t *order,
+                                std::size_t begin, std::size_t end) {
+  for (std::size_t k = begin; k < end; ++k) {
+    const std::uint32_t j = order[k];
+    posX[k] = src.posX[j]; posY[k] = src.posY[j];
+    velX[k] = src.velX[j]; velY[k] = src.velY[j];
+    accX[k] = src.accX[j]; accY[k] = src.accY[j];
+    prevX[k] = src.prevX[j]; prevY[k] = src.prevY[j];
+    type[k]      = src.type[j];
+    material[k]  = src.material[j];
+    restSteps[k] = src.restSteps[j];
+  }
+}
+
+void ParticleSystem::copyMaterialsFrom(const ParticleSystem &src) {
+  materials    = src.materials;
+  overrideIds_ = src.overrideIds_;
+}
+
+void ParticleSystem::storePreviousPositions() {
+  std::copy(posX.begin(), posX.begin() + count, prevX.begin());
+  std::copy(posY.begin(), posY.begin() + count, prevY.begin());
+}
+
+std::uint64_t ParticleSystem::stateHash() const {
+  // FNV-1a over 32-bit words rather than bytes, a quarter of the
+  // multiplies for a few megabytes per frame.
+  std::uint64_t h = 14695981039346656037ull;
+  auto mix = [&h](std::uint32_t w) { h = (h ^ w) * 1099511628211ull; };
+  mix(static_cast<std::uint32_t>(count));
+  for (const ArenaArray<float> *f : {&posX, &posY, &velX, &velY}) {
+    const float *v = f->data();
+    for (std::size_t i = 0; i < count; ++i) {
+      std::uint32_t w;
+      std::memcpy(&w, &v[i], sizeof w);
+      mix(w);
+    }
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    mix(static_cast<std::uint32_t>(type[i]) << 16 | restSteps[i]);
+    mix(material[i]);
+  }
+  return h;
 }
 
 const char *particleTypeName(ParticleType t) {
@@ -78,6 +480,16 @@ const char *particleTypeName(ParticleType t) {
   }
 }
 
+Material materialFor(ParticleType t) {
+  float mass = cfg::DEFAULT_MASS;
+  float radius = cfg::DEFAULT_RADIUS;
+  if (t == TYPE_STONE)   { mass = 8.0f; radius = cfg::DEFAULT_RADIUS * 1.6f; }
+  else if (t == TYPE_GAS){ mass = 0.5f; }
+  else if (t == TYPE_LIQUID) { mass = 0.9f; }
+  const float invMass = t == TYPE_STONE ? 0.0f : 1.0f / mass;
+  return {radius, mass, invMass, particleTypeColor(t)};
+}
+
 SDL_Color particleTypeColor(ParticleType t) {
   switch (t) {
     case TYPE_LIQUID: return {  40, 130, 255, 255 };
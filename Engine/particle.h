@@ -2,16 +2,37 @@
 #define PARTICLE_H
 
 #include "config.h"
+#include "soa_arena.h"
 #include "vec2.h"
 
 #include <SDL2/SDL.h>
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <map>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
+class ThreadPool;
+
 // ---------------------------------------------------------------------------
 // Structure-of-Arrays particle store. Splitting the data this way lets the
 // physics loops walk contiguous floats which is friendlier to the cache and
 // to auto-vectorisation than an array of fat structs would be.
+//
+// All the arrays live in one SoaArena block, each on its own
+// cfg::SOA_ALIGNMENT boundary. Growing moves just the live particles, so a
+// spawn burst that outgrows the capacity costs one copy of what exists
+// rather than reallocating and zero-filling every array. Copies are deep;
+// moves and swaps hand the block over.
+//
+// Radius, mass and colour are not stored per particle. Each particle holds
+// a 16-bit index into `materials`, a small table whose first TYPE_COUNT
+// entries are the types' defaults (materialFor). A particle added with
+// anything else gets an override entry after those, shared with every
+// other particle added with the same values, so only the particles that
+// differ cost anything beyond their index.
 // ---------------------------------------------------------------------------
 
 enum ParticleType : std::uint8_t {
@@ -26,42 +47,196 @@ enum ParticleType : std::uint8_t {
 const char *particleTypeName(ParticleType t);
 SDL_Color   particleTypeColor(ParticleType t);
 
+struct Material {
+  float     radius;
+  float     mass;
+  float     invMass;   // 0 for kinematic/stone particles
+  SDL_Color color;
+};
+
+// A type's default radius, mass and colour: what the brush and random
+// scenes spawn.
+Material materialFor(ParticleType t);
+
 class ParticleSystem {
 public:
   // Kinematics
-  std::vector<float> posX, posY;
-  std::vector<float> velX, velY;
-  std::vector<float> accX, accY;       // accumulator for the force phase
+  ArenaArray<float> posX, posY;
+  ArenaArray<float> velX, velY;
+  ArenaArray<float> accX, accY;       // accumulator for the force phase
+  ArenaArray<float> prevX, prevY;     // position before the last step
 
   // Material
-  std::vector<float>         radius;
-  std::vector<float>         mass;
-  std::vector<float>         invMass;  // 0 for kinematic/stone particles
-  std::vector<std::uint8_t>  type;     // ParticleType
+  ArenaArray<std::uint8_t>  type;      // ParticleType
+  ArenaArray<std::uint16_t> material;  // index into `materials`
 
-  // Colour (packed as 4 separate channel arrays so the renderer can
-  // build vertex buffers quickly).
-  std::vector<std::uint8_t> colorR, colorG, colorB, colorA;
+  // Sleep bookkeeping: consecutive substeps spent below cfg::SLEEP_SPEED.
+  // A particle at or past cfg::SLEEP_SUBSTEPS is asleep.
+  ArenaArray<std::uint16_t> restSteps;
+
+  // materialFor(t) at index t, then the overrides in the order they were
+  // first needed. Only ever appended to, except by clear().
+  std::vector<Material> materials;
 
   std::size_t count    = 0;
   std::size_t capacity = 0;
 
+  // Bumped whenever particles are added, removed or permuted, so caches
+  // keyed by particle index (e.g. Verlet lists) can tell they are stale.
+  std::uint64_t layoutVersion = 0;
+
+  // Optional type partitioning: while `partitioned` is set, particles of
+  // type t occupy [typeStart[t], typeStart[t + 1]) and add/removeSwap keep
+  // it that way in O(TYPE_COUNT) moves. Turn it on with setPartitioned(),
+  // which sorts the particles by type first.
+  bool partitioned = false;
+  std::array<std::size_t, TYPE_COUNT + 1> typeStart{};
+
   explicit ParticleSystem(std::size_t initialCapacity = cfg::INITIAL_CAPACITY);
 
+  ParticleSystem(const ParticleSystem &other);
+  ParticleSystem(ParticleSystem &&other) noexcept;
+  ParticleSystem &operator=(const ParticleSystem &other);
+  ParticleSystem &operator=(ParticleSystem &&other) noexcept;
+
+  void swap(ParticleSystem &other) noexcept;
+
   void reserve(std::size_t newCapacity);
   void clear();
   std::size_t size() const { return count; }
 
-  // Returns the index of the new particle, or count (== failure) if at cap.
+  // Storage per particle slot, summed over the per-particle arrays.
+  std::size_t bytesPerParticle() const;
+
+  // Returns the index of the new particle, or count (== failure) if at cap
+  // or, for the first overload, if the material table is full.
   std::size_t add(float x, float y, float vx, float vy,
                   float r, float m, ParticleType t, SDL_Color c);
 
-  // Remove particle at index by swapping with the last; O(1).
+  // Same, with t's default material.
+  std::size_t add(float x, float y, float vx, float vy, ParticleType t);
+
+  // Remove particle at index by swapping with the last; O(1). With
+  // partitioning the hole is filled from the end of its type's range and
+  // passed down the later ranges instead. Either way, only particles after
+  // `index` (or the one moved into it) change position.
   void removeSwap(std::size_t index);
 
+  // Remove every particle i < count whose mask[i] is non-zero; returns the
+  // number removed. Many victims are removed by stream compaction, which
+  // moves each survivor after the first victim once and keeps their
+  // order. A few are swapped out with removeSwap instead, which costs per
+  // victim rather than per survivor but reorders. Type ranges stay intact
+  // either way.
+  std::size_t removeMask(const std::vector<std::uint8_t> &mask);
+
+  // Same result as a parallel stream compaction: survivors are counted per
+  // chunk and a prefix sum gives each chunk its output offset. Each chunk
+  // then gathers its survivors into `scratch`, which is swapped in, so
+  // the old arrays become the scratch for next time.
+  std::size_t removeMask(const std::vector<std::uint8_t> &mask,
+                         ThreadPool &pool, std::size_t minChunk,
+                         ParticleSystem &scratch);
+
+  // Switch type partitioning on (stable sort by type, bumps layoutVersion)
+  // or off (just drops the bookkeeping).
+  void setPartitioned(bool on);
+
+  // Call fn(std::integral_constant<ParticleType, T>{}, b, e) for each piece
+  // of [begin,end) inside type T's range, so fn can instantiate a kernel
+  // for T. Only valid while `partitioned`.
+  template <class Fn>
+  void forEachTypeRange(std::size_t begin, std::size_t end, Fn &&fn) const;
+
+  // Copy particle order[k] of `src` into slot k for every k in [begin,end).
+  // Building a permuted copy this way lets callers split the gather across
+  // threads; the destination must already have capacity for the full range
+  // and src's material table (copyMaterialsFrom).
+  void gatherFrom(const ParticleSystem &src, const std::uint32_t *order,
+                  std::size_t begin, std::size_t end);
+
+  // Take over src's material table, overrides included.
+  void copyMaterialsFrom(const ParticleSystem &src);
+
+  // Copy posX/posY into prevX/prevY, so the renderer can interpolate
+  // between the previous and the current step.
+  void storePreviousPositions();
+
+  // Order-sensitive 64-bit hash of the count and the exact bits of every
+  // particle's position, velocity, type, material id and rest counter.
+  // Two systems with the same hash are, for every practical purpose,
+  // bit-identical.
+  std::uint64_t stateHash() const;
+
   // Light read-only accessors so external code stays readable.
   Vec2 position(std::size_t i) const { return {posX[i], posY[i]}; }
   Vec2 velocity(std::size_t i) const { return {velX[i], velY[i]}; }
+  bool asleep(std::size_t i) const { return restSteps[i] >= cfg::SLEEP_SUBSTEPS; }
+
+  float radius(std::size_t i) const { return materials[material[i]].radius; }
+  float mass(std::size_t i) const { return materials[material[i]].mass; }
+  float invMass(std::size_t i) const { return materials[material[i]].invMass; }
+  SDL_Color color(std::size_t i) const { return materials[material[i]].color; }
+
+private:
+  // Copy every field of particle `from` into slot `to`.
+  void moveParticle(std::size_t from, std::size_t to);
+
+  SoaArena arena_;   // backs every field above
+
+  // Override entries of `materials` by their values, for sharing.
+  std::map<std::tuple<float, float, float, std::uint32_t>, std::uint16_t>
+      overrideIds_;
+
+  // Index of the entry for these values: t's default if they match it,
+  // else an override, added if need be. kNoMaterial when the table is full.
+  static constexpr std::uint16_t kNoMaterial = 0xFFFF;
+  std::uint16_t materialId(float r, float m, ParticleType t, SDL_Color c);
+
+  std::size_t addWithMaterial(float x, float y, float vx, float vy,
+                              ParticleType t, std::uint16_t id);
+
+  // Call fn(field) for every per-particle array of `self`, in arena order.
+  template <class Self, class Fn>
+  static void forEachField(Self &self, Fn &&fn);
+
+  std::size_t removeMaskImpl(const std::vector<std::uint8_t> &mask,
+                             ThreadPool *pool, std::size_t minChunk,
+                             ParticleSystem *scratch);
+
+  // Whether removing `victims` particles out of the `tail` from the first
+  // victim on is cheaper with removeSwap than with a compaction that
+  // moves `moved` particles.
+  bool preferSwapRemoval(std::size_t victims, std::size_t tail,
+                         std::size_t moved) const;
+
+  // removeMask's few-victims path: removeSwap every marked particle from
+  // the top down to `first`.
+  std::size_t removeSwapped(const std::vector<std::uint8_t> &mask,
+                            std::size_t first);
+
+  // Bookkeeping after a removeMask compaction down to `kept` particles,
+  // `removed[t]` of them of type t. Returns the number removed.
+  std::size_t finishRemoval(std::size_t kept,
+                            const std::array<std::size_t, TYPE_COUNT> &removed);
 };
 
+template <class Fn>
+void ParticleSystem::forEachTypeRange(std::size_t begin, std::size_t end,
+                                      Fn &&fn) const {
+  for (int t = 0; t < TYPE_COUNT; ++t) {
+    const std::size_t b = std::max(begin, typeStart[t]);
+    const std::size_t e = std::min(end, typeStart[t + 1]);
+    if (b >= e) continue;
+    switch (t) {
+      case TYPE_DEFAULT: fn(std::integral_constant<ParticleType, TYPE_DEFAULT>{}, b, e); break;
+      case TYPE_LIQUID:  fn(std::integral_constant<ParticleType, TYPE_LIQUID>{},  b, e); break;
+      case TYPE_SAND:    fn(std::integral_constant<ParticleType, TYPE_SAND>{},    b, e); break;
+      case TYPE_GAS:     fn(std::integral_constant<ParticleType, TYPE_GAS>{},     b, e); break;
+      case TYPE_STONE:   fn(std::integral_constant<ParticleType, TYPE_STONE>{},   b, e); break;
+      default: break;
+    }
+  }
+}
+
 #endif
@@ -0,0 +1,234 @@
+#include "particle_mesh.h"
+
+#include "config.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Cloud-in-cell stencil of a position: the lower of the two cells on each
+// axis whose centres bracket it, and the weight of the upper one. Positions
+// outside the grid are clamped onto the border cells.
+struct Stencil {
+  int   x0, y0;
+  float fx, fy;
+};
+
+inline Stencil stencilAt(float x, float y, float invCell, int n) {
+  const float gx = std::clamp(x * invCell - 0.5f, 0.0f, n - 1.0f);
+  const float gy = std::clamp(y * invCell - 0.5f, 0.0f, n - 1.0f);
+  Stencil s;
+  s.x0 = std::min(static_cast<int>(gx), n - 2);
+  s.y0 = std::min(static_cast<int>(gy), n - 2);
+  s.fx = gx - s.x0;
+  s.fy = gy - s.y0;
+  return s;
+}
+
+} // namespace
+
+void ParticleMesh::FftPlan::init(std::size_t n) {
+  if (length == n) return;
+  length = n;
+  int bits = 0;
+  while ((std::size_t{1} << bits) < n) ++bits;
+  bitReverse.resize(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    std::uint32_t r = 0;
+    for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1u) << (bits - 1 - b);
+    bitReverse[i] = r;
+  }
+  twiddle.resize(n / 2);
+  for (std::size_t k = 0; k < n / 2; ++k) {
+    const double a = -2.0 * 3.14159265358979323846 * k / n;
+    twiddle[k] = Complex(static_cast<float>(std::cos(a)),
+                         static_cast<float>(std::sin(a)));
+  }
+}
+
+void ParticleMesh::FftPlan::run(Complex *a, bool inverse) const {
+  const std::size_t n = length;
+  for (std::size_t i = 0; i < n; ++i) {
+    const std::size_t j = bitReverse[i];
+    if (i < j) std::swap(a[i], a[j]);
+  }
+  for (std::size_t len = 2; len <= n; len <<= 1) {
+    const std::size_t half = len / 2;
+    const std::size_t step = n / len;
+    for (std::size_t i = 0; i < n; i += len) {
+      for (std::size_t k = 0; k < half; ++k) {
+        Complex w = twiddle[k * step];
+        if (inverse) w = std::conj(w);
+        const Complex u = a[i + k];
+        const Complex v = a[i + k + half] * w;
+        a[i + k]        = u + v;
+        a[i + k + half] = u - v;
+      }
+    }
+  }
+}
+
+void ParticleMesh::resize(int n) {
+  if (n == n_) return;
+  n_    = n;
+  cell_ = std::max(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT) / n;
+  const std::size_t m = 2 * static_cast<std::size_t>(n);
+  plan_.init(m);
+  work_.assign(m * m, Complex(0.0f, 0.0f));
+  forceX_.assign(static_cast<std::size_t>(n) * n, 0.0f);
+  forceY_.assign(static_cast<std::size_t>(n) * n, 0.0f);
+
+  // Softened potential of a unit mass at every offset of the padded grid,
+  // wrapped so negative offsets sit at the far end, then transformed. The
+  // inverse FFT's 1 / m^2 is folded in here.
+  constexpr float eps2 = cfg::GRAVITY_SOFTENING * cfg::GRAVITY_SOFTENING;
+  kernelHat_.resize(m * m);
+  const float norm = 1.0f / static_cast<float>(m * m);
+  for (std::size_t r = 0; r < m; ++r) {
+    const float dy = static_cast<float>(std::min(r, m - r)) * cell_;
+    for (std::size_t c = 0; c < m; ++c) {
+      const float dx = static_cast<float>(std::min(c, m - c)) * cell_;
+      kernelHat_[r * m + c] =
+          Complex(-norm / std::sqrt(dx * dx + dy * dy + eps2), 0.0f);
+    }
+  }
+  std::vector<Complex> column(m);
+  for (std::size_t r = 0; r < m; ++r) plan_.run(&kernelHat_[r * m], false);
+  for (std::size_t c = 0; c < m; ++c) {
+    for (std::size_t r = 0; r < m; ++r) column[r] = kernelHat_[r * m + c];
+    plan_.run(column.data(), false);
+    for (std::size_t r = 0; r < m; ++r) kernelHat_[r * m + c] = column[r];
+  }
+}
+
+void ParticleMesh::build(const ParticleSystem &p, int gridSize) {
+  buildImpl(p, gridSize, nullptr, cfg::MIN_PARTICLES_PER_THREAD);
+}
+
+void ParticleMesh::build(const ParticleSystem &p, int gridSize,
+                         ThreadPool &pool, std::size_t minChunk) {
+  buildImpl(p, gridSize, &pool, minChunk);
+}
+
+void ParticleMesh::buildImpl(const ParticleSystem &p, int gridSize,
+                             ThreadPool *pool, std::size_t minChunk) {
+  int n = cfg::PM_MIN_GRID_SIZE;
+  while (n < gridSize && n < cfg::PM_MAX_GRID_SIZE) n *= 2;
+  resize(n);
+
+  const std::size_t N = p.count;
+  const std::size_t cells = static_cast<std::size_t>(n) * n;
+  const std::size_t m = 2 * static_cast<std::size_t>(n);
+  const float invCell = 1.0f / cell_;
+
+  auto forRange = [pool](std::size_t total, std::size_t chunk,
+                         const ThreadPool::RangeFn &fn) {
+    if (pool) {
+      pool->parallelFor(total, chunk, fn);
+    } else {
+      fn(0, total);
+    }
+  };
+
+  // 1. Deposit: one private grid per chunk of particles. The chunks depend
+  // on N and minChunk only, never on the pool, so every cell is summed in
+  // the same order and the field is bit-identical on any thread count.
+  const std::size_t numChunks = std::clamp<std::size_t>(
+      N / std::max<std::size_t>(1, minChunk), 1, cfg::PM_DEPOSIT_GRIDS);
+  const std::size_t chunk = (N + numChunks - 1) / numChunks;
+  chunkMass_.resize(numChunks * cells);
+  forRange(numChunks, 1, [&](std::size_t cb, std::size_t ce) {
+    for (std::size_t c = cb; c < ce; ++c) {
+      float *grid = &chunkMass_[c * cells];
+      std::fill(grid, grid + cells, 0.0f);
+      const std::size_t b = c * chunk;
+      const std::size_t e = std::min(b + chunk, N);
+      for (std::size_t i = b; i < e; ++i) {
+        if (p.type[i] == TYPE_STONE) continue;
+        const Stencil s = stencilAt(p.posX[i], p.posY[i], invCell, n);
+        const float m0 = p.mass(i);
+        float *row0 = grid + static_cast<std::size_t>(s.y0) * n + s.x0;
+        float *row1 = row0 + n;
+        row0[0] += m0 * (1.0f - s.fx) * (1.0f - s.fy);
+        row0[1] += m0 * s.fx * (1.0f - s.fy);
+        row1[0] += m0 * (1.0f - s.fx) * s.fy;
+        row1[1] += m0 * s.fx * s.fy;
+      }
+    }
+  });
+
+  // 2. Sum the chunk grids into the padded work grid and transform its
+  // rows. Rows n..2n-1 hold no mass and stay zero through the row pass.
+  forRange(m, 1, [&](std::size_t rb, std::size_t re) {
+    for (std::size_t r = rb; r < re; ++r) {
+      Complex *row = &work_[r * m];
+      std::fill(row, row + m, Complex(0.0f, 0.0f));
+      if (r >= static_cast<std::size_t>(n)) continue;
+      for (std::size_t x = 0; x < static_cast<std::size_t>(n); ++x) {
+        float sum = 0.0f;
+        for (std::size_t c = 0; c < numChunks; ++c) {
+          sum += chunkMass_[c * cells + r * n + x];
+        }
+        row[x] = Complex(sum, 0.0f);
+      }
+      plan_.run(row, false);
+    }
+  });
+
+  // 3. Columns: forward transform, multiply by the kernel, back again.
+  forRange(m, 1, [&](std::size_t cb, std::size_t ce) {
+    std::vector<Complex> column(m);
+    for (std::size_t c = cb; c < ce; ++c) {
+      for (std::size_t r = 0; r < m; ++r) column[r] = work_[r * m + c];
+      plan_.run(column.data(), false);
+      for (std::size_t r = 0; r < m; ++r) column[r] *= kernelHat_[r * m + c];
+      plan_.run(column.data(), true);
+      for (std::size_t r = 0; r < m; ++r) work_[r * m + c] = column[r];
+    }
+  });
+
+  // 4. Inverse row transforms, only for the rows the world covers, then
+  // the potential's gradient by central differences (one-sided at the
+  // border). The acceleration is minus the gradient.
+  forRange(n, 1, [&](std::size_t rb, std::size_t re) {
+    for (std::size_t r = rb; r < re; ++r) plan_.run(&work_[r * m], true);
+  });
+  const float inv2h = 0.5f * invCell;
+  forRange(n, 1, [&](std::size_t rb, std::size_t re) {
+    for (std::size_t r = rb; r < re; ++r) {
+      const std::size_t up   = r > 0 ? r - 1 : r;
+      const std::size_t down = r + 1 < static_cast<std::size_t>(n) ? r + 1 : r;
+      const float yScale = inv2h * (r > 0 && down != r ? 1.0f : 2.0f);
+      for (std::size_t x = 0; x < static_cast<std::size_t>(n); ++x) {
+        const std::size_t left  = x > 0 ? x - 1 : x;
+        const std::size_t right = x + 1 < static_cast<std::size_t>(n) ? x + 1 : x;
+        const float xScale = inv2h * (x > 0 && right != x ? 1.0f : 2.0f);
+        forceX_[r * n + x] = -(work_[r * m + right].real() -
+                               work_[r * m + left].real()) * xScale;
+        forceY_[r * n + x] = -(work_[down * m + x].real() -
+                               work_[up * m + x].real()) * yScale;
+      }
+    }
+  });
+}
+
+void ParticleMesh::accumulate(ParticleSystem &p, float scale,
+                              std::size_t begin, std::size_t end) const {
+  const int n = n_;
+  const float invCell = 1.0f / cell_;
+  for (std::size_t i = begin; i < end; ++i) {
+    if (p.type[i] == TYPE_STONE) continue;
+    const Stencil s = stencilAt(p.posX[i], p.posY[i], invCell, n);
+    const std::size_t k = static_cast<std::size_t>(s.y0) * n + s.x0;
+    const float w00 = (1.0f - s.fx) * (1.0f - s.fy);
+    const float w10 = s.fx * (1.0f - s.fy);
+    const float w01 = (1.0f - s.fx) * s.fy;
+    const float w11 = s.fx * s.fy;
+    p.accX[i] += scale * (w00 * forceX_[k] + w10 * forceX_[k + 1] +
+                          w01 * forceX_[k + n] + w11 * forceX_[k + n + 1]);
+    p.accY[i] += scale * (w00 * forceY_[k] + w10 * forceY_[k + 1] +
+                          w01 * forceY_[k + n] + w11 * forceY_[k + n + 1]);
+  }
+}
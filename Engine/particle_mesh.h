@@ -0,0 +1,89 @@
+#ifndef PARTICLE_MESH_H
+#define PARTICLE_MESH_H
+
+#include "particle.h"
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// ---------------------------------------------------------------------------
+// Particle-mesh (PM) solver for self-gravity.
+//
+// The world's bounding square is covered by an n x n grid of cells. Each
+// particle's mass is spread over the four cells around it with
+// cloud-in-cell weights; the potential is the grid mass convolved with the
+// softened point-mass potential -1 / sqrt(r^2 + eps^2); its gradient at
+// the cell centres is the acceleration, which is read back at each
+// particle with the same four weights.
+//
+// The convolution is done with FFTs on a 2n x 2n grid: the mass occupies
+// one quadrant and the rest is zero, which keeps the solution free of the
+// periodic images an n x n FFT would add (isolated boundaries), so the
+// result approximates the same free-space sum as the Barnes-Hut tree. The
+// kernel's transform is computed once per grid size. The cost is
+// O(N + n^2 log n) however the particles are spread, where the tree gets
+// slower as particles get denser or more numerous; in exchange, forces
+// are smoothed over about two cells.
+//
+// Parallel steps: each chunk of particles deposits into its own grid
+// (like the per-chunk histograms of the hash build) and the grids are
+// summed row by row; FFTs run one row or column per task; the gradient
+// and the read-back are split over rows and particles respectively. The
+// chunking is fixed by the particle count (at most cfg::PM_DEPOSIT_GRIDS
+// grids), so the serial and pooled builds give bit-identical fields
+// whatever the pool size.
+//
+// Stone is kinematic and has no finite mass, so it takes no part as a
+// source and is not accelerated.
+// ---------------------------------------------------------------------------
+
+class ParticleMesh {
+public:
+  // Solve for the current positions on a gridSize^2 mesh (a power of two
+  // in cfg::PM_MIN_GRID_SIZE..PM_MAX_GRID_SIZE, clamped otherwise).
+  void build(const ParticleSystem &p, int gridSize);
+
+  // Same field, with the deposit, the FFTs and the gradient on the pool.
+  void build(const ParticleSystem &p, int gridSize, ThreadPool &pool,
+             std::size_t minChunk);
+
+  // Add `scale` times the interpolated acceleration (per unit of G) to
+  // accX/accY of particles [begin,end). Safe to call in parallel on
+  // disjoint ranges.
+  void accumulate(ParticleSystem &p, float scale, std::size_t begin,
+                  std::size_t end) const;
+
+  int gridSize() const { return n_; }
+
+private:
+  using Complex = std::complex<float>;
+
+  // Radix-2 FFT tables for one transform length.
+  struct FftPlan {
+    std::size_t length = 0;
+    std::vector<std::uint32_t> bitReverse;
+    std::vector<Complex>       twiddle;   // exp(-2 pi i k / length), k < length/2
+
+    void init(std::size_t n);
+    void run(Complex *a, bool inverse) const;
+  };
+
+  int   n_    = 0;        // grid cells per side
+  float cell_ = 0.0f;     // cell side in world units
+  FftPlan plan_;          // length 2n
+
+  std::vector<float>   chunkMass_;   // one n x n deposit grid per chunk
+  std::vector<Complex> work_;        // 2n x 2n, row major
+  std::vector<Complex> kernelHat_;   // transform of the potential kernel
+  std::vector<float>   forceX_, forceY_;  // n x n, at cell centres
+
+  void resize(int n);
+  void buildImpl(const ParticleSystem &p, int gridSize, ThreadPool *pool,
+                 std::size_t minChunk);
+};
+
+#endif
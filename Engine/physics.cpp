@@ -4,16 +4,100 @@
 #include "forces.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <numeric>
+#include <utility>
 
-PhysicsEngine::PhysicsEngine()
-    : pool_(0) // ThreadPool default-sizes to hardware concurrency
+namespace {
+
+// Raise `target` to `v` if `v` is larger. Chunks call this once each with
+// their local maximum, so contention is negligible.
+void atomicMax(std::atomic<float> &target, float v) {
+  float cur = target.load(std::memory_order_relaxed);
+  while (v > cur &&
+         !target.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+  }
+}
+
+// Every particle's radius and inverse mass is an entry of the material
+// table, so the table's extremes bound them all without a pass over the
+// particles. Entries nobody uses any more only make the bounds looser.
+float minRadiusOf(const ParticleSystem &p) {
+  float r = INFINITY;
+  for (const Material &m : p.materials) r = std::min(r, m.radius);
+  return r;
+}
+
+float maxRadiusOf(const ParticleSystem &p) {
+  float r = 0.0f;
+  for (const Material &m : p.materials) r = std::max(r, m.radius);
+  return r;
+}
+
+float maxInvMassOf(const ParticleSystem &p) {
+  float w = 0.0f;
+  for (const Material &m : p.materials) w = std::max(w, m.invMass);
+  return w;
+}
+
+// Index of the sleep cell holding (x, y), clamped to the grid.
+std::size_t sleepCell(float x, float y, int cols, int rows) {
+  const float inv = 1.0f / cfg::SLEEP_CELL_SIZE;
+  const int cx = std::clamp(static_cast<int>(x * inv), 0, cols - 1);
+  const int cy = std::clamp(static_cast<int>(y * inv), 0, rows - 1);
+  return static_cast<std::size_t>(cy) * cols + cx;
+}
+
+// out[c] = 1 if any cell within `k` cells of c (Chebyshev distance) has
+// in[c] == want. Separable: rows into `tmp`, then columns into `out`.
+void dilateCells(const std::uint8_t *in, std::uint8_t want, std::uint8_t *out,
+                 std::vector<std::uint8_t> &tmp, int cols, int rows, int k) {
+  tmp.assign(static_cast<std::size_t>(cols) * rows, 0);
+  for (int y = 0; y < rows; ++y) {
+    const std::uint8_t *row = in + static_cast<std::size_t>(y) * cols;
+    for (int x = 0; x < cols; ++x) {
+      if (row[x] != want) continue;
+      const int x0 = std::max(0, x - k), x1 = std::min(cols - 1, x + k);
+      std::fill(tmp.begin() + static_cast<std::size_t>(y) * cols + x0,
+                tmp.begin() + static_cast<std::size_t>(y) * cols + x1 + 1,
+                std::uint8_t{1});
+    }
+  }
+  std::fill(out, out + static_cast<std::size_t>(cols) * rows, std::uint8_t{0});
+  for (int y = 0; y < rows; ++y) {
+    const int y0 = std::max(0, y - k), y1 = std::min(rows - 1, y + k);
+    for (int x = 0; x < cols; ++x) {
+      if (!tmp[static_cast<std::size_t>(y) * cols + x]) continue;
+      for (int yy = y0; yy <= y1; ++yy) out[static_cast<std::size_t>(yy) * cols + x] = 1;
+    }
+  }
+}
+
+} // namespace
+
+PhysicsEngine::PhysicsEngine(unsigned int threads)
+    : pool_(threads) // 0: ThreadPool default-sizes to hardware concurrency
 {
   hash_ = std::make_unique<SpatialHash>(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT,
                                         cfg::SPATIAL_CELL_SIZE);
+  sparseHash_ = std::make_unique<SparseSpatialHash>(cfg::SPATIAL_CELL_SIZE);
+  multiGrid_  = std::make_unique<MultiLevelGrid>(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT,
+                                                 cfg::SPATIAL_CELL_SIZE,
+                                                 cfg::GRID_LEVELS);
+  verlet_     = std::make_unique<VerletList>(cfg::VERLET_SKIN);
+  sleepCols_ = static_cast<int>(std::ceil(cfg::WORLD_WIDTH  / cfg::SLEEP_CELL_SIZE));
+  sleepRows_ = static_cast<int>(std::ceil(cfg::WORLD_HEIGHT / cfg::SLEEP_CELL_SIZE));
+  disturbed_ = std::make_unique<std::atomic<std::uint8_t>[]>(
+      static_cast<std::size_t>(sleepCols_) * sleepRows_);
+  awakeCells_ = std::make_unique<std::atomic<std::uint8_t>[]>(
+      static_cast<std::size_t>(sleepCols_) * sleepRows_);
 }
 
 std::size_t PhysicsEngine::chunkSize(std::size_t total) const {
+  if (deterministic_) return cfg::DETERMINISTIC_CHUNK;
   if (!multithreading_) return total;
   unsigned int n = pool_.size();
   if (n == 0) return total;
@@ -21,95 +105,802 @@ std::size_t PhysicsEngine::chunkSize(std::size_t total) const {
   // balanced by chunk stealing.
   std::size_t target = std::max<std::size_t>(cfg::MIN_PARTICLES_PER_THREAD,
                                              total / (n * 4 + 1));
-  return std::max<std::size_t>(1, target);
+  // Whole cache lines of floats, so every chunk of a particle array starts
+  // on an aligned line and no two chunks write into the same one.
+  constexpr std::size_t line = cfg::SOA_ALIGNMENT / sizeof(float);
+  return (target + line - 1) / line * line;
 }
 
 void PhysicsEngine::runParallel(std::size_t total,
                                 const ThreadPool::RangeFn &fn) {
   if (total == 0) return;
   if (!multithreading_) {
-    fn(0, total);
+    // Deterministic mode walks the same chunks the pool would get.
+    const std::size_t chunk = chunkSize(total);
+    for (std::size_t b = 0; b < total; b += chunk) {
+      fn(b, std::min(b + chunk, total));
+    }
     return;
   }
   pool_.parallelFor(total, chunkSize(total), fn);
 }
 
+void PhysicsEngine::reorderByCell(ParticleSystem &particles) {
+  const std::size_t N = particles.count;
+  if (activeCount_ < N) {
+    // Only the active prefix was hashed. It goes through the scratch and
+    // back, and the frozen tail stays where it is.
+    const std::size_t A = activeCount_;
+    reorderScratch_.reserve(particles.capacity);
+    reorderScratch_.count = A;
+    ParticleSystem *src = &particles;
+    ParticleSystem *dst = &reorderScratch_;
+    const std::uint32_t *order = sortedIndices_.data();
+    runParallel(A, [src, dst, order](std::size_t b, std::size_t e) {
+      dst->gatherFrom(*src, order, b, e);
+    });
+    // The slot order is the identity from here on, which is also what the
+    // copy back needs.
+    std::iota(sortedIndices_.begin(), sortedIndices_.begin() + A, 0u);
+    runParallel(A, [src, dst, order](std::size_t b, std::size_t e) {
+      src->gatherFrom(*dst, order, b, e);
+    });
+    frozenVersion_ = ++particles.layoutVersion;
+    return;
+  }
+  const std::uint32_t *order = sortedIndices_.data();
+  if (particles.partitioned) {
+    // Keep the type ranges: each range takes its particles in cell order
+    // (a stable partition of the cell order by type), and the hash's
+    // slots are pointed at where their particles end up.
+    partitionOrder_.resize(N);
+    std::array<std::size_t, TYPE_COUNT + 1> next = particles.typeStart;
+    for (std::size_t s = 0; s < N; ++s) {
+      const std::uint32_t j = sortedIndices_[s];
+      const std::size_t k = next[particles.type[j]]++;
+      partitionOrder_[k] = j;
+      sortedIndices_[s]  = static_cast<std::uint32_t>(k);
+    }
+    order = partitionOrder_.data();
+  }
+
+  permute(particles, order);
+  if (!particles.partitioned) {
+    std::iota(sortedIndices_.begin(), sortedIndices_.begin() + N, 0u);
+  }
+}
+
+void PhysicsEngine::permute(ParticleSystem &particles,
+                            const std::uint32_t *order) {
+  const std::size_t N = particles.count;
+  reorderScratch_.reserve(particles.capacity);
+  reorderScratch_.count = N;
+
+  reorderScratch_.partitioned = particles.partitioned;
+  reorderScratch_.typeStart   = particles.typeStart;
+  reorderScratch_.copyMaterialsFrom(particles);
+
+  ParticleSystem *src = &particles;
+  ParticleSystem *dst = &reorderScratch_;
+  runParallel(N, [src, dst, order](std::size_t b, std::size_t e) {
+    dst->gatherFrom(*src, order, b, e);
+  });
+
+  // The scratch now holds the reordered particles; swapping hands its
+  // storage to the caller and keeps the old arrays around for next time.
+  const std::uint64_t version = particles.layoutVersion;
+  particles.swap(reorderScratch_);
+  particles.layoutVersion = version + 1;
+}
+
+void PhysicsEngine::resolveColoured(ParticleSystem &particles) {
+  const std::size_t N = activeCount_;
+  narrowphase::ContactAccum *acc = &contactAccum_;
+  const narrowphase::SortedParticles *sp = &sortedParticles_;
+  const SpatialHash *hash = hash_.get();
+  const narrowphase::Kernel kind = narrowphase::passKernel(deterministic_);
+
+  acc->resize(N);
+  runParallel(N, [acc](std::size_t b, std::size_t e) { acc->zero(b, e); });
+
+  // Tiles of one colour never write to the same slots; colours are
+  // separated by the barrier at the end of each parallelFor.
+  for (int colour = 0; colour < 4; ++colour) {
+    runParallel(collisions::colourTileCount(*hash, colour),
+                [=](std::size_t b, std::size_t e) {
+                  collisions::resolveColourTiles(*hash, *sp, *acc, colour, b, e,
+                                                 kind);
+                });
+  }
+
+  ParticleSystem *pp = &particles;
+  runParallel(N, [pp, sp, acc](std::size_t b, std::size_t e) {
+    collisions::applyContactAccum(*pp, *sp, *acc, b, e);
+  });
+}
+
+void PhysicsEngine::resolveGaussSeidel(ParticleSystem &particles,
+                                       int iterations) {
+  narrowphase::SortedParticles *sp = &sortedParticles_;
+  const SpatialHash *hash = hash_.get();
+
+  // Same colouring as resolveColoured, but every sweep updates the
+  // snapshot in place, so each colour starts from the previous one's
+  // result.
+  for (int it = 0; it < iterations; ++it) {
+    for (int colour = 0; colour < 4; ++colour) {
+      runParallel(collisions::colourTileCount(*hash, colour),
+                  [=](std::size_t b, std::size_t e) {
+                    collisions::relaxColourTiles(*hash, *sp, colour, b, e,
+                                                 cfg::GS_POSITION_BIAS);
+                  });
+    }
+  }
+
+  ParticleSystem *pp = &particles;
+  runParallel(activeCount_, [pp, sp](std::size_t b, std::size_t e) {
+    collisions::applyRelaxedSnapshot(*pp, *sp, b, e);
+  });
+}
+
+void PhysicsEngine::applyFluidForces(ParticleSystem &particles, float dt,
+                                     PeriodicAxes wrap) {
+  const std::size_t N = activeCount_;
+  narrowphase::SortedParticles *sp = &sortedParticles_;
+  sph::Fields *f = &sphFields_;
+  const SpatialHash *hash = hash_.get();
+  f->resize(N);
+
+  // Each pass reads what the previous one wrote for the neighbours, so
+  // they are separated by the parallelFor barriers.
+  runParallel(N, [=](std::size_t b, std::size_t e) {
+    sph::computeDensity(*hash, *sp, *f, b, e, wrap);
+  });
+  runParallel(N, [=](std::size_t b, std::size_t e) {
+    sph::computeForces(*hash, *sp, *f, dt, b, e, wrap);
+  });
+  ParticleSystem *pp = &particles;
+  runParallel(N, [=](std::size_t b, std::size_t e) {
+    sph::applyForces(*pp, *sp, *f, b, e);
+  });
+}
+
+float PhysicsEngine::maxSpeedSq(const ParticleSystem &particles) {
+  std::atomic<float> peak{0.0f};
+  const ParticleSystem *pp = &particles;
+  runParallel(particles.count, [pp, &peak](std::size_t b, std::size_t e) {
+    const auto &p = *pp;
+    float m = 0.0f;
+    for (std::size_t i = b; i < e; ++i) {
+      if (p.type[i] == TYPE_STONE || p.asleep(i)) continue;
+      m = std::max(m, p.velX[i] * p.velX[i] + p.velY[i] * p.velY[i]);
+    }
+    atomicMax(peak, m);
+  });
+  return peak.load();
+}
+
+int PhysicsEngine::chooseSubsteps(const ParticleSystem &particles,
+                                  const InputState &input, float frameDt) {
+  if (!input.adaptiveSubsteps) return std::max(1, input.substeps);
+  int lo = std::max(1, input.minSubsteps);
+  const int hi = std::max(lo, input.maxSubsteps);
+  const float stepDt = frameDt * input.timeScale;
+
+  // SPH pressure is linear in density, so pressure waves travel at
+  // sqrt(SPH_STIFFNESS) whatever the particles do; a substep may carry one
+  // at most SPH_CFL_NUMBER of the smoothing length.
+  int soundSteps = 0;
+  if (gridEnabled_ && input.sphLiquid &&
+      (broadphase_ == Broadphase::UniformGrid || input.periodicX ||
+       input.periodicY)) {
+    const float perSubstep = cfg::SPH_CFL_NUMBER * cfg::SPH_SMOOTHING;
+    soundSteps = static_cast<int>(std::ceil(std::min(
+        stepDt * std::sqrt(cfg::SPH_STIFFNESS) / perSubstep,
+        static_cast<float>(hi))));
+  }
+  lo = std::max(lo, soundSteps);
+
+  // Last frame's peak is only known for the particles that existed then;
+  // after adds and removals take a fresh reduction instead.
+  float speed = peakSpeed_;
+  if (particles.layoutVersion != peakSpeedVersion_) {
+    speed = std::sqrt(maxSpeedSq(particles));
+  }
+  // An explosion adds up to its full impulse on the first substep, before
+  // any measurement could see it.
+  if (input.explodePending) {
+    speed += cfg::MOUSE_EXPLODE_IMPULSE * maxInvMassOf(particles);
+  }
+
+  const float perSubstep = cfg::CFL_NUMBER * minRadiusOf(particles);
+  if (perSubstep <= 0.0f) return hi;
+  const float travel = speed * stepDt;
+  const float needed = std::ceil(std::min(travel / perSubstep,
+                                          static_cast<float>(hi)));
+  return std::clamp(static_cast<int>(needed), lo, hi);
+}
+
+bool PhysicsEngine::queryRegion(const ParticleSystem &particles, float x,
+                                float y, float radius,
+                                std::vector<std::uint32_t> &out) const {
+  out.clear();
+  if (particles.layoutVersion != hashVersion_ ||
+      particles.count != hashCount_) {
+    return false;
+  }
+  hash_->queryCircle(x, y, radius + cfg::SPATIAL_CELL_SIZE, sortedIndices_, out);
+  return true;
+}
+
+std::size_t PhysicsEngine::removeMarked(ParticleSystem &particles,
+                                        const std::vector<std::uint8_t> &mask) {
+  if (multithreading_) {
+    return particles.removeMask(mask, pool_, cfg::MIN_PARTICLES_PER_THREAD,
+                                reorderScratch_);
+  }
+  return particles.removeMask(mask);
+}
+
+void PhysicsEngine::wakeRegion(ParticleSystem &particles, float x, float y,
+                               float radius) {
+  const float r2 = radius * radius;
+  if (queryRegion(particles, x, y, radius, region_)) {
+    for (std::uint32_t i : region_) {
+      float dx = particles.posX[i] - x;
+      float dy = particles.posY[i] - y;
+      if (dx * dx + dy * dy <= r2) particles.restSteps[i] = 0;
+    }
+    return;
+  }
+  ParticleSystem *pp = &particles;
+  runParallel(particles.count, [pp, x, y, r2](std::size_t b, std::size_t e) {
+    auto &p = *pp;
+    for (std::size_t i = b; i < e; ++i) {
+      float dx = p.posX[i] - x;
+      float dy = p.posY[i] - y;
+      if (dx * dx + dy * dy <= r2) p.restSteps[i] = 0;
+    }
+  });
+}
+
+std::size_t PhysicsEngine::countAsleep(const ParticleSystem &particles) {
+  const std::uint16_t *rest = particles.restSteps.data();
+  std::atomic<std::size_t> total{0};
+  runParallel(particles.count, [rest, &total](std::size_t b, std::size_t e) {
+    const auto n = std::count_if(rest + b, rest + e, [](std::uint16_t r) {
+      return r >= cfg::SLEEP_SUBSTEPS;
+    });
+    if (n) total.fetch_add(static_cast<std::size_t>(n), std::memory_order_relaxed);
+  });
+  return total.load();
+}
+
+void PhysicsEngine::updateSleep(ParticleSystem &particles, float maxRadius) {
+  const std::size_t N = activeCount_;
+  ParticleSystem *pp = &particles;
+  // Awake particles in these cells are within reach of the frozen tail.
+  const std::uint8_t *nearFrozen =
+      N < particles.count ? nearFrozen_.data() : nullptr;
+  std::atomic<bool> thaw{false};
+
+  // Fast particles mark every cell within contact range of them, but only
+  // if there is anyone asleep to wake. Several threads may mark the same
+  // cell, hence the (relaxed) atomic byte stores.
+  const bool mark = asleepCount_ > 0;
+  if (mark) {
+    const std::size_t cells = static_cast<std::size_t>(sleepCols_) * sleepRows_;
+    for (std::size_t c = 0; c < cells; ++c) {
+      disturbed_[c].store(0, std::memory_order_relaxed);
+    }
+  }
+  std::atomic<std::uint8_t> *marks = disturbed_.get();
+  const int cols = sleepCols_, rows = sleepRows_;
+  const float inv = 1.0f / cfg::SLEEP_CELL_SIZE;
+
+  // Count slow substeps; a particle that reaches the threshold goes to
+  // sleep at rest so neighbours see it as motionless.
+  std::atomic<std::size_t> asleepTotal{0};
+  std::atomic<bool> anyFast{false};
+  runParallel(N, [=, &asleepTotal, &anyFast, &thaw](std::size_t b, std::size_t e) {
+    auto &p = *pp;
+    const float slow2 = cfg::SLEEP_SPEED * cfg::SLEEP_SPEED;
+    const float fast2 = cfg::WAKE_SPEED * cfg::WAKE_SPEED;
+    std::size_t asleep = 0;
+    bool fast = false, close = false;
+    for (std::size_t i = b; i < e; ++i) {
+      if (p.asleep(i)) { ++asleep; continue; }
+      if (nearFrozen) {
+        close |= nearFrozen[sleepCell(p.posX[i], p.posY[i], cols, rows)] != 0;
+      }
+      float v2 = p.velX[i] * p.velX[i] + p.velY[i] * p.velY[i];
+      if (v2 < slow2) {
+        if (++p.restSteps[i] == cfg::SLEEP_SUBSTEPS) {
+          p.velX[i] = 0.0f;
+          p.velY[i] = 0.0f;
+          ++asleep;
+        }
+        continue;
+      }
+      p.restSteps[i] = 0;
+      if (!mark || v2 < fast2) continue;
+
+      fast = true;
+      const float reach = p.radius(i) + maxRadius;
+      const int x0 = std::clamp(static_cast<int>((p.posX[i] - reach) * inv), 0, cols - 1);
+      const int x1 = std::clamp(static_cast<int>((p.posX[i] + reach) * inv), 0, cols - 1);
+      const int y0 = std::clamp(static_cast<int>((p.posY[i] - reach) * inv), 0, rows - 1);
+      const int y1 = std::clamp(static_cast<int>((p.posY[i] + reach) * inv), 0, rows - 1);
+      for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+          marks[static_cast<std::size_t>(y) * cols + x].store(1, std::memory_order_relaxed);
+        }
+      }
+    }
+    if (asleep) asleepTotal.fetch_add(asleep, std::memory_order_relaxed);
+    if (fast)   anyFast.store(true, std::memory_order_relaxed);
+    if (close)  thaw.store(true, std::memory_order_relaxed);
+  });
+  // The frozen tail is asleep throughout.
+  asleepCount_ = asleepTotal.load() + (particles.count - N);
+
+  // Wake sleepers whose own cell was marked.
+  if (anyFast.load()) {
+    std::atomic<std::size_t> woken{0};
+    runParallel(N, [=, &woken, &thaw](std::size_t b, std::size_t e) {
+      auto &p = *pp;
+      std::size_t n = 0;
+      bool close = false;
+      for (std::size_t i = b; i < e; ++i) {
+        if (!p.asleep(i)) continue;
+        const int cx = std::clamp(static_cast<int>(p.posX[i] * inv), 0, cols - 1);
+        const int cy = std::clamp(static_cast<int>(p.posY[i] * inv), 0, rows - 1);
+        const std::size_t c = static_cast<std::size_t>(cy) * cols + cx;
+        if (marks[c].load(std::memory_order_relaxed)) {
+          p.restSteps[i] = 0;
+          ++n;
+          if (nearFrozen) close |= nearFrozen[c] != 0;
+        }
+      }
+      if (n) woken.fetch_add(n, std::memory_order_relaxed);
+      if (close) thaw.store(true, std::memory_order_relaxed);
+    });
+    asleepCount_ -= woken.load();
+  }
+
+  // Something awake may reach the frozen tail next substep: let it rejoin.
+  if (thaw.load()) activeCount_ = particles.count;
+}
+
+void PhysicsEngine::freezeSleepers(ParticleSystem &particles,
+                                   const InputState &input, int substeps,
+                                   float frameDt, float maxRadius) {
+  const std::size_t N = particles.count;
+  activeCount_ = N;
+  const int cols = sleepCols_, rows = sleepRows_;
+  const std::size_t cells = static_cast<std::size_t>(cols) * rows;
+
+  // Mark the cells holding an awake particle.
+  std::atomic<std::uint8_t> *awake = awakeCells_.get();
+  for (std::size_t c = 0; c < cells; ++c) {
+    awake[c].store(0, std::memory_order_relaxed);
+  }
+  const ParticleSystem *pp = &particles;
+  runParallel(N, [pp, awake, cols, rows](std::size_t b, std::size_t e) {
+    const auto &p = *pp;
+    for (std::size_t i = b; i < e; ++i) {
+      if (p.asleep(i)) continue;
+      awake[sleepCell(p.posX[i], p.posY[i], cols, rows)].store(
+          1, std::memory_order_relaxed);
+    }
+  });
+
+  // How far something awake can reach during one substep: contact range,
+  // or the SPH neighbourhood of a neighbour, plus the distance it can
+  // travel at last frame's peak speed with gravity added for the frame.
+  const float stepDt = frameDt * input.timeScale;
+  float speed = peakSpeed_;
+  if (particles.layoutVersion != peakSpeedVersion_) {
+    speed = std::sqrt(maxSpeedSq(particles));
+  }
+  if (input.gravityEnabled) {
+    speed += std::sqrt(input.gravity.x * input.gravity.x +
+                       input.gravity.y * input.gravity.y) * stepDt;
+  }
+  float reach = 2.0f * maxRadius;
+  if (input.sphLiquid) reach = std::max(reach, 2.0f * cfg::SPH_SMOOTHING);
+  reach += speed * stepDt / static_cast<float>(std::max(1, substeps));
+  const int k = static_cast<int>(std::ceil(reach / cfg::SLEEP_CELL_SIZE));
+
+  // Live cells: within k + 1 of an awake one, the extra cell so that a
+  // particle creeping into the next cell doesn't thaw the tail at once.
+  liveCells_.resize(cells);
+  nearFrozen_.resize(cells);
+  for (std::size_t c = 0; c < cells; ++c) {
+    nearFrozen_[c] = awake[c].load(std::memory_order_relaxed);
+  }
+  dilateCells(nearFrozen_.data(), 1, liveCells_.data(), dilateScratch_, cols,
+              rows, k + 1);
+  dilateCells(liveCells_.data(), 0, nearFrozen_.data(), dilateScratch_, cols,
+              rows, k);
+
+  // Count the particles outside the live cells, and those of them already
+  // in the tail left by the last frame, if the layout hasn't changed.
+  const bool tailValid = frozenVersion_ == particles.layoutVersion &&
+                         frozenFrom_ <= N;
+  const std::size_t tailFrom = tailValid ? frozenFrom_ : N;
+  const std::uint8_t *live = liveCells_.data();
+  std::atomic<std::size_t> frozen{0}, frozenInTail{0};
+  runParallel(N, [pp, live, cols, rows, tailFrom, &frozen,
+                  &frozenInTail](std::size_t b, std::size_t e) {
+    const auto &p = *pp;
+    std::size_t n = 0, inTail = 0;
+    for (std::size_t i = b; i < e; ++i) {
+      if (live[sleepCell(p.posX[i], p.posY[i], cols, rows)]) continue;
+      ++n;
+      inTail += i >= tailFrom;
+    }
+    if (n) frozen.fetch_add(n, std::memory_order_relaxed);
+    if (inTail) frozenInTail.fetch_add(inTail, std::memory_order_relaxed);
+  });
+  const std::size_t minFrozen =
+      static_cast<std::size_t>(cfg::FREEZE_MIN_SHARE * static_cast<float>(N));
+  if (frozen.load() < minFrozen) return;
+
+  // Keep last frame's tail while all of it is still out of reach and the
+  // prefix hasn't collected enough new candidates to be worth a permute.
+  const std::size_t tail = N - tailFrom;
+  if (tail > 0 && frozenInTail.load() == tail &&
+      frozen.load() - tail < minFrozen) {
+    activeCount_ = tailFrom;
+    return;
+  }
+
+  // Stable partition: everything live first, the frozen after.
+  freezeOrder_.resize(N);
+  std::size_t a = 0, f = N - frozen.load();
+  for (std::size_t i = 0; i < N; ++i) {
+    const bool isLive =
+        live[sleepCell(particles.posX[i], particles.posY[i], cols, rows)];
+    freezeOrder_[isLive ? a++ : f++] = static_cast<std::uint32_t>(i);
+  }
+  permute(particles, freezeOrder_.data());
+  frozenFrom_    = a;
+  frozenVersion_ = particles.layoutVersion;
+  activeCount_   = a;
+}
+
 void PhysicsEngine::update(ParticleSystem &particles, const InputState &input,
                            float frameDt) {
   consumedExplosion_ = false;
+  stats_ = PhysicsStats{};
   if (particles.count == 0) return;
 
-  const int   substeps = std::max(1, input.substeps);
+  const int   substeps = chooseSubsteps(particles, input, frameDt);
   const float dt       = (frameDt * input.timeScale) / static_cast<float>(substeps);
   const std::size_t N  = particles.count;
+  stats_.substeps = substeps;
+
+  // Fastest particle seen by the integration passes, over all substeps.
+  std::atomic<float> peakV2{0.0f};
+  std::atomic<float> *peak = &peakV2;
 
-  // Capture once for closures.
+  // Capture once for closures. The copy lets the explosion be dropped
+  // after the first substep, so its impulse doesn't scale with the count.
   ParticleSystem *pp = &particles;
-  const InputState *in = &input;
+  InputState stepInput = input;
+  const InputState *in = &stepInput;
+
+  // Sleep: global forces changing wake everything; local ones wake the
+  // region they act on. With sleeping off, nobody stays asleep.
+  const bool gravityChanged =
+      input.gravityEnabled != lastGravityEnabled_ ||
+      input.gravity.x != lastGravity_.x || input.gravity.y != lastGravity_.y;
+  lastGravity_        = input.gravity;
+  lastGravityEnabled_ = input.gravityEnabled;
+  const bool wakeAll = !sleepEnabled_ || gravityChanged ||
+                       input.wind.x != 0.0f || input.wind.y != 0.0f;
+  if (wakeAll) {
+    runParallel(N, [pp](std::size_t b, std::size_t e) {
+      std::fill(pp->restSteps.begin() + b, pp->restSteps.begin() + e,
+                std::uint16_t{0});
+    });
+  } else {
+    if (forces::mouseFieldActive(input)) {
+      wakeRegion(particles, input.mousePos.x, input.mousePos.y,
+                 input.brushRadius);
+    }
+    if (input.explodePending) {
+      wakeRegion(particles, input.explodePosition.x, input.explodePosition.y,
+                 forces::explosionRadius(input));
+    }
+  }
+  // Particles may have been added, erased or woken since the last frame.
+  asleepCount_ = wakeAll ? 0 : countAsleep(particles);
+  const float maxRadius = maxRadiusOf(particles);
+
+  // Sleepers nothing awake can reach this frame move to the tail, and the
+  // substeps only visit the active prefix [0, activeCount_). Forces that
+  // reach across the world, wrapped lookups and the type ranges all need
+  // every particle where it is.
+  activeCount_ = N;
+  if (!wakeAll && asleepCount_ > 0 && asleepCount_ < N &&
+      !particles.partitioned && broadphase_ == Broadphase::UniformGrid &&
+      !input.periodicX && !input.periodicY && !input.selfGravity &&
+      !forces::mouseFieldActive(input) && !input.explodePending) {
+    freezeSleepers(particles, input, substeps, frameDt, maxRadius);
+  }
 
   for (int s = 0; s < substeps; ++s) {
 
-    // ----- Phase 1: field accelerations -----
-    runParallel(N, [pp, in](std::size_t b, std::size_t e) {
-      forces::zeroAccelerations(*pp, b, e);
-      forces::applyGravity     (*pp, *in, b, e);
-      forces::applyWind        (*pp, *in, b, e);
-      forces::applyMouseField  (*pp, *in, b, e);
-    });
+    // A fully asleep scene has nothing to integrate or collide.
+    if (asleepCount_ == N) {
+      if (s == 0 && input.explodePending) {
+        consumedExplosion_ = true;
+        stepInput.explodePending = false;
+      }
+      continue;
+    }
+    // Re-read each substep: updateSleep thaws the tail when needed.
+    const std::size_t A = activeCount_;
 
-    // ----- Phase 2: integrate velocity + damping + one-shot impulse -----
-    runParallel(N, [pp, in, dt](std::size_t b, std::size_t e) {
-      auto &p = *pp;
-      for (std::size_t i = b; i < e; ++i) {
-        if (p.type[i] == TYPE_STONE) continue;
-        p.velX[i] += p.accX[i] * dt;
-        p.velY[i] += p.accY[i] * dt;
+    if (forces::fusedIntegrationApplies(stepInput)) {
+      // ----- Phases 1-3 fused: gravity/wind, integrate, damp -----
+      // One pass instead of three; large scenes are bandwidth bound here.
+      runParallel(A, [pp, in, dt, peak](std::size_t b, std::size_t e) {
+        atomicMax(*peak, forces::integrateFused(*pp, *in, dt, b, e));
+      });
+    } else {
+      // ----- Phase 1: field accelerations -----
+      // Sleepers are skipped in phases 2, 3 and 6, so their (harmless)
+      // accelerations are still computed here to keep the force code simple.
+      // The mouse field only visits the particles under the brush when
+      // the uniform grid can say which those are.
+      const bool mouseRegion =
+          forces::mouseFieldActive(*in) &&
+          queryRegion(particles, in->mousePos.x, in->mousePos.y,
+                      in->brushRadius, region_);
+      runParallel(A, [pp, in, mouseRegion](std::size_t b, std::size_t e) {
+        forces::zeroAccelerations(*pp, b, e);
+        forces::applyGravity     (*pp, *in, b, e);
+        forces::applyWind        (*pp, *in, b, e);
+        if (!mouseRegion) forces::applyMouseField(*pp, *in, b, e);
+      });
+      if (mouseRegion) {
+        const std::uint32_t *near = region_.data();
+        runParallel(region_.size(), [pp, in, near](std::size_t b, std::size_t e) {
+          forces::applyMouseField(*pp, *in, near, b, e);
+        });
+      }
+      if (in->selfGravity &&
+          in->gravitySolver == GravitySolver::ParticleMesh) {
+        // The mesh needs every particle deposited before any is read back.
+        auto g0 = std::chrono::steady_clock::now();
+        if (multithreading_) {
+          particleMesh_.build(particles, in->meshSize, pool_,
+                              cfg::MIN_PARTICLES_PER_THREAD);
+        } else {
+          particleMesh_.build(particles, in->meshSize);
+        }
+        const ParticleMesh *mesh = &particleMesh_;
+        runParallel(A, [pp, in, mesh](std::size_t b, std::size_t e) {
+          forces::applyMeshGravity(*pp, *in, *mesh, b, e);
+        });
+        stats_.gravityMs += std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - g0).count();
+      } else if (in->selfGravity) {
+        // The tree walk runs over tree slots, so it is a pass of its own.
+        auto g0 = std::chrono::steady_clock::now();
+        if (multithreading_) {
+          gravityTree_.build(particles, pool_, cfg::MIN_PARTICLES_PER_THREAD);
+        } else {
+          gravityTree_.build(particles);
+        }
+        const BarnesHutTree *tree = &gravityTree_;
+        runParallel(A, [pp, in, tree](std::size_t b, std::size_t e) {
+          forces::applySelfGravity(*pp, *in, *tree, b, e);
+        });
+        stats_.gravityMs += std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - g0).count();
       }
-      forces::applyDamping(p, b, e);
-      forces::applyExplosionImpulse(p, *in, b, e);
-    });
 
-    // ----- Phase 3: integrate position -----
-    runParallel(N, [pp, dt](std::size_t b, std::size_t e) {
-      auto &p = *pp;
-      for (std::size_t i = b; i < e; ++i) {
-        if (p.type[i] == TYPE_STONE) continue;
-        p.posX[i] += p.velX[i] * dt;
-        p.posY[i] += p.velY[i] * dt;
+      // ----- Phase 2: integrate velocity + damping + one-shot impulse -----
+      const bool blastRegion =
+          in->explodePending &&
+          queryRegion(particles, in->explodePosition.x, in->explodePosition.y,
+                      forces::explosionRadius(*in), region_);
+      runParallel(A, [pp, in, dt, blastRegion](std::size_t b, std::size_t e) {
+        forces::integrateVelocity(*pp, dt, b, e);
+        forces::applyDamping(*pp, b, e);
+        if (!blastRegion) forces::applyExplosionImpulse(*pp, *in, b, e);
+      });
+      if (blastRegion) {
+        const std::uint32_t *near = region_.data();
+        runParallel(region_.size(), [pp, in, near](std::size_t b, std::size_t e) {
+          forces::applyExplosionImpulse(*pp, *in, near, b, e);
+        });
       }
-    });
+
+      // ----- Phase 3: integrate position -----
+      runParallel(A, [pp, dt, peak](std::size_t b, std::size_t e) {
+        atomicMax(*peak, forces::integratePosition(*pp, dt, b, e));
+      });
+    }
 
     // Mark explosion as consumed for this frame (the first substep applied it).
     if (s == 0 && input.explodePending) {
       consumedExplosion_ = true;
+      stepInput.explodePending = false;
     }
 
-    // ----- Phase 4: rebuild spatial hash (serial; counting-sort O(N)) -----
+    // ----- Phase 4: rebuild spatial hash (counting-sort O(N)) -----
+    // Periodic boundaries need the uniform grid's wrapped lookup.
+    const PeriodicAxes wrap{in->periodicX, in->periodicY};
+    const ObstacleField *obstacles =
+        obstacles_ && obstacles_->baked() ? obstacles_ : nullptr;
+    const Broadphase bp = wrap.any() ? Broadphase::UniformGrid : broadphase_;
+    hashVersion_ = ~std::uint64_t{0};
     if (gridEnabled_) {
-      hash_->build(sortedIndices_, particles.posX, particles.posY, N);
+      auto h0 = std::chrono::steady_clock::now();
+      bool rebuilt = true;
+      if (bp == Broadphase::VerletList) {
+        rebuilt = multithreading_
+                      ? verlet_->stale(particles, pool_,
+                                       cfg::MIN_PARTICLES_PER_THREAD)
+                      : verlet_->stale(particles);
+      } else {
+        verlet_->invalidate();
+      }
+      if (!rebuilt) {
+        // Lists still cover every contact; keep the old slot order.
+      } else if (bp == Broadphase::SparseGrid) {
+        sparseHash_->build(sortedIndices_, particles.posX.data(),
+                           particles.posY.data(), A);
+      } else if (bp == Broadphase::MultiLevel) {
+        if (multithreading_) {
+          multiGrid_->build(sortedIndices_, particles.posX.data(),
+                            particles.posY.data(), particles.material.data(),
+                            particles.materials.data(), A, pool_,
+                            cfg::MIN_PARTICLES_PER_THREAD);
+        } else {
+          multiGrid_->build(sortedIndices_, particles.posX.data(),
+                            particles.posY.data(), particles.material.data(),
+                            particles.materials.data(), A);
+        }
+      } else if (multithreading_) {
+        hash_->build(sortedIndices_, particles.posX.data(),
+                     particles.posY.data(), A, pool_,
+                     cfg::MIN_PARTICLES_PER_THREAD);
+      } else {
+        hash_->build(sortedIndices_, particles.posX.data(),
+                     particles.posY.data(), A);
+      }
+      auto h1 = std::chrono::steady_clock::now();
+      stats_.hashMs += std::chrono::duration<double, std::milli>(h1 - h0).count();
+
+      // Verlet lists reorder on every rebuild (which is rarer than the
+      // reorder interval anyway) and never in between, since that would
+      // invalidate the lists.
+      ++substepCounter_;
+      const bool reorderDue =
+          bp == Broadphase::VerletList
+              ? rebuilt
+              : substepCounter_ % static_cast<std::uint64_t>(
+                                      std::max(1, reorderInterval_)) == 0;
+      if (reorderInterval_ > 0 && reorderDue) {
+        auto t0 = std::chrono::steady_clock::now();
+        reorderByCell(particles);
+        auto t1 = std::chrono::steady_clock::now();
+        stats_.reorderMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        ++stats_.reorders;
+      }
+      // Until the layout next changes, region queries can use the grid
+      // (a reorder keeps it valid through sortedIndices_). Not while
+      // wrapping: the collision pass may carry a particle across the seam,
+      // out of every cell a circle near the other edge would look in.
+      if (bp == Broadphase::UniformGrid && !wrap.any()) {
+        hashVersion_ = particles.layoutVersion;
+        hashCount_   = A;
+      }
+
+      // Between list rebuilds the layout and slot order are unchanged, so
+      // only the fields a substep moves need copying into the snapshot.
+      sortedParticles_.resize(A);
+      narrowphase::SortedParticles *sp = &sortedParticles_;
+      const std::uint32_t *order = sortedIndices_.data();
+      if (rebuilt) {
+        runParallel(A, [pp, sp, order](std::size_t b, std::size_t e) {
+          sp->gather(*pp, order, b, e);
+        });
+      } else {
+        runParallel(A, [pp, sp, order](std::size_t b, std::size_t e) {
+          sp->refresh(*pp, order, b, e);
+        });
+      }
+
+      if (bp == Broadphase::VerletList && rebuilt) {
+        auto l0 = std::chrono::steady_clock::now();
+        if (multithreading_) {
+          verlet_->build(particles, *hash_, sortedParticles_, pool_,
+                         cfg::MIN_PARTICLES_PER_THREAD);
+        } else {
+          verlet_->build(particles, *hash_, sortedParticles_);
+        }
+        auto l1 = std::chrono::steady_clock::now();
+        stats_.hashMs += std::chrono::duration<double, std::milli>(l1 - l0).count();
+        ++stats_.listRebuilds;
+      }
+    }
+
+    // ----- Phase 4b: SPH liquid forces -----
+    if (gridEnabled_ && in->sphLiquid && bp == Broadphase::UniformGrid) {
+      auto f0 = std::chrono::steady_clock::now();
+      applyFluidForces(particles, dt, wrap);
+      stats_.sphMs += std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - f0).count();
     }
 
-    // ----- Phase 5: collision corrections (Jacobi-style) -----
+    // ----- Phase 5: collision corrections -----
     if (gridEnabled_) {
-      runParallel(N, [pp, this](std::size_t b, std::size_t e) {
-        collisions::resolveBand(*pp, *hash_, sortedIndices_, b, e);
-      });
+      const CollisionSolver solver =
+          wrap.any() ? CollisionSolver::OneSided : solver_;
+      if (bp == Broadphase::UniformGrid &&
+          solver == CollisionSolver::ColouredPairs) {
+        resolveColoured(particles);
+      } else if (bp == Broadphase::UniformGrid &&
+                 solver == CollisionSolver::GaussSeidel) {
+        resolveGaussSeidel(particles, std::max(1, in->solverIterations));
+      } else {
+        const narrowphase::Kernel kind = narrowphase::passKernel(deterministic_);
+        runParallel(A, [pp, this, bp, wrap, kind](std::size_t b, std::size_t e) {
+          switch (bp) {
+            case Broadphase::SparseGrid:
+              collisions::resolveBand(*pp, *sparseHash_, sortedParticles_, b, e,
+                                      kind);
+              break;
+            case Broadphase::MultiLevel:
+              collisions::resolveBand(*pp, *multiGrid_, sortedParticles_, b, e,
+                                      kind);
+              break;
+            case Broadphase::VerletList:
+              collisions::resolveBand(*pp, *verlet_, sortedParticles_, b, e,
+                                      kind);
+              break;
+            default:
+              collisions::resolveBand(*pp, *hash_, sortedParticles_, b, e, wrap,
+                                      kind);
+              break;
+          }
+        });
+      }
 
       // ----- Phase 6: apply scratch corrections + world bounds -----
-      runParallel(N, [pp](std::size_t b, std::size_t e) {
-        auto &p = *pp;
-        for (std::size_t i = b; i < e; ++i) {
-          if (p.type[i] == TYPE_STONE) continue;
-          p.posX[i] += p.accX[i];
-          p.posY[i] += p.accY[i];
+      runParallel(A, [pp, wrap, obstacles](std::size_t b, std::size_t e) {
+        if (wrap.any()) {
+          collisions::applyCorrectionsAndWrap(*pp, wrap, b, e);
+        } else {
+          collisions::applyCorrectionsAndBounds(*pp, b, e);
         }
-        collisions::applyWorldBounds(p, b, e);
+        if (obstacles) collisions::applyObstacles(*pp, *obstacles, b, e);
       });
     } else {
-      // Without spatial hash, just clip to world bounds.
-      runParallel(N, [pp](std::size_t b, std::size_t e) {
-        collisions::applyWorldBounds(*pp, b, e);
+      // Without spatial hash, just clip to world bounds (or wrap).
+      runParallel(A, [pp, wrap, obstacles](std::size_t b, std::size_t e) {
+        if (wrap.any()) {
+          collisions::applyWorldWrap(*pp, wrap, b, e);
+        } else {
+          collisions::applyWorldBounds(*pp, b, e);
+        }
+        if (obstacles) collisions::applyObstacles(*pp, *obstacles, b, e);
       });
     }
+
+    // ----- Phase 7: sleep bookkeeping -----
+    if (sleepEnabled_) updateSleep(particles, maxRadius);
   }
+
+  stats_.sleeping  = static_cast<int>(asleepCount_);
+  stats_.peakSpeed = std::sqrt(peakV2.load());
+  peakSpeed_        = stats_.peakSpeed;
+  peakSpeedVersion_ = particles.layoutVersion;
 }
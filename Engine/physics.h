@@ -1,11 +1,20 @@
 #ifndef PHYSICS_H
 #define PHYSICS_H
 
+#include "barnes_hut.h"
 #include "input_state.h"
+#include "multi_level_grid.h"
+#include "narrowphase.h"
+#include "obstacle_field.h"
 #include "particle.h"
+#include "particle_mesh.h"
+#include "sparse_spatial_hash.h"
+#include "sph.h"
 #include "spatial_hash.h"
 #include "thread_pool.h"
+#include "verlet_list.h"
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <vector>
@@ -13,29 +22,142 @@
 // ---------------------------------------------------------------------------
 // Orchestrates one physics frame:
 //
+//   N = input.substeps, or with adaptive substepping the smallest count
+//   from input.minSubsteps up that keeps the fastest particle within
+//   cfg::CFL_NUMBER of the smallest radius per substep. The speed is last
+//   frame's peak, taken by a max-reduction inside the integration passes,
+//   plus the impulse of a pending explosion. The smallest radius and the
+//   largest inverse mass come from the material table. With SPH liquid N
+//   is also enough for a pressure wave to cross cfg::SPH_CFL_NUMBER of the
+//   smoothing length.
+//
 //   for substep in 0..N:
 //       1. accumulate field accelerations into accX/accY                (parallel)
+//          with self-gravity: build the Barnes-Hut tree first            (parallel)
+//          and add its pull on every particle                            (parallel)
+//          or deposit onto the particle mesh, FFT solve, read back       (parallel)
 //       2. integrate velocity from acc, damp, optional explosion impulse (parallel)
 //       3. integrate position from velocity                              (parallel)
-//       4. rebuild spatial hash                                          (serial)
+//          (1-3 run as one fused pass when there is no mouse field,
+//          explosion or self-gravity, which is almost every substep)     (parallel)
+//       4. rebuild spatial hash (per-chunk counting sort)                (parallel)
+//          or the sparse hash, when that broadphase is selected          (serial)
+//          or one counting sort per level of the multi-level grid        (parallel)
+//          or, with Verlet lists, a displacement check and nothing more
+//          until some particle has moved half the skin; then the
+//          uniform grid plus a list rebuild                              (parallel)
+//          every reorderInterval substeps: permute particles into cell
+//          order so neighbour reads become near-sequential               (parallel)
+//          copy the fields the pair kernels read into cell order         (parallel)
+//          (between list rebuilds only positions, velocities and sleep)
+//          with SPH liquid on the uniform grid: density, then pressure,
+//          viscosity and cohesion into liquid velocities (see sph.h)     (parallel)
 //       5. collision detection -> per-particle position correction       (parallel)
+//          on the uniform grid with the coloured solver: each pair once,
+//          one colour of 2x2-cell tiles at a time, then a scatter pass   (parallel)
+//          or with Gauss-Seidel, input.solverIterations sweeps over the
+//          same colours, resolving pairs in place, then a copy-back     (parallel)
 //       6. apply correction + world bounds                               (parallel)
+//          or, along periodic axes, wrap positions to the other side     (parallel)
+//          then push particles out of the baked obstacles, if any       (parallel)
+//       7. sleep bookkeeping: count slow substeps, put particles to
+//          sleep, wake sleepers near anything fast                      (parallel)
+//
+// Sleeping particles skip phases 2, 3, 5 and 6 but stay in the hash, so
+// awake particles still collide with them as if they were motionless.
+// Sleepers wake when a fast particle comes within contact range, when the
+// mouse field or an explosion reaches them, when gravity changes or wind
+// blows, or through wakeRegion() (used when particles are erased). A
+// substep in which every particle is asleep is skipped outright.
+//
+// Sleepers far from anything awake are also frozen for the frame: at its
+// start every SLEEP_CELL_SIZE cell holding an awake particle is grown by
+// the distance a contact, an SPH neighbourhood and a substep's travel can
+// reach, and the particles outside that region are permuted to the end of
+// the arrays. Substeps then run over the prefix only, so the frozen tail
+// is not hashed, gathered or visited by any pass. Phase 7 checks that no
+// awake particle comes within that distance of a frozen cell; if one does,
+// the tail rejoins for the rest of the frame. The tail keeps its place
+// across frames while it stays frozen. Frames with the mouse field, an
+// explosion, self-gravity, periodic boundaries, per-type storage or a
+// broadphase other than the uniform grid freeze nothing.
+//
+// With periodic boundaries (input.periodicX / periodicY) only the uniform
+// grid's lookup wraps around the seam, so the step runs on it with the
+// one-sided pass whatever broadphase and solver are selected: 150 columns
+// make an odd number of 2x2 tiles, and the colouring's parity would put
+// two same-coloured tiles side by side across the seam.
+//
+// In deterministic mode every parallel pass uses cfg::DETERMINISTIC_CHUNK
+// sized chunks, serial or pooled, so each particle sees the same code path
+// and the result is bit-identical on any number of threads. The remaining
+// reductions are already order-independent: peak speeds are maxima, sleep
+// counts are integers, the grid, tree and list builds are exact, and the
+// particle mesh fixes its own deposit chunks.
 //
 // Every step that writes per-particle state only writes the index it owns,
-// so the parallel passes are race-free. The collision step uses accX/accY
-// as a scratch buffer for position corrections (the field acceleration is
-// no longer needed by the time we reach the collision phase).
+// so the parallel passes are race-free. The coloured collision pass is the
+// exception: it writes per-slot sums for both sides of a pair, and relies
+// on the tile colouring to keep concurrent writers apart; so does the
+// Gauss-Seidel pass, which writes the snapshot itself. The collision step
+// uses accX/accY as a scratch buffer for position corrections (the field
+// acceleration is no longer needed by the time we reach the collision
+// phase).
 // ---------------------------------------------------------------------------
 
+// Per-frame bookkeeping, refreshed by every update() call. The benchmark
+// reads this to attribute cost to individual phases.
+struct PhysicsStats {
+  int    substeps  = 0;
+  float  peakSpeed = 0.0f; // fastest particle integrated this frame
+  double hashMs    = 0.0;  // wall time spent rebuilding the spatial hash
+  int    reorders  = 0;    // spatial reorder passes run this frame
+  double reorderMs = 0.0;  // wall time spent permuting particle arrays
+  double sphMs     = 0.0;  // wall time spent in the SPH liquid passes
+  double gravityMs = 0.0;  // wall time in the self-gravity solver
+  int    listRebuilds = 0; // Verlet list rebuilds this frame
+  int    sleeping  = 0;    // particles asleep at the end of the frame
+};
+
 class PhysicsEngine {
 public:
-  PhysicsEngine();
+  // `threads` workers in the pool; 0 for one per hardware thread.
+  explicit PhysicsEngine(unsigned int threads = 0);
 
   void update(ParticleSystem &particles, const InputState &input,
               float frameDt);
 
   void setMultithreadingEnabled(bool b) { multithreading_ = b; }
   void setGridEnabled(bool b)           { gridEnabled_ = b; }
+  void setReorderInterval(int n)        { reorderInterval_ = n; }
+  void setBroadphase(Broadphase b)      { broadphase_ = b; }
+  void setSleepEnabled(bool b)          { sleepEnabled_ = b; }
+  void setCollisionSolver(CollisionSolver s) { solver_ = s; }
+  void setDeterministic(bool b)         { deterministic_ = b; }
+
+  // Baked obstacles for phase 6 to collide particles with, or null. Not
+  // owned: the field must outlive its use and not change while set.
+  void setObstacles(const ObstacleField *field) { obstacles_ = field; }
+
+  // Wake every particle within `radius` of (x, y), e.g. around erased
+  // particles whose neighbours just lost their support.
+  void wakeRegion(ParticleSystem &particles, float x, float y, float radius);
+
+  // Particles that may lie within `radius` of (x, y): everyone in the
+  // uniform-grid cells under the circle, grown by a cell for whatever the
+  // collision pass moved since the grid was built. Returns false with
+  // `out` empty when the last substep didn't build that grid, ran with
+  // periodic boundaries, or particles were added, removed or reordered
+  // since; callers then scan everything.
+  bool queryRegion(const ParticleSystem &particles, float x, float y,
+                   float radius, std::vector<std::uint32_t> &out) const;
+
+  // ParticleSystem::removeMask, on the pool while multithreading is on
+  // (gathering into reorderScratch_).
+  std::size_t removeMarked(ParticleSystem &particles,
+                           const std::vector<std::uint8_t> &mask);
+
+  const PhysicsStats &stats() const { return stats_; }
 
   // Lets the caller clear the one-shot explode flag after consumption.
   bool consumedExplosionFlag() const { return consumedExplosion_; }
@@ -44,14 +166,101 @@ private:
   bool multithreading_ = true;
   bool gridEnabled_    = true;
   bool consumedExplosion_ = false;
+  int  reorderInterval_   = cfg::REORDER_INTERVAL;
+  Broadphase broadphase_  = Broadphase::UniformGrid;
+  bool sleepEnabled_      = true;
+  CollisionSolver solver_ = CollisionSolver::ColouredPairs;
+  bool deterministic_     = false;
+  const ObstacleField *obstacles_ = nullptr;
+  std::uint64_t substepCounter_ = 0;
+
+  // Adaptive substeps: peak speed from the last frame's integration, valid
+  // while the particle layout is unchanged (new particles may be faster).
+  float         peakSpeed_        = 0.0f;
+  std::uint64_t peakSpeedVersion_ = ~std::uint64_t{0};
+
+  // Region queries: layout version and count the uniform grid was last
+  // built for.
+  std::uint64_t hashVersion_ = ~std::uint64_t{0};
+  std::size_t   hashCount_   = 0;
+
+  PhysicsStats stats_;
 
   ThreadPool                pool_;
   std::unique_ptr<SpatialHash> hash_;
+  std::unique_ptr<SparseSpatialHash> sparseHash_;
+  std::unique_ptr<MultiLevelGrid>    multiGrid_;
+  std::unique_ptr<VerletList>        verlet_;
   std::vector<std::uint32_t>   sortedIndices_;
+  std::vector<std::uint32_t>   partitionOrder_;  // reorder with type ranges
+  std::vector<std::uint32_t>   region_;          // queryRegion results
+  narrowphase::SortedParticles sortedParticles_;
+  narrowphase::ContactAccum    contactAccum_;
+  sph::Fields                  sphFields_;
+  BarnesHutTree                gravityTree_;
+  ParticleMesh                 particleMesh_;
+  ParticleSystem               reorderScratch_{0};
+
+  // Sleep: one byte per SLEEP_CELL_SIZE cell, set when something fast is
+  // within contact range of it during the current substep.
+  std::unique_ptr<std::atomic<std::uint8_t>[]> disturbed_;
+  int  sleepCols_ = 0, sleepRows_ = 0;
+  Vec2 lastGravity_{0.0f, 0.0f};
+  bool lastGravityEnabled_ = true;
+  std::size_t asleepCount_ = 0;   // as of the last sleep pass
+
+  // Frozen sleepers: substeps run over [0, activeCount_). The tail from
+  // frozenFrom_ was laid out in layout frozenVersion_. awakeCells_ marks
+  // the sleep cells holding an awake particle; nearFrozen_ the cells an
+  // awake particle must not enter while the tail is frozen.
+  std::size_t   activeCount_   = 0;
+  std::size_t   frozenFrom_    = 0;
+  std::uint64_t frozenVersion_ = ~std::uint64_t{0};
+  std::unique_ptr<std::atomic<std::uint8_t>[]> awakeCells_;
+  std::vector<std::uint8_t>  liveCells_, nearFrozen_, dilateScratch_;
+  std::vector<std::uint32_t> freezeOrder_;
 
   std::size_t chunkSize(std::size_t total) const;
   void runParallel(std::size_t total,
                    const ThreadPool::RangeFn &fn);
+
+  // Permute `particles` into the order given by sortedIndices_ and turn
+  // sortedIndices_ into the identity, which keeps the freshly built hash
+  // valid for the rest of the substep. Partitioned particles are put in
+  // cell order within each type range instead, and sortedIndices_ maps
+  // each slot to its particle's new index.
+  void reorderByCell(ParticleSystem &particles);
+
+  // Put particle order[k] at index k for every k, through reorderScratch_,
+  // and bump the layout version.
+  void permute(ParticleSystem &particles, const std::uint32_t *order);
+
+  // Set activeCount_ for this frame, moving sleepers nothing awake can
+  // reach to the end of the arrays (see the header comment).
+  void freezeSleepers(ParticleSystem &particles, const InputState &input,
+                      int substeps, float frameDt, float maxRadius);
+
+  // Substep count for this frame (see the header comment).
+  int chooseSubsteps(const ParticleSystem &particles, const InputState &input,
+                     float frameDt);
+
+  // Largest squared speed of any awake, non-stone particle.
+  float maxSpeedSq(const ParticleSystem &particles);
+
+  // Phase 5 with the coloured solver on the uniform grid.
+  void resolveColoured(ParticleSystem &particles);
+
+  // SPH forces on liquid, on the uniform grid's snapshot.
+  void applyFluidForces(ParticleSystem &particles, float dt, PeriodicAxes wrap);
+
+  // Phase 5 with the Gauss-Seidel solver on the uniform grid.
+  void resolveGaussSeidel(ParticleSystem &particles, int iterations);
+
+  // Phase 7 for one substep over the active prefix. maxRadius bounds every
+  // radius in the scene. Thaws the frozen tail if an awake particle came
+  // too close to it.
+  void updateSleep(ParticleSystem &particles, float maxRadius);
+  std::size_t countAsleep(const ParticleSystem &particles);
 };
 
 #endif
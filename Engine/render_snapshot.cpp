@@ -0,0 +1,23 @@
+#include "render_snapshot.h"
+
+namespace {
+
+template <class T>
+void copyPrefix(const ArenaArray<T> &src, std::vector<T> &dst,
+                std::size_t n) {
+  dst.assign(src.begin(), src.begin() + n);
+}
+
+} // namespace
+
+void RenderSnapshot::capture(const ParticleSystem &p) {
+  count = p.count;
+  copyPrefix(p.posX,   posX,   count);
+  copyPrefix(p.posY,   posY,   count);
+  copyPrefix(p.prevX,  prevX,  count);
+  copyPrefix(p.prevY,  prevY,  count);
+  copyPrefix(p.velX,   velX,   count);
+  copyPrefix(p.velY,   velY,   count);
+  copyPrefix(p.material, material, count);
+  materials = p.materials;
+}
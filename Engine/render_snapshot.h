@@ -0,0 +1,43 @@
+#ifndef RENDER_SNAPSHOT_H
+#define RENDER_SNAPSHOT_H
+
+#include "particle.h"
+#include "physics.h"
+
+#include <cstdint>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Read-only copy of one finished physics frame: the particle fields the
+// renderer and the HUD read, plus the frame's diagnostics.
+//
+// With the pipelined simulation the physics thread captures one after
+// every batch of steps into a TripleBuffer, and the UI thread draws the
+// newest one while the next frame is being simulated (see simulation.h).
+// The field and accessor names match ParticleSystem's so drawing code can
+// take either.
+// ---------------------------------------------------------------------------
+
+struct RenderSnapshot {
+  std::size_t count = 0;
+  std::vector<float> posX, posY;
+  std::vector<float> prevX, prevY;
+  std::vector<float> velX, velY;
+  std::vector<std::uint16_t> material;
+  std::vector<Material>      materials;
+
+  PhysicsStats  stats;               // of the frame's last step
+  float         avgUpdateMs = 0.0f;  // Simulation's moving average
+  int           steps       = 0;     // physics steps in this frame
+  float         alpha       = 1.0f;  // render interpolation factor
+  std::uint64_t stateHash   = 0;     // see Simulation::stateHash
+
+  // Copy the first p.count particles' fields. Storage is reused from frame
+  // to frame, so this only allocates when the count grows.
+  void capture(const ParticleSystem &p);
+
+  float radius(std::size_t i) const { return materials[material[i]].radius; }
+  SDL_Color color(std::size_t i) const { return materials[material[i]].color; }
+};
+
+#endif
@@ -5,6 +5,14 @@
 #include <algorithm>
 #include <cmath>
 
+namespace {
+
+// The simulation whose physics loop runs on this thread, if any. Commands
+// that run there call the public mutators, which must then act directly.
+thread_local const Simulation *physicsOwner = nullptr;
+
+} // namespace
+
 Simulation::Simulation()
     : particles_(cfg::INITIAL_CAPACITY),
       rng_(std::random_device{}()) {
@@ -13,10 +21,23 @@ Simulation::Simulation()
   physics_.setGridEnabled(input_.gridEnabled);
 }
 
+Simulation::~Simulation() { setPipelined(false); }
+
 void Simulation::start() { running_ = true; }
 void Simulation::stop()  { running_ = false; }
 
 void Simulation::reset(int particleCount) {
+  const bool seeded = input_.deterministic;
+  if (deferred([this, particleCount, seeded] {
+        resetParticles(particleCount, seeded);
+      })) {
+    return;
+  }
+  resetParticles(particleCount, seeded);
+}
+
+void Simulation::resetParticles(int particleCount, bool seeded) {
+  if (seeded) rng_.seed(cfg::DETERMINISTIC_SEED);
   particles_.clear();
   particles_.reserve(static_cast<std::size_t>(std::max(particleCount, 0)));
   for (int i = 0; i < particleCount; ++i) {
@@ -25,58 +46,217 @@ void Simulation::reset(int particleCount) {
 }
 
 void Simulation::clearParticles() {
+  if (deferred([this] { clearParticles(); })) return;
   particles_.clear();
 }
 
 void Simulation::freezeAll() {
+  if (deferred([this] { freezeAll(); })) return;
   std::fill(particles_.velX.begin(),
             particles_.velX.begin() + particles_.count, 0.0f);
   std::fill(particles_.velY.begin(),
             particles_.velY.begin() + particles_.count, 0.0f);
 }
 
-void Simulation::update(float frameDt) {
+void Simulation::takeInput(const InputState &in) {
+  const bool pending = stepInput_.explodePending && !in.explodePending;
+  const Vec2 at      = stepInput_.explodePosition;
+  stepInput_ = in;
+  if (pending) {
+    stepInput_.explodePending  = true;
+    stepInput_.explodePosition = at;
+  }
+}
+
+void Simulation::pullInput() {
+  if (pipelined_) return;
+  takeInput(input_);
+  input_.explodePending = false;
+}
+
+void Simulation::advance(float wallSeconds) {
+  stepsLastFrame_ = 0;
   if (!running_) return;
+
+  if (pipelined_) {
+    // Hand this frame's input and time to the physics thread, then show
+    // the newest frame it has finished.
+    const InputState frame = input_;
+    input_.explodePending = false;
+    deferred([this, frame, wallSeconds] {
+      takeInput(frame);
+      pendingSeconds_ += wallSeconds;
+      framePending_ = true;
+    });
+    if (snapshots_.acquire()) stepsLastFrame_ = snapshots_.front().steps;
+    alpha_ = snapshots_.front().alpha;
+  } else {
+    pullInput();
+    stepsLastFrame_ = runSteps(wallSeconds);
+    alpha_ = stepAlpha_;
+  }
   if (input_.paused) {
     frameRate_ = 0.0f;
     return;
   }
 
+  // FPS counter (windowed), counting rendered frames rather than steps.
+  auto now = std::chrono::steady_clock::now();
+  ++frameCount_;
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     now - fpsStart_).count();
+  if (elapsed >= 500) {
+    frameRate_ = frameCount_ * 1000.0f / static_cast<float>(elapsed);
+    frameCount_ = 0;
+    fpsStart_ = now;
+  }
+}
+
+int Simulation::runSteps(float wallSeconds) {
+  if (stepInput_.paused) {
+    accumulator_ = 0.0f;
+    stepAlpha_   = 1.0f;
+    return 0;
+  }
+
+  int steps = 0;
+  if (stepInput_.fixedTimestep) {
+    const float stepSeconds = 1.0f / cfg::PHYSICS_RATE;
+    accumulator_ += wallSeconds;
+    while (accumulator_ >= stepSeconds && steps < cfg::MAX_STEPS_PER_FRAME) {
+      update(cfg::DT_DEFAULT);
+      accumulator_ -= stepSeconds;
+      ++steps;
+    }
+    // Over the cap: drop the backlog rather than carry it into the next
+    // frame, which would only make that frame slower still.
+    if (accumulator_ >= stepSeconds) accumulator_ = 0.0f;
+    stepAlpha_ = accumulator_ / stepSeconds;
+  } else {
+    accumulator_ = 0.0f;
+    stepAlpha_   = 1.0f;
+    update(cfg::DT_DEFAULT);
+    steps = 1;
+  }
+  return steps;
+}
+
+void Simulation::update(float frameDt) {
+  pullInput();
+  if (!running_ || stepInput_.paused) return;
+
   auto t0 = std::chrono::steady_clock::now();
+  particles_.storePreviousPositions();
 
   // Forward toggles to physics in case they changed since last frame.
-  physics_.setMultithreadingEnabled(input_.multithreadEnabled);
-  physics_.setGridEnabled(input_.gridEnabled);
+  physics_.setMultithreadingEnabled(stepInput_.multithreadEnabled);
+  physics_.setGridEnabled(stepInput_.gridEnabled);
+  physics_.setReorderInterval(stepInput_.reorderInterval);
+  physics_.setBroadphase(stepInput_.broadphase);
+  physics_.setCollisionSolver(stepInput_.solver);
+  physics_.setSleepEnabled(stepInput_.sleepEnabled);
+  physics_.setDeterministic(stepInput_.deterministic);
+  particles_.setPartitioned(stepInput_.partitionByType);
 
-  physics_.update(particles_, input_, frameDt);
+  physics_.update(particles_, stepInput_, frameDt);
+  stateHash_ = stepInput_.deterministic ? particles_.stateHash() : 0;
 
   // Consume one-shot triggers
-  if (input_.explodePending) {
-    input_.explodePending = false;
-  }
+  stepInput_.explodePending = false;
 
   auto t1 = std::chrono::steady_clock::now();
   float ms = std::chrono::duration<float, std::milli>(t1 - t0).count();
   // Exponential moving average
   avgUpdateMs_ = avgUpdateMs_ * 0.92f + ms * 0.08f;
+}
 
-  // FPS counter (windowed)
-  ++frameCount_;
-  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                     t1 - fpsStart_).count();
-  if (elapsed >= 500) {
-    frameRate_ = frameCount_ * 1000.0f / static_cast<float>(elapsed);
-    frameCount_ = 0;
-    fpsStart_ = t1;
+void Simulation::render(SDL_Renderer *renderer) {
+  if (obstacles_) ParticleRenderer::drawObstacles(renderer, *obstacles_);
+  if (pipelined_) {
+    ParticleRenderer::draw(renderer, snapshots_.front(), alpha_);
+  } else {
+    ParticleRenderer::draw(renderer, particles_, alpha_);
   }
 }
 
-void Simulation::render(SDL_Renderer *renderer) {
-  ParticleRenderer::draw(renderer, particles_);
+bool Simulation::deferred(std::function<void()> fn) {
+  if (!pipelined_ || physicsOwner == this) return false;
+  {
+    std::lock_guard<std::mutex> lk(commandMutex_);
+    commands_.push_back(std::move(fn));
+  }
+  commandCv_.notify_one();
+  return true;
+}
+
+void Simulation::togglePipelined() {
+  input_.pipelined = !input_.pipelined;
+  setPipelined(input_.pipelined);
+}
+
+void Simulation::setPipelined(bool on) {
+  if (on == pipelined_) return;
+  if (on) {
+    // The first snapshot is taken here, so there is a frame to show
+    // before the thread has finished one.
+    pullInput();
+    publishSnapshot(0);
+    snapshots_.acquire();
+    quit_ = false;
+    pipelined_ = true;
+    physicsThread_ = std::thread([this] { physicsLoop(); });
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(commandMutex_);
+    quit_ = true;
+  }
+  commandCv_.notify_one();
+  physicsThread_.join();
+  pipelined_ = false;
+}
+
+void Simulation::physicsLoop() {
+  physicsOwner = this;
+  std::vector<std::function<void()>> batch;
+  while (true) {
+    bool quit = false;
+    {
+      std::unique_lock<std::mutex> lk(commandMutex_);
+      commandCv_.wait(lk, [this] { return quit_ || !commands_.empty(); });
+      batch.swap(commands_);
+      quit = quit_;
+    }
+
+    // Edits and frames in the order they were made. Frames only add up
+    // their time here, so a slow step never builds a queue of them.
+    for (auto &fn : batch) fn();
+    batch.clear();
+    int steps = 0;
+    if (framePending_) {
+      steps = runSteps(pendingSeconds_);
+      pendingSeconds_ = 0.0f;
+      framePending_   = false;
+    }
+    publishSnapshot(steps);
+    if (quit) return;
+  }
+}
+
+void Simulation::publishSnapshot(int steps) {
+  RenderSnapshot &s = snapshots_.back();
+  s.capture(particles_);
+  s.stats       = physics_.stats();
+  s.avgUpdateMs = avgUpdateMs_;
+  s.steps       = steps;
+  s.alpha       = stepAlpha_;
+  s.stateHash   = stateHash_;
+  snapshots_.publish();
 }
 
 void Simulation::spawnBrush(int x, int y, int count, float brushRadius,
                             ParticleType t) {
+  if (deferred([=] { spawnBrush(x, y, count, brushRadius, t); })) return;
   std::uniform_real_distribution<float> dr(0.0f, brushRadius);
   std::uniform_real_distribution<float> da(0.0f, 6.28318f);
   std::uniform_real_distribution<float> dv(-10.0f, 10.0f);
@@ -86,37 +266,48 @@ void Simulation::spawnBrush(int x, int y, int count, float brushRadius,
     float a = da(rng_);
     float px = static_cast<float>(x) + std::cos(a) * r;
     float py = static_cast<float>(y) + std::sin(a) * r;
-    spawnAt(px, py, t);
+    const std::size_t k = spawnAt(px, py, t);
+    if (k == particles_.count) continue;
     // Add a little jitter to velocity for natural-looking emissions
-    auto &p = particles_;
-    p.velX[p.count - 1] += dv(rng_);
-    p.velY[p.count - 1] += dv(rng_);
+    particles_.velX[k] += dv(rng_);
+    particles_.velY[k] += dv(rng_);
   }
 }
 
 void Simulation::eraseBrush(int x, int y, float brushRadius) {
+  if (deferred([=] { eraseBrush(x, y, brushRadius); })) return;
+
+  // Whatever rests on the erased particles has to be able to fall. Done
+  // first, while the physics grid still matches the particles.
+  physics_.wakeRegion(particles_, static_cast<float>(x), static_cast<float>(y),
+                      brushRadius + 2.0f * cfg::SLEEP_CELL_SIZE);
+
+  // Mark everything under the brush, then remove it all in one pass.
   float r2 = brushRadius * brushRadius;
-  std::size_t i = 0;
-  while (i < particles_.count) {
+  eraseMask_.assign(particles_.count, 0);
+  bool any = false;
+  auto mark = [&](std::size_t i) {
     float dx = particles_.posX[i] - x;
     float dy = particles_.posY[i] - y;
     if (dx * dx + dy * dy <= r2) {
-      particles_.removeSwap(i);
-    } else {
-      ++i;
+      eraseMask_[i] = 1;
+      any = true;
     }
+  };
+  if (physics_.queryRegion(particles_, static_cast<float>(x),
+                           static_cast<float>(y), brushRadius, eraseScratch_)) {
+    for (std::uint32_t i : eraseScratch_) mark(i);
+  } else {
+    for (std::size_t i = 0; i < particles_.count; ++i) mark(i);
   }
+  if (any) physics_.removeMarked(particles_, eraseMask_);
 }
 
-void Simulation::spawnAt(float x, float y, ParticleType t) {
+std::size_t Simulation::spawnAt(float x, float y, ParticleType t) {
+  if (deferred([=] { spawnAt(x, y, t); })) return snapshots_.front().count;
   if (x < 0.0f || x > cfg::WORLD_WIDTH ||
-      y < 0.0f || y > cfg::WORLD_HEIGHT) return;
-  float mass = cfg::DEFAULT_MASS;
-  float radius = cfg::DEFAULT_RADIUS;
-  if (t == TYPE_STONE)   { mass = 8.0f; radius = cfg::DEFAULT_RADIUS * 1.6f; }
-  else if (t == TYPE_GAS){ mass = 0.5f; }
-  else if (t == TYPE_LIQUID) { mass = 0.9f; }
-  particles_.add(x, y, 0.0f, 0.0f, radius, mass, t, particleTypeColor(t));
+      y < 0.0f || y > cfg::WORLD_HEIGHT) return particles_.count;
+  return particles_.add(x, y, 0.0f, 0.0f, t);
 }
 
 void Simulation::triggerExplosion(float x, float y) {
@@ -124,26 +315,54 @@ void Simulation::triggerExplosion(float x, float y) {
   input_.explodePosition = { x, y };
 }
 
+void Simulation::setObstacles(std::shared_ptr<const ObstacleField> field) {
+  obstacles_ = field;
+  auto apply = [this, field] {
+    stepObstacles_ = field;
+    physics_.setObstacles(field.get());
+  };
+  if (deferred(apply)) return;
+  apply();
+}
+
 void Simulation::toggleGravity() {
   input_.gravityEnabled = !input_.gravityEnabled;
 }
 void Simulation::toggleMultithreading() {
   input_.multithreadEnabled = !input_.multithreadEnabled;
-  physics_.setMultithreadingEnabled(input_.multithreadEnabled);
 }
 void Simulation::toggleGrid() {
   input_.gridEnabled = !input_.gridEnabled;
-  physics_.setGridEnabled(input_.gridEnabled);
+}
+
+float Simulation::getAvgUpdateMs() const {
+  return pipelined_ ? snapshots_.front().avgUpdateMs : avgUpdateMs_;
+}
+
+int Simulation::getParticleCount() const {
+  return static_cast<int>(pipelined_ ? snapshots_.front().count
+                                     : particles_.count);
+}
+
+const PhysicsStats &Simulation::physicsStats() const {
+  return pipelined_ ? snapshots_.front().stats : physics_.stats();
+}
+
+std::uint64_t Simulation::stateHash() const {
+  return pipelined_ ? snapshots_.front().stateHash : stateHash_;
 }
 
 Vec2 Simulation::getAverageVelocity() const {
-  if (particles_.count == 0) return {0.0f, 0.0f};
+  const std::size_t n = pipelined_ ? snapshots_.front().count : particles_.count;
+  if (n == 0) return {0.0f, 0.0f};
+  const float *vx = pipelined_ ? snapshots_.front().velX.data() : particles_.velX.data();
+  const float *vy = pipelined_ ? snapshots_.front().velY.data() : particles_.velY.data();
   double sx = 0.0, sy = 0.0;
-  for (std::size_t i = 0; i < particles_.count; ++i) {
-    sx += particles_.velX[i];
-    sy += particles_.velY[i];
+  for (std::size_t i = 0; i < n; ++i) {
+    sx += vx[i];
+    sy += vy[i];
   }
-  float inv = 1.0f / static_cast<float>(particles_.count);
+  float inv = 1.0f / static_cast<float>(n);
   return { static_cast<float>(sx) * inv, static_cast<float>(sy) * inv };
 }
 
@@ -167,12 +386,7 @@ void Simulation::createRandomParticle() {
   float vx = std::cos(angle) * speed;
   float vy = std::sin(angle) * speed;
 
-  float mass = cfg::DEFAULT_MASS;
-  float radius = cfg::DEFAULT_RADIUS;
-  if (t == TYPE_STONE)   { mass = 8.0f; radius = cfg::DEFAULT_RADIUS * 1.6f; vx = vy = 0.0f; }
-  else if (t == TYPE_GAS){ mass = 0.5f; }
-  else if (t == TYPE_LIQUID) { mass = 0.9f; }
+  if (t == TYPE_STONE) vx = vy = 0.0f;
 
-  particles_.add(dx(rng_), dy(rng_), vx, vy, radius, mass, t,
-                 particleTypeColor(t));
+  particles_.add(dx(rng_), dy(rng_), vx, vy, t);
 }
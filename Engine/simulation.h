@@ -2,22 +2,60 @@
 #define SIMULATION_H
 
 #include "input_state.h"
+#include "obstacle_field.h"
 #include "particle.h"
 #include "physics.h"
+#include "render_snapshot.h"
+#include "triple_buffer.h"
 #include "vec2.h"
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <thread>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Owns the particles and the physics engine, and is the one interface the
+// input layer, the GUI and main() use.
+//
+// Normally everything runs on the caller's thread: advance() steps the
+// physics and render() draws the particles, one after the other.
+//
+// Pipelined (InputState::pipelined), the physics runs on a thread of its
+// own. The UI thread never touches the particles then:
+//   - edits (reset, spawn, erase, freeze, ...) are queued as commands and
+//     run on the physics thread in the order they were made;
+//   - advance() queues a copy of the InputState and the frame's wall time,
+//     then takes the newest finished frame from a TripleBuffer of
+//     RenderSnapshots;
+//   - render() and the diagnostics read that snapshot.
+// The physics thread waits for commands, runs them, steps for the queued
+// time (several queued frames are merged, so it never builds a backlog)
+// and publishes a snapshot. Frame N+1 is simulated while frame N is drawn,
+// so a frame costs the longer of the two rather than their sum, one frame
+// later than it would otherwise appear.
+// ---------------------------------------------------------------------------
 
 class Simulation {
 public:
   Simulation();
+  ~Simulation();
+
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
 
   void start();
   void stop();
   bool isRunning() const { return running_; }
 
-  // Refill the world with this many randomised particles.
+  // Refill the world with this many randomised particles. In deterministic
+  // mode the RNG is reseeded first, so every reset builds the same scene.
   void reset(int particleCount);
 
   // Clear every particle without resetting any other state.
@@ -26,7 +64,17 @@ public:
   // Set the velocity of all particles to zero.
   void freezeAll();
 
+  // Advance by wallSeconds of real time, once per rendered frame. With the
+  // fixed timestep on this runs however many cfg::PHYSICS_RATE steps have
+  // come due (0..cfg::MAX_STEPS_PER_FRAME); otherwise exactly one step.
+  void advance(float wallSeconds);
+
+  // Run one physics step covering frameDt of simulation time.
   void update(float frameDt);
+
+  // Draw the particles. With the fixed timestep they are interpolated
+  // between the last two steps by the fraction of a step left over in the
+  // accumulator, so motion stays smooth when steps and frames don't align.
   void render(struct SDL_Renderer *renderer);
 
   // Spawn a few particles centred on (x, y) with a brush-style scatter.
@@ -35,47 +83,104 @@ public:
   // Erase any particles inside the brush at (x, y).
   void eraseBrush(int x, int y, float brushRadius);
 
-  // Single-particle convenience used for menus.
-  void spawnAt(float x, float y, ParticleType t);
+  // Single-particle convenience used for menus. Returns the new particle's
+  // index, or the particle count if (x, y) is outside the world. Pipelined,
+  // the particle is added later and this returns the count on screen.
+  std::size_t spawnAt(float x, float y, ParticleType t);
 
   // Trigger an explosion at (x, y) on the next physics step.
   void triggerExplosion(float x, float y);
 
-  // Toggles forwarded to the physics engine.
+  // Collide particles with these baked obstacles from the next step on,
+  // or with none when null. render() draws their outlines. Pipelined, the
+  // physics thread takes them over with the next batch of commands.
+  void setObstacles(std::shared_ptr<const ObstacleField> field);
+  const ObstacleField *obstacles() const { return obstacles_.get(); }
+
+  // Toggles forwarded to the physics engine on its next step.
   void toggleGravity();
   void toggleMultithreading();
   void toggleGrid();
 
+  // Move the physics onto its own thread, or back (see above). Switching
+  // off waits for every queued command to run.
+  void togglePipelined();
+
   // Read-only access to shared input state (the input manager mutates this).
   InputState       &input()       { return input_; }
   const InputState &input() const { return input_; }
 
-  // Diagnostics
+  // Diagnostics. Pipelined, the physics figures come from the frame on
+  // screen.
   float getFrameRate() const     { return frameRate_; }
-  float getAvgUpdateMs() const   { return avgUpdateMs_; }
-  int   getParticleCount() const { return static_cast<int>(particles_.count); }
+  float getAvgUpdateMs() const;
+  int   getStepsLastFrame() const { return stepsLastFrame_; }
+  int   getParticleCount() const;
   Vec2  getAverageVelocity() const;
+  const PhysicsStats &physicsStats() const;
+
+  // ParticleSystem::stateHash() after the last update() in deterministic
+  // mode, 0 otherwise. Equal runs give equal hashes frame by frame.
+  std::uint64_t stateHash() const;
 
   bool isMultithreadingEnabled() const { return input_.multithreadEnabled; }
   bool isGridEnabled() const           { return input_.gridEnabled; }
+  bool isPipelined() const             { return pipelined_; }
 
-  // Direct (read-only) access for the renderer.
+  // Direct (read-only) access to the live particles. Not while pipelined.
   const ParticleSystem &particles() const { return particles_; }
 
 private:
   void createRandomParticle();
+  void resetParticles(int particleCount, bool seeded);
+
+  // Physics side: take `in` as the input the steps read. A pending
+  // explosion stays pending until a step consumes it.
+  void takeInput(const InputState &in);
+  // Not pipelined: take input_ before stepping (no-op when pipelined).
+  void pullInput();
+  // Step for wallSeconds as advance() describes; returns the step count.
+  int runSteps(float wallSeconds);
+
+  // Pipelined and called from the UI thread: queue fn for the physics
+  // thread and return true. Otherwise return false; the caller acts now.
+  bool deferred(std::function<void()> fn);
+  void setPipelined(bool on);
+  void physicsLoop();
+  void publishSnapshot(int steps);
 
   ParticleSystem particles_;
   PhysicsEngine  physics_;
-  InputState     input_;
+  InputState     input_;      // UI side: what the input layer edits
+  InputState     stepInput_;  // physics side: what the steps read
+  std::shared_ptr<const ObstacleField> obstacles_;      // UI side: drawn
+  std::shared_ptr<const ObstacleField> stepObstacles_;  // physics side: collided
 
-  bool  running_ = true;
+  std::atomic<bool> running_{true};
   float frameRate_   = 0.0f;
   float avgUpdateMs_ = 0.0f;
   int   frameCount_  = 0;
+  int   stepsLastFrame_ = 0;
+  float accumulator_ = 0.0f;  // wall seconds not yet simulated
+  float stepAlpha_   = 1.0f;  // interpolation factor after the last steps
+  float alpha_       = 1.0f;  // render interpolation factor
   std::chrono::steady_clock::time_point fpsStart_;
+  std::uint64_t stateHash_ = 0;
 
   std::mt19937 rng_;
+  std::vector<std::uint32_t> eraseScratch_;  // region query candidates
+  std::vector<std::uint8_t>  eraseMask_;     // particles under the brush
+
+  // Pipelining. pipelined_ only changes while no physics thread runs.
+  bool pipelined_ = false;
+  std::thread physicsThread_;
+  std::mutex  commandMutex_;
+  std::condition_variable commandCv_;
+  std::vector<std::function<void()>> commands_;  // guarded by commandMutex_
+  bool  quit_ = false;                            // guarded by commandMutex_
+  float pendingSeconds_ = 0.0f;  // physics side: wall time queued by frames
+  bool  framePending_   = false; // physics side: some frame queued time
+  TripleBuffer<RenderSnapshot> snapshots_;
 };
 
 #endif
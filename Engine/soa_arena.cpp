@@ -0,0 +1,113 @@
+#include "soa_arena.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::size_t roundUp(std::size_t n, std::size_t a) {
+  return (n + a - 1) / a * a;
+}
+
+#if defined(__linux__)
+void adviseHugePages(char *base, std::size_t bytes) {
+#if defined(MADV_HUGEPAGE)
+  // Only worth it once a huge page fits; a hint, so failure is harmless.
+  if (cfg::SOA_HUGE_PAGES && bytes >= (std::size_t{2} << 20)) {
+    madvise(base, bytes, MADV_HUGEPAGE);
+  }
+#else
+  (void)base;
+  (void)bytes;
+#endif
+}
+#endif
+
+} // namespace
+
+SoaArena::~SoaArena() { release(); }
+
+SoaArena::SoaArena(SoaArena &&other) noexcept
+    : base_(std::exchange(other.base_, nullptr)),
+      bytes_(std::exchange(other.bytes_, 0)),
+      offsets_(std::move(other.offsets_)) {}
+
+SoaArena &SoaArena::operator=(SoaArena &&other) noexcept {
+  if (this != &other) {
+    release();
+    base_    = std::exchange(other.base_, nullptr);
+    bytes_   = std::exchange(other.bytes_, 0);
+    offsets_ = std::move(other.offsets_);
+  }
+  return *this;
+}
+
+void SoaArena::release() {
+  if (!base_) return;
+#if defined(__linux__)
+  munmap(base_, bytes_);
+#else
+  ::operator delete(base_, std::align_val_t(cfg::SOA_ALIGNMENT));
+#endif
+  base_  = nullptr;
+  bytes_ = 0;
+}
+
+void SoaArena::grow(const std::vector<std::size_t> &elemSizes,
+                    std::size_t capacity, std::size_t keep) {
+  const std::size_t fields = elemSizes.size();
+  std::vector<std::size_t> offsets(fields);
+  std::size_t total = 0;
+  for (std::size_t k = 0; k < fields; ++k) {
+    offsets[k] = total;
+    total += roundUp(capacity * elemSizes[k], cfg::SOA_ALIGNMENT);
+  }
+  const bool hadBlock = base_ != nullptr && offsets_.size() == fields;
+  if (!hadBlock) keep = 0;
+
+#if defined(__linux__)
+  const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  const std::size_t bytes = roundUp(std::max<std::size_t>(total, 1), page);
+  if (bytes > bytes_ || !base_) {
+    void *p = base_ ? mremap(base_, bytes_, bytes, MREMAP_MAYMOVE)
+                    : mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    base_  = static_cast<char *>(p);
+    bytes_ = bytes;
+    adviseHugePages(base_, bytes_);
+  }
+  // The old slots are where they were inside the (possibly moved) block.
+  for (std::size_t k = fields; keep > 0 && k-- > 0;) {
+    if (offsets[k] != offsets_[k]) {
+      std::memmove(base_ + offsets[k], base_ + offsets_[k], keep * elemSizes[k]);
+    }
+  }
+#else
+  const std::size_t bytes = std::max<std::size_t>(total, cfg::SOA_ALIGNMENT);
+  if (bytes > bytes_ || !base_) {
+    char *p = static_cast<char *>(
+        ::operator new(bytes, std::align_val_t(cfg::SOA_ALIGNMENT)));
+    for (std::size_t k = 0; k < fields && keep > 0; ++k) {
+      std::memcpy(p + offsets[k], base_ + offsets_[k], keep * elemSizes[k]);
+    }
+    release();
+    base_  = p;
+    bytes_ = bytes;
+  } else {
+    for (std::size_t k = fields; keep > 0 && k-- > 0;) {
+      if (offsets[k] != offsets_[k]) {
+        std::memmove(base_ + offsets[k], base_ + offsets_[k], keep * elemSizes[k]);
+      }
+    }
+  }
+#endif
+  offsets_ = std::move(offsets);
+}
@@ -0,0 +1,98 @@
+#ifndef SOA_ARENA_H
+#define SOA_ARENA_H
+
+#include "config.h"
+
+#include <cstddef>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// One allocation behind every array of a structure of arrays.
+//
+// Field k gets a slot of capacity * elemSize[k] bytes rounded up to
+// cfg::SOA_ALIGNMENT, laid end to end after the slots of the fields before
+// it. The block itself is at least that aligned, so every field starts on
+// a cache line and whole-line vector loads from its start are legal.
+//
+// Growing re-lays the slots for the larger capacity and moves only the
+// live prefix of each field (`keep` elements), last field first: a field's
+// slot only ever moves up, past the ends of the ones below it, so nothing
+// is overwritten before it has moved. Nothing past the prefix is copied or
+// cleared.
+//
+// On Linux the block is an anonymous mapping grown with mremap, which
+// extends it where it is when the address space after it is free and
+// otherwise moves the pages rather than copying them; either way the new
+// pages are only faulted in when first touched. With cfg::SOA_HUGE_PAGES
+// the mapping is marked for transparent huge pages, which cuts TLB misses
+// once the arrays run to megabytes. Elsewhere the block is an aligned
+// operator new and growth copies the prefixes into a new one.
+// ---------------------------------------------------------------------------
+
+// A field's view of its slot. Indexable like the std::vector it replaces;
+// size() is the arena's capacity.
+template <class T>
+class ArenaArray {
+public:
+  T *data() { return assumeAligned(ptr_); }
+  const T *data() const { return assumeAligned(ptr_); }
+  std::size_t size() const { return size_; }
+
+  T &operator[](std::size_t i) { return data()[i]; }
+  const T &operator[](std::size_t i) const { return data()[i]; }
+
+  T *begin() { return data(); }
+  T *end() { return data() + size_; }
+  const T *begin() const { return data(); }
+  const T *end() const { return data() + size_; }
+
+  // Point the view at `n` elements starting at `p` (SoaArena::field()).
+  void attach(void *p, std::size_t n) {
+    ptr_  = static_cast<T *>(p);
+    size_ = n;
+  }
+
+private:
+  T          *ptr_  = nullptr;
+  std::size_t size_ = 0;
+
+  static T *assumeAligned(T *p) {
+#if defined(__GNUC__)
+    return static_cast<T *>(__builtin_assume_aligned(p, cfg::SOA_ALIGNMENT));
+#else
+    return p;
+#endif
+  }
+};
+
+class SoaArena {
+public:
+  SoaArena() = default;
+  ~SoaArena();
+
+  SoaArena(const SoaArena &) = delete;
+  SoaArena &operator=(const SoaArena &) = delete;
+  SoaArena(SoaArena &&other) noexcept;
+  SoaArena &operator=(SoaArena &&other) noexcept;
+
+  // Re-lay the block for `capacity` elements of each of the fields whose
+  // element sizes are given, keeping the first `keep` elements of every
+  // field. The sizes must not change between calls on one arena.
+  void grow(const std::vector<std::size_t> &elemSizes, std::size_t capacity,
+            std::size_t keep);
+
+  // Start of field k's slot.
+  void *field(std::size_t k) const { return base_ + offsets_[k]; }
+
+  // Bytes the block spans (address space; pages are touched lazily).
+  std::size_t bytes() const { return bytes_; }
+
+private:
+  char                    *base_  = nullptr;
+  std::size_t              bytes_ = 0;
+  std::vector<std::size_t> offsets_;
+
+  void release();
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "sparse_spatial_hash.h"
+
+#include <algorithm>
+
+void SparseSpatialHash::build(std::vector<std::uint32_t> &indices,
+                              const float *posX,
+                              const float *posY,
+                              std::size_t count) {
+  // Size the table for the worst case of one cell per particle so the load
+  // factor never exceeds 1/2 and probing stays short. The table only grows.
+  std::size_t capacity = 16;
+  int bits = 4;
+  while (capacity < count * 2 || capacity < slots_.size()) { capacity <<= 1; ++bits; }
+  if (slots_.size() != capacity) {
+    slots_.assign(capacity, Slot{0, {0, 0}, 0u});
+    generation_ = 0;
+  }
+  mask_  = capacity - 1;
+  shift_ = 64 - bits;
+
+  if (++generation_ == 0) {
+    // Stamp wrapped after 2^32 builds; start over with a clean table.
+    for (Slot &slot : slots_) slot.stamp = 0u;
+    generation_ = 1;
+  }
+
+  occupied_.clear();
+  if (cellOf_.size() < count) cellOf_.resize(count);
+  if (indices.size() < count) indices.resize(count);
+
+  // 1. Find or insert each particle's cell and tally occupancy.
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::uint64_t key = packKey(cellIndexX(posX[i]), cellIndexY(posY[i]));
+    std::size_t s = slotFor(key);
+    while (slots_[s].stamp == generation_ && slots_[s].key != key) {
+      s = (s + 1) & mask_;
+    }
+    if (slots_[s].stamp != generation_) {
+      slots_[s] = Slot{key, {0, 0}, generation_};
+      occupied_.push_back(static_cast<std::uint32_t>(s));
+    }
+    ++slots_[s].cell.count;
+    cellOf_[i] = static_cast<std::uint32_t>(s);
+  }
+
+  // 2. Order occupied cells by key, then prefix-sum over them only.
+  std::sort(occupied_.begin(), occupied_.end(),
+            [this](std::uint32_t a, std::uint32_t b) {
+              return slots_[a].key < slots_[b].key;
+            });
+  std::uint32_t running = 0;
+  for (std::uint32_t s : occupied_) {
+    Cell &c = slots_[s].cell;
+    c.start = running;
+    running += c.count;
+    c.count = 0;  // reused as a write cursor in step 3
+  }
+
+  // 3. Scatter indices into their cell-local slots.
+  for (std::size_t i = 0; i < count; ++i) {
+    Cell &c = slots_[cellOf_[i]].cell;
+    indices[c.start + c.count++] = static_cast<std::uint32_t>(i);
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef SPARSE_SPATIAL_HASH_H
+#define SPARSE_SPATIAL_HASH_H
+
+#include "spatial_hash.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Sparse counterpart of SpatialHash: only occupied cells are stored, in an
+// open-addressing table keyed by the packed (cx, cy) cell coordinate.
+//
+// Memory scales with the number of particles instead of the world area, and
+// positions are never clamped, so particles far outside the nominal world
+// keep their own cells instead of piling into the edge ones. The build is
+// the same counting sort as the dense grid: tally, prefix-sum over the
+// occupied cells, scatter into sortedIndices. Occupied cells are laid out
+// in key order (column-major: x, then y), so a column of neighbouring
+// cells is one contiguous range of sorted slots, like a row of the dense
+// grid.
+//
+// The table is rebuilt from scratch every build with linear probing at a
+// load factor of at most 1/2. Slots are invalidated by bumping a generation
+// stamp, so a build never has to clear the table.
+// ---------------------------------------------------------------------------
+
+class SparseSpatialHash {
+public:
+  using Cell = SpatialHash::Cell;
+
+  explicit SparseSpatialHash(float cellSize)
+      : cellSize_(cellSize), invCellSize_(1.0f / cellSize) {}
+
+  int cellIndexX(float x) const {
+    return static_cast<int>(std::floor(x * invCellSize_));
+  }
+  int cellIndexY(float y) const {
+    return static_cast<int>(std::floor(y * invCellSize_));
+  }
+
+  void build(std::vector<std::uint32_t> &indices,
+             const float *posX,
+             const float *posY,
+             std::size_t count);
+
+  // Unoccupied cells come back empty, exactly like an off-grid lookup on
+  // the dense hash.
+  const Cell &getCell(int x, int y) const {
+    static const Cell empty{0, 0};
+    if (slots_.empty()) return empty;
+    const std::uint64_t key = packKey(x, y);
+    std::size_t s = slotFor(key);
+    while (slots_[s].stamp == generation_) {
+      if (slots_[s].key == key) return slots_[s].cell;
+      s = (s + 1) & mask_;
+    }
+    return empty;
+  }
+
+  float       cellSize()      const { return cellSize_; }
+  std::size_t occupiedCells() const { return occupied_.size(); }
+
+  // Bytes currently held by the table and build scratch.
+  std::size_t memoryBytes() const {
+    return slots_.capacity()    * sizeof(Slot) +
+           occupied_.capacity() * sizeof(std::uint32_t) +
+           cellOf_.capacity()   * sizeof(std::uint32_t);
+  }
+
+private:
+  // The stamp lives next to the key so a probe touches one cache line.
+  struct Slot {
+    std::uint64_t key;
+    Cell          cell;
+    std::uint32_t stamp;   // slot is live iff == generation_
+  };
+
+  // Flipping the sign bit makes unsigned key order match signed (x, y)
+  // order, so cells on either side of zero stay adjacent once sorted.
+  static std::uint64_t packKey(int x, int y) {
+    const std::uint32_t ux = static_cast<std::uint32_t>(x) ^ 0x80000000u;
+    const std::uint32_t uy = static_cast<std::uint32_t>(y) ^ 0x80000000u;
+    return (static_cast<std::uint64_t>(ux) << 32) | uy;
+  }
+
+  std::size_t slotFor(std::uint64_t key) const {
+    // Fibonacci hashing: the multiply spreads neighbouring cell keys
+    // across the table, the top bits select the slot.
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> shift_);
+  }
+
+  float cellSize_;
+  float invCellSize_;
+
+  std::vector<Slot>          slots_;
+  std::vector<std::uint32_t> occupied_;   // live slots in key order
+  std::vector<std::uint32_t> cellOf_;     // slot per particle
+  std::uint32_t generation_ = 0;
+  std::size_t   mask_  = 0;
+  int           shift_ = 64;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "spatial_hash.h"
+
+#include "thread_pool.h"
+
+void SpatialHash::build(std::vector<std::uint32_t> &indices,
+                        const float *posX,
+                        const float *posY,
+                        std::size_t count,
+                        ThreadPool &pool,
+                        std::size_t minChunk) {
+  const std::size_t cells = grid_.size();
+  const std::size_t maxChunks =
+      std::max<std::size_t>(1, count / std::max<std::size_t>(1, minChunk));
+  const std::size_t numChunks =
+      std::min<std::size_t>(std::max(1u, pool.size()), maxChunks);
+  if (numChunks <= 1) {
+    build(indices, posX, posY, count);
+    return;
+  }
+  const std::size_t chunk = (count + numChunks - 1) / numChunks;
+
+  if (cellOf_.size() < count) cellOf_.resize(count);
+  if (indices.size() < count) indices.resize(count);
+  chunkCounts_.resize(numChunks * cells);
+
+  // 1. Per-chunk histograms. Each chunk owns its row, so no atomics.
+  pool.parallelFor(numChunks, 1, [&](std::size_t cb, std::size_t ce) {
+    for (std::size_t c = cb; c < ce; ++c) {
+      std::uint32_t *row = &chunkCounts_[c * cells];
+      std::fill(row, row + cells, 0u);
+      const std::size_t b = c * chunk;
+      const std::size_t e = std::min(b + chunk, count);
+      for (std::size_t i = b; i < e; ++i) {
+        const std::uint32_t cell =
+            static_cast<std::uint32_t>(cellIndexY(posY[i])) * cols_ +
+            static_cast<std::uint32_t>(cellIndexX(posX[i]));
+        cellOf_[i] = cell;
+        ++row[cell];
+      }
+    }
+  });
+
+  // 2. Prefix sum over cells, in three passes: per-block totals (parallel),
+  // an exclusive scan of those totals (serial, numBlocks entries), then
+  // per-block scans that also turn every chunk's count into its write
+  // cursor inside the cell (parallel).
+  const std::size_t numBlocks = numChunks;
+  const std::size_t block = (cells + numBlocks - 1) / numBlocks;
+  blockTotals_.assign(numBlocks + 1, 0u);
+
+  pool.parallelFor(numBlocks, 1, [&](std::size_t bb, std::size_t be) {
+    for (std::size_t blk = bb; blk < be; ++blk) {
+      const std::size_t b = blk * block;
+      const std::size_t e = std::min(b + block, cells);
+      std::uint32_t total = 0;
+      for (std::size_t cell = b; cell < e; ++cell) {
+        std::uint32_t n = 0;
+        for (std::size_t c = 0; c < numChunks; ++c) n += chunkCounts_[c * cells + cell];
+        grid_[cell].count = n;
+        total += n;
+      }
+      blockTotals_[blk + 1] = total;
+    }
+  });
+
+  for (std::size_t blk = 1; blk <= numBlocks; ++blk) {
+    blockTotals_[blk] += blockTotals_[blk - 1];
+  }
+
+  pool.parallelFor(numBlocks, 1, [&](std::size_t bb, std::size_t be) {
+    for (std::size_t blk = bb; blk < be; ++blk) {
+      const std::size_t b = blk * block;
+      const std::size_t e = std::min(b + block, cells);
+      std::uint32_t running = blockTotals_[blk];
+      for (std::size_t cell = b; cell < e; ++cell) {
+        grid_[cell].start = running;
+        for (std::size_t c = 0; c < numChunks; ++c) {
+          std::uint32_t &slot = chunkCounts_[c * cells + cell];
+          const std::uint32_t n = slot;
+          slot = running;
+          running += n;
+        }
+      }
+    }
+  });
+
+  // 3. Scatter. Each chunk walks its particles in index order and bumps its
+  // own cursors, which reproduces the serial build's order within a cell.
+  pool.parallelFor(numChunks, 1, [&](std::size_t cb, std::size_t ce) {
+    for (std::size_t c = cb; c < ce; ++c) {
+      std::uint32_t *cursor = &chunkCounts_[c * cells];
+      const std::size_t b = c * chunk;
+      const std::size_t e = std::min(b + chunk, count);
+      for (std::size_t i = b; i < e; ++i) {
+        indices[cursor[cellOf_[i]]++] = static_cast<std::uint32_t>(i);
+      }
+    }
+  });
+}
@@ -8,14 +8,37 @@
 #include <cstdint>
 #include <vector>
 
+class ThreadPool;
+
 // ---------------------------------------------------------------------------
 // Uniform grid spatial hash with a counting-sort style build.
 //
 // Cells store a (start, count) pair so neighbouring particles can be walked
 // contiguously out of a sortedIndices buffer. We use a power-of-two cell
 // size so the grid index is just a shift.
+//
+// The parallel build splits the particle range into one chunk per worker,
+// tallies a private histogram per chunk, prefix-sums across (cell, chunk)
+// and then scatters each chunk into its own slots. Chunk c's particles land
+// after every lower chunk's within each cell, so the output is identical to
+// the serial build.
+//
+// Region queries (queryRect / queryCircle) return every particle stored in
+// the cells a region overlaps, so brush-sized effects cost in proportion to
+// the brush area rather than to N. Cells are laid out row by row in slot
+// order, so each row of a region is one contiguous slot span. Results are
+// candidates as of the last build: callers test the exact distance.
 // ---------------------------------------------------------------------------
 
+// Axes along which the world wraps around (periodic boundaries): a
+// particle leaving one side comes back in on the other, and neighbourhoods
+// carry on across the seam.
+struct PeriodicAxes {
+  bool x = false, y = false;
+
+  bool any() const { return x || y; }
+};
+
 class SpatialHash {
 public:
   struct Cell {
@@ -52,8 +75,8 @@ public:
   }
 
   void build(std::vector<std::uint32_t> &indices,
-             const std::vector<float> &posX,
-             const std::vector<float> &posY,
+             const float *posX,
+             const float *posY,
              std::size_t count) {
     // 1. Reset cell counts.
     std::fill(grid_.begin(), grid_.end(), Cell{0, 0});
@@ -84,6 +107,87 @@ public:
     }
   }
 
+  // Parallel variant of build(); produces exactly the same grid_ and
+  // index order. Chunks smaller than minChunk aren't worth a worker.
+  void build(std::vector<std::uint32_t> &indices,
+             const float *posX,
+             const float *posY,
+             std::size_t count,
+             ThreadPool &pool,
+             std::size_t minChunk);
+
+  // Inclusive range of cells, clamped to the grid.
+  struct CellRange {
+    int x0, y0, x1, y1;
+  };
+
+  CellRange cellsInRect(float minX, float minY, float maxX, float maxY) const {
+    return { cellIndexX(minX), cellIndexY(minY),
+             cellIndexX(maxX), cellIndexY(maxY) };
+  }
+
+  CellRange cellsInCircle(float x, float y, float radius) const {
+    return cellsInRect(x - radius, y - radius, x + radius, y + radius);
+  }
+
+  // Append the particle indices stored in `range` to `out`. `indices` is
+  // the buffer the hash was last built into.
+  void gather(const CellRange &range, const std::vector<std::uint32_t> &indices,
+              std::vector<std::uint32_t> &out) const {
+    for (int y = range.y0; y <= range.y1; ++y) {
+      const Cell &first = getCell(range.x0, y);
+      const Cell &last  = getCell(range.x1, y);
+      out.insert(out.end(), indices.begin() + first.start,
+                 indices.begin() + last.start + last.count);
+    }
+  }
+
+  void queryRect(float minX, float minY, float maxX, float maxY,
+                 const std::vector<std::uint32_t> &indices,
+                 std::vector<std::uint32_t> &out) const {
+    gather(cellsInRect(minX, minY, maxX, maxY), indices, out);
+  }
+
+  void queryCircle(float x, float y, float radius,
+                   const std::vector<std::uint32_t> &indices,
+                   std::vector<std::uint32_t> &out) const {
+    gather(cellsInCircle(x, y, radius), indices, out);
+  }
+
+  // Call fn(start, end, shiftX, shiftY) for slot spans covering the 3x3
+  // cells around cell (cx, cy): one span per row, clipped to the grid.
+  // Along a periodic axis the window wraps instead. A row or column past
+  // the edge is read from the other side, as a separate span whose shift
+  // (the world's width or height) moves its particles to where they appear
+  // from (cx, cy). That is up to six spans, for a corner cell with both
+  // axes periodic. The world size should be a whole number of cells, and
+  // at least three of them along a periodic axis.
+  template <class Fn>
+  void forEachNeighbourSpan(int cx, int cy, PeriodicAxes wrap, Fn &&fn) const {
+    const int x0 = std::max(cx - 1, 0);
+    const int x1 = std::min(cx + 1, cols_ - 1);
+    for (int y = cy - 1; y <= cy + 1; ++y) {
+      int row = y;
+      float shiftY = 0.0f;
+      if (y < 0 || y >= rows_) {
+        if (!wrap.y) continue;
+        row    = y < 0 ? rows_ - 1 : 0;
+        shiftY = y < 0 ? -height_ : height_;
+      }
+      const Cell &first = getCell(x0, row);
+      const Cell &last  = getCell(x1, row);
+      fn(first.start, last.start + last.count, 0.0f, shiftY);
+      if (wrap.x && cx == 0) {
+        const Cell &ghost = getCell(cols_ - 1, row);
+        fn(ghost.start, ghost.start + ghost.count, -width_, shiftY);
+      }
+      if (wrap.x && cx == cols_ - 1) {
+        const Cell &ghost = getCell(0, row);
+        fn(ghost.start, ghost.start + ghost.count, width_, shiftY);
+      }
+    }
+  }
+
   const Cell &getCell(int x, int y) const {
     if (x < 0 || x >= cols_ || y < 0 || y >= rows_) {
       static const Cell empty{0, 0};
@@ -102,6 +206,12 @@ private:
   int   cols_, rows_;
   int   cellShift_;
   std::vector<Cell> grid_;
+
+  // Parallel build scratch: flattened cell index per particle and one
+  // histogram row (later a row of write cursors) per chunk.
+  std::vector<std::uint32_t> cellOf_;
+  std::vector<std::uint32_t> chunkCounts_;
+  std::vector<std::uint32_t> blockTotals_;
 };
 
 #endif
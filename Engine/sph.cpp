@@ -0,0 +1,193 @@
+#include "sph.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sph {
+
+namespace {
+
+constexpr float kPi = 3.14159265f;
+constexpr float h   = cfg::SPH_SMOOTHING;
+constexpr float h2  = h * h;
+
+static_assert(cfg::SPH_SMOOTHING <= cfg::SPATIAL_CELL_SIZE,
+              "SPH neighbours are searched in the 3x3 grid cells only");
+
+// 2D kernel normalisations: poly6, spiky gradient, viscosity Laplacian.
+constexpr float kPoly6     = 4.0f  / (kPi * h2 * h2 * h2 * h2);
+constexpr float kSpikyGrad = 30.0f / (kPi * h2 * h2 * h);
+constexpr float kViscLap   = 40.0f / (kPi * h2 * h2 * h);
+
+inline float poly6(float r2) {
+  const float d = h2 - r2;
+  return kPoly6 * d * d * d;
+}
+
+// The 3x3 cells around (x, y) as contiguous slot spans, one per row (as in
+// the collision kernels) plus the ghost spans across a periodic seam.
+// Returns the number of spans.
+int neighbourSpans(const SpatialHash &hash, float x, float y, PeriodicAxes wrap,
+                   narrowphase::Span spans[6]) {
+  int n = 0;
+  hash.forEachNeighbourSpan(hash.cellIndexX(x), hash.cellIndexY(y), wrap,
+                            [&](std::uint32_t b, std::uint32_t e, float sx,
+                                float sy) { spans[n++] = { b, e, sx, sy }; });
+  return n;
+}
+
+// Density at (x, y) from the liquid slots in [begin,end), including the
+// particle at (x, y) itself. Written with selects so the loop vectorises;
+// GCC needs the restrict parameters to see that nothing aliases.
+float densitySpan(const float *__restrict px, const float *__restrict py,
+                  const float *__restrict invMass,
+                  const std::uint8_t *__restrict type,
+                  std::uint32_t begin, std::uint32_t end, float x, float y) {
+  float rho = 0.0f;
+  for (std::uint32_t k = begin; k < end; ++k) {
+    const float rx = px[k] - x;
+    const float ry = py[k] - y;
+    const float d  = std::max(h2 - (rx * rx + ry * ry), 0.0f);
+    const float m  = type[k] == TYPE_LIQUID ? 1.0f / invMass[k] : 0.0f;
+    rho += m * d * d * d;
+  }
+  return rho * kPoly6;
+}
+
+struct ForceSums {
+  float ax = 0.0f, ay = 0.0f;     // pressure + cohesion
+  float visX = 0.0f, visY = 0.0f; // viscosity, not yet divided by rho_i
+};
+
+// Pressure, cohesion and viscosity on a particle at (x, y) with velocity
+// (vx, vy) and p_i / rho_i^2 = pTermI from the liquid slots in
+// [begin,end). The particle's own slot drops out through the r2 > 0 test.
+void forceSpan(const float *__restrict px, const float *__restrict py,
+               const float *__restrict vxs, const float *__restrict vys,
+               const float *__restrict invMass,
+               const std::uint8_t *__restrict type,
+               const float *__restrict pTerm,
+               const float *__restrict volume,
+               std::uint32_t begin, std::uint32_t end,
+               float x, float y, float vx, float vy, float pTermI,
+               ForceSums &out) {
+  float ax = 0.0f, ay = 0.0f, visX = 0.0f, visY = 0.0f;
+  for (std::uint32_t k = begin; k < end; ++k) {
+    const float dx = x - px[k];   // points j -> i
+    const float dy = y - py[k];
+    const float r2 = dx * dx + dy * dy;
+    const bool live = (type[k] == TYPE_LIQUID) & (r2 < h2) & (r2 > 1e-12f);
+    const float r    = std::sqrt(r2);
+    const float q    = live ? h - r : 0.0f;
+    const float invR = live ? 1.0f / r : 0.0f;
+    const float mj   = live ? 1.0f / invMass[k] : 0.0f;
+
+    // Symmetric pressure term along the spiky gradient, and cohesion:
+    // every neighbour pulls, so only the surface feels a net pull.
+    const float pres = mj * (pTermI + pTerm[k]) * kSpikyGrad * q * q * invR;
+    const float d   = h2 - r2;
+    const float coh = cfg::SPH_COHESION * mj * kPoly6 * d * d * d;
+    ax += (pres - coh) * dx;
+    ay += (pres - coh) * dy;
+
+    const float visc = live ? volume[k] * kViscLap * q : 0.0f;
+    visX += visc * (vxs[k] - vx);
+    visY += visc * (vys[k] - vy);
+  }
+  out.ax += ax;     out.ay += ay;
+  out.visX += visX; out.visY += visY;
+}
+
+} // namespace
+
+void Fields::resize(std::size_t n) {
+  density.resize(n);
+  pTerm.resize(n);
+  volume.resize(n);
+  dvX.resize(n);
+  dvY.resize(n);
+}
+
+float restDensity() {
+  static const float rho0 = [] {
+    const float dx = cfg::SPH_REST_SPACING;
+    const float dy = dx * 0.8660254f;
+    const int reach = static_cast<int>(std::ceil(h / dy)) + 1;
+    float sum = 0.0f;
+    for (int row = -reach; row <= reach; ++row) {
+      const float shift = (row & 1) ? dx * 0.5f : 0.0f;
+      for (int col = -reach; col <= reach; ++col) {
+        const float x = col * dx + shift;
+        const float y = row * dy;
+        const float r2 = x * x + y * y;
+        if (r2 < h2) sum += cfg::DEFAULT_MASS * poly6(r2);
+      }
+    }
+    return sum;
+  }();
+  return rho0;
+}
+
+void computeDensity(const SpatialHash &hash,
+                    const narrowphase::SortedParticles &s, Fields &f,
+                    std::size_t begin, std::size_t end, PeriodicAxes wrap) {
+  const float rho0 = restDensity();
+  for (std::size_t i = begin; i < end; ++i) {
+    if (s.type[i] != TYPE_LIQUID) continue;
+    narrowphase::Span spans[6];
+    const int n = neighbourSpans(hash, s.posX[i], s.posY[i], wrap, spans);
+    float rho = 0.0f;
+    for (int sp = 0; sp < n; ++sp) {
+      rho += densitySpan(s.posX.data(), s.posY.data(), s.invMass.data(),
+                         s.type.data(), spans[sp].begin, spans[sp].end,
+                         s.posX[i] - spans[sp].shiftX,
+                         s.posY[i] - spans[sp].shiftY);
+    }
+    // No tension from pressure: a stretched surface would clump. Cohesion
+    // does that job instead.
+    const float pressure = std::max(0.0f, cfg::SPH_STIFFNESS * (rho - rho0));
+    f.density[i] = rho;
+    f.pTerm[i]   = pressure / (rho * rho);
+    f.volume[i]  = 1.0f / (s.invMass[i] * rho);
+  }
+}
+
+void computeForces(const SpatialHash &hash,
+                   const narrowphase::SortedParticles &s, Fields &f,
+                   float dt, std::size_t begin, std::size_t end,
+                   PeriodicAxes wrap) {
+  for (std::size_t i = begin; i < end; ++i) {
+    f.dvX[i] = 0.0f;
+    f.dvY[i] = 0.0f;
+    if (s.type[i] != TYPE_LIQUID || s.asleep[i]) continue;
+
+    const float rhoI = f.density[i];
+    narrowphase::Span spans[6];
+    const int n = neighbourSpans(hash, s.posX[i], s.posY[i], wrap, spans);
+    ForceSums sums;
+    for (int sp = 0; sp < n; ++sp) {
+      forceSpan(s.posX.data(), s.posY.data(), s.velX.data(), s.velY.data(),
+                s.invMass.data(), s.type.data(), f.pTerm.data(),
+                f.volume.data(), spans[sp].begin, spans[sp].end,
+                s.posX[i] - spans[sp].shiftX, s.posY[i] - spans[sp].shiftY,
+                s.velX[i], s.velY[i], f.pTerm[i], sums);
+    }
+    f.dvX[i] = (sums.ax + cfg::SPH_VISCOSITY * sums.visX / rhoI) * dt;
+    f.dvY[i] = (sums.ay + cfg::SPH_VISCOSITY * sums.visY / rhoI) * dt;
+  }
+}
+
+void applyForces(ParticleSystem &p, narrowphase::SortedParticles &s,
+                 const Fields &f, std::size_t begin, std::size_t end) {
+  for (std::size_t k = begin; k < end; ++k) {
+    if (s.type[k] != TYPE_LIQUID || s.asleep[k]) continue;
+    s.velX[k] += f.dvX[k];
+    s.velY[k] += f.dvY[k];
+    const std::uint32_t i = s.id[k];
+    p.velX[i] += f.dvX[k];
+    p.velY[i] += f.dvY[k];
+  }
+}
+
+} // namespace sph
@@ -0,0 +1,74 @@
+#ifndef SPH_H
+#define SPH_H
+
+#include "narrowphase.h"
+#include "particle.h"
+#include "spatial_hash.h"
+
+#include <cstddef>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Smoothed Particle Hydrodynamics for liquid particles.
+//
+// Liquid particles sample a continuous fluid: each one's density is the
+// kernel-weighted mass of the liquid around it, pressure pushes particles
+// from dense regions towards sparse ones, viscosity pulls neighbouring
+// velocities together and a cohesion term pulls neighbours in at the free
+// surface (surface tension). Only liquid-liquid pairs take part; contacts
+// with other types, and the hard core of liquid-liquid contacts closer than
+// two radii, stay with the collision pass.
+//
+// The passes run on the cell-ordered snapshot right after the uniform grid
+// is built. The smoothing length is the grid's cell size, so every
+// neighbour within reach is in the 3x3 cells around a particle, and those
+// cells form three contiguous slot ranges as in the collision kernels.
+// With periodic boundaries the neighbourhood wraps across the seam the
+// same way the collision pass's does (SpatialHash::forEachNeighbourSpan).
+//
+//   1. density + pressure per slot                   (parallel over slots)
+//   2. pressure, viscosity and cohesion -> dv        (parallel over slots)
+//   3. add dv to the snapshot and the particles      (parallel over slots)
+//
+// Each pass writes only the slots it is given and reads neighbours from
+// the previous pass's output, so all three are race-free.
+//
+// Kernels are the usual 2D ones: poly6 for density and cohesion, the
+// spiky gradient for pressure and the viscosity Laplacian.
+// ---------------------------------------------------------------------------
+
+namespace sph {
+
+// Per-slot SPH state, indexed like SortedParticles. Pass 1 also stores the
+// two per-particle factors of the force sums, p / rho^2 and m / rho, so the
+// neighbour loop of pass 2 does not divide by them for every pair.
+struct Fields {
+  std::vector<float> density, pTerm, volume, dvX, dvY;
+
+  void resize(std::size_t n);
+};
+
+// Density of liquid at rest: a hex lattice with cfg::SPH_REST_SPACING
+// between neighbours.
+float restDensity();
+
+// Pass 1 over slots [begin,end): density and pressure of every liquid slot.
+void computeDensity(const SpatialHash &hash,
+                    const narrowphase::SortedParticles &sorted, Fields &f,
+                    std::size_t begin, std::size_t end, PeriodicAxes wrap = {});
+
+// Pass 2 over slots [begin,end): velocity change over `dt` from pressure,
+// viscosity and cohesion for every awake liquid slot (0 for the rest).
+void computeForces(const SpatialHash &hash,
+                   const narrowphase::SortedParticles &sorted, Fields &f,
+                   float dt, std::size_t begin, std::size_t end,
+                   PeriodicAxes wrap = {});
+
+// Pass 3 over slots [begin,end): add the velocity change to the snapshot
+// (which the collision pass reads next) and to the particles.
+void applyForces(ParticleSystem &p, narrowphase::SortedParticles &sorted,
+                 const Fields &f, std::size_t begin, std::size_t end);
+
+} // namespace sph
+
+#endif
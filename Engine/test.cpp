@@ -1,9 +1,27 @@
 #include "test.h"
 
+#include "barnes_hut.h"
+#include "collisions.h"
+#include "forces.h"
+#include "multi_level_grid.h"
+#include "narrowphase.h"
+#include "obstacle_field.h"
+#include "particle_mesh.h"
 #include "simulation.h"
+#include "sparse_spatial_hash.h"
+#include "spatial_hash.h"
+#include "thread_pool.h"
+#include "verlet_list.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 namespace {
@@ -14,10 +32,24 @@ struct Scenario {
   bool multithread;
   bool grid;
   const char *label;
+  int  reorderInterval = cfg::REORDER_INTERVAL;
+  Broadphase broadphase = Broadphase::UniformGrid;
+  bool sleep = true;
+  bool adaptive = false;  // fixed cfg::PHYSICS_SUBSTEPS keeps rows comparable
+  bool partition = false;
 };
 
-// Run one scenario and return total wall-clock ms for all update() calls.
-double runScenario(const Scenario &s) {
+struct Result {
+  double totalMs   = 0.0; // wall-clock ms for all update() calls
+  double hashMs    = 0.0; // ms of totalMs spent rebuilding the spatial hash
+  int    reorders  = 0;   // spatial reorder passes across all frames
+  double reorderMs = 0.0; // ms of totalMs spent in those passes
+  int    substeps  = 0;   // substeps simulated across all frames
+  int    listRebuilds = 0; // Verlet list rebuilds across all frames
+};
+
+// Run one scenario and collect wall-clock and per-phase totals.
+Result runScenario(const Scenario &s) {
   Simulation sim;
   sim.reset(s.particleCount);
 
@@ -25,15 +57,1756 @@ double runScenario(const Scenario &s) {
   // happen via the engine wrappers so the physics engine stays in sync.
   if (sim.isMultithreadingEnabled() != s.multithread) sim.toggleMultithreading();
   if (sim.isGridEnabled()           != s.grid)        sim.toggleGrid();
+  sim.input().reorderInterval = s.reorderInterval;
+  sim.input().broadphase      = s.broadphase;
+  sim.input().sleepEnabled    = s.sleep;
+  sim.input().adaptiveSubsteps = s.adaptive;
+  sim.input().partitionByType  = s.partition;
 
   // Use a fixed frame dt so the benchmark is reproducible.
   const float dt = 1.0f / 60.0f;
 
+  Result r;
   auto t0 = std::chrono::steady_clock::now();
-  for (int f = 0; f < s.frames; ++f) sim.update(dt);
+  for (int f = 0; f < s.frames; ++f) {
+    sim.update(dt);
+    const PhysicsStats &st = sim.physicsStats();
+    r.hashMs    += st.hashMs;
+    r.reorders  += st.reorders;
+    r.reorderMs += st.reorderMs;
+    r.substeps  += st.substeps;
+    r.listRebuilds += st.listRebuilds;
+  }
   auto t1 = std::chrono::steady_clock::now();
 
-  return std::chrono::duration<double, std::milli>(t1 - t0).count();
+  r.totalMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+  return r;
+}
+
+void printRow(const Scenario &s, const Result &r) {
+  double per  = r.totalMs / static_cast<double>(s.frames);
+  double hash = r.hashMs  / static_cast<double>(s.frames);
+  std::printf("%-32s %12.2f %12.3f %12.3f\n", s.label, r.totalMs, per, hash);
+}
+
+double msSince(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - t0).count();
+}
+
+// Build the same hash serially and in parallel, check the two agree cell
+// for cell and index for index, and report both build times.
+void runHashBuildCheck(std::size_t count, unsigned int threads) {
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> dx(0.0f, cfg::WORLD_WIDTH);
+  std::uniform_real_distribution<float> dy(0.0f, cfg::WORLD_HEIGHT);
+  std::vector<float> posX(count), posY(count);
+  for (std::size_t i = 0; i < count; ++i) { posX[i] = dx(rng); posY[i] = dy(rng); }
+
+  SpatialHash serial(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  SpatialHash parallel(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  std::vector<std::uint32_t> serialIdx, parallelIdx;
+  ThreadPool pool(threads);
+
+  // Warm both paths once so allocation isn't part of the timing.
+  serial.build(serialIdx, posX.data(), posY.data(), count);
+  parallel.build(parallelIdx, posX.data(), posY.data(), count, pool, cfg::MIN_PARTICLES_PER_THREAD);
+
+  auto t0 = std::chrono::steady_clock::now();
+  serial.build(serialIdx, posX.data(), posY.data(), count);
+  double serialMs = msSince(t0);
+  t0 = std::chrono::steady_clock::now();
+  parallel.build(parallelIdx, posX.data(), posY.data(), count, pool, cfg::MIN_PARTICLES_PER_THREAD);
+  double parallelMs = msSince(t0);
+
+  bool same = true;
+  for (int y = 0; y < serial.rows() && same; ++y) {
+    for (int x = 0; x < serial.cols(); ++x) {
+      const auto &a = serial.getCell(x, y);
+      const auto &b = parallel.getCell(x, y);
+      if (a.start != b.start || a.count != b.count) { same = false; break; }
+    }
+  }
+  for (std::size_t i = 0; i < count && same; ++i) {
+    same = serialIdx[i] == parallelIdx[i];
+  }
+
+  std::printf("%8zu particles %2u threads   serial %8.3f ms   parallel %8.3f ms   %s\n",
+              count, threads, serialMs, parallelMs,
+              same ? "identical" : "MISMATCH");
+}
+
+// Clustered particles in a square world far larger than the configured
+// one: compare what the dense grid would have to allocate for it against
+// what the sparse hash actually holds after a build.
+void runSparseMemoryCheck(std::size_t count, float worldSize, int clusters) {
+  std::mt19937 rng(4321);
+  std::uniform_real_distribution<float> centre(0.0f, worldSize);
+  std::normal_distribution<float> spread(0.0f, 150.0f);
+  std::vector<float> cx(clusters), cy(clusters);
+  for (int c = 0; c < clusters; ++c) { cx[c] = centre(rng); cy[c] = centre(rng); }
+  std::vector<float> posX(count), posY(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    int c = static_cast<int>(i % static_cast<std::size_t>(clusters));
+    posX[i] = cx[c] + spread(rng);
+    posY[i] = cy[c] + spread(rng);
+  }
+
+  // Dense footprint is computed, not allocated: at this size it would not
+  // fit in memory on most machines.
+  const double cells = std::ceil(worldSize / cfg::SPATIAL_CELL_SIZE);
+  const double denseBytes = cells * cells * sizeof(SpatialHash::Cell);
+
+  SparseSpatialHash sparse(cfg::SPATIAL_CELL_SIZE);
+  std::vector<std::uint32_t> indices;
+  sparse.build(indices, posX.data(), posY.data(), count);
+  auto t0 = std::chrono::steady_clock::now();
+  sparse.build(indices, posX.data(), posY.data(), count);
+  double buildMs = msSince(t0);
+
+  std::printf("%8zu particles in %d clusters, %.0f x %.0f world\n",
+              count, clusters, worldSize, worldSize);
+  std::printf("  dense grid   %14.0f cells %10.1f MB\n",
+              cells * cells, denseBytes / (1024.0 * 1024.0));
+  std::printf("  sparse hash  %14zu cells %10.1f MB   build %.3f ms\n",
+              sparse.occupiedCells(),
+              sparse.memoryBytes() / (1024.0 * 1024.0), buildMs);
+}
+
+// Sand pile resting on the floor: rows of touching particles, stacked on
+// a hex lattice, at rest. Gravity keeps pressing it into the floor. A
+// spacing above 1 leaves gaps, so the pile has to compact first.
+ParticleSystem makeRestingPile(std::size_t count, float spacing = 1.0f) {
+  ParticleSystem p(count);
+  const float r  = cfg::DEFAULT_RADIUS;
+  const float dx = 2.0f * r * spacing;
+  const float dy = dx * 0.8660254f;
+  const int perRow = static_cast<int>((cfg::WORLD_WIDTH - 3.0f * r) / dx);
+  const SDL_Color c = particleTypeColor(TYPE_SAND);
+  for (std::size_t i = 0; i < count; ++i) {
+    int row = static_cast<int>(i) / perRow;
+    int col = static_cast<int>(i) % perRow;
+    float x = r + col * dx + (row & 1 ? r : 0.0f);
+    float y = cfg::WORLD_HEIGHT - r - row * dy;
+    p.add(x, y, 0.0f, 0.0f, r, cfg::DEFAULT_MASS, TYPE_SAND, c);
+  }
+  return p;
+}
+
+// Let a resting pile settle, then time it with sleeping on and off. The
+// last frame sets off an explosion to show sleepers wake up again.
+void runSleepComparison(std::size_t count, int settleFrames, int frames) {
+  const float dt = 1.0f / 60.0f;
+  double offMs = 0.0;
+  for (bool sleep : {false, true}) {
+    ParticleSystem p = makeRestingPile(count);
+    PhysicsEngine engine;
+    InputState in;
+    in.sleepEnabled = sleep;
+    in.adaptiveSubsteps = false;
+    engine.setSleepEnabled(sleep);
+    for (int f = 0; f < settleFrames; ++f) engine.update(p, in, dt);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) engine.update(p, in, dt);
+    double ms = msSince(t0) / frames;
+    const int sleeping = engine.stats().sleeping;
+    if (!sleep) offMs = ms;
+
+    in.explodePending  = true;
+    in.explodePosition = { cfg::WORLD_WIDTH * 0.5f, cfg::WORLD_HEIGHT - 20.0f };
+    engine.update(p, in, dt);
+
+    std::printf("  %5zu particles  sleep %-3s %9.3f ms/frame %8.2fx   "
+                "asleep %5d   after explosion %5d\n",
+                count, sleep ? "on" : "off", ms, offMs / ms, sleeping,
+                engine.stats().sleeping);
+  }
+}
+
+// A settled sand layer (sleeping off) timed through the uniform grid and
+// through Verlet lists. The layer settles once on the grid; each
+// broadphase then runs `frames` frames from that state, alternately,
+// best of 3, since single runs here differ by more than the gap.
+void runVerletSettledComparison(std::size_t count, int settleFrames, int frames) {
+  const float dt = 1.0f / 60.0f;
+  InputState in;
+  in.sleepEnabled = false;
+  in.adaptiveSubsteps = false;
+  ParticleSystem settled = makeRestingPile(count);
+  {
+    PhysicsEngine engine;
+    engine.setSleepEnabled(false);
+    for (int f = 0; f < settleFrames; ++f) engine.update(settled, in, dt);
+  }
+
+  const Broadphase kinds[2] = {Broadphase::UniformGrid, Broadphase::VerletList};
+  double best[2] = {1e30, 1e30};
+  int rebuilds = 0, substeps = 0;
+  for (int rep = 0; rep < 3; ++rep) {
+    for (int k = 0; k < 2; ++k) {
+      ParticleSystem p = settled;
+      PhysicsEngine engine;
+      engine.setSleepEnabled(false);
+      engine.setBroadphase(kinds[k]);
+      rebuilds = substeps = 0;
+      auto t0 = std::chrono::steady_clock::now();
+      for (int f = 0; f < frames; ++f) {
+        engine.update(p, in, dt);
+        rebuilds += engine.stats().listRebuilds;
+        substeps += engine.stats().substeps;
+      }
+      best[k] = std::min(best[k], msSince(t0) / frames);
+    }
+  }
+  for (int k = 0; k < 2; ++k) {
+    std::printf("  %5zu particles  %-14s %9.3f ms/frame %8.2fx", count,
+                broadphaseName(kinds[k]), best[k], best[0] / best[k]);
+    if (kinds[k] == Broadphase::VerletList) {
+      std::printf("   lists rebuilt on %d of %d substeps", rebuilds, substeps);
+    }
+    std::printf("\n");
+  }
+}
+
+// Mostly default-size particles with a few large ones mixed in, radii
+// spanning 10x. Positions are random, so plenty of pairs overlap.
+ParticleSystem makeMixedRadii(std::size_t count, float bigFraction) {
+  ParticleSystem p(count);
+  std::mt19937 rng(77);
+  std::uniform_real_distribution<float> dx(0.0f, cfg::WORLD_WIDTH);
+  std::uniform_real_distribution<float> dy(0.0f, cfg::WORLD_HEIGHT);
+  std::uniform_real_distribution<float> dv(-5.0f, 5.0f);
+  std::uniform_real_distribution<float> u(0.0f, 1.0f);
+  const float small = cfg::DEFAULT_RADIUS;
+  for (std::size_t i = 0; i < count; ++i) {
+    float r = u(rng) < bigFraction ? small * (4.0f + 6.0f * u(rng)) : small;
+    ParticleType t = r > small ? TYPE_DEFAULT : TYPE_SAND;
+    p.add(dx(rng), dy(rng), dv(rng), dv(rng), r, r / small, t,
+          particleTypeColor(t));
+  }
+  return p;
+}
+
+// One collision pass over `base` through the given broadphase, best of
+// `reps`. The post-pass state comes back in `out`.
+template <typename Grid>
+double timeCollisionPass(const ParticleSystem &base, const Grid &grid,
+                         const std::vector<std::uint32_t> &order, int reps,
+                         ParticleSystem &out) {
+  narrowphase::SortedParticles sorted;
+  sorted.resize(base.count);
+  sorted.gather(base, order.data(), 0, base.count);
+  double best = 1e30;
+  for (int rep = 0; rep < reps; ++rep) {
+    out = base;
+    auto t0 = std::chrono::steady_clock::now();
+    collisions::resolveBand(out, grid, sorted, 0, out.count);
+    best = std::min(best, msSince(t0));
+  }
+  return best;
+}
+
+// Compare a single grid sized for the small particles (misses contacts
+// with the large ones), a single grid coarse enough for the largest radius
+// (correct, the reference) and the multi-level grid.
+void runMixedRadiusComparison(std::size_t count, float bigFraction) {
+  const ParticleSystem base = makeMixedRadii(count, bigFraction);
+  const int reps = 10;
+
+  float maxRadius = 0.0f;
+  for (std::size_t i = 0; i < base.count; ++i) maxRadius = std::max(maxRadius, base.radius(i));
+  float coarseCell = cfg::SPATIAL_CELL_SIZE;
+  while (coarseCell < 2.0f * maxRadius) coarseCell *= 2.0f;
+
+  std::vector<std::uint32_t> fineOrder, coarseOrder, multiOrder;
+  SpatialHash fine(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  SpatialHash coarse(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, coarseCell);
+  MultiLevelGrid multi(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT,
+                       cfg::SPATIAL_CELL_SIZE, cfg::GRID_LEVELS);
+  fine.build(fineOrder, base.posX.data(), base.posY.data(), base.count);
+  coarse.build(coarseOrder, base.posX.data(), base.posY.data(), base.count);
+  multi.build(multiOrder, base.posX.data(), base.posY.data(),
+              base.material.data(), base.materials.data(), base.count);
+
+  ParticleSystem reference(0), q(0);
+  double coarseMs = timeCollisionPass(base, coarse, coarseOrder, reps, reference);
+
+  // Particles whose response differs from the reference by more than
+  // rounding missed at least one contact.
+  auto report = [&](const char *label, double ms, const ParticleSystem &r) {
+    std::size_t wrong = 0;
+    for (std::size_t i = 0; i < r.count; ++i) {
+      float d = std::max(std::fabs(r.accX[i] - reference.accX[i]),
+                         std::fabs(r.accY[i] - reference.accY[i]));
+      if (d > 1e-3f) ++wrong;
+    }
+    std::printf("  %-28s %10.3f ms %8zu particles with missed contacts\n",
+                label, ms, wrong);
+  };
+
+  char coarseLabel[64];
+  std::snprintf(coarseLabel, sizeof(coarseLabel), "single grid, %g cells", coarseCell);
+  char fineLabel[64];
+  std::snprintf(fineLabel, sizeof(fineLabel), "single grid, %g cells",
+                cfg::SPATIAL_CELL_SIZE);
+
+  double fineMs = timeCollisionPass(base, fine, fineOrder, reps, q);
+  report(fineLabel, fineMs, q);
+  report(coarseLabel, coarseMs, reference);
+  double multiMs = timeCollisionPass(base, multi, multiOrder, reps, q);
+  report("multi-level grid", multiMs, q);
+}
+
+// Dense liquid block on a slightly compressed hex lattice: every particle
+// overlaps its six neighbours, which is the worst case for the pair loop.
+ParticleSystem makeDenseLiquid(std::size_t count) {
+  ParticleSystem p(count);
+  std::mt19937 rng(99);
+  std::uniform_real_distribution<float> dv(-5.0f, 5.0f);
+  const float r  = cfg::DEFAULT_RADIUS;
+  const float dx = 2.0f * r * 0.95f;
+  const float dy = dx * 0.8660254f;
+  const int perRow = static_cast<int>((cfg::WORLD_WIDTH - 2.0f * r) / dx);
+  const SDL_Color c = particleTypeColor(TYPE_LIQUID);
+  for (std::size_t i = 0; i < count; ++i) {
+    int row = static_cast<int>(i) / perRow;
+    int col = static_cast<int>(i) % perRow;
+    float x = r + col * dx + (row & 1 ? 0.5f * dx : 0.0f);
+    float y = cfg::WORLD_HEIGHT - r - row * dy;
+    p.add(x, y, dv(rng), dv(rng), r, 0.9f, TYPE_LIQUID, c);
+  }
+  return p;
+}
+
+// Time one collision pass per narrowphase kernel over the same dense liquid
+// state and report throughput relative to the scalar reference kernel.
+void runNarrowphaseComparison(std::size_t count) {
+  const ParticleSystem base = makeDenseLiquid(count);
+  SpatialHash hash(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  std::vector<std::uint32_t> order;
+  hash.build(order, base.posX.data(), base.posY.data(), base.count);
+  narrowphase::SortedParticles sorted;
+  sorted.resize(base.count);
+  sorted.gather(base, order.data(), 0, base.count);
+
+  const narrowphase::Kernel previous = narrowphase::activeKernel();
+  const int reps = 10;
+  ParticleSystem reference = base;
+  double scalarMs = 0.0;
+
+  for (int k = 0; k < static_cast<int>(narrowphase::Kernel::Count); ++k) {
+    const auto kernel = static_cast<narrowphase::Kernel>(k);
+    if (!narrowphase::setKernel(kernel)) continue;
+
+    double best = 1e30;
+    ParticleSystem q = base;
+    for (int rep = 0; rep < reps; ++rep) {
+      q = base;
+      auto t0 = std::chrono::steady_clock::now();
+      collisions::resolveBand(q, hash, sorted, 0, q.count);
+      best = std::min(best, msSince(t0));
+    }
+    if (kernel == narrowphase::Kernel::Scalar) {
+      reference = q;
+      scalarMs = best;
+    }
+
+    float maxErr = 0.0f;
+    for (std::size_t i = 0; i < q.count; ++i) {
+      maxErr = std::max(maxErr, std::fabs(q.accX[i] - reference.accX[i]));
+      maxErr = std::max(maxErr, std::fabs(q.velX[i] - reference.velX[i]));
+    }
+    std::printf("  %-8s %10.3f ms %8.2f Mparticles/s %7.2fx   max |diff| %.2e\n",
+                narrowphase::kernelName(kernel), best,
+                static_cast<double>(count) / (best * 1e3),
+                scalarMs / best, maxErr);
+  }
+  narrowphase::setKernel(previous);
+}
+
+// Random positions, velocities and types over the whole world, with small
+// random accX/accY standing in for collision corrections.
+ParticleSystem makeRandomMixedScene(std::size_t count) {
+  ParticleSystem base(count);
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> ux(0.0f, cfg::WORLD_WIDTH);
+  std::uniform_real_distribution<float> uy(0.0f, cfg::WORLD_HEIGHT);
+  std::uniform_real_distribution<float> uv(-40.0f, 40.0f);
+  std::uniform_real_distribution<float> du(-0.5f, 0.5f);
+  std::uniform_int_distribution<int>    ut(0, TYPE_COUNT - 1);
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto t = static_cast<ParticleType>(ut(rng));
+    base.add(ux(rng), uy(rng), uv(rng), uv(rng), cfg::DEFAULT_RADIUS,
+             cfg::DEFAULT_MASS, t, particleTypeColor(t));
+    base.accX[i] = du(rng);
+    base.accY[i] = du(rng);
+  }
+  return base;
+}
+
+float maxStateDiff(const ParticleSystem &a, const ParticleSystem &b) {
+  float m = 0.0f;
+  for (std::size_t i = 0; i < a.count; ++i) {
+    m = std::max(m, std::fabs(a.posX[i] - b.posX[i]));
+    m = std::max(m, std::fabs(a.posY[i] - b.posY[i]));
+    m = std::max(m, std::fabs(a.velX[i] - b.velX[i]));
+    m = std::max(m, std::fabs(a.velY[i] - b.velY[i]));
+  }
+  return m;
+}
+
+// True if every partitioned type range holds only its own type.
+bool typeRangesValid(const ParticleSystem &p) {
+  bool valid = p.typeStart[0] == 0 && p.typeStart[TYPE_COUNT] == p.count;
+  for (int t = 0; t < TYPE_COUNT; ++t) {
+    for (std::size_t i = p.typeStart[t]; i < p.typeStart[t + 1]; ++i) {
+      valid = valid && p.type[i] == t;
+    }
+  }
+  return valid;
+}
+
+// True if a and b hold the same particles, in any order: every position,
+// velocity, type and material id, compared after sorting.
+bool sameParticles(const ParticleSystem &a, const ParticleSystem &b) {
+  if (a.count != b.count) return false;
+  using Key = std::tuple<float, float, float, float, int, int>;
+  auto keys = [](const ParticleSystem &p) {
+    std::vector<Key> k(p.count);
+    for (std::size_t i = 0; i < p.count; ++i) {
+      k[i] = Key(p.posX[i], p.posY[i], p.velX[i], p.velY[i], p.type[i],
+                 p.material[i]);
+    }
+    std::sort(k.begin(), k.end());
+    return k;
+  };
+  return keys(a) == keys(b);
+}
+
+// Phases 1-3 as separate passes vs the fused integrator, and phase 6 as a
+// correction pass plus a bounds pass vs the fused one, over a large random
+// scene (serial, whole range, best of 5). The scene is far bigger than the
+// caches, so the difference is mostly memory traffic.
+void runIntegrationComparison(std::size_t count) {
+  const ParticleSystem base = makeRandomMixedScene(count);
+  InputState in;
+  in.wind = { 3.0f, 0.0f };
+  const float dt = 1.0f / 240.0f;
+  const int reps = 5;
+  const auto maxDiff = maxStateDiff;
+
+  auto report = [](const char *label, double separateMs, double fusedMs,
+                   float diff) {
+    std::printf("  %-14s separate %8.3f ms   fused %8.3f ms %7.2fx   max |diff| %.2e\n",
+                label, separateMs, fusedMs, separateMs / fusedMs, diff);
+  };
+
+  ParticleSystem a(0), b(0);
+  double sepMs = 1e30, fusedMs = 1e30;
+  for (int rep = 0; rep < reps; ++rep) {
+    a = base;
+    auto t0 = std::chrono::steady_clock::now();
+    forces::zeroAccelerations(a, 0, count);
+    forces::applyGravity(a, in, 0, count);
+    forces::applyWind(a, in, 0, count);
+    forces::applyMouseField(a, in, 0, count);
+    forces::integrateVelocity(a, dt, 0, count);
+    forces::applyDamping(a, 0, count);
+    forces::applyExplosionImpulse(a, in, 0, count);
+    forces::integratePosition(a, dt, 0, count);
+    sepMs = std::min(sepMs, msSince(t0));
+
+    b = base;
+    t0 = std::chrono::steady_clock::now();
+    forces::integrateFused(b, in, dt, 0, count);
+    fusedMs = std::min(fusedMs, msSince(t0));
+  }
+  report("phases 1-3", sepMs, fusedMs, maxDiff(a, b));
+
+  sepMs = fusedMs = 1e30;
+  for (int rep = 0; rep < reps; ++rep) {
+    a = base;
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+      if (a.type[i] == TYPE_STONE || a.asleep(i)) continue;
+      a.posX[i] += a.accX[i];
+      a.posY[i] += a.accY[i];
+    }
+    collisions::applyWorldBounds(a, 0, count);
+    sepMs = std::min(sepMs, msSince(t0));
+
+    b = base;
+    t0 = std::chrono::steady_clock::now();
+    collisions::applyCorrectionsAndBounds(b, 0, count);
+    fusedMs = std::min(fusedMs, msSince(t0));
+  }
+  report("phase 6", sepMs, fusedMs, maxDiff(a, b));
+}
+
+// Build Verlet lists over a dense liquid block, jitter every particle by
+// just under half the skin, and check the list pass still agrees with a
+// grid pass over a freshly built hash.
+void runVerletCheck(std::size_t count) {
+  ParticleSystem moved = makeDenseLiquid(count);
+  SpatialHash hash(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  std::vector<std::uint32_t> order;
+  hash.build(order, moved.posX.data(), moved.posY.data(), moved.count);
+  narrowphase::SortedParticles listSorted;
+  listSorted.resize(moved.count);
+  listSorted.gather(moved, order.data(), 0, moved.count);
+
+  VerletList lists(cfg::VERLET_SKIN);
+  auto t0 = std::chrono::steady_clock::now();
+  lists.build(moved, hash, listSorted);
+  const double buildMs = msSince(t0);
+
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+  const float step = 0.49f * lists.skin();
+  for (std::size_t i = 0; i < moved.count; ++i) {
+    const float a = angle(rng);
+    moved.posX[i] += step * std::cos(a);
+    moved.posY[i] += step * std::sin(a);
+  }
+  const bool stale = lists.stale(moved);
+  listSorted.gather(moved, order.data(), 0, moved.count);
+
+  std::vector<std::uint32_t> freshOrder;
+  hash.build(freshOrder, moved.posX.data(), moved.posY.data(), moved.count);
+  ParticleSystem reference(0), q(0);
+  const double gridMs = timeCollisionPass(moved, hash, freshOrder, 10, reference);
+
+  double listMs = 1e30;
+  for (int rep = 0; rep < 10; ++rep) {
+    q = moved;
+    t0 = std::chrono::steady_clock::now();
+    collisions::resolveBand(q, lists, listSorted, 0, q.count);
+    listMs = std::min(listMs, msSince(t0));
+  }
+
+  float maxErr = 0.0f;
+  for (std::size_t i = 0; i < q.count; ++i) {
+    maxErr = std::max(maxErr, std::fabs(q.accX[i] - reference.accX[i]));
+    maxErr = std::max(maxErr, std::fabs(q.accY[i] - reference.accY[i]));
+    maxErr = std::max(maxErr, std::fabs(q.velX[i] - reference.velX[i]));
+    maxErr = std::max(maxErr, std::fabs(q.velY[i] - reference.velY[i]));
+  }
+  std::printf("  %zu particles, skin %.2f, %.1f neighbours/particle, build %.3f ms\n",
+              count, lists.skin(),
+              static_cast<double>(lists.pairCount()) / static_cast<double>(count),
+              buildMs);
+  std::printf("  after moving every particle %.2f: stale %s   grid pass %.3f ms"
+              "   list pass %.3f ms   max |diff| %.2e\n",
+              step, stale ? "yes" : "no", gridMs, listMs, maxErr);
+}
+
+// One-sided pass vs the coloured half-stencil pass (all four colours run
+// back to back, plus the zeroing and scatter it needs) on the same dense
+// liquid state, for the scalar kernel and the runtime pick.
+void runSolverComparison(std::size_t count) {
+  const ParticleSystem base = makeDenseLiquid(count);
+  SpatialHash hash(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  std::vector<std::uint32_t> order;
+  hash.build(order, base.posX.data(), base.posY.data(), base.count);
+  narrowphase::SortedParticles sorted;
+  sorted.resize(base.count);
+  sorted.gather(base, order.data(), 0, base.count);
+  narrowphase::ContactAccum acc;
+  acc.resize(base.count);
+
+  const narrowphase::Kernel previous = narrowphase::activeKernel();
+  const int reps = 10;
+  const narrowphase::Kernel kernels[] = { narrowphase::Kernel::Scalar,
+                                          narrowphase::bestKernel() };
+  for (narrowphase::Kernel kernel : kernels) {
+    narrowphase::setKernel(kernel);
+
+    ParticleSystem oneSided = base, coloured = base;
+    double oneMs = 1e30, colMs = 1e30;
+    for (int rep = 0; rep < reps; ++rep) {
+      oneSided = base;
+      auto t0 = std::chrono::steady_clock::now();
+      collisions::resolveBand(oneSided, hash, sorted, 0, oneSided.count);
+      oneMs = std::min(oneMs, msSince(t0));
+
+      coloured = base;
+      t0 = std::chrono::steady_clock::now();
+      acc.zero(0, coloured.count);
+      for (int colour = 0; colour < 4; ++colour) {
+        collisions::resolveColourTiles(hash, sorted, acc, colour, 0,
+                                       collisions::colourTileCount(hash, colour));
+      }
+      collisions::applyContactAccum(coloured, sorted, acc, 0, coloured.count);
+      colMs = std::min(colMs, msSince(t0));
+    }
+
+    float maxErr = 0.0f;
+    for (std::size_t i = 0; i < base.count; ++i) {
+      maxErr = std::max(maxErr, std::fabs(coloured.accX[i] - oneSided.accX[i]));
+      maxErr = std::max(maxErr, std::fabs(coloured.accY[i] - oneSided.accY[i]));
+      maxErr = std::max(maxErr, std::fabs(coloured.velX[i] - oneSided.velX[i]));
+      maxErr = std::max(maxErr, std::fabs(coloured.velY[i] - oneSided.velY[i]));
+    }
+    std::printf("  %-8s one-sided %8.3f ms   coloured pairs %8.3f ms %7.2fx"
+                "   max |diff| %.2e\n",
+                narrowphase::kernelName(kernel), oneMs, colMs, oneMs / colMs,
+                maxErr);
+    if (kernel == narrowphase::bestKernel()) break;
+  }
+  narrowphase::setKernel(previous);
+}
+
+// Periodic boundaries, first one one-sided collision pass with both axes
+// wrapping over a random scene that fills the world. A periodic world
+// looks the same after a translation, so the pass is repeated on the scene
+// moved by half the world (and wrapped back in), which takes every seam
+// particle into the interior and every central one to a seam: each
+// particle's push and impulse must come out the same. Positions lie on a
+// 1/64 px lattice so the translation is exact. The pass with walls is
+// timed alongside, and the particles whose result differs from it are the
+// ones touching something across a seam. Then the scene runs through the
+// engine for `frames` frames without gravity, with walls and wrapping,
+// and every particle must end inside the world.
+void runPeriodicCheck(std::size_t count, int frames) {
+  const float w = cfg::WORLD_WIDTH, h = cfg::WORLD_HEIGHT;
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> ux(0.0f, w), uy(0.0f, h);
+  std::uniform_real_distribution<float> uv(-40.0f, 40.0f);
+  std::uniform_int_distribution<int> ut(TYPE_DEFAULT, TYPE_GAS);
+  ParticleSystem base(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const float x = std::floor(ux(rng) * 64.0f) / 64.0f;
+    const float y = std::floor(uy(rng) * 64.0f) / 64.0f;
+    base.add(x, y, uv(rng), uv(rng), static_cast<ParticleType>(ut(rng)));
+  }
+  ParticleSystem moved = base;
+  for (std::size_t i = 0; i < count; ++i) {
+    moved.posX[i] += w * 0.5f;
+    moved.posY[i] += h * 0.5f;
+    if (moved.posX[i] >= w) moved.posX[i] -= w;
+    if (moved.posY[i] >= h) moved.posY[i] -= h;
+  }
+
+  // One pass over a copy of `scene`, best of 5.
+  const PeriodicAxes both{true, true};
+  auto onePass = [](const ParticleSystem &scene, PeriodicAxes wrap,
+                    ParticleSystem &out) {
+    SpatialHash hash(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+    std::vector<std::uint32_t> order;
+    hash.build(order, scene.posX.data(), scene.posY.data(), scene.count);
+    narrowphase::SortedParticles sorted;
+    sorted.resize(scene.count);
+    sorted.gather(scene, order.data(), 0, scene.count);
+    double best = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+      out = scene;
+      auto t0 = std::chrono::steady_clock::now();
+      collisions::resolveBand(out, hash, sorted, 0, out.count, wrap);
+      best = std::min(best, msSince(t0));
+    }
+    return best;
+  };
+
+  const narrowphase::Kernel previous = narrowphase::activeKernel();
+  const narrowphase::Kernel kernels[] = { narrowphase::Kernel::Scalar,
+                                          narrowphase::bestKernel() };
+  for (narrowphase::Kernel kernel : kernels) {
+    narrowphase::setKernel(kernel);
+    ParticleSystem walls, wrapped, wrappedMoved;
+    const double wallMs = onePass(base, {}, walls);
+    const double wrapMs = onePass(base, both, wrapped);
+    onePass(moved, both, wrappedMoved);
+
+    float maxErr = 0.0f;
+    std::size_t acrossSeam = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      maxErr = std::max(maxErr, std::fabs(wrapped.accX[i] - wrappedMoved.accX[i]));
+      maxErr = std::max(maxErr, std::fabs(wrapped.accY[i] - wrappedMoved.accY[i]));
+      maxErr = std::max(maxErr, std::fabs(wrapped.velX[i] - wrappedMoved.velX[i]));
+      maxErr = std::max(maxErr, std::fabs(wrapped.velY[i] - wrappedMoved.velY[i]));
+      if (wrapped.accX[i] != walls.accX[i] || wrapped.accY[i] != walls.accY[i]) {
+        ++acrossSeam;
+      }
+    }
+    std::printf("  %-8s walls %7.3f ms   periodic %7.3f ms   %5zu touching "
+                "across a seam   max |diff| moved %.2e%s\n",
+                narrowphase::kernelName(kernel), wallMs, wrapMs, acrossSeam,
+                maxErr, maxErr > 1e-4f ? "  MISMATCH" : "");
+    if (kernel == narrowphase::bestKernel()) break;
+  }
+  narrowphase::setKernel(previous);
+
+  for (bool periodic : {false, true}) {
+    ParticleSystem p = base;
+    PhysicsEngine engine;
+    InputState in;
+    in.gravityEnabled = false;
+    in.periodicX = periodic;
+    in.periodicY = periodic;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) engine.update(p, in, 1.0f / 60.0f);
+    const double ms = msSince(t0);
+    std::size_t outside = 0;
+    for (std::size_t i = 0; i < p.count; ++i) {
+      outside += (p.posX[i] < 0.0f) | (p.posX[i] >= w) |
+                 (p.posY[i] < 0.0f) | (p.posY[i] >= h);
+    }
+    std::printf("  %-8s %d frames %8.1f ms   %zu outside the world%s\n",
+                periodic ? "periodic" : "walls", frames, ms, outside,
+                outside ? "  BROKEN" : "");
+  }
+}
+
+// Static obstacles: the demo level as stone particles filling its shapes
+// on a hex lattice (how such a level is built without obstacles) and as a
+// baked distance field, with the same block of sand poured over it for
+// `frames` frames. Reports the bake, the frame time either way, where the
+// sand ended up and how much of it is inside solid geometry at the end.
+// Then times the field lookup alone over a million particles.
+void runObstacleComparison(std::size_t count, int frames) {
+  ObstacleField field = ObstacleField::demoLevel();
+  auto t0 = std::chrono::steady_clock::now();
+  field.bake();
+  std::printf("  bake %7.2f ms, %zu KB for %zu segments and %zu polygons\n",
+              msSince(t0), field.bytes() / 1024, field.segments().size(),
+              field.polygons().size());
+
+  ParticleSystem sand;
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> ux(cfg::WORLD_WIDTH * 0.34f,
+                                           cfg::WORLD_WIDTH * 0.66f);
+  std::uniform_real_distribution<float> uy(10.0f, cfg::WORLD_HEIGHT * 0.18f);
+  for (std::size_t i = 0; i < count; ++i) sand.add(ux(rng), uy(rng), 0.0f, 0.0f, TYPE_SAND);
+
+  ParticleSystem stones;
+  const float dx = 2.0f * cfg::DEFAULT_RADIUS, dy = dx * 0.8660254f;
+  int row = 0;
+  for (float y = dy * 0.5f; y < cfg::WORLD_HEIGHT; y += dy, ++row) {
+    for (float x = (row & 1) ? dx : dx * 0.5f; x < cfg::WORLD_WIDTH; x += dx) {
+      if (field.distance({ x, y }) < 0.0f) stones.add(x, y, 0.0f, 0.0f, TYPE_STONE);
+    }
+  }
+
+  for (bool baked : {false, true}) {
+    ParticleSystem p = baked ? ParticleSystem() : stones;
+    for (std::size_t i = 0; i < sand.count; ++i) {
+      p.add(sand.posX[i], sand.posY[i], 0.0f, 0.0f, TYPE_SAND);
+    }
+    PhysicsEngine engine;
+    InputState in;
+    if (baked) engine.setObstacles(&field);
+    t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) engine.update(p, in, 1.0f / 60.0f);
+    const double ms = msSince(t0);
+
+    std::size_t inBox = 0, inside = 0;
+    for (std::size_t i = 0; i < p.count; ++i) {
+      if (p.type[i] == TYPE_STONE) continue;
+      const float x = p.posX[i], y = p.posY[i];
+      inBox  += std::fabs(x - cfg::WORLD_WIDTH * 0.5f) < 130.0f &&
+                y > cfg::WORLD_HEIGHT * 0.62f && y < cfg::WORLD_HEIGHT * 0.78f;
+      inside += field.distance({ x, y }) < 0.0f;
+    }
+    std::printf("  %-15s %6zu particles %8.2f ms/frame   %5zu of %zu sand in "
+                "the box, %zu inside solid%s\n",
+                baked ? "baked field" : "stone particles", p.count, ms / frames,
+                inBox, count, inside, baked && inside ? "  LEAKED" : "");
+  }
+
+  const ParticleSystem scene = makeRandomMixedScene(1000000);
+  double best = 1e30;
+  for (int rep = 0; rep < 5; ++rep) {
+    ParticleSystem p = scene;
+    t0 = std::chrono::steady_clock::now();
+    collisions::applyObstacles(p, field, 0, p.count);
+    best = std::min(best, msSince(t0));
+  }
+  std::printf("  field lookup, 1000000 random particles %7.2f ms (%.1f ns "
+              "per particle)\n", best, best * 1e6 / scene.count);
+}
+
+// Mean and largest overlap over all touching pairs, as a fraction of the
+// contact distance. A pile that sinks into itself shows up here.
+void measureOverlap(const ParticleSystem &p, float &mean, float &worst) {
+  SpatialHash hash(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  std::vector<std::uint32_t> order;
+  hash.build(order, p.posX.data(), p.posY.data(), p.count);
+  double sum = 0.0;
+  std::size_t contacts = 0;
+  worst = 0.0f;
+  for (std::size_t i = 0; i < p.count; ++i) {
+    const int cx = hash.cellIndexX(p.posX[i]);
+    const int cy = hash.cellIndexY(p.posY[i]);
+    for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, hash.rows() - 1); ++y) {
+      for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, hash.cols() - 1); ++x) {
+        const auto &cell = hash.getCell(x, y);
+        for (std::uint32_t k = cell.start; k < cell.start + cell.count; ++k) {
+          const std::uint32_t j = order[k];
+          if (j <= i) continue;
+          const float rx = p.posX[j] - p.posX[i];
+          const float ry = p.posY[j] - p.posY[i];
+          const float rSum = p.radius(i) + p.radius(j);
+          const float dist = std::sqrt(rx * rx + ry * ry);
+          if (dist >= rSum) continue;
+          const float f = (rSum - dist) / rSum;
+          sum += f;
+          worst = std::max(worst, f);
+          ++contacts;
+        }
+      }
+    }
+  }
+  mean = contacts ? static_cast<float>(sum / contacts) : 0.0f;
+}
+
+// Drop a loose sand pile (sleeping off, fixed substeps) and run it until
+// its centre of mass has stopped moving for a second, with the Jacobi
+// coloured-pair solver and with Gauss-Seidel at a few substep and sweep
+// counts. Reports the time to settle, how far the centre of mass sank and
+// how much the pile overlaps itself at the end.
+void runSettleComparison(std::size_t count, int maxFrames) {
+  struct Config {
+    CollisionSolver solver;
+    int substeps, iterations;
+  };
+  const Config configs[] = {
+    {CollisionSolver::ColouredPairs, 4, 1},
+    {CollisionSolver::ColouredPairs, 2, 1},
+    {CollisionSolver::ColouredPairs, 1, 1},
+    {CollisionSolver::GaussSeidel,   2, 2},
+    {CollisionSolver::GaussSeidel,   1, 2},
+    {CollisionSolver::GaussSeidel,   1, 4},
+  };
+  const float dt = 1.0f / 60.0f;
+  const int calmFrames = 60;
+  const double calmDrift = 0.002;   // px per frame
+  auto centreY = [](const ParticleSystem &p) {
+    double sum = 0.0;
+    for (std::size_t i = 0; i < p.count; ++i) sum += p.posY[i];
+    return sum / p.count;
+  };
+  for (const Config &c : configs) {
+    ParticleSystem p = makeRestingPile(count, 1.1f);
+    const double start = centreY(p);
+    PhysicsEngine engine;
+    InputState in;
+    in.sleepEnabled = false;
+    in.adaptiveSubsteps = false;
+    in.substeps = c.substeps;
+    in.solverIterations = c.iterations;
+    engine.setSleepEnabled(false);
+    engine.setCollisionSolver(c.solver);
+
+    int frame = 0, calm = 0;
+    double ms = 0.0, y = start;
+    while (frame < maxFrames && calm < calmFrames) {
+      auto t0 = std::chrono::steady_clock::now();
+      engine.update(p, in, dt);
+      ms += msSince(t0);
+      ++frame;
+      const double next = centreY(p);
+      calm = std::fabs(next - y) < calmDrift ? calm + 1 : 0;
+      y = next;
+    }
+    float mean = 0.0f, worst = 0.0f;
+    measureOverlap(p, mean, worst);
+
+    char label[48];
+    std::snprintf(label, sizeof(label), "%s, %d substep%s",
+                  collisionSolverName(c.solver), c.substeps,
+                  c.substeps == 1 ? "" : "s");
+    if (c.solver == CollisionSolver::GaussSeidel) {
+      const std::size_t n = std::strlen(label);
+      std::snprintf(label + n, sizeof(label) - n, " x%d", c.iterations);
+    }
+    if (calm >= calmFrames) {
+      std::printf("  %-30s settled after %4d frames %8.1f ms", label, frame, ms);
+    } else {
+      std::printf("  %-30s not settled in %4d frames %8.1f ms", label, frame, ms);
+    }
+    std::printf("   sank %6.2f px   overlap mean %5.2f%% max %6.2f%%\n",
+                y - start, mean * 100.0f, worst * 100.0f);
+  }
+}
+
+// The integration and correction passes over mixed storage vs the same
+// particles partitioned into per-type ranges (serial, best of 5). The
+// partitioned result is compared against the mixed one after sorting that
+// by type the same way.
+void runPartitionComparison(std::size_t count) {
+  const ParticleSystem mixed = makeRandomMixedScene(count);
+  ParticleSystem byType = mixed;
+  byType.setPartitioned(true);
+  InputState in;
+  in.wind = { 3.0f, 0.0f };
+  const float dt = 1.0f / 240.0f;
+  const int reps = 5;
+
+  struct Pass {
+    const char *label;
+    void (*run)(ParticleSystem &, const InputState &, float, std::size_t);
+  };
+  const Pass passes[] = {
+    {"phases 1-3", [](ParticleSystem &p, const InputState &in, float dt,
+                      std::size_t n) {
+       forces::zeroAccelerations(p, 0, n);
+       forces::applyGravity(p, in, 0, n);
+       forces::applyWind(p, in, 0, n);
+       forces::integrateVelocity(p, dt, 0, n);
+       forces::applyDamping(p, 0, n);
+       forces::integratePosition(p, dt, 0, n);
+     }},
+    {"fused 1-3", [](ParticleSystem &p, const InputState &in, float dt,
+                     std::size_t n) { forces::integrateFused(p, in, dt, 0, n); }},
+    {"phase 6", [](ParticleSystem &p, const InputState &, float,
+                   std::size_t n) {
+       collisions::applyCorrectionsAndBounds(p, 0, n);
+     }},
+  };
+
+  ParticleSystem a(0), b(0);
+  for (const Pass &pass : passes) {
+    double mixedMs = 1e30, typedMs = 1e30;
+    for (int rep = 0; rep < reps; ++rep) {
+      a = mixed;
+      auto t0 = std::chrono::steady_clock::now();
+      pass.run(a, in, dt, count);
+      mixedMs = std::min(mixedMs, msSince(t0));
+
+      b = byType;
+      t0 = std::chrono::steady_clock::now();
+      pass.run(b, in, dt, count);
+      typedMs = std::min(typedMs, msSince(t0));
+    }
+    a.setPartitioned(true);
+    std::printf("  %-12s mixed %8.3f ms   by type %8.3f ms %7.2fx   max |diff| %.2e\n",
+                pass.label, mixedMs, typedMs, mixedMs / typedMs,
+                maxStateDiff(a, b));
+  }
+
+  // Spawning and erasing must keep every particle inside its type's range.
+  std::mt19937 rng(11);
+  std::uniform_int_distribution<int> ut(0, TYPE_COUNT - 1);
+  ParticleSystem p = makeRandomMixedScene(20000);
+  p.setPartitioned(true);
+  int adds = 0, removes = 0;
+  for (int op = 0; op < 50000; ++op) {
+    if (p.count > 0 && rng() % 2) {
+      p.removeSwap(rng() % p.count);
+      ++removes;
+    } else {
+      const auto t = static_cast<ParticleType>(ut(rng));
+      p.add(1.0f, 1.0f, 0.0f, 0.0f, cfg::DEFAULT_RADIUS, cfg::DEFAULT_MASS, t,
+            particleTypeColor(t));
+      ++adds;
+    }
+  }
+  std::printf("  %d adds and %d removes on 20000 partitioned particles: "
+              "ranges %s\n", adds, removes,
+              typeRangesValid(p) ? "valid" : "BROKEN");
+}
+
+// A sand layer settled with fixed substeps, then run calm for `frames`
+// frames, hit by an explosion and left to scatter for `after` frames, once
+// with fixed and once with adaptive substeps. Reports frame cost while calm
+// and the substep counts chosen around the explosion.
+void runAdaptiveSubstepComparison(std::size_t count, int settleFrames,
+                                  int frames, int after) {
+  const float dt = 1.0f / 60.0f;
+  ParticleSystem settled = makeRestingPile(count);
+  {
+    PhysicsEngine engine;
+    InputState in;
+    in.sleepEnabled = false;
+    in.adaptiveSubsteps = false;
+    engine.setSleepEnabled(false);
+    for (int f = 0; f < settleFrames; ++f) engine.update(settled, in, dt);
+  }
+
+  double fixedMs = 0.0;
+  for (bool adaptive : {false, true}) {
+    ParticleSystem p = settled;
+    PhysicsEngine engine;
+    InputState in;
+    in.sleepEnabled = false;
+    in.adaptiveSubsteps = adaptive;
+    engine.setSleepEnabled(false);
+
+    int calmSubsteps = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+      engine.update(p, in, dt);
+      calmSubsteps += engine.stats().substeps;
+    }
+    const double ms = msSince(t0) / frames;
+    if (!adaptive) fixedMs = ms;
+
+    in.explodePending  = true;
+    in.explodePosition = { cfg::WORLD_WIDTH * 0.5f, cfg::WORLD_HEIGHT - 20.0f };
+    engine.update(p, in, dt);
+    in.explodePending = false;
+    const int blastSubsteps = engine.stats().substeps;
+    const float blastSpeed  = engine.stats().peakSpeed;
+
+    int afterMax = 0, afterTotal = 0;
+    for (int f = 0; f < after; ++f) {
+      engine.update(p, in, dt);
+      afterMax    = std::max(afterMax, engine.stats().substeps);
+      afterTotal += engine.stats().substeps;
+    }
+
+    std::printf("  %-8s calm %8.3f ms/frame %6.2fx  %4.1f substeps   "
+                "explosion %2d (peak speed %5.0f)   next %d frames avg %4.1f max %2d\n",
+                adaptive ? "adaptive" : "fixed", ms, fixedMs / ms,
+                static_cast<double>(calmSubsteps) / frames, blastSubsteps,
+                blastSpeed, after, static_cast<double>(afterTotal) / after,
+                afterMax);
+  }
+}
+
+// A block of SPH liquid collapsing at the app's timestep, cfg::DT_DEFAULT
+// per frame with sleeping on, under fixed and adaptive substeps. Too few
+// substeps for the pressure stiffness keep the liquid boiling, so it never
+// falls asleep.
+void runSphSubstepCheck(std::size_t count, int frames) {
+  const float r  = cfg::DEFAULT_RADIUS;
+  const float dx = 2.2f * r;
+  const float dy = dx * 0.8660254f;
+  const int perRow = static_cast<int>(300.0f / dx);
+  for (bool adaptive : {false, true}) {
+    ParticleSystem p(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const int row = static_cast<int>(i) / perRow;
+      const int col = static_cast<int>(i) % perRow;
+      p.add(r + col * dx + (row & 1 ? r : 0.0f),
+            cfg::WORLD_HEIGHT - r - row * dy, 0.0f, 0.0f, TYPE_LIQUID);
+    }
+    PhysicsEngine engine;
+    InputState in;
+    in.sphLiquid = true;
+    in.adaptiveSubsteps = adaptive;
+    engine.setSleepEnabled(in.sleepEnabled);
+
+    int substeps = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+      engine.update(p, in, cfg::DT_DEFAULT);
+      substeps += engine.stats().substeps;
+    }
+    const double ms = msSince(t0) / frames;
+    std::printf("  SPH %-8s %8.3f ms/frame  %4.1f substeps   asleep %5d of %zu\n",
+                adaptive ? "adaptive" : "fixed", ms,
+                static_cast<double>(substeps) / frames,
+                engine.stats().sleeping, count);
+  }
+}
+
+// Dam break: a block of liquid 300 px wide at rest against the left wall
+// is let go and runs for `frames` frames with the app's settings
+// (cfg::DT_DEFAULT per frame, fixed substeps, sleeping on), once as
+// plain discs and once as an SPH fluid. Reports the cost per
+// particle and substep, how far the front got and the height difference
+// across the surface (lower is flatter).
+void runFluidComparison(std::size_t count, int frames) {
+  const float r  = cfg::DEFAULT_RADIUS;
+  const float dx = 2.0f * r;
+  const float dy = dx * 0.8660254f;
+  const int perRow = static_cast<int>(300.0f / dx);
+  const SDL_Color c = particleTypeColor(TYPE_LIQUID);
+  for (bool sph : {false, true}) {
+    ParticleSystem p(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const int row = static_cast<int>(i) / perRow;
+      const int col = static_cast<int>(i) % perRow;
+      p.add(r + col * dx + (row & 1 ? r : 0.0f),
+            cfg::WORLD_HEIGHT - r - row * dy, 0.0f, 0.0f, r, 1.0f,
+            TYPE_LIQUID, c);
+    }
+    PhysicsEngine engine;
+    InputState in;
+    in.sphLiquid = sph;
+    engine.setSleepEnabled(in.sleepEnabled);
+
+    double ms = 0.0, sphMs = 0.0;
+    int substeps = 0;
+    for (int f = 0; f < frames; ++f) {
+      auto t0 = std::chrono::steady_clock::now();
+      engine.update(p, in, cfg::DT_DEFAULT);
+      ms += msSince(t0);
+      sphMs += engine.stats().sphMs;
+      substeps += engine.stats().substeps;
+    }
+
+    // Surface height in 50 px columns over the wetted width.
+    constexpr int kColumns = static_cast<int>(cfg::WORLD_WIDTH / 50.0f);
+    float top[kColumns];
+    std::fill(top, top + kColumns, cfg::WORLD_HEIGHT);
+    float reach = 0.0f;
+    for (std::size_t i = 0; i < p.count; ++i) {
+      const int col = std::min(static_cast<int>(p.posX[i] / 50.0f),
+                               kColumns - 1);
+      top[col] = std::min(top[col], p.posY[i]);
+      reach = std::max(reach, p.posX[i]);
+    }
+    float lo = cfg::WORLD_HEIGHT, hi = 0.0f;
+    for (int col = 0; col <= std::min(static_cast<int>(reach / 50.0f),
+                                      kColumns - 1); ++col) {
+      lo = std::min(lo, top[col]);
+      hi = std::max(hi, top[col]);
+    }
+
+    const double perParticle =
+        1e6 * ms / (static_cast<double>(substeps) * count);
+    std::printf("  %-8s %8.3f ms/frame (SPH %6.3f)  %4.1f substeps  %6.1f "
+                "ns/particle/substep   front at %6.1f px   surface range "
+                "%6.1f px\n",
+                sph ? "SPH" : "discs", ms / frames, sphMs / frames,
+                static_cast<double>(substeps) / frames, perParticle, reach,
+                hi - lo);
+  }
+}
+
+// A uniform disc of `count` particles, radius 350 px, centred in the world.
+ParticleSystem makeDisc(std::size_t count) {
+  ParticleSystem p(count);
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> u(0.0f, 1.0f);
+  const SDL_Color c = particleTypeColor(TYPE_DEFAULT);
+  for (std::size_t i = 0; i < count; ++i) {
+    const float r = 350.0f * std::sqrt(u(rng));
+    const float a = 6.2831853f * u(rng);
+    p.add(0.5f * cfg::WORLD_WIDTH + r * std::cos(a),
+          0.5f * cfg::WORLD_HEIGHT + r * std::sin(a), 0.0f, 0.0f,
+          cfg::DEFAULT_RADIUS, cfg::DEFAULT_MASS, TYPE_DEFAULT, c);
+  }
+  return p;
+}
+
+// Direct O(N^2) self-gravity for `samples` evenly spaced particles (all
+// of them if samples >= count), with its time scaled to the whole system.
+struct DirectGravity {
+  std::vector<std::size_t> picks;
+  std::vector<float> refX, refY;
+  double ms  = 0.0;
+  double rms = 0.0;   // RMS acceleration over the picks
+
+  DirectGravity(const ParticleSystem &p, std::size_t samples) {
+    const std::size_t count = p.count;
+    const std::size_t stride = std::max<std::size_t>(1, count / samples);
+    for (std::size_t i = 0; i < count; i += stride) picks.push_back(i);
+
+    constexpr float eps2 = cfg::GRAVITY_SOFTENING * cfg::GRAVITY_SOFTENING;
+    refX.resize(picks.size());
+    refY.resize(picks.size());
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t k = 0; k < picks.size(); ++k) {
+      const float x = p.posX[picks[k]], y = p.posY[picks[k]];
+      float ax = 0.0f, ay = 0.0f;
+      for (std::size_t j = 0; j < count; ++j) {
+        const float dx = p.posX[j] - x;
+        const float dy = p.posY[j] - y;
+        const float inv = 1.0f / std::sqrt(dx * dx + dy * dy + eps2);
+        const float s = p.mass(j) * inv * inv * inv;
+        ax += s * dx;
+        ay += s * dy;
+      }
+      refX[k] = ax;
+      refY[k] = ay;
+    }
+    ms = msSince(t0) * static_cast<double>(count) / picks.size();
+    for (std::size_t k = 0; k < picks.size(); ++k) {
+      rms += refX[k] * refX[k] + refY[k] * refY[k];
+    }
+    rms = std::sqrt(rms / picks.size());
+  }
+
+  // Error of the accelerations in p.accX/accY at the picks: mean relative
+  // error, and the maximum relative to the RMS acceleration (the field
+  // vanishes at the centre of a disc, so a relative maximum says little
+  // there).
+  void error(const ParticleSystem &p, double &mean, double &max) const {
+    mean = 0.0;
+    max  = 0.0;
+    for (std::size_t k = 0; k < picks.size(); ++k) {
+      const double err = std::hypot(p.accX[picks[k]] - refX[k],
+                                    p.accY[picks[k]] - refY[k]);
+      mean += err / std::hypot(refX[k], refY[k]);
+      max = std::max(max, err / rms);
+    }
+    mean /= picks.size();
+  }
+};
+
+void zeroAccelerations(ParticleSystem &p) {
+  std::fill(p.accX.begin(), p.accX.begin() + p.count, 0.0f);
+  std::fill(p.accY.begin(), p.accY.begin() + p.count, 0.0f);
+}
+
+// Barnes-Hut self-gravity on a uniform disc against the direct sum. For
+// each opening angle: serial tree build and walk, both on the pool, and
+// the error in acceleration.
+void runSelfGravityComparison(std::size_t count, std::size_t samples) {
+  ParticleSystem p = makeDisc(count);
+  const DirectGravity direct(p, samples);
+  const double directMs = direct.ms;
+  auto t0 = std::chrono::steady_clock::now();
+
+  ThreadPool pool;
+  BarnesHutTree tree;
+  for (float theta : {0.3f, 0.5f, 0.7f, 1.0f}) {
+    zeroAccelerations(p);
+    t0 = std::chrono::steady_clock::now();
+    tree.build(p);
+    const double buildMs = msSince(t0);
+    t0 = std::chrono::steady_clock::now();
+    tree.accumulate(p, theta, 1.0f, 0, count);
+    const double walkMs = msSince(t0);
+
+    double meanErr = 0.0, maxErr = 0.0;
+    direct.error(p, meanErr, maxErr);
+
+    zeroAccelerations(p);
+    t0 = std::chrono::steady_clock::now();
+    tree.build(p, pool, cfg::MIN_PARTICLES_PER_THREAD);
+    pool.parallelFor(count, cfg::MIN_PARTICLES_PER_THREAD,
+                     [&](std::size_t b, std::size_t e) {
+                       tree.accumulate(p, theta, 1.0f, b, e);
+                     });
+    const double poolMs = msSince(t0);
+
+    std::printf("  %6zu particles  theta %.1f   build %7.2f ms  walk %8.2f ms"
+                "  pool %8.2f ms   direct %9.1f ms   error mean %5.2f%% "
+                "max %5.2f%% of rms\n",
+                count, theta, buildMs, walkMs, poolMs, directMs,
+                meanErr * 100.0, maxErr * 100.0);
+  }
+}
+
+// Particle-mesh self-gravity on the same disc, against the direct sum and
+// Barnes-Hut at the default opening angle. For each grid size: the serial
+// solve (deposit, FFTs, gradient) and read-back, both on the pool, and the
+// error in acceleration.
+void runMeshGravityComparison(std::size_t count, std::size_t samples) {
+  ParticleSystem p = makeDisc(count);
+  const DirectGravity direct(p, samples);
+  ThreadPool pool;
+  double meanErr = 0.0, maxErr = 0.0;
+
+  BarnesHutTree tree;
+  zeroAccelerations(p);
+  auto t0 = std::chrono::steady_clock::now();
+  tree.build(p, pool, cfg::MIN_PARTICLES_PER_THREAD);
+  pool.parallelFor(count, cfg::MIN_PARTICLES_PER_THREAD,
+                   [&](std::size_t b, std::size_t e) {
+                     tree.accumulate(p, cfg::BH_THETA, 1.0f, b, e);
+                   });
+  const double treeMs = msSince(t0);
+  direct.error(p, meanErr, maxErr);
+  std::printf("  %7zu particles  barnes-hut theta %.1f  pool %8.2f ms"
+              "   direct %10.1f ms   error mean %5.2f%% max %5.2f%% of rms\n",
+              count, cfg::BH_THETA, treeMs, direct.ms, meanErr * 100.0,
+              maxErr * 100.0);
+
+  ParticleMesh mesh;
+  for (int n = cfg::PM_MIN_GRID_SIZE; n <= cfg::PM_MAX_GRID_SIZE; n *= 2) {
+    mesh.build(p, n);   // first build at a size sets up the kernel
+    zeroAccelerations(p);
+    t0 = std::chrono::steady_clock::now();
+    mesh.build(p, n);
+    const double solveMs = msSince(t0);
+    t0 = std::chrono::steady_clock::now();
+    mesh.accumulate(p, 1.0f, 0, count);
+    const double gatherMs = msSince(t0);
+    direct.error(p, meanErr, maxErr);
+
+    zeroAccelerations(p);
+    t0 = std::chrono::steady_clock::now();
+    mesh.build(p, n, pool, cfg::MIN_PARTICLES_PER_THREAD);
+    pool.parallelFor(count, cfg::MIN_PARTICLES_PER_THREAD,
+                     [&](std::size_t b, std::size_t e) {
+                       mesh.accumulate(p, 1.0f, b, e);
+                     });
+    const double poolMs = msSince(t0);
+
+    std::printf("  %7zu particles  mesh %4d^2  solve %7.2f ms  gather %6.2f ms"
+                "  pool %8.2f ms   error mean %5.2f%% max %5.2f%% of rms\n",
+                count, n, solveMs, gatherMs, poolMs, meanErr * 100.0,
+                maxErr * 100.0);
+  }
+}
+
+// Brush effects through SpatialHash region queries against full scans, on
+// `count` random particles with a 60 px brush. The mouse field and the
+// explosion (best of 5) must come out identical. Erasing is timed on a
+// Simulation right after a step, when the physics grid is current, and
+// again right after that, when the first erase has made the grid stale and
+// every particle is scanned.
+void runRegionQueryComparison(std::size_t count) {
+  const ParticleSystem base = makeRandomMixedScene(count);
+  SpatialHash hash(cfg::WORLD_WIDTH, cfg::WORLD_HEIGHT, cfg::SPATIAL_CELL_SIZE);
+  std::vector<std::uint32_t> indices, near;
+  hash.build(indices, base.posX.data(), base.posY.data(), count);
+
+  InputState in;
+  in.leftDown        = true;
+  in.mode            = MouseMode::Vortex;
+  in.brushRadius     = 60.0f;
+  in.mousePos        = { 0.5f * cfg::WORLD_WIDTH, 0.5f * cfg::WORLD_HEIGHT };
+  in.explodePending  = true;
+  in.explodePosition = in.mousePos;
+  const int reps = 5;
+
+  struct Pass {
+    const char *label;
+    float radius;
+    void (*scan)(ParticleSystem &, const InputState &, std::size_t);
+    void (*region)(ParticleSystem &, const InputState &,
+                   const std::vector<std::uint32_t> &);
+  };
+  const Pass passes[] = {
+    {"mouse field", in.brushRadius,
+     [](ParticleSystem &p, const InputState &in, std::size_t n) {
+       forces::applyMouseField(p, in, 0, n);
+     },
+     [](ParticleSystem &p, const InputState &in,
+        const std::vector<std::uint32_t> &near) {
+       forces::applyMouseField(p, in, near.data(), 0, near.size());
+     }},
+    {"explosion", forces::explosionRadius(in),
+     [](ParticleSystem &p, const InputState &in, std::size_t n) {
+       forces::applyExplosionImpulse(p, in, 0, n);
+     },
+     [](ParticleSystem &p, const InputState &in,
+        const std::vector<std::uint32_t> &near) {
+       forces::applyExplosionImpulse(p, in, near.data(), 0, near.size());
+     }},
+  };
+
+  ParticleSystem a(0), b(0);
+  for (const Pass &pass : passes) {
+    double scanMs = 1e30, regionMs = 1e30;
+    for (int rep = 0; rep < reps; ++rep) {
+      a = base;
+      auto t0 = std::chrono::steady_clock::now();
+      pass.scan(a, in, count);
+      scanMs = std::min(scanMs, msSince(t0));
+
+      b = base;
+      t0 = std::chrono::steady_clock::now();
+      near.clear();
+      hash.queryCircle(in.mousePos.x, in.mousePos.y, pass.radius, indices, near);
+      pass.region(b, in, near);
+      regionMs = std::min(regionMs, msSince(t0));
+    }
+    std::printf("  %-12s scan %8.3f ms   region %7.3f ms %8.1fx   %6zu candidates"
+                "   max |diff| %.2e\n",
+                pass.label, scanMs, regionMs, scanMs / regionMs, near.size(),
+                maxStateDiff(a, b));
+  }
+
+  Simulation sim;
+  sim.reset(static_cast<int>(count));
+  sim.advance(1.5f / cfg::PHYSICS_RATE);   // exactly one step
+  const float ex[] = { 0.5f * cfg::WORLD_WIDTH, 0.25f * cfg::WORLD_WIDTH };
+  const char *labels[] = { "grid current", "grid stale" };
+  for (int k = 0; k < 2; ++k) {
+    const std::size_t before = sim.particles().count;
+    const int x = static_cast<int>(ex[k]);
+    const int y = static_cast<int>(0.5f * cfg::WORLD_HEIGHT);
+    auto t0 = std::chrono::steady_clock::now();
+    sim.eraseBrush(x, y, in.brushRadius);
+    const double ms = msSince(t0);
+    const ParticleSystem &p = sim.particles();
+    std::size_t left = 0;
+    for (std::size_t i = 0; i < p.count; ++i) {
+      const float dx = p.posX[i] - x, dy = p.posY[i] - y;
+      if (dx * dx + dy * dy <= in.brushRadius * in.brushRadius) ++left;
+    }
+    std::printf("  erase, %-12s %8.3f ms   %5zu erased   %zu left in the brush\n",
+                labels[k], ms, before - p.count, left);
+  }
+}
+
+// Bulk erase on `count` random particles, mixed and type-partitioned: the
+// old forward scan calling removeSwap per hit against removeMask, serial
+// and on a 4-thread pool, for a 175 px brush (about a tenth of the
+// particles) and for the left half of the world. Best of 3. All three must
+// leave the same particles, in any order (swapping and compacting order
+// the survivors differently), and nothing inside the region.
+void runEraseComparison(std::size_t count) {
+  ParticleSystem mixed = makeRandomMixedScene(count);
+  ParticleSystem byType = mixed;
+  byType.setPartitioned(true);
+  ThreadPool pool(4);
+  const int reps = 3;
+
+  struct Region {
+    const char *label;
+    bool (*inside)(float x, float y);
+  };
+  const Region regions[] = {
+    {"175 px brush", [](float x, float y) {
+       const float dx = x - 0.5f * cfg::WORLD_WIDTH;
+       const float dy = y - 0.5f * cfg::WORLD_HEIGHT;
+       return dx * dx + dy * dy <= 175.0f * 175.0f;
+     }},
+    {"left half", [](float x, float) { return x < 0.5f * cfg::WORLD_WIDTH; }},
+  };
+
+  ParticleSystem a(0), b(0), c(0), scratch(0);
+  for (const ParticleSystem *base : {&mixed, &byType}) {
+    for (const Region &r : regions) {
+      std::vector<std::uint8_t> mask(base->count);
+      for (std::size_t i = 0; i < base->count; ++i) {
+        mask[i] = r.inside(base->posX[i], base->posY[i]);
+      }
+      double scanMs = 1e30, maskMs = 1e30, poolMs = 1e30;
+      for (int rep = 0; rep < reps; ++rep) {
+        a = *base;
+        auto t0 = std::chrono::steady_clock::now();
+        std::size_t i = 0;
+        while (i < a.count) {
+          if (r.inside(a.posX[i], a.posY[i])) a.removeSwap(i);
+          else ++i;
+        }
+        scanMs = std::min(scanMs, msSince(t0));
+
+        b = *base;
+        t0 = std::chrono::steady_clock::now();
+        b.removeMask(mask);
+        maskMs = std::min(maskMs, msSince(t0));
+
+        c = *base;
+        t0 = std::chrono::steady_clock::now();
+        c.removeMask(mask, pool, cfg::MIN_PARTICLES_PER_THREAD, scratch);
+        poolMs = std::min(poolMs, msSince(t0));
+      }
+      std::size_t left = 0;
+      for (std::size_t i = 0; i < c.count; ++i) {
+        left += r.inside(c.posX[i], c.posY[i]);
+      }
+      const bool ranges = !base->partitioned ||
+                          (typeRangesValid(b) && typeRangesValid(c));
+      std::printf("  %-8s %-13s %7zu erased   removeSwap %8.2f ms   "
+                  "removeMask %7.2f ms   pool %7.2f ms   %s%s%s\n",
+                  base->partitioned ? "by type" : "mixed", r.label,
+                  count - c.count, scanMs, maskMs, poolMs,
+                  sameParticles(a, b) && sameParticles(b, c) && left == 0
+                      ? "identical"
+                      : "MISMATCH",
+                  base->partitioned ? ", ranges " : "",
+                  base->partitioned ? (ranges ? "valid" : "BROKEN") : "");
+    }
+  }
+
+  // Tails shorter than the pool with one-particle chunks: rounding the
+  // chunk up leaves fewer chunks than workers, which must not run past
+  // the end (5 particles with 4 marked is the smallest such case).
+  std::mt19937 rng(11);
+  bool agree = true;
+  for (std::size_t n = 1; n <= 64; ++n) {
+    for (int trial = 0; trial < 8; ++trial) {
+      ParticleSystem small = makeRandomMixedScene(n);
+      small.setPartitioned(trial & 1);
+      std::vector<std::uint8_t> mask(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        mask[i] = n == 5 && trial < 2 ? i != 0 : (rng() & 3) != 0;
+      }
+      b = small;
+      b.removeMask(mask);
+      c = small;
+      c.removeMask(mask, pool, 1, scratch);
+      agree = agree && sameParticles(b, c) &&
+              (!small.partitioned || typeRangesValid(c));
+    }
+  }
+  std::printf("  1-64 particles, pool of 4, chunks of 1: %s\n",
+              agree ? "identical" : "MISMATCH");
+}
+
+// One seeded scene of `count` particles run for `frames` frames on 1, 4
+// and 16 threads and serially, comparing ParticleSystem::stateHash()
+// with the 1-thread run after every frame. An explosion goes off in the
+// middle on frame 10. Every configuration runs in deterministic mode.
+// The default scene then runs once with each supported kernel made active,
+// which deterministic mode must ignore.
+void runDeterminismCheck(std::size_t count, int frames) {
+  Simulation seeded, again;
+  seeded.input().deterministic = true;
+  again.input().deterministic  = true;
+  seeded.reset(static_cast<int>(count));
+  again.reset(static_cast<int>(count));
+  std::printf("  seeded resets: %s\n",
+              seeded.particles().stateHash() == again.particles().stateHash()
+                  ? "same scene" : "DIFFERENT SCENES");
+
+  struct Config {
+    const char *label;
+    bool sph;
+    bool selfGravity;
+    GravitySolver gravitySolver;
+    CollisionSolver solver;
+  };
+  const Config configs[] = {
+      {"default",             false, false, GravitySolver::BarnesHut,
+       CollisionSolver::ColouredPairs},
+      {"SPH + mesh gravity",  true,  true,  GravitySolver::ParticleMesh,
+       CollisionSolver::ColouredPairs},
+      {"Gauss-Seidel + tree", false, true,  GravitySolver::BarnesHut,
+       CollisionSolver::GaussSeidel},
+  };
+  struct Variant { const char *label; unsigned int threads; bool multithread; };
+  const Variant variants[] = {
+      {"1 thread", 1, true}, {"4 threads", 4, true},
+      {"16 threads", 16, true}, {"serial", 1, false},
+  };
+
+  const float dt = 1.0f / 60.0f;
+  for (const Config &c : configs) {
+    std::printf("  %s\n", c.label);
+    std::vector<std::uint64_t> reference;
+    for (const Variant &v : variants) {
+      ParticleSystem p = seeded.particles();
+      PhysicsEngine engine(v.threads);
+      engine.setMultithreadingEnabled(v.multithread);
+      engine.setDeterministic(true);
+      engine.setCollisionSolver(c.solver);
+      InputState in;
+      in.deterministic = true;
+      in.sphLiquid     = c.sph;
+      in.selfGravity   = c.selfGravity;
+      in.gravitySolver = c.gravitySolver;
+      in.solver        = c.solver;
+
+      std::vector<std::uint64_t> hashes;
+      auto t0 = std::chrono::steady_clock::now();
+      for (int f = 0; f < frames; ++f) {
+        if (f == 10) {
+          in.explodePending  = true;
+          in.explodePosition = {0.5f * cfg::WORLD_WIDTH,
+                                0.5f * cfg::WORLD_HEIGHT};
+        }
+        engine.update(p, in, dt);
+        in.explodePending = false;
+        hashes.push_back(p.stateHash());
+      }
+      const double ms = msSince(t0);
+      if (reference.empty()) reference = hashes;
+
+      const auto diverged =
+          std::mismatch(hashes.begin(), hashes.end(), reference.begin()).first;
+      std::printf("    %-10s %8.3f ms/frame   final hash %016llx   ", v.label,
+                  ms / frames,
+                  static_cast<unsigned long long>(hashes.back()));
+      if (diverged == hashes.end()) {
+        std::printf("identical for %d frames\n", frames);
+      } else {
+        std::printf("differs from frame %d\n",
+                    static_cast<int>(diverged - hashes.begin()));
+      }
+    }
+  }
+
+  // The active kernel is set per CPU and by setKernel(); deterministic
+  // mode must not depend on it. Pin each supported kernel in turn and
+  // compare the default scene against the first one, frame by frame.
+  std::printf("  default, active kernel pinned (4 threads)\n");
+  const narrowphase::Kernel previous = narrowphase::activeKernel();
+  std::vector<std::uint64_t> reference;
+  for (int k = 0; k < static_cast<int>(narrowphase::Kernel::Count); ++k) {
+    const auto kernel = static_cast<narrowphase::Kernel>(k);
+    if (!narrowphase::setKernel(kernel)) continue;
+    ParticleSystem p = seeded.particles();
+    PhysicsEngine engine(4);
+    engine.setDeterministic(true);
+    InputState in;
+    in.deterministic = true;
+
+    std::vector<std::uint64_t> hashes;
+    for (int f = 0; f < frames; ++f) {
+      if (f == 10) {
+        in.explodePending  = true;
+        in.explodePosition = {0.5f * cfg::WORLD_WIDTH,
+                              0.5f * cfg::WORLD_HEIGHT};
+      }
+      engine.update(p, in, dt);
+      in.explodePending = false;
+      hashes.push_back(p.stateHash());
+    }
+    if (reference.empty()) reference = hashes;
+
+    const auto diverged =
+        std::mismatch(hashes.begin(), hashes.end(), reference.begin()).first;
+    std::printf("    %-10s final hash %016llx   ", narrowphase::kernelName(kernel),
+                static_cast<unsigned long long>(hashes.back()));
+    if (diverged == hashes.end()) {
+      std::printf("identical for %d frames\n", frames);
+    } else {
+      std::printf("differs from frame %d\n",
+                  static_cast<int>(diverged - hashes.begin()));
+    }
+  }
+  narrowphase::setKernel(previous);
+}
+
+// `frames` frames of a `count`-particle scene at a 60 Hz display rate,
+// each one physics step (advance by 1 / PHYSICS_RATE) plus the renderer's
+// vertex build (render with no SDL renderer), with the physics inline and
+// pipelined. Reports the UI thread's work per frame, the frames that ran
+// over the display interval, and the physics steps whose results reached
+// the screen (pipelined, frames the physics thread couldn't keep up with
+// are merged, and the step cap drops some of their time).
+void runPipelineComparison(int count, int frames) {
+  const auto interval = std::chrono::microseconds(1000000 / 60);
+  for (bool pipelined : {false, true}) {
+    Simulation sim;
+    sim.reset(count);
+    if (pipelined) sim.togglePipelined();
+    int steps = 0, late = 0;
+    double uiMs = 0.0;
+    auto next = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+      auto f0 = std::chrono::steady_clock::now();
+      sim.advance(1.0f / cfg::PHYSICS_RATE);
+      sim.render(nullptr);
+      uiMs  += msSince(f0);
+      steps += sim.getStepsLastFrame();
+      next += interval;
+      if (std::chrono::steady_clock::now() > next) {
+        ++late;
+        next = std::chrono::steady_clock::now();
+      }
+      std::this_thread::sleep_until(next);
+    }
+    if (pipelined) sim.togglePipelined();
+    std::printf("  %-10s %8.3f ms/frame on the UI thread   %4d of %d frames "
+                "late   %4d steps shown\n",
+                pipelined ? "pipelined" : "inline", uiMs / frames, late,
+                frames, steps);
+  }
+}
+
+// The particle store as it was before SoaArena and the material table:
+// one std::vector per field, radius, mass and colour included, each
+// resized (reallocated, copied and zero-filled up to the new capacity)
+// whenever add() runs out of room.
+struct VectorParticleStore {
+  std::vector<float> posX, posY, velX, velY, accX, accY, prevX, prevY;
+  std::vector<float> radius, mass, invMass;
+  std::vector<std::uint8_t>  type;
+  std::vector<std::uint16_t> restSteps;
+  std::vector<std::uint8_t>  colorR, colorG, colorB, colorA;
+  std::size_t count = 0, capacity = 0;
+
+  static constexpr std::size_t kBytesPerParticle =
+      11 * sizeof(float) + 5 * sizeof(std::uint8_t) + sizeof(std::uint16_t);
+
+  void reserve(std::size_t n) {
+    for (auto *f : {&posX, &posY, &velX, &velY, &accX, &accY, &prevX, &prevY,
+                    &radius, &mass, &invMass}) {
+      f->resize(n);
+    }
+    for (auto *f : {&type, &colorR, &colorG, &colorB, &colorA}) f->resize(n);
+    restSteps.resize(n);
+    capacity = n;
+  }
+
+  void add(float x, float y, float vx, float vy, float r, float m,
+           ParticleType t, SDL_Color c) {
+    if (count >= capacity) reserve(capacity * 2 + 1024);
+    const std::size_t i = count++;
+    posX[i] = x; posY[i] = y; velX[i] = vx; velY[i] = vy;
+    accX[i] = 0.0f; accY[i] = 0.0f; prevX[i] = x; prevY[i] = y;
+    radius[i] = r; mass[i] = m; invMass[i] = 1.0f / m;
+    type[i] = static_cast<std::uint8_t>(t); restSteps[i] = 0;
+    colorR[i] = c.r; colorG[i] = c.g; colorB[i] = c.b; colorA[i] = c.a;
+  }
+};
+
+// Spawn `count` particles in bursts of `burst` per frame into a store
+// that starts at cfg::INITIAL_CAPACITY, with the per-field vectors and
+// with the arena. Reports the slowest frame (the spawn hitch, which is a
+// growth step), the total and the bytes stored per particle, best of 3,
+// and checks that the arena kept every particle and that each of its
+// arrays is cfg::SOA_ALIGNMENT aligned.
+void runGrowthComparison(std::size_t count, std::size_t burst) {
+  const SDL_Color color = particleTypeColor(TYPE_DEFAULT);
+  auto spawn = [&](auto &store) {
+    double worstMs = 0.0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t done = 0; done < count; done += burst) {
+      auto f0 = std::chrono::steady_clock::now();
+      for (std::size_t k = done; k < std::min(done + burst, count); ++k) {
+        const float f = static_cast<float>(k);
+        store.add(f, -f, 1.0f, 2.0f, cfg::DEFAULT_RADIUS, cfg::DEFAULT_MASS,
+                  TYPE_DEFAULT, color);
+      }
+      worstMs = std::max(worstMs, msSince(f0));
+    }
+    return std::make_pair(worstMs, msSince(t0));
+  };
+
+  const int reps = 3;
+  double vecWorst = 1e30, vecTotal = 1e30, arenaWorst = 1e30, arenaTotal = 1e30;
+  bool intact = true, aligned = true;
+  for (int rep = 0; rep < reps; ++rep) {
+    VectorParticleStore v;
+    v.reserve(cfg::INITIAL_CAPACITY);
+    auto [vw, vt] = spawn(v);
+    vecWorst = std::min(vecWorst, vw);
+    vecTotal = std::min(vecTotal, vt);
+
+    ParticleSystem p;
+    auto [aw, at] = spawn(p);
+    arenaWorst = std::min(arenaWorst, aw);
+    arenaTotal = std::min(arenaTotal, at);
+
+    for (std::size_t i = 0; i < count; ++i) {
+      intact = intact && p.posX[i] == static_cast<float>(i) &&
+               p.posY[i] == -static_cast<float>(i) && p.prevX[i] == p.posX[i] &&
+               p.velY[i] == 2.0f && p.color(i).a == color.a &&
+               p.restSteps[i] == 0;
+    }
+    for (const void *f : {static_cast<const void *>(p.posX.data()),
+                          static_cast<const void *>(p.velY.data()),
+                          static_cast<const void *>(p.type.data()),
+                          static_cast<const void *>(p.material.data()),
+                          static_cast<const void *>(p.restSteps.data())}) {
+      aligned = aligned &&
+                reinterpret_cast<std::uintptr_t>(f) % cfg::SOA_ALIGNMENT == 0;
+    }
+  }
+  std::printf("  vectors   worst frame %8.3f ms   total %8.2f ms   %2zu bytes "
+              "per particle\n",
+              vecWorst, vecTotal, VectorParticleStore::kBytesPerParticle);
+  std::printf("  arena     worst frame %8.3f ms   total %8.2f ms   %2zu bytes "
+              "per particle   %s, %s\n",
+              arenaWorst, arenaTotal, ParticleSystem().bytesPerParticle(),
+              intact ? "intact" : "CORRUPT", aligned ? "aligned" : "MISALIGNED");
+}
+
+// Drive Simulation::advance with a synthetic frame time for `wallSeconds`
+// of wall time at the given display rate, and report how many physics
+// steps ran. Below cfg::PHYSICS_RATE / cfg::MAX_STEPS_PER_FRAME frames per
+// second the step cap kicks in and simulated time falls behind wall time.
+void runFixedTimestepCheck(std::size_t count, float displayHz,
+                           float wallSeconds) {
+  Simulation sim;
+  sim.reset(static_cast<int>(count));
+  const int frames = static_cast<int>(wallSeconds * displayHz + 0.5f);
+  int steps = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int f = 0; f < frames; ++f) {
+    sim.advance(1.0f / displayHz);
+    steps += sim.getStepsLastFrame();
+  }
+  const double ms = msSince(t0);
+  const float expected = wallSeconds * cfg::PHYSICS_RATE;
+  std::printf("  display %5.0f Hz   %4d frames   %4d steps (%3.0f%% of %3.0f)"
+              "   %8.3f ms/frame\n",
+              displayHz, frames, steps, 100.0f * steps / expected, expected,
+              ms / frames);
 }
 
 } // namespace
@@ -54,12 +1827,181 @@ void runPerformanceTests() {
       {10000, frames, true,  true,  "10000 particles   MT + grid"},
   };
 
-  std::printf("%-32s %12s %12s\n", "Scenario", "total (ms)", "per-frame (ms)");
-  std::printf("---------------------------------------------------------------\n");
+  std::printf("%-32s %12s %12s %12s\n", "Scenario", "total (ms)",
+              "per-frame (ms)", "hash (ms)");
+  std::printf("----------------------------------------------------------------------------\n");
   for (const auto &s : scenarios) {
-    double total = runScenario(s);
-    double per   = total / static_cast<double>(s.frames);
-    std::printf("%-32s %12.2f %12.3f\n", s.label, total, per);
+    printRow(s, runScenario(s));
+  }
+
+  // Spatial reorder: the same scene with and without the periodic
+  // cell-order permutation. Reset spawns at random positions, so storage
+  // order starts out unrelated to space, as it ends up after a while of
+  // spawning and erasing. The pair is run alternately, best of 5 each:
+  // single runs differ by more than the few percent being measured.
+  const int reorderFrames = 60;
+  const int reorderReps   = 5;
+  std::printf("\nSpatial reorder (every %d substeps when enabled, random "
+              "spawn order, best of %d alternating runs)\n",
+              cfg::REORDER_INTERVAL, reorderReps);
+  std::printf("%-32s %12s %12s %9s %12s\n", "Scenario", "total (ms)",
+              "per-frame (ms)", "reorders", "ms/reorder");
+  std::printf("-------------------------------------------------------------------------------\n");
+  for (int count : {20000, 50000}) {
+    const Scenario pair[2] = {
+        {count, reorderFrames, true, true, "no reorder", 0},
+        {count, reorderFrames, true, true, "reorder"},
+    };
+    Result best[2];
+    best[0].totalMs = best[1].totalMs = 1e30;
+    for (int rep = 0; rep < reorderReps; ++rep) {
+      for (int k = 0; k < 2; ++k) {
+        const Result r = runScenario(pair[k]);
+        if (r.totalMs < best[k].totalMs) best[k] = r;
+      }
+    }
+    for (int k = 0; k < 2; ++k) {
+      const Result &r = best[k];
+      const double per = r.totalMs / static_cast<double>(reorderFrames);
+      const double perReorder = r.reorders > 0 ? r.reorderMs / r.reorders : 0.0;
+      std::printf("%5d particles   %-14s %12.2f %12.3f %9d %12.3f", count,
+                  pair[k].label, r.totalMs, per, r.reorders, perReorder);
+      if (k == 1) std::printf("   %5.2fx", best[0].totalMs / r.totalMs);
+      std::printf("\n");
+    }
+  }
+  // Broadphase: the same scene through the dense grid and the sparse hash.
+  std::vector<Scenario> broadphaseScenarios = {
+      {10000, reorderFrames, true, true, "10000 particles   uniform grid"},
+      {10000, reorderFrames, true, true, "10000 particles   sparse grid",
+       cfg::REORDER_INTERVAL, Broadphase::SparseGrid},
+      {10000, reorderFrames, true, true, "10000 particles   multi-level",
+       cfg::REORDER_INTERVAL, Broadphase::MultiLevel},
+      {10000, reorderFrames, true, true, "10000 particles   verlet list",
+       cfg::REORDER_INTERVAL, Broadphase::VerletList},
+  };
+  std::printf("\nBroadphase\n");
+  std::printf("%-32s %12s %12s %12s\n", "Scenario", "total (ms)",
+              "per-frame (ms)", "hash (ms)");
+  std::printf("----------------------------------------------------------------------------\n");
+  for (const auto &s : broadphaseScenarios) {
+    const Result r = runScenario(s);
+    printRow(s, r);
+    if (s.broadphase == Broadphase::VerletList) {
+      std::printf("%-32s lists rebuilt on %d of %d substeps\n", "",
+                  r.listRebuilds, r.substeps);
+    }
+  }
+  std::printf("\nVerlet lists (dense liquid, one collision pass, best of 10)\n");
+  runVerletCheck(20000);
+  std::printf("  settled sand layer, sleeping off (600 frames to settle, 240 "
+              "timed, best of 3)\n");
+  for (std::size_t count : {2000, 5000, 10000, 20000}) {
+    runVerletSettledComparison(count, 600, 240);
+  }
+  std::printf("\nSleeping (sand layer settled for 600 frames, then 240 "
+              "timed frames and an explosion)\n");
+  runSleepComparison(2000, 600, 240);
+  runSleepComparison(5000, 600, 240);
+
+  std::printf("\nAdaptive substeps (sand layer settled for 600 frames, "
+              "240 calm frames, then an explosion; CFL %.2f, %d..%d)\n",
+              cfg::CFL_NUMBER, cfg::MIN_SUBSTEPS, cfg::MAX_SUBSTEPS);
+  runAdaptiveSubstepComparison(5000, 600, 240, 60);
+  std::printf("  liquid block, 600 frames of %.2f s with sleeping on (SPH "
+              "CFL %.2f)\n", cfg::DT_DEFAULT, cfg::SPH_CFL_NUMBER);
+  runSphSubstepCheck(6000, 600);
+
+  std::printf("\nMixed radii (20000 particles, 2%% with 4-10x radius; one "
+              "collision pass, best of 10)\n");
+  runMixedRadiusComparison(20000, 0.02f);
+  std::printf("\nSparse hash memory\n");
+  runSparseMemoryCheck(200000, 100000.0f, 64);
+
+  std::printf("\nNarrowphase kernels, dense liquid (one collision pass, "
+              "best of 10; runtime pick: %s)\n",
+              narrowphase::kernelName(narrowphase::bestKernel()));
+  runNarrowphaseComparison(20000);
+
+  std::printf("\nIntegration passes (1000000 particles, serial, best of 5)\n");
+  runIntegrationComparison(1000000);
+
+  std::printf("\nType-partitioned storage (1000000 particles, serial, best of 5)\n");
+  runPartitionComparison(1000000);
+  const Scenario partitionScenarios[] = {
+      {20000, reorderFrames, true, true, "20000 particles   mixed"},
+      {20000, reorderFrames, true, true, "20000 particles   by type",
+       cfg::REORDER_INTERVAL, Broadphase::UniformGrid, true, false, true},
+  };
+  std::printf("%-32s %12s %12s %12s\n", "Scenario", "total (ms)",
+              "per-frame (ms)", "hash (ms)");
+  std::printf("----------------------------------------------------------------------------\n");
+  for (const auto &s : partitionScenarios) {
+    printRow(s, runScenario(s));
+  }
+
+  std::printf("\nSettling a loose sand pile (no sleep, at most 600 frames)\n");
+  for (std::size_t count : {3000, 6000}) {
+    std::printf(" %zu particles\n", count);
+    runSettleComparison(count, 600);
+  }
+
+  std::printf("\nCollision solver, dense liquid (one serial pass, best of 10)\n");
+  runSolverComparison(20000);
+
+  std::printf("\nPeriodic boundaries (40000 particles filling the world; "
+              "one serial pass best of 5, then 240 frames without gravity)\n");
+  runPeriodicCheck(40000, 240);
+
+  std::printf("\nStatic obstacles, demo level (3000 sand poured for 600 "
+              "frames; lookup serial, best of 5)\n");
+  runObstacleComparison(3000, 600);
+
+  std::printf("\nBrush region queries (500000 particles, 60 px brush)\n");
+  runRegionQueryComparison(500000);
+
+  std::printf("\nBulk erase (1000000 particles, best of 3)\n");
+  runEraseComparison(1000000);
+
+  std::printf("\nSpawn bursts (2000000 particles, 20000 per frame, from "
+              "%d capacity, best of 3)\n", cfg::INITIAL_CAPACITY);
+  runGrowthComparison(2000000, 20000);
+
+  std::printf("\nSelf-gravity, Barnes-Hut vs direct sum (uniform disc; direct "
+              "timed on up to 2000 particles and scaled)\n");
+  for (std::size_t count : {20000, 100000, 200000}) {
+    runSelfGravityComparison(count, 2000);
   }
+
+  std::printf("\nSelf-gravity, particle mesh vs Barnes-Hut and direct sum "
+              "(direct timed on up to 500 particles and scaled)\n");
+  for (std::size_t count : {200000, 1000000}) {
+    runMeshGravityComparison(count, 500);
+  }
+
+  std::printf("\nLiquid dam break (6000 particles, 400 frames of %.2f s, "
+              "app defaults)\n", cfg::DT_DEFAULT);
+  runFluidComparison(6000, 400);
+
+  std::printf("\nFixed timestep (2000 particles, 2 s of wall time, physics at "
+              "%.0f Hz, at most %d steps per frame)\n",
+              cfg::PHYSICS_RATE, cfg::MAX_STEPS_PER_FRAME);
+  for (float hz : {144.0f, 60.0f, 30.0f, 10.0f}) {
+    runFixedTimestepCheck(2000, hz, 2.0f);
+  }
+
+  std::printf("\nPipelined physics (20000 particles, 240 frames at 60 Hz, "
+              "one step plus the vertex build each)\n");
+  runPipelineComparison(20000, 240);
+
+  std::printf("\nDeterminism (20000 particles, 60 frames, state hash "
+              "compared with 1 thread every frame)\n");
+  runDeterminismCheck(20000, 60);
+
+  std::printf("\nSpatial hash build (serial vs parallel counting sort)\n");
+  runHashBuildCheck( 50000, 4);
+  runHashBuildCheck(200000, 4);
+  runHashBuildCheck(200000, 16);
+
   std::printf("\nDone.\n");
 }
@@ -0,0 +1,51 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+
+// ---------------------------------------------------------------------------
+// Lock-free single-producer, single-consumer triple buffer.
+//
+// The writer fills back() and publish()es it; the reader calls acquire()
+// and then reads front() for as long as it likes. Three slots mean neither
+// side ever waits: the writer always has a slot nobody is reading, and the
+// reader keeps its slot until it asks for a newer one. Frames the reader
+// never picked up are simply overwritten, so a slow reader sees the latest
+// state rather than a backlog.
+//
+// The "ready" slot index is swapped atomically with the side's own index;
+// a flag bit in it says whether the slot holds a frame the reader hasn't
+// taken yet.
+// ---------------------------------------------------------------------------
+
+template <class T>
+class TripleBuffer {
+public:
+  // Writer side.
+  T &back() { return slots_[back_]; }
+
+  void publish() {
+    back_ = ready_.exchange(back_ | kFresh, std::memory_order_acq_rel) & kIndex;
+  }
+
+  // Reader side. Returns true when front() changed to a newer frame.
+  bool acquire() {
+    if (!(ready_.load(std::memory_order_relaxed) & kFresh)) return false;
+    front_ = ready_.exchange(front_, std::memory_order_acq_rel) & kIndex;
+    return true;
+  }
+
+  const T &front() const { return slots_[front_]; }
+
+private:
+  static constexpr unsigned int kIndex = 3u;
+  static constexpr unsigned int kFresh = 4u;
+
+  std::array<T, 3> slots_;
+  unsigned int back_  = 0;             // writer only
+  unsigned int front_ = 1;             // reader only
+  std::atomic<unsigned int> ready_{2};
+};
+
+#endif
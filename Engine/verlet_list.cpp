@@ -0,0 +1,161 @@
+#include "verlet_list.h"
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+
+// Chunks for a pass over n particles: one per worker, none smaller than
+// minChunk; one without a pool.
+std::size_t chunkCount(std::size_t n, ThreadPool *pool, std::size_t minChunk) {
+  if (!pool) return 1;
+  const std::size_t maxChunks =
+      std::max<std::size_t>(1, n / std::max<std::size_t>(1, minChunk));
+  return std::min<std::size_t>(std::max(1u, pool->size()), maxChunks);
+}
+
+} // namespace
+
+bool VerletList::stale(const ParticleSystem &p) const {
+  return staleImpl(p, nullptr, 0);
+}
+
+bool VerletList::stale(const ParticleSystem &p, ThreadPool &pool,
+                       std::size_t minChunk) const {
+  return staleImpl(p, &pool, minChunk);
+}
+
+bool VerletList::staleImpl(const ParticleSystem &p, ThreadPool *pool,
+                           std::size_t minChunk) const {
+  if (!built_ || p.count != count_ || p.layoutVersion != layoutVersion_) {
+    return true;
+  }
+  // Largest squared displacement per chunk, a plain max so it vectorises;
+  // only the maximum of the chunk maxima is compared with the limit.
+  const std::size_t numChunks = chunkCount(count_, pool, minChunk);
+  const std::size_t chunk = (count_ + numChunks - 1) / numChunks;
+  std::vector<float> moved2(numChunks, 0.0f);
+  auto measure = [&](std::size_t cb, std::size_t ce) {
+    for (std::size_t c = cb; c < ce; ++c) {
+      const std::size_t e = std::min(count_, (c + 1) * chunk);
+      float m = 0.0f;
+      for (std::size_t i = c * chunk; i < e; ++i) {
+        const float dx = p.posX[i] - refX_[i];
+        const float dy = p.posY[i] - refY_[i];
+        m = std::max(m, dx * dx + dy * dy);
+      }
+      moved2[c] = m;
+    }
+  };
+  if (numChunks > 1) {
+    pool->parallelFor(numChunks, 1, measure);
+  } else {
+    measure(0, 1);
+  }
+  const float limit = 0.5f * skin_;
+  return *std::max_element(moved2.begin(), moved2.end()) > limit * limit;
+}
+
+void VerletList::build(const ParticleSystem &p, const SpatialHash &hash,
+                       const narrowphase::SortedParticles &sorted) {
+  buildImpl(p, hash, sorted, nullptr, 0);
+}
+
+void VerletList::build(const ParticleSystem &p, const SpatialHash &hash,
+                       const narrowphase::SortedParticles &sorted,
+                       ThreadPool &pool, std::size_t minChunk) {
+  buildImpl(p, hash, sorted, &pool, minChunk);
+}
+
+std::uint32_t VerletList::scan(const ParticleSystem &p,
+                               const SpatialHash &hash,
+                               const narrowphase::SortedParticles &sorted,
+                               std::size_t i, float maxRadius,
+                               std::vector<std::uint32_t> &out) const {
+  const float px = p.posX[i], py = p.posY[i];
+  const float reach = p.radius(i) + skin_;
+  // Only the cells the widest possible pair distance can reach; the cell
+  // lookups clamp to the grid.
+  const float far = reach + maxRadius;
+  const int x0 = hash.cellIndexX(px - far);
+  const int x1 = hash.cellIndexX(px + far);
+  const int y0 = hash.cellIndexY(py - far);
+  const int y1 = hash.cellIndexY(py + far);
+
+  // Room for every candidate first, so the loop can write each slot and
+  // keep it or not depending on the test, with no branch to mispredict.
+  const std::size_t before = out.size();
+  std::size_t candidates = 0;
+  for (int y = y0; y <= y1; ++y) {
+    candidates += hash.getCell(x1, y).start + hash.getCell(x1, y).count -
+                  hash.getCell(x0, y).start;
+  }
+  out.resize(before + candidates);
+  std::uint32_t *o = out.data();
+  std::size_t n = before;
+  for (int y = y0; y <= y1; ++y) {
+    const auto &last = hash.getCell(x1, y);
+    const std::uint32_t end = last.start + last.count;
+    for (std::uint32_t k = hash.getCell(x0, y).start; k < end; ++k) {
+      const float dx = sorted.posX[k] - px;
+      const float dy = sorted.posY[k] - py;
+      const float cut = reach + sorted.radius[k];
+      o[n] = k;
+      n += (dx * dx + dy * dy < cut * cut) & (sorted.id[k] != i);
+    }
+  }
+  out.resize(n);
+  return static_cast<std::uint32_t>(n - before);
+}
+
+void VerletList::buildImpl(const ParticleSystem &p, const SpatialHash &hash,
+                           const narrowphase::SortedParticles &sorted,
+                           ThreadPool *pool, std::size_t minChunk) {
+  const std::size_t N = p.count;
+  // Every radius is a material table entry, so the table bounds how far
+  // away a neighbour's centre can be.
+  float maxRadius = 0.0f;
+  for (const Material &m : p.materials) {
+    maxRadius = std::max(maxRadius, m.radius);
+  }
+
+  offsets_.resize(N + 1);
+  refX_.assign(p.posX.begin(), p.posX.begin() + N);
+  refY_.assign(p.posY.begin(), p.posY.begin() + N);
+
+  const std::size_t numChunks = chunkCount(N, pool, minChunk);
+  const std::size_t chunk = (N + numChunks - 1) / numChunks;
+  if (chunkSlots_.size() < numChunks) chunkSlots_.resize(numChunks);
+
+  // 1. Each chunk scans its particles once into its own buffer, recording
+  //    per-particle counts.
+  auto scanChunks = [&](std::size_t cb, std::size_t ce) {
+    for (std::size_t c = cb; c < ce; ++c) {
+      std::vector<std::uint32_t> &buf = chunkSlots_[c];
+      buf.clear();
+      const std::size_t e = std::min(N, (c + 1) * chunk);
+      for (std::size_t i = c * chunk; i < e; ++i) {
+        offsets_[i + 1] = scan(p, hash, sorted, i, maxRadius, buf);
+      }
+    }
+  };
+  if (numChunks > 1) {
+    pool->parallelFor(numChunks, 1, scanChunks);
+  } else {
+    scanChunks(0, 1);
+  }
+
+  // 2. Prefix sum, 3. copy the chunk buffers into place.
+  offsets_[0] = 0;
+  for (std::size_t i = 0; i < N; ++i) offsets_[i + 1] += offsets_[i];
+  slots_.resize(offsets_[N]);
+  for (std::size_t c = 0; c < numChunks && c * chunk < N; ++c) {
+    std::copy(chunkSlots_[c].begin(), chunkSlots_[c].end(),
+              slots_.begin() + offsets_[c * chunk]);
+  }
+
+  count_ = N;
+  layoutVersion_ = p.layoutVersion;
+  built_ = true;
+}
@@ -0,0 +1,89 @@
+#ifndef VERLET_LIST_H
+#define VERLET_LIST_H
+
+#include "narrowphase.h"
+#include "particle.h"
+#include "spatial_hash.h"
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// ---------------------------------------------------------------------------
+// Verlet neighbour lists: for every particle, the snapshot slots of all
+// particles within (r_i + r_j + skin) at build time, stored compactly
+// (CSR: one offset per particle into a single slot array).
+//
+// While no particle has moved more than skin/2 since the build, no pair
+// can have closed the skin gap, so every contact is still in the lists and
+// the spatial hash does not need rebuilding. The lists hold slots of the
+// cell-ordered snapshot taken at build time; the caller keeps gathering the
+// snapshot in that same order each substep so the slots stay meaningful.
+//
+// Lists also go stale when particles are added, removed or permuted, which
+// ParticleSystem::layoutVersion tracks. The build scans every cell within
+// r_i + maxRadius + skin of each particle, so the skin is not bound by the
+// cell size; a wider skin means longer lists but rarer rebuilds.
+// ---------------------------------------------------------------------------
+
+class VerletList {
+public:
+  explicit VerletList(float skin) : skin_(skin) {}
+
+  // True if the lists may miss a contact and must be rebuilt.
+  bool stale(const ParticleSystem &p) const;
+
+  // Same result, with the displacement check run on the pool.
+  bool stale(const ParticleSystem &p, ThreadPool &pool,
+             std::size_t minChunk) const;
+
+  // Force a rebuild, e.g. after another broadphase overwrote the slot
+  // order the lists refer to.
+  void invalidate() { built_ = false; }
+
+  // Rebuild from a hash and snapshot built over the current positions.
+  void build(const ParticleSystem &p, const SpatialHash &hash,
+             const narrowphase::SortedParticles &sorted);
+
+  // Same result, with the count and fill passes run on the pool.
+  void build(const ParticleSystem &p, const SpatialHash &hash,
+             const narrowphase::SortedParticles &sorted,
+             ThreadPool &pool, std::size_t minChunk);
+
+  const std::uint32_t *neighbours(std::size_t i) const {
+    return slots_.data() + offsets_[i];
+  }
+  std::uint32_t neighbourCount(std::size_t i) const {
+    return offsets_[i + 1] - offsets_[i];
+  }
+
+  float       skin()      const { return skin_; }
+  std::size_t pairCount() const { return offsets_.empty() ? 0 : offsets_.back(); }
+
+private:
+  float skin_;
+  bool  built_ = false;
+  std::uint64_t layoutVersion_ = 0;
+  std::size_t   count_ = 0;
+
+  std::vector<std::uint32_t> offsets_;  // count_ + 1 entries
+  std::vector<std::uint32_t> slots_;
+  std::vector<float>         refX_, refY_;
+  std::vector<std::vector<std::uint32_t>> chunkSlots_;  // build scratch
+
+  bool staleImpl(const ParticleSystem &p, ThreadPool *pool,
+                 std::size_t minChunk) const;
+
+  void buildImpl(const ParticleSystem &p, const SpatialHash &hash,
+                 const narrowphase::SortedParticles &sorted,
+                 ThreadPool *pool, std::size_t minChunk);
+
+  // Append particle i's neighbour slots to `out`; returns how many.
+  std::uint32_t scan(const ParticleSystem &p, const SpatialHash &hash,
+                     const narrowphase::SortedParticles &sorted,
+                     std::size_t i, float maxRadius,
+                     std::vector<std::uint32_t> &out) const;
+};
+
+#endif
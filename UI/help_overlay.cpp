@@ -2,9 +2,12 @@
 
 #include "particle_renderer.h"
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstddef>
 #include <cstdio>
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -34,7 +37,8 @@ void HelpOverlay::renderText(const std::string &text, int x, int y,
 }
 
 void HelpOverlay::drawStatusBar(const InputState &state, float fps,
-                                int particleCount, float updateMs) {
+                                int particleCount, float updateMs,
+                                int substeps) {
   // Background strip
   SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
   SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 140);
@@ -43,21 +47,58 @@ void HelpOverlay::drawStatusBar(const InputState &state, float fps,
 
   char buf[256];
   std::snprintf(buf, sizeof(buf),
-                "FPS: %5.1f   particles: %5d   update: %5.2f ms",
-                fps, particleCount, updateMs);
+                "FPS: %5.1f  particles: %5d  update: %5.2f ms  substeps: %2d",
+                fps, particleCount, updateMs, substeps);
   renderText(buf, 8, 4, kAccent);
 
   std::snprintf(buf, sizeof(buf), "mode: %s   type: %s   brush: %.0f",
                 mouseModeName(state.mode),
                 particleTypeName(static_cast<ParticleType>(state.spawnType)),
                 state.brushRadius);
-  renderText(buf, 460, 4, kKey);
+  renderText(buf, 500, 4, kKey);
 
   std::string flags;
   if (state.paused)            flags += "[PAUSED] ";
   if (!state.gravityEnabled)   flags += "[no-gravity] ";
   if (!state.gridEnabled)      flags += "[no-grid] ";
+  else if (state.broadphase != Broadphase::UniformGrid) {
+    flags += std::string("[") + broadphaseName(state.broadphase) + "] ";
+  }
+  if (state.gridEnabled && state.solver == CollisionSolver::GaussSeidel) {
+    char gs[48];
+    std::snprintf(gs, sizeof(gs), "[%s x%d] ",
+                  collisionSolverName(state.solver), state.solverIterations);
+    flags += gs;
+  } else if (state.gridEnabled &&
+             state.solver != CollisionSolver::ColouredPairs) {
+    flags += std::string("[") + collisionSolverName(state.solver) + "] ";
+  }
   if (!state.multithreadEnabled) flags += "[serial] ";
+  if (!state.sleepEnabled)     flags += "[no-sleep] ";
+  if (!state.fixedTimestep)    flags += "[step per frame] ";
+  if (state.partitionByType)   flags += "[by type] ";
+  if (state.sphLiquid)         flags += "[SPH liquid] ";
+  if (state.deterministic)     flags += "[deterministic] ";
+  if (state.pipelined)         flags += "[pipelined] ";
+  if (state.periodicX || state.periodicY) {
+    flags += state.periodicX && state.periodicY ? "[wrap xy] "
+             : state.periodicX                  ? "[wrap x] "
+                                                : "[wrap y] ";
+  }
+  if (state.selfGravity) {
+    char sg[40];
+    if (state.gravitySolver == GravitySolver::ParticleMesh) {
+      std::snprintf(sg, sizeof(sg), "[self-gravity PM %d] ", state.meshSize);
+    } else {
+      std::snprintf(sg, sizeof(sg), "[self-gravity %.1f] ", state.openingAngle);
+    }
+    flags += sg;
+  }
+  if (state.adaptiveSubsteps) {
+    char ss[32];
+    std::snprintf(ss, sizeof(ss), "[adaptive <= %d] ", state.maxSubsteps);
+    flags += ss;
+  }
   if (state.timeScale != 1.0f) {
     char ts[32];
     std::snprintf(ts, sizeof(ts), "[time x%.2f] ", state.timeScale);
@@ -69,18 +110,9 @@ void HelpOverlay::drawStatusBar(const InputState &state, float fps,
 }
 
 void HelpOverlay::drawHelp(const InputState & /*state*/) {
-  // Translucent panel on the left side of the sim window.
-  const int x = 12, y = 40;
-  const int w = 360, h = 540;
-  SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
-  SDL_SetRenderDrawColor(renderer_, 10, 10, 20, 200);
-  SDL_Rect bg{ x, y, w, h };
-  SDL_RenderFillRect(renderer_, &bg);
-  SDL_SetRenderDrawColor(renderer_, 80, 100, 160, 255);
-  SDL_RenderDrawRect(renderer_, &bg);
-
   struct Row { const char *key; const char *desc; SDL_Color color; };
-  const Row rows[] = {
+  // Two columns, so the list fits under the status bar of the 800 px window.
+  const Row left[] = {
     {"Controls",       "(press H to hide)",                kHeading},
     {"",               "",                                  kBody},
     {"Space",          "pause / resume",                    kBody},
@@ -89,7 +121,21 @@ void HelpOverlay::drawHelp(const InputState & /*state*/) {
     {"C",              "clear all particles",               kBody},
     {"F",              "freeze (zero velocities)",          kBody},
     {"M / B",          "toggle multithreading / grid",      kBody},
-    {"",               "",                                  kBody},
+    {"N",              "next broadphase",                   kBody},
+    {"Z",              "toggle sleeping",                   kBody},
+    {"V",              "next collision solver",             kBody},
+    {"I",              "Gauss-Seidel sweeps (1 2 4 8)",     kBody},
+    {"T",              "toggle fixed timestep",             kBody},
+    {"U",              "toggle adaptive substeps",          kBody},
+    {", / .",          "lower / raise substep ceiling",     kBody},
+    {"P",              "toggle per-type particle storage",  kBody},
+    {"L",              "toggle SPH liquid",                 kBody},
+    {"X",              "toggle deterministic mode",         kBody},
+    {"Tab",            "toggle physics on its own thread",  kBody},
+    {"6",              "edges: walls / wrap x / y / both",  kBody},
+    {"7",              "toggle obstacles (demo level)",     kBody},
+  };
+  const Row right[] = {
     {"Brush & spawn",  "",                                  kHeading},
     {"LMB drag",       "act with current tool",             kBody},
     {"Q / E",          "previous / next tool",              kBody},
@@ -102,21 +148,42 @@ void HelpOverlay::drawHelp(const InputState & /*state*/) {
     {"Left / Right",   "rotate gravity",                    kBody},
     {"Up / Down",      "weaker / stronger gravity",         kBody},
     {"[ / ]",          "decrease / increase gravity",       kBody},
+    {"K",              "toggle self-gravity (N-body)",      kBody},
+    {"J",              "opening angle (0.3 0.5 0.7 1.0)",   kBody},
+    {"O",              "solver: barnes-hut / particle mesh", kBody},
+    {"Y",              "mesh size (64 .. 1024)",            kBody},
     {"- / =",          "slow-mo / fast-fwd  (0 = 1.0x)",    kBody},
     {"",               "",                                  kBody},
     {"H",              "toggle this overlay",               kDim},
   };
+  constexpr int kRows = std::max(std::size(left), std::size(right));
 
-  int row_y = y + 10;
-  for (const auto &r : rows) {
-    if (r.key[0] != '\0') {
-      renderText(r.key, x + 12, row_y, kKey);
-    }
-    if (r.desc[0] != '\0') {
-      renderText(r.desc, x + 140, row_y, r.color);
+  // Translucent panel on the left side of the sim window.
+  const int x = 12, y = 40;
+  const int colW = 360, rowH = 19;
+  const int w = 2 * colW, h = kRows * rowH + 20;
+  SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer_, 10, 10, 20, 200);
+  SDL_Rect bg{ x, y, w, h };
+  SDL_RenderFillRect(renderer_, &bg);
+  SDL_SetRenderDrawColor(renderer_, 80, 100, 160, 255);
+  SDL_RenderDrawRect(renderer_, &bg);
+
+  auto drawColumn = [&](const Row *rows, std::size_t n, int colX) {
+    int row_y = y + 10;
+    for (std::size_t i = 0; i < n; ++i) {
+      const Row &r = rows[i];
+      if (r.key[0] != '\0') {
+        renderText(r.key, colX + 12, row_y, kKey);
+      }
+      if (r.desc[0] != '\0') {
+        renderText(r.desc, colX + 140, row_y, r.color);
+      }
+      row_y += rowH;
     }
-    row_y += 19;
-  }
+  };
+  drawColumn(left, std::size(left), x);
+  drawColumn(right, std::size(right), x + colW);
 }
 
 void HelpOverlay::drawBrush(const InputState &state) {
@@ -20,7 +20,7 @@ public:
 
   // Status bar (always visible across top): mode, brush, type, paused...
   void drawStatusBar(const InputState &state, float fps, int particleCount,
-                     float updateMs);
+                     float updateMs, int substeps);
 
   // Full keymap (toggle via H).
   void drawHelp(const InputState &state);
@@ -40,12 +40,11 @@ inline void speedToRGB(float speedSq, SDL_Color base,
   outB = static_cast<Uint8>(base.b * (1.0f - t) + hotB * t);
 }
 
-} // namespace
-
-namespace ParticleRenderer {
-
-void draw(SDL_Renderer *renderer, const ParticleSystem &p) {
-  if (!renderer || p.count == 0) return;
+// Fill the vertex and index buffers for every particle of `p`, which is a
+// ParticleSystem or a RenderSnapshot (same names), and submit them.
+template <class Particles>
+void drawParticles(SDL_Renderer *renderer, const Particles &p, float alpha) {
+  if (p.count == 0) return;
 
   constexpr int V    = cfg::RENDER_CIRCLE_VERTS;
   constexpr int TRIS = V - 2;       // fan triangulation
@@ -60,15 +59,15 @@ void draw(SDL_Renderer *renderer, const ParticleSystem &p) {
   idx.reserve(p.count * TRIS * 3);
 
   for (std::size_t i = 0; i < p.count; ++i) {
-    float cx = p.posX[i];
-    float cy = p.posY[i];
-    float r  = p.radius[i];
+    float cx = p.prevX[i] + (p.posX[i] - p.prevX[i]) * alpha;
+    float cy = p.prevY[i] + (p.posY[i] - p.prevY[i]) * alpha;
+    float r  = p.radius(i);
 
     float speedSq = p.velX[i] * p.velX[i] + p.velY[i] * p.velY[i];
-    SDL_Color base{ p.colorR[i], p.colorG[i], p.colorB[i], p.colorA[i] };
+    const SDL_Color base = p.color(i);
     Uint8 rC, gC, bC;
     speedToRGB(speedSq, base, rC, gC, bC);
-    SDL_Color col{ rC, gC, bC, p.colorA[i] };
+    SDL_Color col{ rC, gC, bC, base.a };
 
     int baseV = static_cast<int>(verts.size());
 
@@ -89,6 +88,7 @@ void draw(SDL_Renderer *renderer, const ParticleSystem &p) {
     }
   }
 
+  if (!renderer) return;
   SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
   SDL_RenderGeometry(renderer,
                      /*texture*/ nullptr,
@@ -98,6 +98,42 @@ void draw(SDL_Renderer *renderer, const ParticleSystem &p) {
                      static_cast<int>(idx.size()));
 }
 
+} // namespace
+
+namespace ParticleRenderer {
+
+void draw(SDL_Renderer *renderer, const ParticleSystem &p, float alpha) {
+  drawParticles(renderer, p, alpha);
+}
+
+void draw(SDL_Renderer *renderer, const RenderSnapshot &s, float alpha) {
+  drawParticles(renderer, s, alpha);
+}
+
+void drawObstacles(SDL_Renderer *renderer, const ObstacleField &field) {
+  if (!renderer) return;
+  auto line = [renderer](Vec2 a, Vec2 b) {
+    SDL_RenderDrawLine(renderer, static_cast<int>(a.x), static_cast<int>(a.y),
+                       static_cast<int>(b.x), static_cast<int>(b.y));
+  };
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer, 150, 150, 165, 255);
+  for (const ObstacleField::Segment &s : field.segments()) {
+    const Vec2 d = (s.b - s.a).normalized();
+    const Vec2 side{ -d.y * s.radius, d.x * s.radius };
+    line(s.a + side, s.b + side);
+    line(s.b + side, s.b - side);
+    line(s.b - side, s.a - side);
+    line(s.a - side, s.a + side);
+  }
+  for (const ObstacleField::Polygon &poly : field.polygons()) {
+    const std::size_t n = poly.points.size();
+    for (std::size_t k = 0, j = n - 1; k < n; j = k++) {
+      line(poly.points[j], poly.points[k]);
+    }
+  }
+}
+
 void drawBrush(SDL_Renderer *renderer, int x, int y, float radius,
                SDL_Color color) {
   if (!renderer) return;
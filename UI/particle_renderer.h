@@ -1,7 +1,9 @@
 #ifndef PARTICLE_RENDERER_H
 #define PARTICLE_RENDERER_H
 
+#include "obstacle_field.h"
 #include "particle.h"
+#include "render_snapshot.h"
 
 #include <SDL2/SDL.h>
 
@@ -21,7 +23,17 @@
 
 namespace ParticleRenderer {
 
-void draw(SDL_Renderer *renderer, const ParticleSystem &p);
+// Each particle is drawn at prev + (pos - prev) * alpha, i.e. `alpha` of
+// the way from its previous-step position to its current one. With a null
+// renderer the vertex buffer is still built, so headless runs can time it.
+void draw(SDL_Renderer *renderer, const ParticleSystem &p, float alpha = 1.0f);
+
+// Same, from a snapshot published by the pipelined simulation.
+void draw(SDL_Renderer *renderer, const RenderSnapshot &s, float alpha = 1.0f);
+
+// Outlines of static obstacles: each segment as the rectangle its
+// thickness covers, each polygon as its edges.
+void drawObstacles(SDL_Renderer *renderer, const ObstacleField &field);
 
 // Brush overlay (mouse cursor radius indicator).
 void drawBrush(SDL_Renderer *renderer, int x, int y, float radius,
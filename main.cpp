@@ -21,6 +21,7 @@
 #include <SDL2/SDL_ttf.h>
 #include <chrono>
 #include <cstdio>
+#include <memory>
 #include <string>
 
 namespace {
@@ -66,8 +67,12 @@ bool init(SDL_Window **sw, SDL_Renderer **sr,
 int main(int argc, char *argv[]) {
 
   bool runTests = false;
+  const char *obstaclePath = nullptr;   // -obstacles <file>
   for (int i = 1; i < argc; ++i) {
     if (std::string(argv[i]) == "-test") { runTests = true; break; }
+    if (std::string(argv[i]) == "-obstacles" && i + 1 < argc) {
+      obstaclePath = argv[++i];
+    }
   }
   if (runTests) {
     runPerformanceTests();
@@ -88,6 +93,16 @@ int main(int argc, char *argv[]) {
   }
 
   Simulation simulation;
+  if (obstaclePath) {
+    auto field = std::make_shared<ObstacleField>();
+    std::string error;
+    if (field->load(obstaclePath, error)) {
+      field->bake();
+      simulation.setObstacles(std::move(field));
+    } else {
+      std::fprintf(stderr, "Warning: no obstacles loaded: %s\n", error.c_str());
+    }
+  }
   simulation.reset(1000);
   simulation.start();
 
@@ -157,8 +172,8 @@ int main(int argc, char *argv[]) {
       lastBrushTime = nowMs;
     }
 
-    // Step simulation
-    simulation.update(cfg::DT_DEFAULT);
+    // Step simulation: 0..N fixed physics steps for the time that passed.
+    simulation.advance(dtMs * 0.001f);
 
     // --- Render sim window ---
     SDL_SetRenderDrawColor(simRen, 8, 9, 14, 255);
@@ -168,7 +183,8 @@ int main(int argc, char *argv[]) {
       overlay.drawStatusBar(simulation.input(),
                             simulation.getFrameRate(),
                             simulation.getParticleCount(),
-                            simulation.getAvgUpdateMs());
+                            simulation.getAvgUpdateMs(),
+                            simulation.physicsStats().substeps);
       if (simulation.input().showHelp) {
         overlay.drawHelp(simulation.input());
       }